@@ -0,0 +1,84 @@
+// asteroid_elements.cpp - Orbital elements of the belt's asteroids: generation and 16-bit packing
+
+#include "asteroid_elements.h"
+#include "philox.h"
+
+#include <algorithm>
+#include <cmath>
+
+namespace {
+
+const double PI = 3.14159265358979323846;
+
+} // namespace
+
+float orbitalMeanMotion(float semiMajorAxis, float earthDistance) {
+    float ratio = earthDistance / semiMajorAxis;
+    return float(2.0 * PI / 365.25) * (ratio * std::sqrt(ratio)); // sqrt is correctly rounded everywhere, pow is not
+}
+
+void generateAsteroid(uint32_t seed, size_t index, float earthDistance, AsteroidElements& elements) {
+    PhiloxStream random(seed, STREAM_ASTEROIDS);
+    PhiloxCounter shape = random.block(index, 0);
+    PhiloxCounter phase = random.block(index, 1);
+
+    elements.semiMajorAxis = 7.0f + philoxUniform(shape.v[0]) * 1.0f;
+    elements.eccentricity = philoxUniform(shape.v[1]) * 0.1f;
+    elements.inclination = philoxUniform(shape.v[2]) * 0.035f; // Up to about 2 degrees
+    elements.ascendingNode = philoxUniform(shape.v[3]) * float(2.0 * PI);
+    elements.argumentOfPeriapsis = philoxUniform(phase.v[0]) * float(2.0 * PI);
+    elements.meanAnomaly = philoxUniform(phase.v[1]) * float(2.0 * PI);
+    elements.meanMotion = orbitalMeanMotion(elements.semiMajorAxis, earthDistance);
+}
+
+void setAsteroidBand(AsteroidBands& belt, int band, float minMeanMotion, float maxMeanMotion) {
+    AsteroidBand& range = belt.bands[band];
+    range.minAxis = belt.minAxis + band * belt.bandWidth;
+    range.axisStep = belt.bandWidth / 65535.0f;
+    range.minMeanMotion = minMeanMotion <= maxMeanMotion ? minMeanMotion : 0.0f; // Empty bands stay zero
+    range.meanMotionStep = (maxMeanMotion - range.minMeanMotion) / 65535.0f;
+    if (!(range.meanMotionStep > 0.0f)) {
+        range.meanMotionStep = 0.0f;
+    }
+}
+
+int asteroidBand(const AsteroidBands& belt, float semiMajorAxis) {
+    return std::min(std::max(int((semiMajorAxis - belt.minAxis) / belt.bandWidth), 0), ASTEROID_SECTOR_BANDS - 1);
+}
+
+uint32_t quantize16(float value, float step) {
+    if (!(step > 0.0f)) {
+        return 0; // Every asteroid of the range has the same value
+    }
+    return static_cast<uint32_t>(std::min(std::max(value / step + 0.5f, 0.0f), 65535.0f));
+}
+
+uint32_t quantizeAngle(float angle) {
+    float turns = angle / float(2.0 * PI);
+    return static_cast<uint32_t>((turns - std::floor(turns)) * 65536.0f + 0.5f) & 0xFFFFu;
+}
+
+PackedAsteroidElements packAsteroid(const AsteroidBands& belt, const AsteroidElements& elements, size_t index) {
+    int band = asteroidBand(belt, elements.semiMajorAxis);
+    const AsteroidBand& range = belt.bands[band];
+    PackedAsteroidElements packed;
+    packed.words[0] = quantize16(elements.semiMajorAxis - range.minAxis, range.axisStep) | quantize16(elements.eccentricity, 1.0f / 65536.0f) << 16;
+    packed.words[1] = quantize16(elements.inclination, float(PI / 65536.0)) | quantizeAngle(elements.ascendingNode) << 16;
+    packed.words[2] = quantizeAngle(elements.argumentOfPeriapsis) | quantizeAngle(elements.meanAnomaly) << 16;
+    packed.words[3] = quantize16(elements.meanMotion - range.minMeanMotion, range.meanMotionStep) | (uint32_t(band) | uint32_t(index & 0x7FF) << 5) << 16;
+    return packed;
+}
+
+AsteroidElements unpackAsteroid(const AsteroidBands& belt, const PackedAsteroidElements& packed) {
+    const float angleStep = float(2.0 * PI / 65536.0);
+    const AsteroidBand& range = belt.bands[(packed.words[3] >> 16) & 31];
+    AsteroidElements elements;
+    elements.semiMajorAxis = range.minAxis + range.axisStep * float(packed.words[0] & 0xFFFFu);
+    elements.eccentricity = float(packed.words[0] >> 16) / 65536.0f;
+    elements.inclination = float(packed.words[1] & 0xFFFFu) * (0.5f * angleStep);
+    elements.ascendingNode = float(packed.words[1] >> 16) * angleStep;
+    elements.argumentOfPeriapsis = float(packed.words[2] & 0xFFFFu) * angleStep;
+    elements.meanAnomaly = float(packed.words[2] >> 16) * angleStep;
+    elements.meanMotion = range.minMeanMotion + range.meanMotionStep * float(packed.words[3] & 0xFFFFu);
+    return elements;
+}
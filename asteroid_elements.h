@@ -0,0 +1,84 @@
+// asteroid_elements.h - Orbital elements of the belt's asteroids: generation and 16-bit packing
+//
+// The belt keeps every asteroid as four 32-bit words of 16-bit fixed point, decoded by the propagation
+// shaders (and by unpackAsteroid() on the CPU). The eccentricity, inclination and angles have fixed
+// steps; the semi-major axis and mean motion are relative to the ranges of one of ASTEROID_SECTOR_BANDS
+// radial bands, so that a narrow band keeps them finer than a belt-wide range would. Quantization rounds
+// to the nearest code, so every element decodes to within half a step of its value, angles around the
+// circle. A band whose mean motions are all equal, or that holds no asteroids, has a mean motion step
+// of 0 and decodes every code to its minimum.
+//
+// The generated belt is drawn from Philox streams (philox.h) keyed by a seed, so asteroid i is a pure
+// function of the seed and i, the same on every machine and whichever thread generates it.
+
+#ifndef ASTEROID_ELEMENTS_H
+#define ASTEROID_ELEMENTS_H
+
+#include <cstddef>
+#include <cstdint>
+
+// Random streams of the procedural generation, one per purpose
+enum RandomStream { STREAM_ASTEROIDS, STREAM_ROCK_MESHES };
+
+const int ASTEROID_SECTOR_BANDS = 32; // Radial bands; narrower bands drift apart more slowly
+
+// Keplerian elements of an asteroid at full precision, as generated or read from the catalog
+struct AsteroidElements {
+    float semiMajorAxis;       // Semi-major axis (scene units)
+    float eccentricity;        // Eccentricity, below 1
+    float inclination;         // Inclination to the ecliptic (radians)
+    float ascendingNode;       // Longitude of the ascending node (radians)
+    float argumentOfPeriapsis; // Argument of periapsis (radians)
+    float meanAnomaly;         // Mean anomaly at day 0 (radians)
+    float meanMotion;          // Mean motion (radians per day)
+};
+
+// The same elements as 16-bit fixed point, one uvec4 per asteroid in host memory and the element buffer.
+// Low and high halves: semi-major axis and eccentricity, inclination and ascending node, argument of periapsis
+// and mean anomaly, mean motion and band (5 bits) with an 11-bit shape id. The axis and mean motion are relative
+// to the ranges of their band; the id comes from the asteroid's index, so its shape survives new elements
+struct PackedAsteroidElements {
+    uint32_t words[4];
+};
+
+// Quantization ranges of a band, uploaded as one vec4 per band
+struct AsteroidBand {
+    float minAxis, axisStep;             // Semi-major axis of code 0 and per code (scene units)
+    float minMeanMotion, meanMotionStep; // Mean motion of code 0 and per code (radians per day)
+};
+
+// Bands of a belt, of equal width from its innermost semi-major axis
+struct AsteroidBands {
+    AsteroidBand bands[ASTEROID_SECTOR_BANDS];
+    float minAxis;   // Inner edge of the first band
+    float bandWidth; // Width of every band
+};
+
+// Function to get the mean motion (radians per day) of an orbit around the Sun from Kepler's third law,
+// scaled so that an orbit at Earth's distance takes one year
+float orbitalMeanMotion(float semiMajorAxis, float earthDistance);
+
+// Function to generate an asteroid orbit of a seed's belt: low eccentricity and inclination, between 7.0 and
+// 8.0 from the Sun, with the mean motion for the scene's distance of the Earth
+void generateAsteroid(uint32_t seed, size_t index, float earthDistance, AsteroidElements& elements);
+
+// Function to set a band's ranges from its place in the belt and the range of its mean motions; an empty
+// band, with the minimum above the maximum, gets a zero range
+void setAsteroidBand(AsteroidBands& belt, int band, float minMeanMotion, float maxMeanMotion);
+
+// Function to get the band of a semi-major axis in a belt, clamped to the first and last bands
+int asteroidBand(const AsteroidBands& belt, float semiMajorAxis);
+
+// Function to quantize a value to the nearest of 65536 steps from zero, clamped; 0 for a step that is not positive
+uint32_t quantize16(float value, float step);
+
+// Function to quantize an angle to 16 bits, wrapping around the circle
+uint32_t quantizeAngle(float angle);
+
+// Function to pack an asteroid's elements into the ranges of its band
+PackedAsteroidElements packAsteroid(const AsteroidBands& belt, const AsteroidElements& elements, size_t index);
+
+// Function to decode packed elements, exactly as the propagation shaders do
+AsteroidElements unpackAsteroid(const AsteroidBands& belt, const PackedAsteroidElements& packed);
+
+#endif // ASTEROID_ELEMENTS_H
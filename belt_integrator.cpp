@@ -0,0 +1,367 @@
+// belt_integrator.cpp - Restricted three-body integration of the asteroid belt
+
+#include "belt_integrator.h"
+#include "parallel.h"
+#include "simd.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+
+namespace {
+
+const double PI = 3.14159265358979323846;
+const double DEGREES = PI / 180.0;
+const double GAUSSIAN_GRAVITY = 0.01720209895; // k, so that GM of the Sun is k^2 in AU^3 / day^2
+
+// Perturbing planet: J2000 mean elements (Standish, JPL approximate positions) and mass relative to the Sun
+struct Perturber {
+    double semiMajorAxis, eccentricity, inclination, meanLongitude, perihelionLongitude, ascendingNode; // AU, degrees
+    double massRatio;
+};
+
+const Perturber JUPITER = { 5.20288700, 0.04838624, 1.30439695, 34.39644051, 14.72847983, 100.47390909, 1.0 / 1047.3486 };
+const Perturber SATURN = { 9.53667594, 0.05386179, 2.48599187, 49.95424423, 92.59887831, 113.66242448, 1.0 / 3497.898 };
+
+const int MAX_BATCH_STEPS = 64;     // Steps integrated per hand-off with the main thread
+const size_t CACHE_BLOCK = 512;     // Particles taken through a whole batch at a time, about 12 KB of state
+const float SOFTENING = 1e-6f;      // Squared distance (AU^2) added to planet encounters, against division by zero
+const double MAX_AXIS = 100.0;      // Orbits of scattered asteroids are clamped to stay drawable
+const double MAX_ECCENTRICITY = 0.99;
+const double SNAPSHOT_INTERVAL = 0.5; // Seconds between published snapshots
+
+struct Vector3 {
+    double x, y, z;
+};
+
+// Function to solve Kepler's equation M = E - e sin E by Newton's method
+double solveKepler(double meanAnomaly, double eccentricity) {
+    meanAnomaly = std::fmod(meanAnomaly, 2.0 * PI);
+    double E = eccentricity < 0.8 ? meanAnomaly : PI;
+    for (int i = 0; i < 30; i++) {
+        double delta = (E - eccentricity * std::sin(E) - meanAnomaly) / (1.0 - eccentricity * std::cos(E));
+        E -= delta;
+        if (std::fabs(delta) < 1e-12) {
+            break;
+        }
+    }
+    return E;
+}
+
+// Function to rotate a vector from the orbital plane (x towards periapsis) to the ecliptic
+Vector3 orbitToEcliptic(double x, double y, double inclination, double ascendingNode, double argumentOfPeriapsis) {
+    double cosNode = std::cos(ascendingNode), sinNode = std::sin(ascendingNode);
+    double cosPeri = std::cos(argumentOfPeriapsis), sinPeri = std::sin(argumentOfPeriapsis);
+    double cosInc = std::cos(inclination), sinInc = std::sin(inclination);
+    Vector3 result;
+    result.x = (cosNode * cosPeri - sinNode * sinPeri * cosInc) * x - (cosNode * sinPeri + sinNode * cosPeri * cosInc) * y;
+    result.y = (sinNode * cosPeri + cosNode * sinPeri * cosInc) * x - (sinNode * sinPeri - cosNode * cosPeri * cosInc) * y;
+    result.z = sinPeri * sinInc * x + cosPeri * sinInc * y;
+    return result;
+}
+
+// Function to get a perturber's heliocentric position on its fixed Kepler orbit
+Vector3 perturberPosition(const Perturber& planet, double day) {
+    double meanMotion = GAUSSIAN_GRAVITY * std::sqrt((1.0 + planet.massRatio) / (planet.semiMajorAxis * planet.semiMajorAxis * planet.semiMajorAxis));
+    double argumentOfPeriapsis = (planet.perihelionLongitude - planet.ascendingNode) * DEGREES;
+    double meanAnomaly = (planet.meanLongitude - planet.perihelionLongitude) * DEGREES + meanMotion * day;
+    double E = solveKepler(meanAnomaly, planet.eccentricity);
+    double x = planet.semiMajorAxis * (std::cos(E) - planet.eccentricity);
+    double y = planet.semiMajorAxis * std::sqrt(1.0 - planet.eccentricity * planet.eccentricity) * std::sin(E);
+    return orbitToEcliptic(x, y, planet.inclination * DEGREES, planet.ascendingNode * DEGREES, argumentOfPeriapsis);
+}
+
+// Function to convert an orbit at a day to a heliocentric position and velocity
+void orbitToState(const MinorPlanetOrbit& orbit, double day, double gm, Vector3& position, Vector3& velocity) {
+    double a = orbit.semiMajorAxis, e = orbit.eccentricity;
+    double meanMotion = std::sqrt(gm / (a * a * a));
+    double E = solveKepler(orbit.meanAnomaly + meanMotion * day, e);
+    double cosE = std::cos(E), sinE = std::sin(E);
+    double minorAxis = a * std::sqrt(1.0 - e * e);
+    double rate = meanMotion / (1.0 - e * cosE); // dE/dt
+    position = orbitToEcliptic(a * (cosE - e), minorAxis * sinE, orbit.inclination, orbit.ascendingNode, orbit.argumentOfPerihelion);
+    velocity = orbitToEcliptic(-a * sinE * rate, minorAxis * cosE * rate, orbit.inclination, orbit.ascendingNode, orbit.argumentOfPerihelion);
+}
+
+// Function to convert a heliocentric position and velocity to the osculating orbit around the Sun
+MinorPlanetOrbit stateToOrbit(const Vector3& r, const Vector3& v, double day, double gm) {
+    double radius = std::sqrt(r.x * r.x + r.y * r.y + r.z * r.z);
+    double speed2 = v.x * v.x + v.y * v.y + v.z * v.z;
+    double radialSpeed = r.x * v.x + r.y * v.y + r.z * v.z;
+    Vector3 h = { r.y * v.z - r.z * v.y, r.z * v.x - r.x * v.z, r.x * v.y - r.y * v.x };
+    double angularMomentum = std::sqrt(h.x * h.x + h.y * h.y + h.z * h.z);
+
+    // Eccentricity vector, pointing to periapsis
+    double radialTerm = (speed2 - gm / radius) / gm, velocityTerm = radialSpeed / gm;
+    Vector3 ev = { radialTerm * r.x - velocityTerm * v.x, radialTerm * r.y - velocityTerm * v.y, radialTerm * r.z - velocityTerm * v.z };
+
+    double inclination = std::acos(std::max(-1.0, std::min(1.0, h.z / angularMomentum)));
+    double ascendingNode = std::atan2(h.x, -h.y);
+
+    // Position and eccentricity vector in the orbital plane, with x towards the ascending node; works down to zero inclination
+    double cosNode = std::cos(ascendingNode), sinNode = std::sin(ascendingNode);
+    double cosInc = std::cos(inclination), sinInc = std::sin(inclination);
+    double rx = r.x * cosNode + r.y * sinNode;
+    double ry = (r.y * cosNode - r.x * sinNode) * cosInc + r.z * sinInc;
+    double ex = ev.x * cosNode + ev.y * sinNode;
+    double ey = (ev.y * cosNode - ev.x * sinNode) * cosInc + ev.z * sinInc;
+
+    double semiMajorAxis = 1.0 / (2.0 / radius - speed2 / gm);
+    double eccentricity = std::sqrt(ex * ex + ey * ey);
+    if (!(semiMajorAxis > 0.0) || semiMajorAxis > MAX_AXIS || eccentricity > MAX_ECCENTRICITY) {
+        // Scattered out of the belt; the renderer only draws bound ellipses
+        semiMajorAxis = std::min(std::fabs(semiMajorAxis), MAX_AXIS);
+        eccentricity = std::min(eccentricity, MAX_ECCENTRICITY);
+    }
+
+    double argumentOfPeriapsis = std::atan2(ey, ex);
+    double trueAnomaly = std::atan2(ry, rx) - argumentOfPeriapsis;
+    double E = std::atan2(std::sqrt(1.0 - eccentricity * eccentricity) * std::sin(trueAnomaly), eccentricity + std::cos(trueAnomaly));
+    double meanAnomaly = E - eccentricity * std::sin(E);
+    double meanMotion = std::sqrt(gm / (semiMajorAxis * semiMajorAxis * semiMajorAxis));
+
+    // Mean anomaly referred back to day 0, like the catalog's
+    double meanAnomalyAtEpoch = std::fmod(meanAnomaly - meanMotion * day, 2.0 * PI);
+    MinorPlanetOrbit orbit;
+    orbit.semiMajorAxis = float(semiMajorAxis);
+    orbit.eccentricity = float(eccentricity);
+    orbit.inclination = float(inclination);
+    orbit.ascendingNode = float(ascendingNode < 0.0 ? ascendingNode + 2.0 * PI : ascendingNode);
+    orbit.argumentOfPerihelion = float(argumentOfPeriapsis < 0.0 ? argumentOfPeriapsis + 2.0 * PI : argumentOfPeriapsis);
+    orbit.meanAnomaly = float(meanAnomalyAtEpoch < 0.0 ? meanAnomalyAtEpoch + 2.0 * PI : meanAnomalyAtEpoch);
+    orbit.meanMotion = float(meanMotion);
+    orbit.absoluteMagnitude = 99.0f;
+    return orbit;
+}
+
+} // namespace
+
+void orbitState(const MinorPlanetOrbit& orbit, double day, double position[3], double velocity[3], double gm) {
+    Vector3 r, v;
+    orbitToState(orbit, day, gm, r, v);
+    position[0] = r.x; position[1] = r.y; position[2] = r.z;
+    velocity[0] = v.x; velocity[1] = v.y; velocity[2] = v.z;
+}
+
+MinorPlanetOrbit osculatingOrbit(const double position[3], const double velocity[3], double day, double gm) {
+    Vector3 r = { position[0], position[1], position[2] };
+    Vector3 v = { velocity[0], velocity[1], velocity[2] };
+    return stateToOrbit(r, v, day, gm);
+}
+
+const double BeltIntegrator::STEP = 2.0;
+const int BeltIntegrator::MAX_PERTURBERS = 2;
+
+BeltIntegrator::BeltIntegrator()
+    : count(0), numPerturbers(0), time(0.0), stopping(false), targetDay(0.0), snapshotDay(0.0), snapshotReady(false), stepRate(0.0) {
+}
+
+BeltIntegrator::~BeltIntegrator() {
+    stop();
+}
+
+void BeltIntegrator::start(const std::vector<MinorPlanetOrbit>& orbits, double day, int perturbers) {
+    stop();
+
+    // Pad to whole SIMD registers with a harmless circular orbit at 1 AU
+    count = orbits.size();
+    size_t padded = (count + SIMD_WIDTH - 1) / SIMD_WIDTH * SIMD_WIDTH;
+    x.assign(padded, 1.0f); y.assign(padded, 0.0f); z.assign(padded, 0.0f);
+    vx.assign(padded, 0.0f); vy.assign(padded, float(GAUSSIAN_GRAVITY)); vz.assign(padded, 0.0f);
+    absoluteMagnitudes.resize(count);
+
+    parallelFor(count, [&](size_t first, size_t last) {
+        for (size_t i = first; i < last; i++) {
+            Vector3 position, velocity;
+            orbitToState(orbits[i], day, SUN_GM, position, velocity);
+            x[i] = float(position.x); y[i] = float(position.y); z[i] = float(position.z);
+            vx[i] = float(velocity.x); vy[i] = float(velocity.y); vz[i] = float(velocity.z);
+            absoluteMagnitudes[i] = orbits[i].absoluteMagnitude;
+        }
+    });
+
+    numPerturbers = std::max(0, std::min(perturbers, MAX_PERTURBERS));
+    stepTable.resize(MAX_BATCH_STEPS * (4 * numPerturbers + 3));
+    time = day;
+    targetDay = day;
+    stopping = false;
+    snapshotReady = false;
+    worker = std::thread(&BeltIntegrator::run, this);
+}
+
+void BeltIntegrator::stop() {
+    if (!worker.joinable()) {
+        return;
+    }
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        stopping = true;
+    }
+    wake.notify_one();
+    worker.join();
+}
+
+void BeltIntegrator::setTargetDay(double day) {
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        targetDay = day;
+    }
+    wake.notify_one();
+}
+
+bool BeltIntegrator::takeSnapshot(std::vector<MinorPlanetOrbit>& orbits, double& day) {
+    std::lock_guard<std::mutex> guard(lock);
+    if (!snapshotReady) {
+        return false;
+    }
+    orbits.swap(snapshot);
+    day = snapshotDay;
+    snapshotReady = false;
+    return true;
+}
+
+void BeltIntegrator::run() {
+    const Perturber* perturbers[2] = { &JUPITER, &SATURN };
+    const int stride = 4 * numPerturbers + 3;
+    std::chrono::steady_clock::time_point lastSnapshot = std::chrono::steady_clock::now();
+    bool published = true;
+
+    for (;;) {
+        int numSteps;
+        double step; // Signed: the leapfrog is time-reversible, so a target in the past is integrated backwards
+        {
+            // Steps still unpublished when the worker catches up are published once the interval is over, so the
+            // last state shows while the clock is paused
+            std::unique_lock<std::mutex> guard(lock);
+            auto ready = [this] { return stopping || std::fabs(targetDay - time) >= STEP; };
+            std::chrono::steady_clock::time_point deadline = lastSnapshot + std::chrono::milliseconds(int(SNAPSHOT_INTERVAL * 1000.0));
+            if (!published && !wake.wait_until(guard, deadline, ready)) {
+                guard.unlock();
+                publish();
+                published = true;
+                lastSnapshot = std::chrono::steady_clock::now();
+                continue;
+            }
+            wake.wait(guard, ready);
+            if (stopping) {
+                return;
+            }
+            step = targetDay >= time ? STEP : -STEP;
+            numSteps = int(std::min(std::fabs(targetDay - time) / STEP, double(MAX_BATCH_STEPS)));
+        }
+
+        // Perturber positions at the middle of every step, where the kick is applied. The heliocentric
+        // frame accelerates towards each planet, which the asteroids feel as the indirect term
+        for (int s = 0; s < numSteps; s++) {
+            float* table = &stepTable[s * stride];
+            double ax = 0.0, ay = 0.0, az = 0.0;
+            for (int p = 0; p < numPerturbers; p++) {
+                Vector3 position = perturberPosition(*perturbers[p], time + (s + 0.5) * step);
+                double gm = SUN_GM * perturbers[p]->massRatio;
+                double distance = std::sqrt(position.x * position.x + position.y * position.y + position.z * position.z);
+                double scale = gm / (distance * distance * distance);
+                table[4 * p + 0] = float(position.x);
+                table[4 * p + 1] = float(position.y);
+                table[4 * p + 2] = float(position.z);
+                table[4 * p + 3] = float(gm);
+                ax += scale * position.x;
+                ay += scale * position.y;
+                az += scale * position.z;
+            }
+            table[4 * numPerturbers + 0] = float(ax);
+            table[4 * numPerturbers + 1] = float(ay);
+            table[4 * numPerturbers + 2] = float(az);
+        }
+
+        std::chrono::steady_clock::time_point batchStart = std::chrono::steady_clock::now();
+        parallelFor(x.size(), [&](size_t first, size_t last) {
+            integrate(first, last, numSteps, step);
+        }, SIMD_WIDTH);
+        time += numSteps * step;
+
+        std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+        double seconds = std::chrono::duration<double>(now - batchStart).count();
+        if (seconds > 0.0) {
+            stepRate.store(double(count) * numSteps / seconds);
+        }
+
+        published = false;
+        if (std::chrono::duration<double>(now - lastSnapshot).count() >= SNAPSHOT_INTERVAL) {
+            publish();
+            published = true;
+            lastSnapshot = now;
+        }
+    }
+}
+
+void BeltIntegrator::integrate(size_t first, size_t last, int numSteps, double stepLength) {
+    const int stride = 4 * numPerturbers + 3;
+    const SimdFloat step = float(stepLength), halfStep = float(0.5 * stepLength);
+    const SimdFloat sunGM = float(SUN_GM), softening = SOFTENING;
+
+    // Each cache block goes through the whole batch before the next one is loaded
+    for (size_t block = first; block < last; block += CACHE_BLOCK) {
+        size_t blockEnd = std::min(block + CACHE_BLOCK, last);
+        for (int s = 0; s < numSteps; s++) {
+            const float* table = &stepTable[s * stride];
+            const SimdFloat indirectX(table[4 * numPerturbers + 0]);
+            const SimdFloat indirectY(table[4 * numPerturbers + 1]);
+            const SimdFloat indirectZ(table[4 * numPerturbers + 2]);
+
+            for (size_t i = block; i < blockEnd; i += SIMD_WIDTH) {
+                // Drift half a step
+                SimdFloat px = simdLoad(&x[i]) + simdLoad(&vx[i]) * halfStep;
+                SimdFloat py = simdLoad(&y[i]) + simdLoad(&vy[i]) * halfStep;
+                SimdFloat pz = simdLoad(&z[i]) + simdLoad(&vz[i]) * halfStep;
+
+                // Sun
+                SimdFloat r2 = px * px + py * py + pz * pz;
+                SimdFloat sunScale = sunGM / (r2 * simdSqrt(r2));
+                SimdFloat ax = SimdFloat(0.0f) - px * sunScale - indirectX;
+                SimdFloat ay = SimdFloat(0.0f) - py * sunScale - indirectY;
+                SimdFloat az = SimdFloat(0.0f) - pz * sunScale - indirectZ;
+
+                // Planets
+                for (int p = 0; p < numPerturbers; p++) {
+                    SimdFloat dx = SimdFloat(table[4 * p + 0]) - px;
+                    SimdFloat dy = SimdFloat(table[4 * p + 1]) - py;
+                    SimdFloat dz = SimdFloat(table[4 * p + 2]) - pz;
+                    SimdFloat d2 = dx * dx + dy * dy + dz * dz + softening;
+                    SimdFloat scale = SimdFloat(table[4 * p + 3]) / (d2 * simdSqrt(d2));
+                    ax = ax + dx * scale;
+                    ay = ay + dy * scale;
+                    az = az + dz * scale;
+                }
+
+                // Kick a whole step, then drift the other half
+                SimdFloat velocityX = simdLoad(&vx[i]) + ax * step;
+                SimdFloat velocityY = simdLoad(&vy[i]) + ay * step;
+                SimdFloat velocityZ = simdLoad(&vz[i]) + az * step;
+                simdStore(&vx[i], velocityX);
+                simdStore(&vy[i], velocityY);
+                simdStore(&vz[i], velocityZ);
+                simdStore(&x[i], px + velocityX * halfStep);
+                simdStore(&y[i], py + velocityY * halfStep);
+                simdStore(&z[i], pz + velocityZ * halfStep);
+            }
+        }
+    }
+}
+
+void BeltIntegrator::publish() {
+    std::vector<MinorPlanetOrbit> orbits(count);
+    double day = time;
+    parallelFor(count, [&](size_t first, size_t last) {
+        for (size_t i = first; i < last; i++) {
+            Vector3 position = { x[i], y[i], z[i] };
+            Vector3 velocity = { vx[i], vy[i], vz[i] };
+            orbits[i] = stateToOrbit(position, velocity, day, SUN_GM);
+            orbits[i].absoluteMagnitude = absoluteMagnitudes[i];
+        }
+    });
+
+    std::lock_guard<std::mutex> guard(lock);
+    snapshot.swap(orbits);
+    snapshotDay = day;
+    snapshotReady = true;
+}
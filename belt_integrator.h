@@ -0,0 +1,92 @@
+// belt_integrator.h - Restricted three-body integration of the asteroid belt
+//
+// Asteroids are massless test particles moving around the Sun under Jupiter's, and optionally
+// Saturn's, pull. The planets follow fixed Keplerian orbits from their J2000 mean elements, so
+// they move the asteroids but not the other way round. A drift-kick-drift leapfrog advances
+// SIMD_WIDTH asteroids per instruction (simd.h), split across the CPU cores, on a worker thread
+// that keeps up with the requested time. Osculating orbits are published as snapshots, which
+// the renderer propagates as Kepler orbits until the next one, so mean-motion resonances such as
+// the Kirkwood gaps build up in the drawn belt over simulated time.
+//
+// Units are AU and days in heliocentric ecliptic J2000 coordinates; day 0 is J2000.0.
+
+#ifndef BELT_INTEGRATOR_H
+#define BELT_INTEGRATOR_H
+
+#include "mpcorb.h"
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// GM of the Sun (AU^3 / day^2), the square of the Gaussian gravitational constant
+const double SUN_GM = 0.01720209895 * 0.01720209895;
+
+// Function to get the heliocentric position (AU) and velocity (AU / day) on an orbit around the Sun at a day. gm is
+// that of the Sun and the body together, which only differs from the Sun's for bodies as heavy as the planets
+void orbitState(const MinorPlanetOrbit& orbit, double day, double position[3], double velocity[3], double gm = SUN_GM);
+
+// Function to get the osculating orbit around the Sun of a heliocentric position and velocity at a day, with the
+// mean anomaly referred back to day 0 like the catalog's; unbound orbits are clamped to drawable ellipses
+MinorPlanetOrbit osculatingOrbit(const double position[3], const double velocity[3], double day, double gm = SUN_GM);
+
+class BeltIntegrator {
+public:
+    BeltIntegrator();
+    ~BeltIntegrator();
+
+    // Function to start integrating the orbits from a day under the first perturbers of Jupiter and Saturn; with
+    // none the asteroids only feel the Sun and stay on their Kepler orbits
+    void start(const std::vector<MinorPlanetOrbit>& orbits, double day, int perturbers);
+
+    // Function to stop the worker thread
+    void stop();
+
+    // Function to set the day the worker integrates towards, backwards if it is in the past
+    void setTargetDay(double day);
+
+    // Function to take the newest snapshot of osculating orbits, if one was published since the last call
+    bool takeSnapshot(std::vector<MinorPlanetOrbit>& orbits, double& day);
+
+    bool running() const { return worker.joinable(); }
+    double particleStepsPerSecond() const { return stepRate.load(); }
+
+    // Step length (days); about 1/500 of the shortest main-belt period
+    static const double STEP;
+    static const int MAX_PERTURBERS; // Jupiter and Saturn
+
+private:
+    BeltIntegrator(const BeltIntegrator&) = delete;
+    BeltIntegrator& operator=(const BeltIntegrator&) = delete;
+
+    void run();
+    void integrate(size_t first, size_t last, int numSteps, double stepLength);
+    void publish();
+
+    // Particle states, structure of arrays padded to a multiple of SIMD_WIDTH
+    size_t count;
+    std::vector<float> x, y, z, vx, vy, vz;
+    std::vector<float> absoluteMagnitudes;
+
+    // Per-step perturber positions and the Sun's acceleration towards them, filled before each batch
+    int numPerturbers;
+    std::vector<float> stepTable;
+
+    double time; // Day the particle states are at
+
+    // Worker thread and its hand-off with the main thread
+    std::thread worker;
+    std::mutex lock;
+    std::condition_variable wake;
+    bool stopping;
+    double targetDay;
+    std::vector<MinorPlanetOrbit> snapshot;
+    double snapshotDay;
+    bool snapshotReady;
+    std::atomic<double> stepRate; // Particle steps per second over the last batch, all cores together
+};
+
+#endif // BELT_INTEGRATOR_H
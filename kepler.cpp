@@ -0,0 +1,248 @@
+// kepler.cpp - Batch propagation of Kepler orbits with a SIMD solver for Kepler's equation
+
+#include "kepler.h"
+#include "simd.h"
+
+#include <algorithm>
+#include <cmath>
+
+namespace {
+
+const float TWO_PI = 6.28318530718f;
+const int MAX_ELLIPTIC_ITERATIONS = 10;   // Halley from Danby's starting guess needs 3 or 4 at most eccentricities
+const int MAX_HYPERBOLIC_ITERATIONS = 30; // The logarithmic starting guess is rougher
+const float TOLERANCE = 1e-6f;            // Step in the eccentric anomaly (relative for hyperbolic orbits) to stop at
+const float MAX_HYPERBOLIC_ANOMALY = 80.0f; // Keeps exp() finite in single precision
+
+// Function to get the absolute value of every lane
+inline SimdFloat simdAbs(SimdFloat a) {
+    return simdMax(a, SimdFloat(0.0f) - a);
+}
+
+// Function to get -1 where a lane is negative and 1 elsewhere
+inline SimdFloat simdSign(SimdFloat a) {
+    return simdSelect(simdLess(a, SimdFloat(0.0f)), SimdFloat(-1.0f), SimdFloat(1.0f));
+}
+
+// Function to get the sine and cosine of every lane, accurate to a few float ulps for |x| up to a few thousand.
+// Cody-Waite reduction to [-pi/4, pi/4] and the minimax polynomials of Cephes' sinf and cosf
+inline void simdSinCos(SimdFloat x, SimdFloat& sine, SimdFloat& cosine) {
+    SimdFloat quadrant = simdFloor(x * SimdFloat(0.636619772f) + SimdFloat(0.5f)); // Nearest multiple of pi/2
+    SimdFloat r = x - quadrant * SimdFloat(1.5703125f) - quadrant * SimdFloat(4.83751297e-4f) - quadrant * SimdFloat(7.54978995e-8f);
+    SimdFloat r2 = r * r;
+
+    SimdFloat s = SimdFloat(-1.9515295891e-4f);
+    s = s * r2 + SimdFloat(8.3321608736e-3f);
+    s = s * r2 + SimdFloat(-1.6666654611e-1f);
+    s = s * r2 * r + r;
+    SimdFloat c = SimdFloat(2.443315711809948e-5f);
+    c = c * r2 + SimdFloat(-1.388731625493765e-3f);
+    c = c * r2 + SimdFloat(4.166664568298827e-2f);
+    c = c * r2 * r2 - r2 * SimdFloat(0.5f) + SimdFloat(1.0f);
+
+    // Quadrant 0: (s, c); 1: (c, -s); 2: (-s, -c); 3: (-c, s)
+    SimdFloat q = quadrant - SimdFloat(4.0f) * simdFloor(quadrant * SimdFloat(0.25f));
+    SimdFloat odd = q - SimdFloat(2.0f) * simdFloor(q * SimdFloat(0.5f));
+    SimdMask swap = simdLess(SimdFloat(0.5f), odd);
+    SimdFloat sineBase = simdSelect(swap, c, s);
+    SimdFloat cosineBase = simdSelect(swap, s, c);
+    SimdFloat cosineQuadrant = q + SimdFloat(1.0f) - SimdFloat(4.0f) * simdFloor((q + SimdFloat(1.0f)) * SimdFloat(0.25f));
+    sine = simdSelect(simdLess(SimdFloat(1.5f), q), SimdFloat(0.0f) - sineBase, sineBase);
+    cosine = simdSelect(simdLess(SimdFloat(1.5f), cosineQuadrant), SimdFloat(0.0f) - cosineBase, cosineBase);
+}
+
+// Function to get e^x of every lane, for |x| up to 87; Cephes' expf polynomial
+inline SimdFloat simdExp(SimdFloat x) {
+    x = simdMin(simdMax(x, SimdFloat(-87.0f)), SimdFloat(87.0f));
+    SimdFloat n = simdFloor(x * SimdFloat(1.44269504f) + SimdFloat(0.5f));
+    SimdFloat r = x - n * SimdFloat(0.693359375f) + n * SimdFloat(2.12194440e-4f);
+    SimdFloat p = SimdFloat(1.9875691500e-4f);
+    p = p * r + SimdFloat(1.3981999507e-3f);
+    p = p * r + SimdFloat(8.3334519073e-3f);
+    p = p * r + SimdFloat(4.1665795894e-2f);
+    p = p * r + SimdFloat(1.6666665459e-1f);
+    p = p * r + SimdFloat(5.0000001201e-1f);
+    p = p * r * r + r + SimdFloat(1.0f);
+    return p * simdPow2(n);
+}
+
+// Function to solve Kepler's equation M = E - e sin(E) of elliptic orbits, returning sin(E) and cos(E).
+// The mean anomaly is reduced to [-pi, pi), where the root lies between M and M + e sign(M). Halley's method
+// starts from Danby's E = M + 0.85 e sign(M) and is safeguarded by that bracket, narrowed on every step, falling
+// back to bisection where a step would leave it; without that it can overshoot for eccentricities near 1
+inline void solveElliptic(SimdFloat meanAnomaly, SimdFloat e, SimdFloat& sine, SimdFloat& cosine) {
+    SimdFloat M = meanAnomaly - SimdFloat(TWO_PI) * simdFloor(meanAnomaly * SimdFloat(1.0f / TWO_PI) + SimdFloat(0.5f));
+    SimdFloat bound = M + e * simdSign(M);
+    SimdFloat low = simdMin(M, bound), high = simdMax(M, bound);
+    SimdFloat E = M + SimdFloat(0.85f) * e * simdSign(M);
+    for (int k = 0; k < MAX_ELLIPTIC_ITERATIONS; k++) {
+        simdSinCos(E, sine, cosine);
+        SimdFloat f = E - e * sine - M;
+        SimdFloat slope = SimdFloat(1.0f) - e * cosine;
+        SimdFloat dE = f / (slope - SimdFloat(0.5f) * f * e * sine / slope);
+        SimdMask above = simdLess(SimdFloat(0.0f), f);
+        high = simdSelect(above, E, high);
+        low = simdSelect(above, low, E);
+        SimdFloat next = E - dE;
+        next = simdSelect(simdLess(next, low), SimdFloat(0.5f) * (low + high), next);
+        next = simdSelect(simdLess(high, next), SimdFloat(0.5f) * (low + high), next);
+        dE = E - next;
+        E = next;
+
+        // The sine and cosine of the final step follow to second order from the last ones
+        SimdFloat newSine = sine - cosine * dE;
+        cosine = cosine + sine * dE;
+        sine = newSine;
+        if (!simdAny(simdLess(SimdFloat(TOLERANCE), simdAbs(dE)))) {
+            break;
+        }
+    }
+}
+
+// Function to solve Kepler's equation M = e sinh(H) - H of hyperbolic orbits, returning sinh(H) and cosh(H),
+// starting from H = sign(M) ln(2 |M| / e + 1.8)
+inline void solveHyperbolic(SimdFloat M, SimdFloat e, SimdFloat& sine, SimdFloat& cosine) {
+    SimdFloat H = simdSign(M) * SimdFloat(0.693147181f) * simdLog2Estimate(SimdFloat(2.0f) * simdAbs(M) / e + SimdFloat(1.8f));
+    for (int k = 0; k < MAX_HYPERBOLIC_ITERATIONS; k++) {
+        SimdFloat exponential = simdExp(H);
+        SimdFloat inverse = SimdFloat(1.0f) / exponential;
+        sine = SimdFloat(0.5f) * (exponential - inverse);
+        cosine = SimdFloat(0.5f) * (exponential + inverse);
+        SimdFloat f = e * sine - H - M;
+        SimdFloat slope = e * cosine - SimdFloat(1.0f);
+        SimdFloat dH = f / (slope - SimdFloat(0.5f) * f * e * sine / slope);
+        H = simdMin(simdMax(H - dH, SimdFloat(-MAX_HYPERBOLIC_ANOMALY)), SimdFloat(MAX_HYPERBOLIC_ANOMALY));
+        if (!simdAny(simdLess(SimdFloat(TOLERANCE) * (SimdFloat(1.0f) + simdAbs(H)), simdAbs(dH)))) {
+            break;
+        }
+    }
+    SimdFloat exponential = simdExp(H);
+    SimdFloat inverse = SimdFloat(1.0f) / exponential;
+    sine = SimdFloat(0.5f) * (exponential - inverse);
+    cosine = SimdFloat(0.5f) * (exponential + inverse);
+}
+
+// Time of every orbit: the same for all, or one each
+struct SharedTime {
+    SimdFloat time;
+    SimdFloat load(size_t) const { return time; }
+};
+
+struct OrbitTimes {
+    const float* times; // Starting with the first orbit's
+    size_t first, last;
+    SimdFloat load(size_t i) const {
+        if (i + SIMD_WIDTH <= last) {
+            return simdLoad(times + (i - first));
+        }
+        float tail[SIMD_WIDTH] = {};
+        std::copy(times + (i - first), times + (last - first), tail);
+        return simdLoad(tail);
+    }
+};
+
+} // namespace
+
+KeplerBatch::KeplerBatch() : count(0) {
+}
+
+void KeplerBatch::resize(size_t newCount) {
+    count = newCount;
+    size_t padded = newCount + SIMD_WIDTH;
+    px.resize(padded, 1.0f); py.resize(padded, 0.0f); pz.resize(padded, 0.0f);
+    qx.resize(padded, 0.0f); qy.resize(padded, 1.0f); qz.resize(padded, 0.0f);
+    axis.resize(padded, 1.0f);
+    minorAxis.resize(padded, 1.0f);
+    eccentricity.resize(padded, 0.0f);
+    meanAnomaly.resize(padded, 0.0f);
+    meanMotion.resize(padded, 0.0f);
+}
+
+void KeplerBatch::setOrbit(size_t index, const KeplerOrbit& orbit) {
+    double cosNode = std::cos(orbit.ascendingNode), sinNode = std::sin(orbit.ascendingNode);
+    double cosInc = std::cos(orbit.inclination), sinInc = std::sin(orbit.inclination);
+    double cosPeri = std::cos(orbit.argumentOfPeriapsis), sinPeri = std::sin(orbit.argumentOfPeriapsis);
+    px[index] = float(cosNode * cosPeri - sinNode * sinPeri * cosInc);
+    py[index] = float(sinNode * cosPeri + cosNode * sinPeri * cosInc);
+    pz[index] = float(sinPeri * sinInc);
+    qx[index] = float(-cosNode * sinPeri - sinNode * cosPeri * cosInc);
+    qy[index] = float(-sinNode * sinPeri + cosNode * cosPeri * cosInc);
+    qz[index] = float(cosPeri * sinInc);
+
+    double e = orbit.eccentricity;
+    axis[index] = orbit.semiMajorAxis;
+    minorAxis[index] = float(std::fabs(orbit.semiMajorAxis) * std::sqrt(std::fabs(1.0 - e * e)));
+    eccentricity[index] = orbit.eccentricity;
+    meanAnomaly[index] = orbit.meanAnomaly;
+    meanMotion[index] = orbit.meanMotion;
+}
+
+void KeplerBatch::propagate(double time, size_t first, size_t last, const KeplerStates& states) const {
+    SharedTime shared = { SimdFloat(float(time)) };
+    propagateRange(shared, first, last, states);
+}
+
+void KeplerBatch::propagate(const float* times, size_t first, size_t last, const KeplerStates& states) const {
+    OrbitTimes perOrbit = { times, first, std::min(last, count) };
+    propagateRange(perOrbit, first, last, states);
+}
+
+template <typename TimeSource>
+void KeplerBatch::propagateRange(const TimeSource& times, size_t first, size_t last, const KeplerStates& states) const {
+    const bool velocities = states.vx != NULL;
+    last = std::min(last, count);
+    for (size_t i = first; i < last; i += SIMD_WIDTH) {
+        SimdFloat e = simdLoad(&eccentricity[i]);
+        SimdFloat M = simdLoad(&meanAnomaly[i]) + simdLoad(&meanMotion[i]) * times.load(i);
+
+        // Every lane runs the elliptic solver; lanes of hyperbolic orbits are given a harmless circular one, and
+        // the other way round, so that they converge at once instead of holding their register back
+        SimdMask hyperbolic = simdLess(SimdFloat(1.0f), e);
+        SimdFloat sine, cosine;
+        solveElliptic(M, simdSelect(hyperbolic, SimdFloat(0.0f), e), sine, cosine);
+        if (simdAny(hyperbolic)) {
+            SimdFloat hyperbolicSine, hyperbolicCosine;
+            solveHyperbolic(simdSelect(hyperbolic, M, SimdFloat(0.0f)), simdSelect(hyperbolic, e, SimdFloat(2.0f)), hyperbolicSine, hyperbolicCosine);
+            sine = simdSelect(hyperbolic, hyperbolicSine, sine);
+            cosine = simdSelect(hyperbolic, hyperbolicCosine, cosine);
+        }
+
+        // Position in the orbital plane, x towards periapsis: (a (cos E - e), b sin E), or with the hyperbolic
+        // functions of H for hyperbolic orbits, whose negative semi-major axis gives the right sign
+        SimdFloat a = simdLoad(&axis[i]), b = simdLoad(&minorAxis[i]);
+        SimdFloat planeX = a * (cosine - e);
+        SimdFloat planeY = b * sine;
+        SimdFloat Px = simdLoad(&px[i]), Py = simdLoad(&py[i]), Pz = simdLoad(&pz[i]);
+        SimdFloat Qx = simdLoad(&qx[i]), Qy = simdLoad(&qy[i]), Qz = simdLoad(&qz[i]);
+
+        SimdFloat out[6];
+        out[0] = Px * planeX + Qx * planeY;
+        out[1] = Py * planeX + Qy * planeY;
+        out[2] = Pz * planeX + Qz * planeY;
+        if (velocities) {
+            // dE/dt = n / (1 - e cos E), dH/dt = n / (e cosh H - 1); d(cos E)/dE = -sin E, d(cosh H)/dH = sinh H
+            SimdFloat sign = simdSelect(hyperbolic, SimdFloat(1.0f), SimdFloat(-1.0f));
+            SimdFloat rate = simdLoad(&meanMotion[i]) / (sign * (e * cosine - SimdFloat(1.0f)));
+            SimdFloat planeVX = a * sign * sine * rate;
+            SimdFloat planeVY = b * cosine * rate;
+            out[3] = Px * planeVX + Qx * planeVY;
+            out[4] = Py * planeVX + Qy * planeVY;
+            out[5] = Pz * planeVX + Qz * planeVY;
+        }
+
+        float* outputs[6] = { states.x, states.y, states.z, states.vx, states.vy, states.vz };
+        int numOutputs = velocities ? 6 : 3;
+        if (i + SIMD_WIDTH <= last) {
+            for (int k = 0; k < numOutputs; k++) {
+                simdStore(outputs[k] + (i - first), out[k]);
+            }
+        } else {
+            // Partial register at the end of the range
+            for (int k = 0; k < numOutputs; k++) {
+                float tail[SIMD_WIDTH];
+                simdStore(tail, out[k]);
+                std::copy(tail, tail + (last - i), outputs[k] + (i - first));
+            }
+        }
+    }
+}
@@ -0,0 +1,74 @@
+// kepler.h - Batch propagation of Kepler orbits with a SIMD solver for Kepler's equation
+//
+// KeplerBatch holds orbits as structure of arrays, with the orientation of each orbit turned into
+// the two unit vectors of its plane once, when the orbit is set. propagate() then solves Kepler's
+// equation for SIMD_WIDTH orbits per instruction (simd.h) with Halley's method, elliptic (e < 1)
+// and hyperbolic (e > 1) orbits alike, and writes positions and, if asked, velocities. Separate
+// ranges of a batch can be propagated from several threads at once.
+//
+// Units are the caller's: positions come out in the unit of the semi-major axis and times are in
+// the unit of the mean motion. The mean anomaly is formed in single precision, so its error grows
+// with the mean motion times the time; keep times near the epoch of the elements. Parabolic orbits
+// (e = 1 exactly) are not supported.
+
+#ifndef KEPLER_H
+#define KEPLER_H
+
+#include <cstddef>
+#include <vector>
+
+// Orbital elements of one orbit
+struct KeplerOrbit {
+    float semiMajorAxis;       // Negative for hyperbolic orbits
+    float eccentricity;        // Below 1 for elliptic orbits, above 1 for hyperbolic ones
+    float inclination;         // Inclination to the reference plane (radians)
+    float ascendingNode;       // Longitude of the ascending node (radians)
+    float argumentOfPeriapsis; // Argument of periapsis (radians)
+    float meanAnomaly;         // Mean anomaly at time 0 (radians)
+    float meanMotion;          // Mean motion (radians per unit of time)
+};
+
+// Arrays a propagation writes to, starting with its first orbit; the velocity arrays may be null
+struct KeplerStates {
+    float* x;
+    float* y;
+    float* z;
+    float* vx;
+    float* vy;
+    float* vz;
+};
+
+class KeplerBatch {
+public:
+    KeplerBatch();
+
+    // Function to set the number of orbits; new orbits are circular and at rest until set
+    void resize(size_t count);
+
+    // Function to set an orbit; different orbits may be set from different threads
+    void setOrbit(size_t index, const KeplerOrbit& orbit);
+
+    // Function to propagate the orbits [first, last) to a time
+    void propagate(double time, size_t first, size_t last, const KeplerStates& states) const;
+
+    // Function to propagate the orbits [first, last) to a time of their own each, starting with the first orbit's
+    void propagate(const float* times, size_t first, size_t last, const KeplerStates& states) const;
+
+    size_t size() const { return count; }
+
+private:
+    template <typename TimeSource>
+    void propagateRange(const TimeSource& times, size_t first, size_t last, const KeplerStates& states) const;
+
+    // Orbits as structure of arrays, padded by a whole SIMD register so that any range can be loaded in full
+    size_t count;
+    std::vector<float> px, py, pz; // Unit vector towards periapsis
+    std::vector<float> qx, qy, qz; // Unit vector 90 degrees ahead of periapsis in the orbital plane
+    std::vector<float> axis;       // Semi-major axis, negative for hyperbolic orbits
+    std::vector<float> minorAxis;  // |a| sqrt(|1 - e^2|)
+    std::vector<float> eccentricity;
+    std::vector<float> meanAnomaly;
+    std::vector<float> meanMotion;
+};
+
+#endif // KEPLER_H
@@ -0,0 +1,434 @@
+// mpcorb.cpp - Minor Planet Center orbit catalog (MPCORB.DAT) importer with a binary cache
+
+#include "mpcorb.h"
+
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <thread>
+#include <sys/stat.h>
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
+namespace {
+
+const char CACHE_MAGIC[8] = { 'M', 'P', 'C', 'O', 'R', 'B', 'C', 'A' };
+const uint32_t CACHE_VERSION = 1; // Bump whenever the parser or MinorPlanetOrbit changes
+const uint32_t CACHE_BYTE_ORDER = 0x01020304u; // Reads back differently on a machine of the other endianness
+
+// Cache layout: header, orbits, count + 1 name offsets, name characters
+struct CacheHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t byteOrder;
+    uint32_t orbitSize;
+    uint32_t reserved;
+    uint64_t count;
+    uint64_t nameBytes;
+    uint64_t sourceSize; // The cache is only used while the source keeps its size and modification time
+    int64_t sourceTime;
+};
+
+const double DEGREES = 3.14159265358979323846 / 180.0;
+const double J2000 = 2451545.0; // Julian date of the J2000.0 epoch
+
+// Catalog columns (0-based start, width), from the MPCORB.DAT format description
+const int COLUMN_H = 8, WIDTH_H = 5;
+const int COLUMN_EPOCH = 20;
+const int COLUMN_MEAN_ANOMALY = 26, WIDTH_ANGLE = 9;
+const int COLUMN_PERIHELION = 37;
+const int COLUMN_NODE = 48;
+const int COLUMN_INCLINATION = 59;
+const int COLUMN_ECCENTRICITY = 70, WIDTH_ECCENTRICITY = 9;
+const int COLUMN_MEAN_MOTION = 80, WIDTH_MEAN_MOTION = 11;
+const int COLUMN_SEMI_MAJOR_AXIS = 92, WIDTH_SEMI_MAJOR_AXIS = 11;
+const int COLUMN_NAME = 166, WIDTH_NAME = 28;
+const int MIN_LINE_LENGTH = COLUMN_SEMI_MAJOR_AXIS + WIDTH_SEMI_MAJOR_AXIS;
+
+// Function to parse a fixed-width decimal field; locale independent, unlike strtod
+bool parseField(const char* field, int width, double& value) {
+    int i = 0;
+    while (i < width && field[i] == ' ') i++;
+
+    double sign = 1.0;
+    if (i < width && (field[i] == '-' || field[i] == '+')) {
+        sign = field[i] == '-' ? -1.0 : 1.0;
+        i++;
+    }
+
+    double result = 0.0, scale = 0.0;
+    int digits = 0;
+    for (; i < width && field[i] != ' '; i++) {
+        char c = field[i];
+        if (c == '.' && scale == 0.0) {
+            scale = 1.0;
+        } else if (c >= '0' && c <= '9') {
+            result = result * 10.0 + (c - '0');
+            scale *= 10.0;
+            digits++;
+        } else {
+            return false;
+        }
+    }
+    while (i < width && field[i] == ' ') i++;
+    if (digits == 0 || i != width) {
+        return false;
+    }
+
+    value = sign * (scale > 0.0 ? result / scale : result);
+    return true;
+}
+
+// Function to unpack a packed-date character: 0-9, then A-V for 10-31
+int unpackDigit(char c) {
+    if (c >= '0' && c <= '9') return c - '0';
+    if (c >= 'A' && c <= 'V') return c - 'A' + 10;
+    return -1;
+}
+
+// Function to get the days from 1970-01-01 to a proleptic Gregorian date
+long daysFromCivil(long year, int month, int day) {
+    year -= month <= 2;
+    long era = (year >= 0 ? year : year - 399) / 400;
+    long yearOfEra = year - era * 400;
+    long dayOfYear = (153 * (month + (month > 2 ? -3 : 9)) + 2) / 5 + day - 1;
+    long dayOfEra = yearOfEra * 365 + yearOfEra / 4 - yearOfEra / 100 + dayOfYear;
+    return era * 146097 + dayOfEra - 719468;
+}
+
+// Function to unpack an epoch such as "K2555" (2025-05-05.0 TT) into a Julian date
+bool unpackEpoch(const char* packed, double& julianDate) {
+    int century = unpackDigit(packed[0]);
+    int decade = unpackDigit(packed[1]), year = unpackDigit(packed[2]);
+    int month = unpackDigit(packed[3]), day = unpackDigit(packed[4]);
+    if (century < 10 || decade < 0 || decade > 9 || year < 0 || year > 9 || month < 1 || month > 12 || day < 1) {
+        return false;
+    }
+    julianDate = daysFromCivil(century * 100 + decade * 10 + year, month, day) + 2440587.5;
+    return true;
+}
+
+// Orbits and names parsed by one thread
+struct ParsedChunk {
+    std::vector<MinorPlanetOrbit> orbits;
+    std::vector<uint32_t> nameLengths;
+    std::vector<char> names;
+};
+
+// Function to parse one catalog line; header, blank and malformed lines are skipped
+bool parseLine(const char* line, int length, ParsedChunk& chunk) {
+    if (length < MIN_LINE_LENGTH) {
+        return false;
+    }
+
+    double meanAnomaly, perihelion, node, inclination, eccentricity, meanMotion, semiMajorAxis, epoch;
+    if (!parseField(line + COLUMN_MEAN_ANOMALY, WIDTH_ANGLE, meanAnomaly) ||
+        !parseField(line + COLUMN_PERIHELION, WIDTH_ANGLE, perihelion) ||
+        !parseField(line + COLUMN_NODE, WIDTH_ANGLE, node) ||
+        !parseField(line + COLUMN_INCLINATION, WIDTH_ANGLE, inclination) ||
+        !parseField(line + COLUMN_ECCENTRICITY, WIDTH_ECCENTRICITY, eccentricity) ||
+        !parseField(line + COLUMN_MEAN_MOTION, WIDTH_MEAN_MOTION, meanMotion) ||
+        !parseField(line + COLUMN_SEMI_MAJOR_AXIS, WIDTH_SEMI_MAJOR_AXIS, semiMajorAxis) ||
+        !unpackEpoch(line + COLUMN_EPOCH, epoch)) {
+        return false;
+    }
+    if (eccentricity < 0.0 || eccentricity >= 1.0 || semiMajorAxis <= 0.0) {
+        return false;
+    }
+
+    double magnitude;
+    if (!parseField(line + COLUMN_H, WIDTH_H, magnitude)) {
+        magnitude = 99.0; // Not yet determined
+    }
+
+    // Move the mean anomaly from the catalog epoch back to J2000 so every orbit shares one time origin
+    double meanAnomalyJ2000 = fmod(meanAnomaly - meanMotion * (epoch - J2000), 360.0);
+    if (meanAnomalyJ2000 < 0.0) {
+        meanAnomalyJ2000 += 360.0;
+    }
+
+    MinorPlanetOrbit orbit;
+    orbit.semiMajorAxis = float(semiMajorAxis);
+    orbit.eccentricity = float(eccentricity);
+    orbit.inclination = float(inclination * DEGREES);
+    orbit.ascendingNode = float(node * DEGREES);
+    orbit.argumentOfPerihelion = float(perihelion * DEGREES);
+    orbit.meanAnomaly = float(meanAnomalyJ2000 * DEGREES);
+    orbit.meanMotion = float(meanMotion * DEGREES);
+    orbit.absoluteMagnitude = float(magnitude);
+    chunk.orbits.push_back(orbit);
+
+    // Readable designation, or the packed one on short lines
+    const char* name = line;
+    int nameLength = 7;
+    if (length > COLUMN_NAME) {
+        name = line + COLUMN_NAME;
+        nameLength = length - COLUMN_NAME < WIDTH_NAME ? length - COLUMN_NAME : WIDTH_NAME;
+    }
+    while (nameLength > 0 && name[0] == ' ') {
+        name++;
+        nameLength--;
+    }
+    while (nameLength > 0 && name[nameLength - 1] == ' ') nameLength--;
+    chunk.names.insert(chunk.names.end(), name, name + nameLength);
+    chunk.nameLengths.push_back(nameLength);
+    return true;
+}
+
+// Function to parse the lines between two offsets of the catalog text
+void parseChunk(const char* begin, const char* end, ParsedChunk* chunk) {
+    while (begin < end) {
+        const char* newline = static_cast<const char*>(memchr(begin, '\n', end - begin));
+        const char* lineEnd = newline ? newline : end;
+        int length = int(lineEnd - begin);
+        if (length > 0 && begin[length - 1] == '\r') length--;
+        parseLine(begin, length, *chunk);
+        begin = lineEnd + 1;
+    }
+}
+
+// Function to get a file's size and modification time
+bool fileStatus(const std::string& path, uint64_t& size, int64_t& time) {
+#ifdef _WIN32
+    struct _stat64 info;
+    if (_stat64(path.c_str(), &info) != 0) return false;
+#else
+    struct stat info;
+    if (stat(path.c_str(), &info) != 0) return false;
+#endif
+    size = uint64_t(info.st_size);
+    time = int64_t(info.st_mtime);
+    return true;
+}
+
+} // namespace
+
+MinorPlanetCatalog::MinorPlanetCatalog()
+    : count(0), orbitData(NULL), nameOffsets(NULL), nameData(NULL), mapping(NULL), mappingSize(0)
+#ifdef _WIN32
+    , mappingHandle(NULL)
+#endif
+{
+}
+
+MinorPlanetCatalog::~MinorPlanetCatalog() {
+    unmap();
+}
+
+// Function to load a catalog from its cache, or parse it and write the cache
+bool MinorPlanetCatalog::load(const std::string& path) {
+    uint64_t sourceSize;
+    int64_t sourceTime;
+    if (!fileStatus(path, sourceSize, sourceTime)) {
+        printf("Cannot open minor planet catalog %s\n", path.c_str());
+        return false;
+    }
+
+    std::string cachePath = path + ".cache";
+    if (mapCache(cachePath, sourceSize, sourceTime)) {
+        return true;
+    }
+    if (!parse(path)) {
+        return false;
+    }
+    writeCache(cachePath, sourceSize, sourceTime);
+    return true;
+}
+
+// Function to get the readable designation, e.g. "(1) Ceres"
+std::string MinorPlanetCatalog::name(size_t index) const {
+    return std::string(nameData + nameOffsets[index], nameOffsets[index + 1] - nameOffsets[index]);
+}
+
+// Function to parse the catalog text in parallel chunks split at line boundaries
+bool MinorPlanetCatalog::parse(const std::string& path) {
+    FILE* file = fopen(path.c_str(), "rb");
+    if (!file) {
+        printf("Cannot open minor planet catalog %s\n", path.c_str());
+        return false;
+    }
+    fseek(file, 0, SEEK_END);
+    long size = ftell(file);
+    fseek(file, 0, SEEK_SET);
+    std::vector<char> text(size > 0 ? size : 0);
+    size_t read = fread(text.data(), 1, text.size(), file);
+    fclose(file);
+    if (read != text.size()) {
+        printf("Failed to read minor planet catalog %s\n", path.c_str());
+        return false;
+    }
+
+    // The full catalog starts with a text header ending in a line of dashes; extracts have none
+    const char* begin = text.data();
+    const char* end = begin + text.size();
+    for (const char* line = begin; line < end && line < text.data() + 65536;) {
+        const char* newline = static_cast<const char*>(memchr(line, '\n', end - line));
+        if (!newline) break;
+        if (newline - line >= 5 && strncmp(line, "-----", 5) == 0) {
+            begin = newline + 1;
+            break;
+        }
+        line = newline + 1;
+    }
+
+    // One chunk per core, each ending just after a newline
+    size_t numThreads = std::thread::hardware_concurrency();
+    numThreads = numThreads > 0 ? numThreads : 1;
+    std::vector<ParsedChunk> chunks(numThreads);
+    std::vector<std::thread> threads;
+    const char* chunkBegin = begin;
+    for (size_t i = 0; i < numThreads; i++) {
+        const char* chunkEnd = i + 1 == numThreads ? end : chunkBegin + (end - begin) / numThreads;
+        if (chunkEnd < chunkBegin) chunkEnd = chunkBegin;
+        const char* newline = chunkEnd < end ? static_cast<const char*>(memchr(chunkEnd, '\n', end - chunkEnd)) : NULL;
+        chunkEnd = newline ? newline + 1 : end;
+        threads.push_back(std::thread(parseChunk, chunkBegin, chunkEnd, &chunks[i]));
+        chunkBegin = chunkEnd;
+    }
+    for (std::thread& thread : threads) {
+        thread.join();
+    }
+
+    // Concatenate the chunks in file order
+    unmap();
+    parsedOrbits.clear();
+    parsedNameOffsets.assign(1, 0);
+    parsedNames.clear();
+    for (const ParsedChunk& chunk : chunks) {
+        parsedOrbits.insert(parsedOrbits.end(), chunk.orbits.begin(), chunk.orbits.end());
+        for (uint32_t length : chunk.nameLengths) {
+            parsedNameOffsets.push_back(parsedNameOffsets.back() + length);
+        }
+        parsedNames.insert(parsedNames.end(), chunk.names.begin(), chunk.names.end());
+    }
+
+    count = parsedOrbits.size();
+    orbitData = parsedOrbits.data();
+    nameOffsets = parsedNameOffsets.data();
+    nameData = parsedNames.data();
+    return true;
+}
+
+// Function to memory-map the cache if it was written for this version of the source
+bool MinorPlanetCatalog::mapCache(const std::string& cachePath, uint64_t sourceSize, int64_t sourceTime) {
+#ifdef _WIN32
+    HANDLE file = CreateFileA(cachePath.c_str(), GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+    if (file == INVALID_HANDLE_VALUE) return false;
+    LARGE_INTEGER size;
+    HANDLE handle = NULL;
+    void* view = NULL;
+    if (GetFileSizeEx(file, &size) && size.QuadPart >= (LONGLONG)sizeof(CacheHeader)) {
+        handle = CreateFileMappingA(file, NULL, PAGE_READONLY, 0, 0, NULL);
+        view = handle ? MapViewOfFile(handle, FILE_MAP_READ, 0, 0, 0) : NULL;
+    }
+    CloseHandle(file);
+    if (!view) {
+        if (handle) CloseHandle(handle);
+        return false;
+    }
+    unmap();
+    mapping = view;
+    mappingSize = size_t(size.QuadPart);
+    mappingHandle = handle;
+#else
+    int file = open(cachePath.c_str(), O_RDONLY);
+    if (file < 0) return false;
+    struct stat info;
+    void* view = MAP_FAILED;
+    if (fstat(file, &info) == 0 && size_t(info.st_size) >= sizeof(CacheHeader)) {
+        view = mmap(NULL, info.st_size, PROT_READ, MAP_PRIVATE, file, 0);
+    }
+    close(file);
+    if (view == MAP_FAILED) return false;
+    unmap();
+    mapping = view;
+    mappingSize = size_t(info.st_size);
+#endif
+
+    // Check the header, then that the file holds exactly what the header describes
+    const CacheHeader* header = static_cast<const CacheHeader*>(mapping);
+    bool valid = memcmp(header->magic, CACHE_MAGIC, sizeof(CACHE_MAGIC)) == 0 &&
+                 header->version == CACHE_VERSION && header->byteOrder == CACHE_BYTE_ORDER &&
+                 header->orbitSize == sizeof(MinorPlanetOrbit) &&
+                 header->sourceSize == sourceSize && header->sourceTime == sourceTime &&
+                 header->count < (uint64_t(1) << 32) && header->nameBytes < (uint64_t(1) << 32) &&
+                 mappingSize == sizeof(CacheHeader) + header->count * sizeof(MinorPlanetOrbit) +
+                                (header->count + 1) * sizeof(uint32_t) + header->nameBytes;
+    if (!valid) {
+        unmap();
+        return false;
+    }
+
+    // name() trusts the offsets, so they must run from 0 to the end of the names without going back
+    const char* data = static_cast<const char*>(mapping) + sizeof(CacheHeader);
+    size_t mappedCount = size_t(header->count);
+    const uint32_t* offsets = reinterpret_cast<const uint32_t*>(data + mappedCount * sizeof(MinorPlanetOrbit));
+    valid = offsets[0] == 0 && offsets[mappedCount] == header->nameBytes;
+    for (size_t i = 0; valid && i < mappedCount; i++) {
+        valid = offsets[i] <= offsets[i + 1];
+    }
+    if (!valid) {
+        unmap();
+        return false;
+    }
+
+    count = mappedCount;
+    orbitData = reinterpret_cast<const MinorPlanetOrbit*>(data);
+    nameOffsets = offsets;
+    nameData = data + count * sizeof(MinorPlanetOrbit) + (count + 1) * sizeof(uint32_t);
+    return true;
+}
+
+// Function to write the parsed catalog as a cache; failure only costs a parse on the next run
+void MinorPlanetCatalog::writeCache(const std::string& cachePath, uint64_t sourceSize, int64_t sourceTime) const {
+    CacheHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, CACHE_MAGIC, sizeof(CACHE_MAGIC));
+    header.version = CACHE_VERSION;
+    header.byteOrder = CACHE_BYTE_ORDER;
+    header.orbitSize = sizeof(MinorPlanetOrbit);
+    header.count = count;
+    header.nameBytes = nameOffsets[count];
+    header.sourceSize = sourceSize;
+    header.sourceTime = sourceTime;
+
+    FILE* file = fopen(cachePath.c_str(), "wb");
+    if (!file) {
+        printf("Cannot write minor planet cache %s\n", cachePath.c_str());
+        return;
+    }
+    bool written = fwrite(&header, sizeof(header), 1, file) == 1 &&
+                   fwrite(orbitData, sizeof(MinorPlanetOrbit), count, file) == count &&
+                   fwrite(nameOffsets, sizeof(uint32_t), count + 1, file) == count + 1 &&
+                   fwrite(nameData, 1, header.nameBytes, file) == header.nameBytes;
+    if (fclose(file) != 0 || !written) {
+        printf("Failed to write minor planet cache %s\n", cachePath.c_str());
+        remove(cachePath.c_str()); // A truncated cache would fail the size check anyway
+    }
+}
+
+// Function to release the cache mapping, if any
+void MinorPlanetCatalog::unmap() {
+    if (!mapping) return;
+#ifdef _WIN32
+    UnmapViewOfFile(mapping);
+    CloseHandle(mappingHandle);
+    mappingHandle = NULL;
+#else
+    munmap(mapping, mappingSize);
+#endif
+    mapping = NULL;
+    mappingSize = 0;
+    count = 0;
+    orbitData = NULL;
+    nameOffsets = NULL;
+    nameData = NULL;
+}
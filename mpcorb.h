@@ -0,0 +1,69 @@
+// mpcorb.h - Minor Planet Center orbit catalog (MPCORB.DAT) importer with a binary cache
+//
+// The fixed-width catalog is parsed in parallel chunks into packed orbital elements and
+// names, then written next to the source as "<path>.cache". Later runs memory-map the
+// cache when it matches the source's size and modification time.
+
+#ifndef MPCORB_H
+#define MPCORB_H
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// Osculating orbit of one minor planet, referred to the J2000 ecliptic and equinox
+struct MinorPlanetOrbit {
+    float semiMajorAxis;        // Semi-major axis (AU)
+    float eccentricity;         // Eccentricity, below 1
+    float inclination;          // Inclination to the ecliptic (radians)
+    float ascendingNode;        // Longitude of the ascending node (radians)
+    float argumentOfPerihelion; // Argument of perihelion (radians)
+    float meanAnomaly;          // Mean anomaly at J2000.0, JD 2451545.0 (radians)
+    float meanMotion;           // Mean daily motion (radians per day)
+    float absoluteMagnitude;    // Absolute magnitude H, 99 when unknown
+};
+
+class MinorPlanetCatalog {
+public:
+    MinorPlanetCatalog();
+    ~MinorPlanetCatalog();
+
+    // Function to load a catalog from its cache, or parse it and write the cache
+    bool load(const std::string& path);
+
+    size_t size() const { return count; }
+    const MinorPlanetOrbit* orbits() const { return orbitData; }
+
+    // Function to get the readable designation, e.g. "(1) Ceres"
+    std::string name(size_t index) const;
+
+private:
+    MinorPlanetCatalog(const MinorPlanetCatalog&) = delete;
+    MinorPlanetCatalog& operator=(const MinorPlanetCatalog&) = delete;
+
+    bool parse(const std::string& path);
+    bool mapCache(const std::string& cachePath, uint64_t sourceSize, int64_t sourceTime);
+    void writeCache(const std::string& cachePath, uint64_t sourceSize, int64_t sourceTime) const;
+    void unmap();
+
+    // Views of the catalog, into either the parsed arrays or the mapped cache
+    size_t count;
+    const MinorPlanetOrbit* orbitData;
+    const uint32_t* nameOffsets; // count + 1 offsets into nameData
+    const char* nameData;
+
+    // Storage when parsed from the catalog
+    std::vector<MinorPlanetOrbit> parsedOrbits;
+    std::vector<uint32_t> parsedNameOffsets;
+    std::vector<char> parsedNames;
+
+    // Mapping when loaded from the cache
+    void* mapping;
+    size_t mappingSize;
+#ifdef _WIN32
+    void* mappingHandle;
+#endif
+};
+
+#endif // MPCORB_H
@@ -0,0 +1,973 @@
+// nbody.cpp - Self-gravitating N-body simulation with Barnes-Hut and fast multipole solvers
+
+#include "nbody.h"
+#include "belt_integrator.h"
+#include "parallel.h"
+#include "simd.h"
+
+#include <algorithm>
+#include <cfloat>
+#include <chrono>
+#include <cmath>
+#include <functional>
+
+namespace {
+
+const int MAX_LEVEL = 21;           // Morton keys hold 21 bits per axis
+const uint32_t LEAF_SIZE = 64;      // Particles per leaf; the walk of a leaf is shared by several SIMD registers of targets
+const int BUCKET_BITS = 9;          // Top bits of the keys the sort splits the particles by, three octree levels
+const size_t LEAVES_PER_TASK = 32;  // Leaves a thread takes at a time during the walk
+const uint32_t FMM_LEAF_SIZE = 128;  // Particles per leaf of the fast multipole tree
+const size_t NODES_PER_TASK = 64;   // Nodes a thread takes at a time when translating expansions between levels
+const size_t SUBTREES_PER_THREAD = 16; // Target subtrees per thread for the interactions, to even out their load
+const int MAX_BATCH_STEPS = 16;     // Steps integrated per hand-off with the main thread
+const double SNAPSHOT_INTERVAL = 0.5; // Seconds between published snapshots
+
+// Function to spread the low 21 bits of a value to every third bit
+uint64_t spreadBits(uint32_t value) {
+    uint64_t x = value & 0x1FFFFFu;
+    x = (x | x << 32) & 0x1F00000000FFFFull;
+    x = (x | x << 16) & 0x1F0000FF0000FFull;
+    x = (x | x << 8) & 0x100F00F00F00F00Full;
+    x = (x | x << 4) & 0x10C30C30C30C30C3ull;
+    x = (x | x << 2) & 0x1249249249249249ull;
+    return x;
+}
+
+// Function to get the octant of a key among the children of a node at a level: bit 0 is x, bit 1 y, bit 2 z
+inline uint32_t childOctant(uint64_t key, int level) {
+    return uint32_t(key >> (3 * (MAX_LEVEL - level - 1))) & 7u;
+}
+
+// Function to sum the pulls of point masses on count particles, SIMD_WIDTH of them at a time, handing each sum to
+// store(i, x, y, z). The particle arrays must be readable for a whole register past count. A particle's pull on
+// itself vanishes, as its offset is zero and the softening keeps the distance positive
+template <typename Store>
+void sumPointMasses(const float* x, const float* y, const float* z, uint32_t count, const std::vector<float>& pullX, const std::vector<float>& pullY,
+                    const std::vector<float>& pullZ, const std::vector<float>& pullMass, float softening, const Store& store) {
+    const SimdFloat softening2 = softening * softening;
+    size_t numPulls = pullMass.size();
+    for (uint32_t t = 0; t < count; t += SIMD_WIDTH) {
+        SimdFloat targetX = simdLoad(x + t), targetY = simdLoad(y + t), targetZ = simdLoad(z + t);
+        SimdFloat sumX = 0.0f, sumY = 0.0f, sumZ = 0.0f;
+        for (size_t k = 0; k < numPulls; k++) {
+            SimdFloat dx = SimdFloat(pullX[k]) - targetX;
+            SimdFloat dy = SimdFloat(pullY[k]) - targetY;
+            SimdFloat dz = SimdFloat(pullZ[k]) - targetZ;
+            SimdFloat d2 = dx * dx + dy * dy + dz * dz + softening2;
+            SimdFloat scale = SimdFloat(pullMass[k]) / (d2 * simdSqrt(d2));
+            sumX = sumX + dx * scale;
+            sumY = sumY + dy * scale;
+            sumZ = sumZ + dz * scale;
+        }
+
+        float resultX[SIMD_WIDTH], resultY[SIMD_WIDTH], resultZ[SIMD_WIDTH];
+        simdStore(resultX, sumX);
+        simdStore(resultY, sumY);
+        simdStore(resultZ, sumZ);
+        for (uint32_t j = 0; j < SIMD_WIDTH && t + j < count; j++) {
+            store(t + j, resultX[j], resultY[j], resultZ[j]);
+        }
+    }
+}
+
+// Function to add the massive particles of a node to the point masses pulling on a group
+void gatherParticles(const NBodyOctree& octree, const NBodyOctree::Node& node, std::vector<float>& pullX, std::vector<float>& pullY,
+                     std::vector<float>& pullZ, std::vector<float>& pullMass) {
+    const float* mass = octree.mass();
+    for (uint32_t i = node.first; i < node.last; i++) {
+        if (mass[i] > 0.0f) {
+            pullX.push_back(octree.x()[i]); pullY.push_back(octree.y()[i]); pullZ.push_back(octree.z()[i]); pullMass.push_back(mass[i]);
+        }
+    }
+}
+
+// Expansions of the fast multipole method in solid harmonics, after Greengard and Rokhlin. The regular harmonics
+// r^n Y_n^m and irregular ones r^(-n-1) Y_n^m are stored for -n <= m <= n at n (n + 1) + m; an expansion stores its
+// coefficients for m >= 0 at n (n + 1) / 2 + m, those for m < 0 being their conjugates
+typedef std::complex<double> Complex;
+
+// Function to get (-1)^n
+inline double oddOrEven(int n) {
+    return (n & 1) ? -1.0 : 1.0;
+}
+
+// Offset in spherical coordinates, with the angles kept as their sines and cosines
+struct SphericalOffset {
+    double r;
+    double cosTheta, sinTheta;
+    Complex eiPhi; // cos(phi) + i sin(phi)
+};
+
+// Function to get the spherical coordinates of an offset, without any trigonometric function
+SphericalOffset sphericalOffset(double dx, double dy, double dz) {
+    SphericalOffset offset;
+    double rhoSquared = dx * dx + dy * dy;
+    double rho = std::sqrt(rhoSquared);
+    offset.r = std::sqrt(rhoSquared + dz * dz);
+    offset.cosTheta = offset.r > 0.0 ? dz / offset.r : 1.0;
+    offset.sinTheta = offset.r > 0.0 ? rho / offset.r : 0.0;
+    offset.eiPhi = rho > 0.0 ? Complex(dx / rho, dy / rho) : Complex(1.0, 0.0);
+    return offset;
+}
+
+// Function to evaluate the regular solid harmonics of the orders below order at an offset, and, if asked, their
+// derivatives by theta for m >= 0
+void regularHarmonics(int order, const SphericalOffset& offset, Complex* ynm, Complex* ynmTheta) {
+    double x = offset.cosTheta, y = offset.sinTheta, r = offset.r;
+    double invY = y == 0.0 ? 0.0 : 1.0 / y;
+    double factor = 1.0, pn = 1.0, rhoM = 1.0;
+    Complex ei = offset.eiPhi, eim = 1.0;
+    for (int m = 0; m < order; m++) {
+        double p = pn;
+        int npn = m * m + 2 * m, nmn = m * m;
+        ynm[npn] = rhoM * p * eim;
+        ynm[nmn] = std::conj(ynm[npn]);
+        double p1 = p;
+        p = x * (2 * m + 1) * p1;
+        if (ynmTheta) {
+            ynmTheta[npn] = rhoM * (p - (m + 1) * x * p1) * invY * eim;
+        }
+        rhoM *= r;
+        double rhoN = rhoM;
+        for (int n = m + 1; n < order; n++) {
+            int npm = n * n + n + m, nmm = n * n + n - m;
+            rhoN /= -(n + m);
+            ynm[npm] = rhoN * p * eim;
+            ynm[nmm] = std::conj(ynm[npm]);
+            double p2 = p1;
+            p1 = p;
+            p = (x * (2 * n + 1) * p1 - (n + m) * p2) / (n - m + 1);
+            if (ynmTheta) {
+                ynmTheta[npm] = rhoN * ((n - m + 1) * p - (n + 1) * x * p1) * invY * eim;
+            }
+            rhoN *= r;
+        }
+        rhoM /= -(2 * m + 2) * (2 * m + 1);
+        pn = -pn * factor * y;
+        factor += 2.0;
+        eim *= ei;
+    }
+}
+
+// Function to evaluate the irregular solid harmonics of the orders below order at an offset
+void irregularHarmonics(int order, const SphericalOffset& offset, Complex* ynm) {
+    double x = offset.cosTheta, y = offset.sinTheta;
+    double factor = 1.0, pn = 1.0;
+    double invR = -1.0 / offset.r, rhoM = -invR;
+    Complex ei = offset.eiPhi, eim = 1.0;
+    for (int m = 0; m < order; m++) {
+        double p = pn;
+        int npn = m * m + 2 * m, nmn = m * m;
+        ynm[npn] = rhoM * p * eim;
+        ynm[nmn] = std::conj(ynm[npn]);
+        double p1 = p;
+        p = x * (2 * m + 1) * p1;
+        rhoM *= invR;
+        double rhoN = rhoM;
+        for (int n = m + 1; n < order; n++) {
+            int npm = n * n + n + m, nmm = n * n + n - m;
+            ynm[npm] = rhoN * p * eim;
+            ynm[nmm] = std::conj(ynm[npm]);
+            double p2 = p1;
+            p1 = p;
+            p = (x * (2 * n + 1) * p1 - (n + m) * p2) / (n - m + 1);
+            rhoN *= invR * (n - m + 1);
+        }
+        pn = -pn * factor * y;
+        factor += 2.0;
+        eim *= ei;
+    }
+}
+
+// Function to get the centre of a node's expansions, its centre of mass, about which their dipole terms vanish
+inline void expansionCenter(const NBodyOctree::Node& node, double& x, double& y, double& z) {
+    x = node.x;
+    y = node.y;
+    z = node.z;
+}
+
+// Function to add a point mass at an offset from the centre to a multipole expansion
+void particleToMultipole(int order, double mass, double dx, double dy, double dz, Complex* ynm, Complex* multipole) {
+    SphericalOffset offset = sphericalOffset(dx, dy, dz);
+    offset.eiPhi = std::conj(offset.eiPhi);
+    regularHarmonics(order, offset, ynm, NULL);
+    for (int n = 0; n < order; n++) {
+        for (int m = 0; m <= n; m++) {
+            multipole[n * (n + 1) / 2 + m] += mass * ynm[n * n + n + m];
+        }
+    }
+}
+
+// Function to shift a child's multipole expansion to its parent, offset by (dx, dy, dz) from the child's centre
+void multipoleToMultipole(int order, const Complex* child, double dx, double dy, double dz, Complex* ynm, Complex* parent) {
+    regularHarmonics(order, sphericalOffset(dx, dy, dz), ynm, NULL);
+    for (int j = 0; j < order; j++) {
+        for (int k = 0; k <= j; k++) {
+            Complex sum = 0.0;
+            for (int n = 0; n <= j; n++) {
+                for (int m = std::max(-n, -j + k + n); m <= std::min(k - 1, n); m++) {
+                    double sign = (m >= 0 ? 1.0 : oddOrEven(m)) * oddOrEven(n);
+                    sum += child[(j - n) * (j - n + 1) / 2 + k - m] * ynm[n * n + n - m] * sign;
+                }
+                for (int m = k; m <= std::min(n, j + k - n); m++) {
+                    sum += std::conj(child[(j - n) * (j - n + 1) / 2 - k + m]) * ynm[n * n + n - m] * oddOrEven(k + n + m);
+                }
+            }
+            parent[j * (j + 1) / 2 + k] += sum;
+        }
+    }
+}
+
+// Function to add a source's multipole expansion to a target's local expansion, the target's centre being offset by
+// (dx, dy, dz) from the source's
+void multipoleToLocal(int order, const Complex* multipole, double dx, double dy, double dz, Complex* ynm, Complex* local) {
+    irregularHarmonics(order, sphericalOffset(dx, dy, dz), ynm);
+    for (int j = 0; j < order; j++) {
+        double cnm = oddOrEven(j);
+        for (int k = 0; k <= j; k++) {
+            Complex sum = 0.0;
+            for (int n = 0; n < order - j; n++) {
+                for (int m = -n; m < 0; m++) {
+                    sum += std::conj(multipole[n * (n + 1) / 2 - m]) * cnm * ynm[(j + n) * (j + n) + j + n + m - k];
+                }
+                for (int m = 0; m <= n; m++) {
+                    double sign = cnm * oddOrEven((k - m) * (k < m) + m);
+                    sum += multipole[n * (n + 1) / 2 + m] * sign * ynm[(j + n) * (j + n) + j + n + m - k];
+                }
+            }
+            local[j * (j + 1) / 2 + k] += sum;
+        }
+    }
+}
+
+// Function to shift a parent's local expansion to its child, offset by (dx, dy, dz) from the parent's centre
+void localToLocal(int order, const Complex* parent, double dx, double dy, double dz, Complex* ynm, Complex* child) {
+    regularHarmonics(order, sphericalOffset(dx, dy, dz), ynm, NULL);
+    for (int j = 0; j < order; j++) {
+        for (int k = 0; k <= j; k++) {
+            Complex sum = 0.0;
+            for (int n = j; n < order; n++) {
+                for (int m = j + k - n; m < 0; m++) {
+                    sum += std::conj(parent[n * (n + 1) / 2 - m]) * ynm[(n - j) * (n - j) + n - j + m - k] * oddOrEven(k);
+                }
+                for (int m = 0; m <= n; m++) {
+                    if (n - j >= std::abs(m - k)) {
+                        sum += parent[n * (n + 1) / 2 + m] * ynm[(n - j) * (n - j) + n - j + m - k] * oddOrEven((m - k) * (m < k));
+                    }
+                }
+            }
+            child[j * (j + 1) / 2 + k] += sum;
+        }
+    }
+}
+
+// Function to get the gradient of a local expansion, the acceleration, at an offset from its centre
+void localToParticle(int order, const Complex* local, double dx, double dy, double dz, Complex* ynm, Complex* ynmTheta, double acceleration[3]) {
+    SphericalOffset offset = sphericalOffset(dx, dy, dz);
+    regularHarmonics(order, offset, ynm, ynmTheta);
+    double r = offset.r;
+    double radial = 0.0, polar = 0.0, azimuthal = 0.0; // Derivatives by r, theta and phi
+    for (int n = 0; n < order; n++) {
+        int nm = n * n + n, nms = n * (n + 1) / 2;
+        radial += std::real(local[nms] * ynm[nm]) / r * n;
+        polar += std::real(local[nms] * ynmTheta[nm]);
+        for (int m = 1; m <= n; m++) {
+            nm = n * n + n + m;
+            nms = n * (n + 1) / 2 + m;
+            radial += 2.0 * std::real(local[nms] * ynm[nm]) / r * n;
+            polar += 2.0 * std::real(local[nms] * ynmTheta[nm]);
+            azimuthal += 2.0 * std::real(local[nms] * ynm[nm] * Complex(0.0, 1.0)) * m;
+        }
+    }
+    double sinTheta = offset.sinTheta, cosTheta = offset.cosTheta, sinPhi = offset.eiPhi.imag(), cosPhi = offset.eiPhi.real();
+    acceleration[0] = sinTheta * cosPhi * radial + cosTheta * cosPhi / r * polar - sinPhi / (r * sinTheta) * azimuthal;
+    acceleration[1] = sinTheta * sinPhi * radial + cosTheta * sinPhi / r * polar + cosPhi / (r * sinTheta) * azimuthal;
+    acceleration[2] = cosTheta * radial - sinTheta / r * polar;
+}
+
+} // namespace
+
+void NBodyParticles::resize(size_t count) {
+    x.resize(count); y.resize(count); z.resize(count);
+    vx.resize(count); vy.resize(count); vz.resize(count);
+    mass.resize(count);
+}
+
+NBodyOctree::NBodyOctree()
+    : leafSize(LEAF_SIZE), rootX(0.0f), rootY(0.0f), rootZ(0.0f), rootSize(1.0f) {
+}
+
+void NBodyOctree::build(const NBodyParticles& particles, uint32_t maxLeafSize) {
+    leafSize = std::max(maxLeafSize, 1u);
+    sortParticles(particles);
+
+    // The top levels are built on this thread; the subtrees below them are built in parallel into trees of their own
+    // and appended, then the top levels are finished
+    tree.clear();
+    leafNodes.clear();
+    Node root = Node();
+    root.first = 0;
+    root.last = uint32_t(keys.size());
+    tree.push_back(root);
+
+    int splitLevel = 1;
+    while ((size_t(1) << (3 * splitLevel)) < 8 * parallelThreadCount(keys.size()) && splitLevel < 3) {
+        splitLevel++;
+    }
+    std::vector<Cell> pending, deferred;
+    Cell rootCell = { 0, 0, 0, 0, 0 };
+    buildNode(tree, rootCell, splitLevel, &pending, &deferred);
+
+    // Subtrees, each with its root at index 0 of its own tree
+    std::vector<std::vector<Node> > subtrees(pending.size());
+    parallelTasks(pending.size(), parallelThreadCount(keys.size()), [&](size_t task) {
+        std::vector<Node>& nodes = subtrees[task];
+        nodes.push_back(tree[pending[task].node]);
+        Cell cell = pending[task];
+        cell.node = 0;
+        buildNode(nodes, cell, splitLevel, NULL, NULL);
+    });
+    for (size_t task = 0; task < pending.size(); task++) {
+        std::vector<Node>& nodes = subtrees[task];
+        uint32_t offset = uint32_t(tree.size()) - 1; // Subtree node k > 0 goes to offset + k
+        for (Node& node : nodes) {
+            if (node.numChildren > 0) {
+                node.firstChild += offset;
+            }
+        }
+        tree[pending[task].node] = nodes[0];
+        tree.insert(tree.end(), nodes.begin() + 1, nodes.end());
+    }
+
+    // Top levels; they were deferred after their children, so children come first
+    for (const Cell& cell : deferred) {
+        finishNode(tree, cell);
+    }
+
+    for (uint32_t i = 0; i < tree.size(); i++) {
+        if (tree[i].numChildren == 0) {
+            leafNodes.push_back(i);
+        }
+    }
+    std::sort(leafNodes.begin(), leafNodes.end(), [this](uint32_t a, uint32_t b) { return tree[a].first < tree[b].first; });
+}
+
+// Function to sort the particles along the Morton curve of the cube around them
+void NBodyOctree::sortParticles(const NBodyParticles& particles) {
+    size_t count = particles.size();
+
+    // Bounding cube
+    std::mutex merge;
+    float minX = FLT_MAX, minY = FLT_MAX, minZ = FLT_MAX, maxX = -FLT_MAX, maxY = -FLT_MAX, maxZ = -FLT_MAX;
+    parallelFor(count, [&](size_t first, size_t last) {
+        float lowX = FLT_MAX, lowY = FLT_MAX, lowZ = FLT_MAX, highX = -FLT_MAX, highY = -FLT_MAX, highZ = -FLT_MAX;
+        for (size_t i = first; i < last; i++) {
+            lowX = std::min(lowX, particles.x[i]); highX = std::max(highX, particles.x[i]);
+            lowY = std::min(lowY, particles.y[i]); highY = std::max(highY, particles.y[i]);
+            lowZ = std::min(lowZ, particles.z[i]); highZ = std::max(highZ, particles.z[i]);
+        }
+        std::lock_guard<std::mutex> guard(merge);
+        minX = std::min(minX, lowX); maxX = std::max(maxX, highX);
+        minY = std::min(minY, lowY); maxY = std::max(maxY, highY);
+        minZ = std::min(minZ, lowZ); maxZ = std::max(maxZ, highZ);
+    });
+    rootX = minX;
+    rootY = minY;
+    rootZ = minZ;
+    rootSize = std::max(std::max(maxX - minX, maxY - minY), std::max(maxZ - minZ, 1e-6f)) * 1.0001f;
+
+    // Keys, bucketed by their top bits, then each bucket sorted on its own
+    const float scale = float(1u << MAX_LEVEL) / rootSize;
+    const uint32_t maxCell = (1u << MAX_LEVEL) - 1;
+    std::vector<uint64_t> unsortedKeys(count);
+    parallelFor(count, [&](size_t first, size_t last) {
+        for (size_t i = first; i < last; i++) {
+            uint32_t cellX = std::min(uint32_t((particles.x[i] - rootX) * scale), maxCell);
+            uint32_t cellY = std::min(uint32_t((particles.y[i] - rootY) * scale), maxCell);
+            uint32_t cellZ = std::min(uint32_t((particles.z[i] - rootZ) * scale), maxCell);
+            unsortedKeys[i] = spreadBits(cellX) | spreadBits(cellY) << 1 | spreadBits(cellZ) << 2;
+        }
+    });
+
+    const int bucketShift = 3 * MAX_LEVEL - BUCKET_BITS;
+    std::vector<size_t> bucketStarts((1u << BUCKET_BITS) + 1, 0);
+    for (size_t i = 0; i < count; i++) {
+        bucketStarts[(unsortedKeys[i] >> bucketShift) + 1]++;
+    }
+    for (size_t b = 1; b < bucketStarts.size(); b++) {
+        bucketStarts[b] += bucketStarts[b - 1];
+    }
+    std::vector<std::pair<uint64_t, uint32_t> > sorted(count);
+    std::vector<size_t> fill(bucketStarts.begin(), bucketStarts.end() - 1);
+    for (size_t i = 0; i < count; i++) {
+        sorted[fill[unsortedKeys[i] >> bucketShift]++] = std::make_pair(unsortedKeys[i], uint32_t(i));
+    }
+    parallelTasks(size_t(1) << BUCKET_BITS, parallelThreadCount(count), [&](size_t bucket) {
+        std::sort(sorted.begin() + bucketStarts[bucket], sorted.begin() + bucketStarts[bucket + 1]);
+    });
+
+    // Particles in Morton order; the padding is never summed, as it has no mass, but keeps whole loads in range
+    size_t padded = count + SIMD_WIDTH;
+    keys.resize(count);
+    sortedOrder.resize(count);
+    sortedX.assign(padded, 0.0f); sortedY.assign(padded, 0.0f); sortedZ.assign(padded, 0.0f); sortedMass.assign(padded, 0.0f);
+    parallelFor(count, [&](size_t first, size_t last) {
+        for (size_t i = first; i < last; i++) {
+            uint32_t index = sorted[i].second;
+            keys[i] = sorted[i].first;
+            sortedOrder[i] = index;
+            sortedX[i] = particles.x[index];
+            sortedY[i] = particles.y[index];
+            sortedZ[i] = particles.z[index];
+            sortedMass[i] = particles.mass[index];
+        }
+    });
+}
+
+// Function to split a node into its children and build them, finishing the node afterwards. When building the top
+// levels, nodes at the split level are left to be built later, and their ancestors to be finished later
+void NBodyOctree::buildNode(std::vector<Node>& nodes, const Cell& cell, int splitLevel, std::vector<Cell>* pending, std::vector<Cell>* deferred) const {
+    uint32_t first = nodes[cell.node].first, last = nodes[cell.node].last;
+    if (last - first <= leafSize || cell.level == MAX_LEVEL) {
+        finishNode(nodes, cell);
+        return;
+    }
+    if (pending && cell.level == splitLevel) {
+        pending->push_back(cell);
+        return;
+    }
+
+    // Children in octant order, which is key order
+    uint32_t firstChild = uint32_t(nodes.size());
+    uint32_t start = first;
+    for (uint32_t octant = 0; octant < 8 && start < last; octant++) {
+        uint32_t end = uint32_t(std::partition_point(keys.begin() + start, keys.begin() + last, [&](uint64_t key) {
+            return childOctant(key, cell.level) <= octant;
+        }) - keys.begin());
+        if (end > start) {
+            Node child = Node();
+            child.first = start;
+            child.last = end;
+            child.firstChild = octant; // Kept here until the child is built
+            nodes.push_back(child);
+        }
+        start = end;
+    }
+    uint32_t numChildren = uint32_t(nodes.size()) - firstChild;
+    nodes[cell.node].firstChild = firstChild;
+    nodes[cell.node].numChildren = numChildren;
+
+    for (uint32_t i = firstChild; i < firstChild + numChildren; i++) {
+        uint32_t octant = nodes[i].firstChild;
+        nodes[i].firstChild = 0;
+        Cell child = { i, cell.level + 1, 2 * cell.x + (octant & 1), 2 * cell.y + (octant >> 1 & 1), 2 * cell.z + (octant >> 2) };
+        buildNode(nodes, child, splitLevel, pending, deferred);
+    }
+
+    if (deferred) {
+        deferred->push_back(cell);
+    } else {
+        finishNode(nodes, cell);
+    }
+}
+
+// Function to set a node's mass, centre of mass, bounds and cell from its particles or children
+void NBodyOctree::finishNode(std::vector<Node>& nodes, const Cell& cell) const {
+    Node& node = nodes[cell.node];
+    double mass = 0.0, sumX = 0.0, sumY = 0.0, sumZ = 0.0;
+    float minX = FLT_MAX, minY = FLT_MAX, minZ = FLT_MAX, maxX = -FLT_MAX, maxY = -FLT_MAX, maxZ = -FLT_MAX;
+    if (node.numChildren == 0) {
+        for (uint32_t i = node.first; i < node.last; i++) {
+            mass += sortedMass[i];
+            sumX += double(sortedMass[i]) * sortedX[i];
+            sumY += double(sortedMass[i]) * sortedY[i];
+            sumZ += double(sortedMass[i]) * sortedZ[i];
+            minX = std::min(minX, sortedX[i]); maxX = std::max(maxX, sortedX[i]);
+            minY = std::min(minY, sortedY[i]); maxY = std::max(maxY, sortedY[i]);
+            minZ = std::min(minZ, sortedZ[i]); maxZ = std::max(maxZ, sortedZ[i]);
+        }
+    } else {
+        for (uint32_t i = node.firstChild; i < node.firstChild + node.numChildren; i++) {
+            const Node& child = nodes[i];
+            mass += child.mass;
+            sumX += double(child.mass) * child.x;
+            sumY += double(child.mass) * child.y;
+            sumZ += double(child.mass) * child.z;
+            minX = std::min(minX, child.minX); maxX = std::max(maxX, child.maxX);
+            minY = std::min(minY, child.minY); maxY = std::max(maxY, child.maxY);
+            minZ = std::min(minZ, child.minZ); maxZ = std::max(maxZ, child.maxZ);
+        }
+    }
+
+    node.size = rootSize / float(1u << cell.level);
+    node.centerX = rootX + (cell.x + 0.5f) * node.size;
+    node.centerY = rootY + (cell.y + 0.5f) * node.size;
+    node.centerZ = rootZ + (cell.z + 0.5f) * node.size;
+    node.level = cell.level;
+    node.mass = float(mass);
+    node.x = mass > 0.0 ? float(sumX / mass) : node.centerX; // Massless nodes pull nothing, but keep a defined position
+    node.y = mass > 0.0 ? float(sumY / mass) : node.centerY;
+    node.z = mass > 0.0 ? float(sumZ / mass) : node.centerZ;
+    node.minX = minX; node.minY = minY; node.minZ = minZ;
+    node.maxX = maxX; node.maxY = maxY; node.maxZ = maxZ;
+}
+
+const float BarnesHutSolver::DEFAULT_OPENING_ANGLE = 0.5f;
+const float BarnesHutSolver::DEFAULT_SOFTENING = 1e-5f;
+
+BarnesHutSolver::BarnesHutSolver(float angle, float softeningLength)
+    : openingAngle(angle), softening(std::max(softeningLength, 1e-9f)) {
+}
+
+void BarnesHutSolver::accelerations(const NBodyParticles& particles, float* ax, float* ay, float* az) {
+    octree.build(particles, LEAF_SIZE);
+
+    // A node opens within its cell's size over the opening angle of its centre of mass, plus the centre of mass's
+    // offset from the cell's centre, so that a particle inside a cell never takes the cell whole
+    const std::vector<NBodyOctree::Node>& nodes = octree.nodes();
+    float theta = openingAngle.load();
+    openRadiiSquared.resize(nodes.size());
+    parallelFor(nodes.size(), [&](size_t first, size_t last) {
+        for (size_t i = first; i < last; i++) {
+            const NBodyOctree::Node& node = nodes[i];
+            if (theta > 0.0f) {
+                float offset = std::sqrt((node.x - node.centerX) * (node.x - node.centerX) + (node.y - node.centerY) * (node.y - node.centerY) +
+                                         (node.z - node.centerZ) * (node.z - node.centerZ));
+                float radius = node.size / theta + offset;
+                openRadiiSquared[i] = radius * radius;
+            } else {
+                openRadiiSquared[i] = FLT_MAX; // Always opened: direct summation
+            }
+        }
+    });
+
+    const std::vector<uint32_t>& leaves = octree.leaves();
+    size_t numTasks = (leaves.size() + LEAVES_PER_TASK - 1) / LEAVES_PER_TASK;
+    parallelTasks(numTasks, parallelThreadCount(particles.size()), [&](size_t task) {
+        walkLeaves(task * LEAVES_PER_TASK, std::min((task + 1) * LEAVES_PER_TASK, leaves.size()), ax, ay, az);
+    });
+}
+
+// Function to walk the tree for a range of leaves. Each leaf gathers the point masses acting on it, whole cells far
+// enough from all of its particles and the particles of the others, then sums them for its particles at once
+void BarnesHutSolver::walkLeaves(size_t firstLeaf, size_t lastLeaf, float* ax, float* ay, float* az) const {
+    const std::vector<NBodyOctree::Node>& nodes = octree.nodes();
+    const uint32_t* order = octree.order();
+    std::vector<float> pullX, pullY, pullZ, pullMass;
+    std::vector<uint32_t> stack;
+
+    for (size_t l = firstLeaf; l < lastLeaf; l++) {
+        const NBodyOctree::Node& group = nodes[octree.leaves()[l]];
+        pullX.clear(); pullY.clear(); pullZ.clear(); pullMass.clear();
+
+        stack.clear();
+        stack.push_back(0);
+        while (!stack.empty()) {
+            uint32_t index = stack.back();
+            const NBodyOctree::Node& node = nodes[index];
+            stack.pop_back();
+            if (node.mass == 0.0f) {
+                continue;
+            }
+
+            // Distance from the centre of mass to the nearest point of the leaf's bounds
+            float dx = std::max(std::max(group.minX - node.x, node.x - group.maxX), 0.0f);
+            float dy = std::max(std::max(group.minY - node.y, node.y - group.maxY), 0.0f);
+            float dz = std::max(std::max(group.minZ - node.z, node.z - group.maxZ), 0.0f);
+            if (dx * dx + dy * dy + dz * dz > openRadiiSquared[index]) {
+                pullX.push_back(node.x); pullY.push_back(node.y); pullZ.push_back(node.z); pullMass.push_back(node.mass);
+            } else if (node.numChildren == 0) {
+                gatherParticles(octree, node, pullX, pullY, pullZ, pullMass);
+            } else {
+                for (uint32_t i = node.firstChild; i < node.firstChild + node.numChildren; i++) {
+                    stack.push_back(i);
+                }
+            }
+        }
+
+        sumPointMasses(octree.x() + group.first, octree.y() + group.first, octree.z() + group.first, group.last - group.first, pullX, pullY, pullZ,
+                       pullMass, softening, [&](uint32_t i, float x, float y, float z) {
+            uint32_t index = order[group.first + i];
+            ax[index] = x;
+            ay[index] = y;
+            az[index] = z;
+        });
+    }
+}
+
+const int FastMultipoleSolver::DEFAULT_ORDER = 6;
+const int FastMultipoleSolver::MIN_ORDER = 2;
+const int FastMultipoleSolver::MAX_ORDER = 20;
+const float FastMultipoleSolver::DEFAULT_OPENING_ANGLE = 0.5f;
+
+FastMultipoleSolver::FastMultipoleSolver(int expansionOrder, float angle, float softeningLength)
+    : order(std::max(MIN_ORDER, std::min(expansionOrder, MAX_ORDER))), openingAngle(angle), softening(std::max(softeningLength, 1e-9f)) {
+    numTerms = size_t(order) * (order + 1) / 2;
+}
+
+void FastMultipoleSolver::accelerations(const NBodyParticles& particles, float* ax, float* ay, float* az) {
+    octree.build(particles, FMM_LEAF_SIZE);
+    const std::vector<NBodyOctree::Node>& nodes = octree.nodes();
+    size_t numThreads = parallelThreadCount(particles.size());
+
+    // Radii of the nodes and the nodes by depth
+    radii.resize(nodes.size());
+    int maxLevel = 0;
+    for (size_t i = 0; i < nodes.size(); i++) {
+        const NBodyOctree::Node& node = nodes[i];
+        float dx = std::max(node.x - node.minX, node.maxX - node.x);
+        float dy = std::max(node.y - node.minY, node.maxY - node.y);
+        float dz = std::max(node.z - node.minZ, node.maxZ - node.z);
+        radii[i] = std::sqrt(dx * dx + dy * dy + dz * dz);
+        maxLevel = std::max(maxLevel, node.level);
+    }
+    levelStarts.assign(maxLevel + 2, 0);
+    for (const NBodyOctree::Node& node : nodes) {
+        levelStarts[node.level + 1]++;
+    }
+    for (size_t l = 1; l < levelStarts.size(); l++) {
+        levelStarts[l] += levelStarts[l - 1];
+    }
+    levelNodes.resize(nodes.size());
+    std::vector<uint32_t> fill(levelStarts.begin(), levelStarts.end() - 1);
+    for (uint32_t i = 0; i < nodes.size(); i++) {
+        levelNodes[fill[nodes[i].level]++] = i;
+    }
+
+    multipoles.assign(nodes.size() * numTerms, Complex(0.0));
+    locals.assign(nodes.size() * numTerms, Complex(0.0));
+    upwardPass();
+
+    // The targets are split into subtrees of similar size, each taking its interactions with the whole tree on one
+    // thread: the far ones by translating multipole expansions to the local expansions of its cells, the near ones
+    // by direct summation. No two threads write to the same cell or particle
+    std::vector<uint32_t> subtrees, stack(1, 0);
+    size_t subtreeSize = std::max(particles.size() / (numThreads * SUBTREES_PER_THREAD), size_t(FMM_LEAF_SIZE));
+    while (!stack.empty()) {
+        const NBodyOctree::Node& node = nodes[stack.back()];
+        if (node.numChildren == 0 || node.last - node.first <= subtreeSize) {
+            subtrees.push_back(stack.back());
+            stack.pop_back();
+        } else {
+            stack.pop_back();
+            for (uint32_t i = node.firstChild; i < node.firstChild + node.numChildren; i++) {
+                stack.push_back(i);
+            }
+        }
+    }
+    nearX.assign(particles.size(), 0.0f);
+    nearY.assign(particles.size(), 0.0f);
+    nearZ.assign(particles.size(), 0.0f);
+    float theta = openingAngle.load();
+    parallelTasks(subtrees.size(), numThreads, [&](size_t task) {
+        std::vector<std::pair<uint32_t, uint32_t> > neighbours;
+        interact(subtrees[task], theta, neighbours);
+        nearField(neighbours);
+    });
+
+    downwardPass();
+    const std::vector<uint32_t>& leaves = octree.leaves();
+    size_t numTasks = (leaves.size() + LEAVES_PER_TASK - 1) / LEAVES_PER_TASK;
+    parallelTasks(numTasks, numThreads, [&](size_t task) {
+        for (size_t l = task * LEAVES_PER_TASK; l < std::min((task + 1) * LEAVES_PER_TASK, leaves.size()); l++) {
+            evaluateLeaf(leaves[l], ax, ay, az);
+        }
+    });
+}
+
+// Function to form the multipole expansions of the leaves from their particles, then those of the other nodes from
+// their children's, a level at a time from the deepest
+void FastMultipoleSolver::upwardPass() {
+    const std::vector<NBodyOctree::Node>& nodes = octree.nodes();
+    for (size_t level = levelStarts.size() - 1; level-- > 0;) {
+        size_t first = levelStarts[level], count = levelStarts[level + 1] - first;
+        size_t numTasks = (count + NODES_PER_TASK - 1) / NODES_PER_TASK;
+        parallelTasks(numTasks, parallelThreadCount(nodes[0].last), [&](size_t task) {
+            std::vector<Complex> ynm(order * order);
+            for (size_t k = task * NODES_PER_TASK; k < std::min((task + 1) * NODES_PER_TASK, count); k++) {
+                uint32_t index = levelNodes[first + k];
+                const NBodyOctree::Node& node = nodes[index];
+                Complex* multipole = &multipoles[index * numTerms];
+                double centerX, centerY, centerZ;
+                expansionCenter(node, centerX, centerY, centerZ);
+                if (node.numChildren == 0) {
+                    for (uint32_t i = node.first; i < node.last; i++) {
+                        if (octree.mass()[i] > 0.0f) {
+                            particleToMultipole(order, octree.mass()[i], octree.x()[i] - centerX, octree.y()[i] - centerY, octree.z()[i] - centerZ,
+                                                ynm.data(), multipole);
+                        }
+                    }
+                } else {
+                    for (uint32_t c = node.firstChild; c < node.firstChild + node.numChildren; c++) {
+                        double childX, childY, childZ;
+                        expansionCenter(nodes[c], childX, childY, childZ);
+                        multipoleToMultipole(order, &multipoles[c * numTerms], centerX - childX, centerY - childY, centerZ - childZ, ynm.data(), multipole);
+                    }
+                }
+            }
+        });
+    }
+}
+
+// Function to traverse the pairs of a target subtree and the whole tree. Pairs of cells far apart compared to their
+// radii interact through their expansions, pairs of leaves too near for that are collected as neighbours, and other
+// pairs are split at the larger cell
+void FastMultipoleSolver::interact(uint32_t target, float theta, std::vector<std::pair<uint32_t, uint32_t> >& neighbours) {
+    const std::vector<NBodyOctree::Node>& nodes = octree.nodes();
+    std::vector<Complex> ynm(order * order);
+    std::vector<std::pair<uint32_t, uint32_t> > stack(1, std::make_pair(target, 0u));
+    while (!stack.empty()) {
+        uint32_t i = stack.back().first, j = stack.back().second;
+        stack.pop_back();
+        const NBodyOctree::Node& a = nodes[i];
+        const NBodyOctree::Node& b = nodes[j];
+        if (b.mass == 0.0f) {
+            continue;
+        }
+
+        double targetX, targetY, targetZ, sourceX, sourceY, sourceZ;
+        expansionCenter(a, targetX, targetY, targetZ);
+        expansionCenter(b, sourceX, sourceY, sourceZ);
+        double dx = targetX - sourceX, dy = targetY - sourceY, dz = targetZ - sourceZ;
+        double reach = double(radii[i]) + radii[j];
+        if (reach * reach < double(theta) * theta * (dx * dx + dy * dy + dz * dz)) {
+            multipoleToLocal(order, &multipoles[j * numTerms], dx, dy, dz, ynm.data(), &locals[i * numTerms]);
+        } else if (a.numChildren == 0 && b.numChildren == 0) {
+            neighbours.push_back(std::make_pair(i, j));
+        } else if (b.numChildren == 0 || (a.numChildren > 0 && radii[i] >= radii[j])) {
+            for (uint32_t c = a.firstChild; c < a.firstChild + a.numChildren; c++) {
+                stack.push_back(std::make_pair(c, j));
+            }
+        } else {
+            for (uint32_t c = b.firstChild; c < b.firstChild + b.numChildren; c++) {
+                stack.push_back(std::make_pair(i, c));
+            }
+        }
+    }
+}
+
+// Function to sum the pulls of the neighbouring leaves' particles on each target leaf's particles
+void FastMultipoleSolver::nearField(std::vector<std::pair<uint32_t, uint32_t> >& neighbours) {
+    const std::vector<NBodyOctree::Node>& nodes = octree.nodes();
+    std::sort(neighbours.begin(), neighbours.end());
+    std::vector<float> pullX, pullY, pullZ, pullMass;
+    for (size_t k = 0; k < neighbours.size();) {
+        const NBodyOctree::Node& group = nodes[neighbours[k].first];
+        pullX.clear(); pullY.clear(); pullZ.clear(); pullMass.clear();
+        size_t end = k;
+        while (end < neighbours.size() && neighbours[end].first == neighbours[k].first) {
+            gatherParticles(octree, nodes[neighbours[end].second], pullX, pullY, pullZ, pullMass);
+            end++;
+        }
+        sumPointMasses(octree.x() + group.first, octree.y() + group.first, octree.z() + group.first, group.last - group.first, pullX, pullY, pullZ,
+                       pullMass, softening, [&](uint32_t i, float x, float y, float z) {
+            nearX[group.first + i] = x;
+            nearY[group.first + i] = y;
+            nearZ[group.first + i] = z;
+        });
+        k = end;
+    }
+}
+
+// Function to shift the local expansions down the tree, a level at a time from the root
+void FastMultipoleSolver::downwardPass() {
+    const std::vector<NBodyOctree::Node>& nodes = octree.nodes();
+    for (size_t level = 0; level + 1 < levelStarts.size(); level++) {
+        size_t first = levelStarts[level], count = levelStarts[level + 1] - first;
+        size_t numTasks = (count + NODES_PER_TASK - 1) / NODES_PER_TASK;
+        parallelTasks(numTasks, parallelThreadCount(nodes[0].last), [&](size_t task) {
+            std::vector<Complex> ynm(order * order);
+            for (size_t k = task * NODES_PER_TASK; k < std::min((task + 1) * NODES_PER_TASK, count); k++) {
+                uint32_t index = levelNodes[first + k];
+                const NBodyOctree::Node& node = nodes[index];
+                double centerX, centerY, centerZ;
+                expansionCenter(node, centerX, centerY, centerZ);
+                for (uint32_t c = node.firstChild; c < node.firstChild + node.numChildren; c++) {
+                    double childX, childY, childZ;
+                    expansionCenter(nodes[c], childX, childY, childZ);
+                    localToLocal(order, &locals[index * numTerms], childX - centerX, childY - centerY, childZ - centerZ, ynm.data(), &locals[c * numTerms]);
+                }
+            }
+        });
+    }
+}
+
+// Function to add the far field of a leaf's local expansion to the near field of its particles
+void FastMultipoleSolver::evaluateLeaf(uint32_t leaf, float* ax, float* ay, float* az) const {
+    const NBodyOctree::Node& node = octree.nodes()[leaf];
+    std::vector<Complex> ynm(order * order), ynmTheta(order * order);
+    double centerX, centerY, centerZ;
+    expansionCenter(node, centerX, centerY, centerZ);
+    for (uint32_t i = node.first; i < node.last; i++) {
+        double dx = octree.x()[i] - centerX, dy = octree.y()[i] - centerY, dz = octree.z()[i] - centerZ;
+        if (dx == 0.0 && dy == 0.0) {
+            dx = 1e-9 * node.size; // The expansion is smooth, but its spherical gradient is undefined on the axis
+        }
+        double acceleration[3];
+        localToParticle(order, &locals[leaf * numTerms], dx, dy, dz, ynm.data(), ynmTheta.data(), acceleration);
+        uint32_t index = octree.order()[i];
+        ax[index] = nearX[i] + float(acceleration[0]);
+        ay[index] = nearY[i] + float(acceleration[1]);
+        az[index] = nearZ[i] + float(acceleration[2]);
+    }
+}
+
+const double NBodySimulation::STEP = 0.5;
+
+NBodySimulation::NBodySimulation()
+    : time(0.0), stopping(false), targetDay(0.0), snapshotDay(0.0), snapshotReady(false), stepRate(0.0) {
+}
+
+NBodySimulation::~NBodySimulation() {
+    stop();
+}
+
+void NBodySimulation::start(const NBodyParticles& particles, double day, std::unique_ptr<GravitySolver> gravity) {
+    stop();
+
+    // Move to the barycentre, so the system does not drift out of view
+    state = particles;
+    double mass = 0.0, x = 0.0, y = 0.0, z = 0.0, vx = 0.0, vy = 0.0, vz = 0.0;
+    for (size_t i = 0; i < state.size(); i++) {
+        double m = state.mass[i];
+        mass += m;
+        x += m * state.x[i]; y += m * state.y[i]; z += m * state.z[i];
+        vx += m * state.vx[i]; vy += m * state.vy[i]; vz += m * state.vz[i];
+    }
+    if (mass > 0.0) {
+        for (size_t i = 0; i < state.size(); i++) {
+            state.x[i] -= float(x / mass); state.y[i] -= float(y / mass); state.z[i] -= float(z / mass);
+            state.vx[i] -= float(vx / mass); state.vy[i] -= float(vy / mass); state.vz[i] -= float(vz / mass);
+        }
+    }
+
+    ax.assign(state.size(), 0.0f);
+    ay.assign(state.size(), 0.0f);
+    az.assign(state.size(), 0.0f);
+    solver = std::move(gravity);
+    time = day;
+    targetDay = day;
+    stopping = false;
+    snapshotReady = false;
+    worker = std::thread(&NBodySimulation::run, this);
+}
+
+void NBodySimulation::stop() {
+    if (!worker.joinable()) {
+        return;
+    }
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        stopping = true;
+    }
+    wake.notify_one();
+    worker.join();
+}
+
+void NBodySimulation::setTargetDay(double day) {
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        targetDay = day;
+    }
+    wake.notify_one();
+}
+
+bool NBodySimulation::takeSnapshot(std::vector<MinorPlanetOrbit>& orbits, double& day) {
+    std::lock_guard<std::mutex> guard(lock);
+    if (!snapshotReady) {
+        return false;
+    }
+    orbits.swap(snapshot);
+    day = snapshotDay;
+    snapshotReady = false;
+    return true;
+}
+
+void NBodySimulation::run() {
+    const size_t count = state.size();
+    std::chrono::steady_clock::time_point lastSnapshot = std::chrono::steady_clock::now();
+    solver->accelerations(state, ax.data(), ay.data(), az.data());
+    publish();
+    bool published = true;
+
+    for (;;) {
+        int numSteps;
+        double stepLength; // Signed: the leapfrog is time-reversible, so a target in the past is integrated backwards
+        {
+            // Steps still unpublished when the worker catches up are published once the interval is over, so the
+            // last state shows while the clock is paused
+            std::unique_lock<std::mutex> guard(lock);
+            auto ready = [this] { return stopping || std::fabs(targetDay - time) >= STEP; };
+            std::chrono::steady_clock::time_point deadline = lastSnapshot + std::chrono::milliseconds(int(SNAPSHOT_INTERVAL * 1000.0));
+            if (!published && !wake.wait_until(guard, deadline, ready)) {
+                guard.unlock();
+                publish();
+                published = true;
+                lastSnapshot = std::chrono::steady_clock::now();
+                continue;
+            }
+            wake.wait(guard, ready);
+            if (stopping) {
+                return;
+            }
+            stepLength = targetDay >= time ? STEP : -STEP;
+            numSteps = int(std::min(std::fabs(targetDay - time) / STEP, double(MAX_BATCH_STEPS)));
+        }
+
+        // Kick half a step, drift a whole one, then kick the other half with the new forces
+        std::chrono::steady_clock::time_point batchStart = std::chrono::steady_clock::now();
+        const float halfStep = float(0.5 * stepLength), step = float(stepLength);
+        for (int s = 0; s < numSteps; s++) {
+            parallelFor(count, [&](size_t first, size_t last) {
+                for (size_t i = first; i < last; i++) {
+                    state.vx[i] += ax[i] * halfStep; state.vy[i] += ay[i] * halfStep; state.vz[i] += az[i] * halfStep;
+                    state.x[i] += state.vx[i] * step; state.y[i] += state.vy[i] * step; state.z[i] += state.vz[i] * step;
+                }
+            });
+            solver->accelerations(state, ax.data(), ay.data(), az.data());
+            parallelFor(count, [&](size_t first, size_t last) {
+                for (size_t i = first; i < last; i++) {
+                    state.vx[i] += ax[i] * halfStep; state.vy[i] += ay[i] * halfStep; state.vz[i] += az[i] * halfStep;
+                }
+            });
+            time += stepLength;
+
+            std::lock_guard<std::mutex> guard(lock);
+            if (stopping) {
+                return;
+            }
+        }
+
+        std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+        double seconds = std::chrono::duration<double>(now - batchStart).count();
+        if (seconds > 0.0) {
+            stepRate.store(double(count) * numSteps / seconds);
+        }
+
+        published = false;
+        if (std::chrono::duration<double>(now - lastSnapshot).count() >= SNAPSHOT_INTERVAL) {
+            publish();
+            published = true;
+            lastSnapshot = now;
+        }
+    }
+}
+
+void NBodySimulation::publish() {
+    size_t count = state.size();
+    std::vector<MinorPlanetOrbit> orbits(count > 0 ? count - 1 : 0);
+    double day = time;
+    parallelFor(orbits.size(), [&](size_t first, size_t last) {
+        for (size_t i = first; i < last; i++) {
+            double position[3] = { double(state.x[i + 1]) - state.x[0], double(state.y[i + 1]) - state.y[0], double(state.z[i + 1]) - state.z[0] };
+            double velocity[3] = { double(state.vx[i + 1]) - state.vx[0], double(state.vy[i + 1]) - state.vy[0], double(state.vz[i + 1]) - state.vz[0] };
+            orbits[i] = osculatingOrbit(position, velocity, day, double(state.mass[0]) + state.mass[i + 1]);
+        }
+    });
+
+    std::lock_guard<std::mutex> guard(lock);
+    snapshot.swap(orbits);
+    snapshotDay = day;
+    snapshotReady = true;
+}
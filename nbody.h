@@ -0,0 +1,228 @@
+// nbody.h - Self-gravitating N-body simulation with Barnes-Hut and fast multipole solvers
+//
+// Every particle attracts every other. The forces come from a GravitySolver. Both solvers sort
+// the particles along a Morton curve and build an adaptive octree over them in parallel every
+// step (NBodyOctree). BarnesHutSolver lets each leaf walk the tree once for all of its particles,
+// taking distant cells whole when their size seen from the leaf is below the opening angle, in
+// O(N log N). FastMultipoleSolver gives every cell multipole and local expansions of a chosen
+// order and translates between the expansions of pairs of well separated cells, spreading the
+// pairs over the CPU cores, in O(N). The interactions between nearby particles are summed for
+// SIMD_WIDTH of them per instruction (simd.h).
+//
+// NBodySimulation advances the particles with a kick-drift-kick leapfrog on a worker thread that
+// keeps up with the requested time, like BeltIntegrator, and publishes snapshots of the osculating
+// orbits of the particles around the first one, the central body, each under the pull of both
+// bodies' masses, for the renderer to propagate as Kepler orbits until the next one.
+//
+// Units are AU and days; masses are gravitational parameters GM (AU^3 / day^2).
+
+#ifndef NBODY_H
+#define NBODY_H
+
+#include "mpcorb.h"
+
+#include <atomic>
+#include <complex>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Particles as structure of arrays
+struct NBodyParticles {
+    std::vector<float> x, y, z;
+    std::vector<float> vx, vy, vz;
+    std::vector<float> mass; // GM
+
+    size_t size() const { return x.size(); }
+    void resize(size_t count);
+};
+
+// Interface of the force calculations
+class GravitySolver {
+public:
+    virtual ~GravitySolver() {}
+
+    // Function to get the acceleration of every particle due to all the others. The solver may keep state
+    // between calls, but is only ever called from one thread at a time
+    virtual void accelerations(const NBodyParticles& particles, float* ax, float* ay, float* az) = 0;
+
+    // Function to get the name shown for the solver
+    virtual const char* name() const = 0;
+
+    // Function to change the opening angle, the solver's trade of accuracy for speed, from any thread; it applies
+    // from the next step. 0 sums every pair directly
+    virtual void setOpeningAngle(float angle) = 0;
+    virtual float getOpeningAngle() const = 0;
+};
+
+// Octree over particles sorted along the Morton curve of their bounding cube. Cells are split until they hold at most
+// a leaf's worth of particles, so the tree is as deep as the particles are clustered
+class NBodyOctree {
+public:
+    struct Node {
+        float x, y, z, mass;       // Centre of mass and total mass
+        float minX, minY, minZ;    // Bounding box of the node's particles
+        float maxX, maxY, maxZ;
+        float centerX, centerY, centerZ, size; // Centre and edge of the node's cell
+        uint32_t firstChild;       // 0 for leaves; the root is never a child
+        uint32_t numChildren;
+        uint32_t first, last;      // Range of the node's particles in Morton order
+        int level;                 // Depth, 0 at the root
+    };
+
+    NBodyOctree();
+
+    // Function to sort the particles and build the tree over them, with at most leafSize particles per leaf
+    void build(const NBodyParticles& particles, uint32_t leafSize);
+
+    // Nodes, the root first; the children of a node are consecutive, and a node's particles too
+    const std::vector<Node>& nodes() const { return tree; }
+    const std::vector<uint32_t>& leaves() const { return leafNodes; } // Node indices of the leaves, in Morton order
+
+    // Particles in Morton order, padded by a whole SIMD register of massless ones, and the original index of each
+    const float* x() const { return sortedX.data(); }
+    const float* y() const { return sortedY.data(); }
+    const float* z() const { return sortedZ.data(); }
+    const float* mass() const { return sortedMass.data(); }
+    const uint32_t* order() const { return sortedOrder.data(); }
+
+private:
+    // Octree cell of a node: its depth and integer coordinates at that depth
+    struct Cell {
+        uint32_t node;
+        int level;
+        uint32_t x, y, z;
+    };
+
+    void sortParticles(const NBodyParticles& particles);
+    void buildNode(std::vector<Node>& nodes, const Cell& cell, int splitLevel, std::vector<Cell>* pending, std::vector<Cell>* deferred) const;
+    void finishNode(std::vector<Node>& nodes, const Cell& cell) const;
+
+    uint32_t leafSize;
+    std::vector<uint64_t> keys;
+    std::vector<uint32_t> sortedOrder;
+    std::vector<float> sortedX, sortedY, sortedZ, sortedMass;
+    float rootX, rootY, rootZ, rootSize; // Lower corner and edge of the root cell
+
+    std::vector<Node> tree;
+    std::vector<uint32_t> leafNodes;
+};
+
+class BarnesHutSolver : public GravitySolver {
+public:
+    // The opening angle trades accuracy for speed: cells are taken whole when their size over their distance is
+    // below it; 0 sums every pair directly. Forces are softened over the softening length (AU)
+    explicit BarnesHutSolver(float openingAngle = DEFAULT_OPENING_ANGLE, float softening = DEFAULT_SOFTENING);
+
+    void accelerations(const NBodyParticles& particles, float* ax, float* ay, float* az) override;
+    const char* name() const override { return "Barnes-Hut"; }
+
+    void setOpeningAngle(float angle) override { openingAngle.store(angle); }
+    float getOpeningAngle() const override { return openingAngle.load(); }
+
+    static const float DEFAULT_OPENING_ANGLE;
+    static const float DEFAULT_SOFTENING;
+
+private:
+    void walkLeaves(size_t firstLeaf, size_t lastLeaf, float* ax, float* ay, float* az) const;
+
+    std::atomic<float> openingAngle;
+    float softening;
+
+    NBodyOctree octree;
+    std::vector<float> openRadiiSquared; // Per node: particles nearer to its centre of mass than this open it
+};
+
+class FastMultipoleSolver : public GravitySolver {
+public:
+    // The expansions are truncated after the given order, and two cells interact through them when the sum of their
+    // radii over their distance is below the opening angle; raising the order or lowering the angle gains accuracy.
+    // Forces between nearby particles are softened over the softening length (AU)
+    explicit FastMultipoleSolver(int order = DEFAULT_ORDER, float openingAngle = DEFAULT_OPENING_ANGLE, float softening = BarnesHutSolver::DEFAULT_SOFTENING);
+
+    void accelerations(const NBodyParticles& particles, float* ax, float* ay, float* az) override;
+    const char* name() const override { return "FMM"; }
+
+    void setOpeningAngle(float angle) override { openingAngle.store(angle); }
+    float getOpeningAngle() const override { return openingAngle.load(); }
+    int getOrder() const { return order; }
+
+    static const int DEFAULT_ORDER;
+    static const int MIN_ORDER; // Below it the local expansions are constant and carry no force
+    static const int MAX_ORDER;
+    static const float DEFAULT_OPENING_ANGLE;
+
+private:
+    void upwardPass();
+    void interact(uint32_t target, float theta, std::vector<std::pair<uint32_t, uint32_t> >& neighbours);
+    void nearField(std::vector<std::pair<uint32_t, uint32_t> >& neighbours);
+    void downwardPass();
+    void evaluateLeaf(uint32_t leaf, float* ax, float* ay, float* az) const;
+
+    int order;
+    size_t numTerms; // Coefficients per expansion, order (order + 1) / 2
+    std::atomic<float> openingAngle;
+    float softening;
+
+    NBodyOctree octree;
+    std::vector<float> radii; // Per node: distance from its centre of mass to the farthest corner of its bounds
+    std::vector<uint32_t> levelNodes, levelStarts; // Node indices by depth
+    std::vector<std::complex<double> > multipoles, locals; // numTerms per node, about its centre of mass
+    std::vector<float> nearX, nearY, nearZ; // Near-field accelerations in Morton order
+};
+
+class NBodySimulation {
+public:
+    NBodySimulation();
+    ~NBodySimulation();
+
+    // Function to start simulating particles from a day; the first particle is the central body the snapshot
+    // orbits are taken around. The particles are moved to their barycentre first
+    void start(const NBodyParticles& particles, double day, std::unique_ptr<GravitySolver> solver);
+
+    // Function to stop the worker thread
+    void stop();
+
+    // Function to set the day the worker integrates towards, backwards if it is in the past
+    void setTargetDay(double day);
+
+    // Function to take the newest snapshot of the orbits of particles 1 and up around particle 0, if one was
+    // published since the last call
+    bool takeSnapshot(std::vector<MinorPlanetOrbit>& orbits, double& day);
+
+    bool running() const { return worker.joinable(); }
+    GravitySolver* gravitySolver() const { return solver.get(); }
+    double particleStepsPerSecond() const { return stepRate.load(); }
+
+    // Step length (days); about 1/180 of Mercury's period
+    static const double STEP;
+
+private:
+    NBodySimulation(const NBodySimulation&) = delete;
+    NBodySimulation& operator=(const NBodySimulation&) = delete;
+
+    void run();
+    void publish();
+
+    NBodyParticles state;
+    std::vector<float> ax, ay, az; // Accelerations at the current positions
+    std::unique_ptr<GravitySolver> solver;
+    double time; // Day the particle states are at
+
+    // Worker thread and its hand-off with the main thread
+    std::thread worker;
+    std::mutex lock;
+    std::condition_variable wake;
+    bool stopping;
+    double targetDay;
+    std::vector<MinorPlanetOrbit> snapshot;
+    double snapshotDay;
+    bool snapshotReady;
+    std::atomic<double> stepRate; // Particle steps per second over the last batch, all cores together
+};
+
+#endif // NBODY_H
@@ -0,0 +1,131 @@
+// parallel.cpp - Loops split across the CPU cores on a shared pool of worker threads
+
+#include "parallel.h"
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace {
+
+// Loop handed to the pool: its tasks are claimed one at a time by whichever threads take part
+struct ParallelJob {
+    const std::function<void(size_t task)>* function;
+    size_t count;
+    size_t maxHelpers;        // Pool workers allowed to take part besides the calling thread
+    std::atomic<size_t> next; // Next task to claim
+    size_t helpers;           // Pool workers taking part; guarded by the pool's lock
+};
+
+class ThreadPool {
+public:
+    ThreadPool() {
+        size_t numWorkers = std::max(std::thread::hardware_concurrency(), 1u) - 1;
+        for (size_t i = 0; i < numWorkers; i++) {
+            workers.push_back(std::thread(&ThreadPool::runWorker, this));
+        }
+    }
+
+    // Function to run a job's tasks on this thread and the workers that are free, returning once all are done
+    void run(ParallelJob& job) {
+        {
+            std::lock_guard<std::mutex> guard(lock);
+            jobs.push_back(&job);
+        }
+        wake.notify_all();
+        runTasks(job);
+
+        // Every task is claimed; wait for the workers still running theirs, and make sure no other picks the job up
+        std::unique_lock<std::mutex> guard(lock);
+        std::deque<ParallelJob*>::iterator queued = std::find(jobs.begin(), jobs.end(), &job);
+        if (queued != jobs.end()) {
+            jobs.erase(queued);
+        }
+        finished.wait(guard, [&job] { return job.helpers == 0; });
+    }
+
+private:
+    // Function to claim and run a job's tasks until none are left
+    static void runTasks(ParallelJob& job) {
+        for (size_t task = job.next++; task < job.count; task = job.next++) {
+            (*job.function)(task);
+        }
+    }
+
+    // Function to help with queued jobs for the rest of the run
+    void runWorker() {
+        std::unique_lock<std::mutex> guard(lock);
+        for (;;) {
+            wake.wait(guard, [this] { return !jobs.empty(); });
+            ParallelJob* job = jobs.front();
+            if (++job->helpers >= job->maxHelpers || job->next.load() >= job->count) {
+                jobs.pop_front(); // Full, or nothing left to claim
+            }
+            guard.unlock();
+            runTasks(*job);
+            guard.lock();
+            if (--job->helpers == 0) {
+                finished.notify_all();
+            }
+        }
+    }
+
+    std::vector<std::thread> workers;
+    std::mutex lock;
+    std::condition_variable wake;     // Signalled when a job is queued
+    std::condition_variable finished; // Signalled when the last helper leaves a job
+    std::deque<ParallelJob*> jobs;    // Jobs with tasks left to claim and room for more helpers
+};
+
+// Function to get the pool, started on first use. It is never destroyed: threads that outlive main(), such as the
+// simulation workers, may still be in a loop while static objects are torn down
+ThreadPool& threadPool() {
+    static ThreadPool* pool = new ThreadPool();
+    return *pool;
+}
+
+// Function to run tasks on up to numThreads threads, inline if there is only one
+void runTasks(size_t count, size_t numThreads, const std::function<void(size_t task)>& function) {
+    if (numThreads <= 1 || count <= 1) {
+        for (size_t task = 0; task < count; task++) {
+            function(task);
+        }
+        return;
+    }
+    ParallelJob job;
+    job.function = &function;
+    job.count = count;
+    job.maxHelpers = std::min(numThreads, count) - 1;
+    job.next = 0;
+    job.helpers = 0;
+    threadPool().run(job);
+}
+
+} // namespace
+
+size_t parallelThreadCount(size_t count) {
+    size_t numThreads = std::max(std::thread::hardware_concurrency(), 1u);
+    return std::min(numThreads, std::max(count / PARALLEL_MIN_ITEMS, size_t(1)));
+}
+
+size_t parallelRangeSize(size_t count, size_t alignment) {
+    size_t numThreads = parallelThreadCount(count);
+    size_t rangeSize = (count + numThreads - 1) / numThreads;
+    return std::max((rangeSize + alignment - 1) / alignment * alignment, alignment);
+}
+
+void parallelFor(size_t count, const std::function<void(size_t first, size_t last)>& function, size_t alignment) {
+    size_t rangeSize = parallelRangeSize(count, alignment);
+    size_t numRanges = (count + rangeSize - 1) / rangeSize;
+    runTasks(numRanges, numRanges, [&](size_t range) {
+        function(range * rangeSize, std::min((range + 1) * rangeSize, count));
+    });
+}
+
+void parallelTasks(size_t count, size_t numThreads, const std::function<void(size_t task)>& function) {
+    runTasks(count, numThreads, function);
+}
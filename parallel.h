@@ -0,0 +1,32 @@
+// parallel.h - Loops split across the CPU cores on a shared pool of worker threads
+//
+// The pool starts one worker per core but one on first use and keeps them for the rest of the
+// run, so a loop costs a hand-off rather than thread start-ups. The calling thread takes part in
+// its own loop and only waits for work other threads already took, so loops may be started from
+// several threads at once, or from inside one another, without running out of workers.
+
+#ifndef PARALLEL_H
+#define PARALLEL_H
+
+#include <cstddef>
+#include <functional>
+
+// Items below which a loop is not worth splitting further
+const size_t PARALLEL_MIN_ITEMS = 4096;
+
+// Function to get the number of threads a loop over count items is spread over
+size_t parallelThreadCount(size_t count);
+
+// Function to get the length of the ranges parallelFor() splits [0, count) into, a multiple of alignment
+size_t parallelRangeSize(size_t count, size_t alignment = 1);
+
+// Function to run a function over ranges of [0, count), split evenly across the cores. Every range but the last is
+// parallelRangeSize(count, alignment) long, so first / parallelRangeSize(count, alignment) numbers the ranges; an
+// alignment of SIMD_WIDTH keeps every range but the last in whole SIMD registers
+void parallelFor(size_t count, const std::function<void(size_t first, size_t last)>& function, size_t alignment = 1);
+
+// Function to run a function over tasks [0, count) on up to numThreads threads, each taking the next task as it
+// gets free, for work of uneven size
+void parallelTasks(size_t count, size_t numThreads, const std::function<void(size_t task)>& function);
+
+#endif // PARALLEL_H
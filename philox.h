@@ -0,0 +1,66 @@
+// philox.h - Philox4x32-10 counter-based random number generator
+//
+// Salmon, Moraes, Dror and Shaw, "Parallel Random Numbers: As Easy as 1, 2, 3" (SC11).
+// Every output block is a pure function of a 128-bit counter and a 64-bit key, so the
+// i-th random number of a stream can be computed directly, on any thread, in any order,
+// with the same bits on every platform. Matches the Random123 reference implementation.
+
+#ifndef PHILOX_H
+#define PHILOX_H
+
+#include <cstdint>
+
+// Counter and key of one Philox4x32 block
+struct PhiloxCounter {
+    uint32_t v[4];
+};
+
+struct PhiloxKey {
+    uint32_t v[2];
+};
+
+// Function to compute the Philox4x32-10 block for a counter and key
+inline PhiloxCounter philox4x32(PhiloxCounter counter, PhiloxKey key) {
+    const uint32_t M0 = 0xD2511F53u, M1 = 0xCD9E8D57u; // Round multipliers
+    const uint32_t W0 = 0x9E3779B9u, W1 = 0xBB67AE85u; // Key schedule (golden ratio, sqrt(3) - 1)
+
+    for (int round = 0; round < 10; round++) {
+        if (round > 0) {
+            key.v[0] += W0;
+            key.v[1] += W1;
+        }
+
+        uint64_t product0 = uint64_t(M0) * counter.v[0];
+        uint64_t product1 = uint64_t(M1) * counter.v[2];
+        PhiloxCounter next;
+        next.v[0] = uint32_t(product1 >> 32) ^ counter.v[1] ^ key.v[0];
+        next.v[1] = uint32_t(product1);
+        next.v[2] = uint32_t(product0 >> 32) ^ counter.v[3] ^ key.v[1];
+        next.v[3] = uint32_t(product0);
+        counter = next;
+    }
+    return counter;
+}
+
+// Function to turn 32 random bits into a float uniform in [0, 1); exact, so identical on every platform
+inline float philoxUniform(uint32_t bits) {
+    return float(bits >> 8) * (1.0f / 16777216.0f);
+}
+
+// Counter-based stream: element `index` of a stream gets its own blocks, numbered by `block`
+struct PhiloxStream {
+    PhiloxKey key;
+
+    PhiloxStream(uint32_t seed, uint32_t stream) {
+        key.v[0] = seed;
+        key.v[1] = stream;
+    }
+
+    // Function to get four random words for an element; use more blocks for more than four
+    PhiloxCounter block(uint64_t index, uint32_t block = 0) const {
+        PhiloxCounter counter = { { uint32_t(index), uint32_t(index >> 32), block, 0 } };
+        return philox4x32(counter, key);
+    }
+};
+
+#endif // PHILOX_H
@@ -0,0 +1,186 @@
+// simd.h - Portable packed-float type for the CPU physics kernels
+//
+// SimdFloat holds SIMD_WIDTH floats: 16 with AVX-512, 8 with AVX, 4 with SSE2 or NEON and 1 otherwise,
+// picked from the instruction set the compiler targets. Kernels written against it process SIMD_WIDTH
+// bodies per instruction and are compiled for the widest registers the build allows. SimdMask holds the
+// result of a per-lane comparison, for branch-free selects.
+
+#ifndef SIMD_H
+#define SIMD_H
+
+#if defined(__AVX512F__)
+#include <immintrin.h>
+#define SIMD_AVX512
+#elif defined(__AVX__)
+#include <immintrin.h>
+#define SIMD_AVX
+#elif defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define SIMD_SSE
+#elif (defined(__aarch64__) && defined(__ARM_NEON)) || defined(_M_ARM64)
+#include <arm_neon.h>
+#define SIMD_NEON
+#else
+#include <cmath>
+#include <cstring>
+#endif
+
+// Besides arithmetic, every path provides:
+//   simdMin, simdMax     per-lane minimum and maximum
+//   simdLess(a, b)       mask of the lanes where a < b
+//   simdSelect(m, a, b)  a where the mask is set, b elsewhere
+//   simdAny(m)           whether any lane of the mask is set
+//   simdFloor            round down; exact for |x| < 2^31
+//   simdPow2(n)          2^n for whole numbers n in [-126, 127]
+//   simdLog2Estimate(x)  log2 of a positive normal x to within 0.09, exact at powers of two
+
+#if defined(SIMD_AVX512)
+
+const int SIMD_WIDTH = 16;
+struct SimdFloat {
+    __m512 v;
+    SimdFloat() {}
+    SimdFloat(__m512 value) : v(value) {}
+    SimdFloat(float value) : v(_mm512_set1_ps(value)) {}
+};
+struct SimdMask {
+    __mmask16 m;
+};
+inline SimdFloat simdLoad(const float* p) { return _mm512_loadu_ps(p); }
+inline void simdStore(float* p, SimdFloat a) { _mm512_storeu_ps(p, a.v); }
+inline SimdFloat operator+(SimdFloat a, SimdFloat b) { return _mm512_add_ps(a.v, b.v); }
+inline SimdFloat operator-(SimdFloat a, SimdFloat b) { return _mm512_sub_ps(a.v, b.v); }
+inline SimdFloat operator*(SimdFloat a, SimdFloat b) { return _mm512_mul_ps(a.v, b.v); }
+inline SimdFloat operator/(SimdFloat a, SimdFloat b) { return _mm512_div_ps(a.v, b.v); }
+inline SimdFloat simdSqrt(SimdFloat a) { return _mm512_sqrt_ps(a.v); }
+inline SimdFloat simdMin(SimdFloat a, SimdFloat b) { return _mm512_min_ps(a.v, b.v); }
+inline SimdFloat simdMax(SimdFloat a, SimdFloat b) { return _mm512_max_ps(a.v, b.v); }
+inline SimdMask simdLess(SimdFloat a, SimdFloat b) { SimdMask mask = { _mm512_cmp_ps_mask(a.v, b.v, _CMP_LT_OQ) }; return mask; }
+inline SimdFloat simdSelect(SimdMask mask, SimdFloat a, SimdFloat b) { return _mm512_mask_blend_ps(mask.m, b.v, a.v); }
+inline bool simdAny(SimdMask mask) { return mask.m != 0; }
+inline SimdFloat simdFloor(SimdFloat a) { return _mm512_roundscale_ps(a.v, _MM_FROUND_TO_NEG_INF | _MM_FROUND_NO_EXC); }
+inline SimdFloat simdPow2(SimdFloat n) { return _mm512_castsi512_ps(_mm512_cvtps_epi32(_mm512_mul_ps(_mm512_add_ps(n.v, _mm512_set1_ps(127.0f)), _mm512_set1_ps(8388608.0f)))); }
+inline SimdFloat simdLog2Estimate(SimdFloat a) { return _mm512_sub_ps(_mm512_mul_ps(_mm512_cvtepi32_ps(_mm512_castps_si512(a.v)), _mm512_set1_ps(1.0f / 8388608.0f)), _mm512_set1_ps(127.0f)); }
+
+#elif defined(SIMD_AVX)
+
+const int SIMD_WIDTH = 8;
+struct SimdFloat {
+    __m256 v;
+    SimdFloat() {}
+    SimdFloat(__m256 value) : v(value) {}
+    SimdFloat(float value) : v(_mm256_set1_ps(value)) {}
+};
+struct SimdMask {
+    __m256 m;
+};
+inline SimdFloat simdLoad(const float* p) { return _mm256_loadu_ps(p); }
+inline void simdStore(float* p, SimdFloat a) { _mm256_storeu_ps(p, a.v); }
+inline SimdFloat operator+(SimdFloat a, SimdFloat b) { return _mm256_add_ps(a.v, b.v); }
+inline SimdFloat operator-(SimdFloat a, SimdFloat b) { return _mm256_sub_ps(a.v, b.v); }
+inline SimdFloat operator*(SimdFloat a, SimdFloat b) { return _mm256_mul_ps(a.v, b.v); }
+inline SimdFloat operator/(SimdFloat a, SimdFloat b) { return _mm256_div_ps(a.v, b.v); }
+inline SimdFloat simdSqrt(SimdFloat a) { return _mm256_sqrt_ps(a.v); }
+inline SimdFloat simdMin(SimdFloat a, SimdFloat b) { return _mm256_min_ps(a.v, b.v); }
+inline SimdFloat simdMax(SimdFloat a, SimdFloat b) { return _mm256_max_ps(a.v, b.v); }
+inline SimdMask simdLess(SimdFloat a, SimdFloat b) { SimdMask mask = { _mm256_cmp_ps(a.v, b.v, _CMP_LT_OQ) }; return mask; }
+inline SimdFloat simdSelect(SimdMask mask, SimdFloat a, SimdFloat b) { return _mm256_blendv_ps(b.v, a.v, mask.m); }
+inline bool simdAny(SimdMask mask) { return _mm256_movemask_ps(mask.m) != 0; }
+inline SimdFloat simdFloor(SimdFloat a) { return _mm256_floor_ps(a.v); }
+inline SimdFloat simdPow2(SimdFloat n) { return _mm256_castsi256_ps(_mm256_cvtps_epi32(_mm256_mul_ps(_mm256_add_ps(n.v, _mm256_set1_ps(127.0f)), _mm256_set1_ps(8388608.0f)))); }
+inline SimdFloat simdLog2Estimate(SimdFloat a) { return _mm256_sub_ps(_mm256_mul_ps(_mm256_cvtepi32_ps(_mm256_castps_si256(a.v)), _mm256_set1_ps(1.0f / 8388608.0f)), _mm256_set1_ps(127.0f)); }
+
+#elif defined(SIMD_SSE)
+
+const int SIMD_WIDTH = 4;
+struct SimdFloat {
+    __m128 v;
+    SimdFloat() {}
+    SimdFloat(__m128 value) : v(value) {}
+    SimdFloat(float value) : v(_mm_set1_ps(value)) {}
+};
+struct SimdMask {
+    __m128 m;
+};
+inline SimdFloat simdLoad(const float* p) { return _mm_loadu_ps(p); }
+inline void simdStore(float* p, SimdFloat a) { _mm_storeu_ps(p, a.v); }
+inline SimdFloat operator+(SimdFloat a, SimdFloat b) { return _mm_add_ps(a.v, b.v); }
+inline SimdFloat operator-(SimdFloat a, SimdFloat b) { return _mm_sub_ps(a.v, b.v); }
+inline SimdFloat operator*(SimdFloat a, SimdFloat b) { return _mm_mul_ps(a.v, b.v); }
+inline SimdFloat operator/(SimdFloat a, SimdFloat b) { return _mm_div_ps(a.v, b.v); }
+inline SimdFloat simdSqrt(SimdFloat a) { return _mm_sqrt_ps(a.v); }
+inline SimdFloat simdMin(SimdFloat a, SimdFloat b) { return _mm_min_ps(a.v, b.v); }
+inline SimdFloat simdMax(SimdFloat a, SimdFloat b) { return _mm_max_ps(a.v, b.v); }
+inline SimdMask simdLess(SimdFloat a, SimdFloat b) { SimdMask mask = { _mm_cmplt_ps(a.v, b.v) }; return mask; }
+inline SimdFloat simdSelect(SimdMask mask, SimdFloat a, SimdFloat b) { return _mm_or_ps(_mm_and_ps(mask.m, a.v), _mm_andnot_ps(mask.m, b.v)); }
+inline bool simdAny(SimdMask mask) { return _mm_movemask_ps(mask.m) != 0; }
+inline SimdFloat simdFloor(SimdFloat a) {
+    // SSE2 has no floor: truncate, then step down where truncation rounded a negative value up
+    __m128 truncated = _mm_cvtepi32_ps(_mm_cvttps_epi32(a.v));
+    return _mm_sub_ps(truncated, _mm_and_ps(_mm_cmpgt_ps(truncated, a.v), _mm_set1_ps(1.0f)));
+}
+inline SimdFloat simdPow2(SimdFloat n) { return _mm_castsi128_ps(_mm_cvtps_epi32(_mm_mul_ps(_mm_add_ps(n.v, _mm_set1_ps(127.0f)), _mm_set1_ps(8388608.0f)))); }
+inline SimdFloat simdLog2Estimate(SimdFloat a) { return _mm_sub_ps(_mm_mul_ps(_mm_cvtepi32_ps(_mm_castps_si128(a.v)), _mm_set1_ps(1.0f / 8388608.0f)), _mm_set1_ps(127.0f)); }
+
+#elif defined(SIMD_NEON)
+
+const int SIMD_WIDTH = 4;
+struct SimdFloat {
+    float32x4_t v;
+    SimdFloat() {}
+    SimdFloat(float32x4_t value) : v(value) {}
+    SimdFloat(float value) : v(vdupq_n_f32(value)) {}
+};
+struct SimdMask {
+    uint32x4_t m;
+};
+inline SimdFloat simdLoad(const float* p) { return vld1q_f32(p); }
+inline void simdStore(float* p, SimdFloat a) { vst1q_f32(p, a.v); }
+inline SimdFloat operator+(SimdFloat a, SimdFloat b) { return vaddq_f32(a.v, b.v); }
+inline SimdFloat operator-(SimdFloat a, SimdFloat b) { return vsubq_f32(a.v, b.v); }
+inline SimdFloat operator*(SimdFloat a, SimdFloat b) { return vmulq_f32(a.v, b.v); }
+inline SimdFloat operator/(SimdFloat a, SimdFloat b) { return vdivq_f32(a.v, b.v); }
+inline SimdFloat simdSqrt(SimdFloat a) { return vsqrtq_f32(a.v); }
+inline SimdFloat simdMin(SimdFloat a, SimdFloat b) { return vminq_f32(a.v, b.v); }
+inline SimdFloat simdMax(SimdFloat a, SimdFloat b) { return vmaxq_f32(a.v, b.v); }
+inline SimdMask simdLess(SimdFloat a, SimdFloat b) { SimdMask mask = { vcltq_f32(a.v, b.v) }; return mask; }
+inline SimdFloat simdSelect(SimdMask mask, SimdFloat a, SimdFloat b) { return vbslq_f32(mask.m, a.v, b.v); }
+inline bool simdAny(SimdMask mask) { return vmaxvq_u32(mask.m) != 0; }
+inline SimdFloat simdFloor(SimdFloat a) { return vrndmq_f32(a.v); }
+inline SimdFloat simdPow2(SimdFloat n) { return vreinterpretq_f32_s32(vcvtq_s32_f32(vmulq_f32(vaddq_f32(n.v, vdupq_n_f32(127.0f)), vdupq_n_f32(8388608.0f)))); }
+inline SimdFloat simdLog2Estimate(SimdFloat a) { return vsubq_f32(vmulq_f32(vcvtq_f32_s32(vreinterpretq_s32_f32(a.v)), vdupq_n_f32(1.0f / 8388608.0f)), vdupq_n_f32(127.0f)); }
+
+#else
+
+const int SIMD_WIDTH = 1;
+struct SimdFloat {
+    float v;
+    SimdFloat() {}
+    SimdFloat(float value) : v(value) {}
+};
+struct SimdMask {
+    bool m;
+};
+inline SimdFloat simdLoad(const float* p) { return *p; }
+inline void simdStore(float* p, SimdFloat a) { *p = a.v; }
+inline SimdFloat operator+(SimdFloat a, SimdFloat b) { return a.v + b.v; }
+inline SimdFloat operator-(SimdFloat a, SimdFloat b) { return a.v - b.v; }
+inline SimdFloat operator*(SimdFloat a, SimdFloat b) { return a.v * b.v; }
+inline SimdFloat operator/(SimdFloat a, SimdFloat b) { return a.v / b.v; }
+inline SimdFloat simdSqrt(SimdFloat a) { return std::sqrt(a.v); }
+inline SimdFloat simdMin(SimdFloat a, SimdFloat b) { return a.v < b.v ? a.v : b.v; }
+inline SimdFloat simdMax(SimdFloat a, SimdFloat b) { return a.v > b.v ? a.v : b.v; }
+inline SimdMask simdLess(SimdFloat a, SimdFloat b) { SimdMask mask = { a.v < b.v }; return mask; }
+inline SimdFloat simdSelect(SimdMask mask, SimdFloat a, SimdFloat b) { return mask.m ? a : b; }
+inline bool simdAny(SimdMask mask) { return mask.m; }
+inline SimdFloat simdFloor(SimdFloat a) { return std::floor(a.v); }
+inline SimdFloat simdPow2(SimdFloat n) { return std::ldexp(1.0f, int(n.v)); }
+inline SimdFloat simdLog2Estimate(SimdFloat a) {
+    int bits;
+    std::memcpy(&bits, &a.v, sizeof(bits));
+    return float(bits) * (1.0f / 8388608.0f) - 127.0f;
+}
+
+#endif
+
+#endif // SIMD_H
@@ -0,0 +1,133 @@
+// simulation_clock.cpp - Simulation time in days since J2000.0, driven by real time and a warp factor
+
+#include "simulation_clock.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <ctime>
+
+namespace {
+
+const double J2000_UNIX_DAY = 10957.5; // 2000-01-01 12:00 UTC in days since 1970-01-01; TT and UTC differ by about a minute
+
+// Function to get a monotonic real time in seconds
+double realSeconds() {
+    return std::chrono::duration<double>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+// Function to get the proleptic Gregorian date of a day since 1970-01-01, the inverse of daysFromCivil()
+void civilFromDays(long days, long& year, unsigned& month, unsigned& dayOfMonth) {
+    days += 719468;
+    long era = (days >= 0 ? days : days - 146096) / 146097;
+    unsigned dayOfEra = static_cast<unsigned>(days - era * 146097);
+    unsigned yearOfEra = (dayOfEra - dayOfEra / 1460 + dayOfEra / 36524 - dayOfEra / 146096) / 365;
+    unsigned dayOfYear = dayOfEra - (365 * yearOfEra + yearOfEra / 4 - yearOfEra / 100);
+    unsigned monthIndex = (5 * dayOfYear + 2) / 153; // March is 0
+    dayOfMonth = dayOfYear - (153 * monthIndex + 2) / 5 + 1;
+    month = monthIndex < 10 ? monthIndex + 3 : monthIndex - 9;
+    year = long(yearOfEra) + era * 400 + (month <= 2);
+}
+
+// Function to get the number of days in a month of a proleptic Gregorian year
+unsigned daysInMonth(long year, unsigned month) {
+    static const unsigned DAYS[12] = { 31, 28, 31, 30, 31, 30, 31, 31, 30, 31, 30, 31 };
+    bool leap = year % 4 == 0 && (year % 100 != 0 || year % 400 == 0);
+    return month == 2 && leap ? 29 : DAYS[month - 1];
+}
+
+} // namespace
+
+long daysFromCivil(long year, unsigned month, unsigned dayOfMonth) {
+    year -= month <= 2;
+    long era = (year >= 0 ? year : year - 399) / 400;
+    unsigned yearOfEra = static_cast<unsigned>(year - era * 400);
+    unsigned dayOfYear = (153 * (month + (month > 2 ? -3 : 9)) + 2) / 5 + dayOfMonth - 1;
+    unsigned dayOfEra = yearOfEra * 365 + yearOfEra / 4 - yearOfEra / 100 + dayOfYear;
+    return era * 146097 + long(dayOfEra) - 719468;
+}
+
+const double SimulationClock::MIN_WARP = 1.0;
+const double SimulationClock::MAX_WARP = 1e7;
+const double SimulationClock::SECONDS_PER_DAY = 86400.0;
+
+SimulationClock::SimulationClock()
+    : anchorSeconds(realSeconds()), anchorDay(0.0), currentDay(0.0), warpFactor(MIN_WARP), isPaused(false) {
+}
+
+void SimulationClock::tick() {
+    std::lock_guard<std::mutex> guard(lock);
+    currentDay = dayAt(realSeconds());
+}
+
+double SimulationClock::now() const {
+    std::lock_guard<std::mutex> guard(lock);
+    return dayAt(realSeconds());
+}
+
+double SimulationClock::warp() const {
+    std::lock_guard<std::mutex> guard(lock);
+    return warpFactor;
+}
+
+bool SimulationClock::paused() const {
+    std::lock_guard<std::mutex> guard(lock);
+    return isPaused;
+}
+
+double SimulationClock::dayAt(double seconds) const {
+    if (isPaused) {
+        return anchorDay;
+    }
+    return anchorDay + (seconds - anchorSeconds) * warpFactor / SECONDS_PER_DAY;
+}
+
+void SimulationClock::anchor() {
+    double seconds = realSeconds();
+    anchorDay = currentDay = dayAt(seconds);
+    anchorSeconds = seconds;
+}
+
+void SimulationClock::setDay(double day) {
+    std::lock_guard<std::mutex> guard(lock);
+    anchor();
+    anchorDay = currentDay = day;
+}
+
+void SimulationClock::setWarp(double warp) {
+    std::lock_guard<std::mutex> guard(lock);
+    anchor();
+    warpFactor = std::min(std::max(warp, MIN_WARP), MAX_WARP);
+}
+
+void SimulationClock::setPaused(bool paused) {
+    std::lock_guard<std::mutex> guard(lock);
+    anchor();
+    isPaused = paused;
+}
+
+std::string formatDate(double day) {
+    long year;
+    unsigned month, dayOfMonth;
+    civilFromDays(long(std::floor(day + J2000_UNIX_DAY)), year, month, dayOfMonth);
+    char text[32];
+    snprintf(text, sizeof(text), "%04ld-%02u-%02u", year, month, dayOfMonth);
+    return text;
+}
+
+bool parseDate(const std::string& text, double& day) {
+    long year;
+    unsigned month, dayOfMonth;
+    char end;
+    if (sscanf(text.c_str(), "%ld-%u-%u%c", &year, &month, &dayOfMonth, &end) != 3 ||
+        month < 1 || month > 12 || dayOfMonth < 1 || dayOfMonth > daysInMonth(year, month)) {
+        return false;
+    }
+    day = double(daysFromCivil(year, month, dayOfMonth)) - J2000_UNIX_DAY;
+    return true;
+}
+
+double todayDay() {
+    return double(std::time(NULL)) / SimulationClock::SECONDS_PER_DAY - J2000_UNIX_DAY;
+}
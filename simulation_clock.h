@@ -0,0 +1,78 @@
+// simulation_clock.h - Simulation time in days since J2000.0, driven by real time and a warp factor
+//
+// The clock keeps the real time and simulation day of its last jump or rate change and derives
+// the current day from them, so the day is exact however many frames pass in between, and frame
+// drops or stalls never slow the simulation down. Everything that moves is evaluated from the
+// day, which makes a jump to any date as cheap as a normal frame.
+//
+// One thread drives the clock with tick() and the setters, and reads day(); now(), warp() and
+// paused() may be called from any thread.
+
+#ifndef SIMULATION_CLOCK_H
+#define SIMULATION_CLOCK_H
+
+#include <mutex>
+#include <string>
+
+class SimulationClock {
+public:
+    SimulationClock();
+
+    // Function to read the real time and move the simulation day on; the day only changes here, so every
+    // part of a frame sees the same time
+    void tick();
+
+    // Function to jump to a day
+    void setDay(double day);
+
+    // Function to set how many simulation seconds pass per real second, clamped to [MIN_WARP, MAX_WARP]
+    void setWarp(double warp);
+
+    // Function to stop or restart the simulation time
+    void setPaused(bool paused);
+
+    // Function to get the simulation day at the current real time, from any thread
+    double now() const;
+
+    double day() const { return currentDay; } // Day of the last tick
+    double warp() const;
+    bool paused() const;
+
+    static const double MIN_WARP; // Real time
+    static const double MAX_WARP;
+    static const double SECONDS_PER_DAY;
+
+private:
+    SimulationClock(const SimulationClock&) = delete;
+    SimulationClock& operator=(const SimulationClock&) = delete;
+
+    // Function to get the simulation day at a real time; the lock is held
+    double dayAt(double seconds) const;
+
+    // Function to re-anchor the clock at the current real time and day, before a jump or rate change; the lock is held
+    void anchor();
+
+    mutable std::mutex lock;
+
+    double anchorSeconds; // Real time (seconds) of the last jump or rate change
+    double anchorDay;     // Simulation day at anchorSeconds
+    double currentDay;    // Simulation day of the last tick
+    double warpFactor;
+    bool isPaused;
+};
+
+// Function to get the days from 1970-01-01 to a proleptic Gregorian date (H. Hinnant's days_from_civil); the day
+// of the month is not checked against the month's length
+long daysFromCivil(long year, unsigned month, unsigned dayOfMonth);
+
+// Function to format a day since J2000.0 as a UTC calendar date, "YYYY-MM-DD"
+std::string formatDate(double day);
+
+// Function to parse a UTC calendar date, "YYYY-MM-DD", to the day since J2000.0 at its midnight; false for days
+// the month does not have
+bool parseDate(const std::string& text, double& day);
+
+// Function to get the current date and time of the system as a day since J2000.0
+double todayDay();
+
+#endif // SIMULATION_CLOCK_H
@@ -8,6 +8,18 @@ Copyright (c) 2025 Artem Moroz
 #include <cstdlib>         // Include cstdlib for exit
 #include <vector>          // Include vector for dynamic arrays
 #include <string>          // Include string for moon names
+#include <map>             // Include map for the sphere mesh cache
+#include <unordered_map>   // Include unordered_map for the label lookup
+#include <algorithm>       // Include algorithm for fill
+#include <cstddef>         // Include cstddef for offsetof
+#include <cfloat>          // Include cfloat for FLT_MAX
+#include <thread>          // Include thread for parallel asteroid generation
+#include <mutex>           // Include mutex for merging per-thread asteroid ranges
+#include <functional>      // Include functional for the parallel asteroid passes
+#include <memory>          // Include memory for the belt shared with the workers
+#include <condition_variable> // Include condition_variable for waking the belt worker
+#include <deque>           // Include deque for the simulation thread's window of steps
+#include <chrono>          // Include chrono for the simulation thread's sleeps
 #include <iostream>
 
 #include <GL/glew.h>       // Include GLEW for OpenGL function loading
@@ -23,22 +35,56 @@ Copyright (c) 2025 Artem Moroz
 #include <SDL_opengl.h>
 
 #include "stb_easy_font.h"
+#include "philox.h"
+#include "mpcorb.h"
+#include "belt_integrator.h"
+#include "spatial_index.h"
+#include "simulation_clock.h"
+#include "triple_buffer.h"
+#include "kepler.h"
+#include "asteroid_elements.h"
+#include "nbody.h"
+#include "parallel.h"
 
 #ifdef main
 #undef main
 #endif /* main */
 
+#if defined(__SSE__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 1)
+#include <xmmintrin.h>     // Include SSE intrinsics for the batched frustum test
+#define SOLAR_SYSTEM_SSE
+#endif
+
 #ifndef M_PI
 #    define  M_PI  3.14159265358979323846
 #endif
 
 // Global variables for rotation angles
-std::vector<float> planetRotations = {0.0f, 0.0f, 0.0f, 0.0f, 0.0f, 0.0f, 0.0f, 0.0f, 0.0f}; // Rotations for each planet
-std::vector<float> planetOrbits = {0.0f, 0.0f, 0.0f, 0.0f, 0.0f, 0.0f, 0.0f, 0.0f, 0.0f};    // Orbits for each planet
+std::vector<float> planetRotations = {0.0f, 0.0f, 0.0f, 0.0f, 0.0f, 0.0f, 0.0f, 0.0f, 0.0f}; // Rotations for each planet, set from the clock by update()
+std::vector<float> planetOrbits = {0.0f, 0.0f, 0.0f, 0.0f, 0.0f, 0.0f, 0.0f, 0.0f, 0.0f};    // Orbits for each planet, set from the clock by update()
+std::vector<glm::vec3> planetPositions(9); // Positions on the planets' Kepler orbits, set from the clock by update()
 
 // Planet distances from the Sun (scaled down to fit the screen)
 std::vector<float> planetDistances = {2.0f, 3.0f, 4.0f, 5.0f, 6.5f, 8.0f, 9.5f, 11.0f, 12.5f};
 
+// Real semi-major axes of the planets (AU), used to place catalog orbits between the scaled planet distances
+std::vector<float> planetAxes = {0.387f, 0.723f, 1.0f, 1.524f, 5.203f, 9.537f, 19.19f, 30.07f, 39.48f};
+
+// Mean longitudes at J2000.0 (degrees) and sidereal periods (days) of the planets, so the scaled circular orbits
+// show each planet where it really is on any date
+std::vector<double> planetLongitudes = {252.250, 181.979, 100.464, 355.447, 34.396, 49.954, 313.238, 304.880, 238.929};
+std::vector<double> planetPeriods = {87.969, 224.701, 365.256, 686.980, 4332.59, 10759.22, 30688.5, 60182.0, 90560.0};
+
+// The rest of the J2000.0 elements of the planets (degrees, with the longitude of perihelion), giving their scaled
+// orbits their real shapes and tilts
+std::vector<double> planetEccentricities = {0.20564, 0.00678, 0.01671, 0.09339, 0.04839, 0.05386, 0.04726, 0.00859, 0.24883};
+std::vector<double> planetInclinations = {7.005, 3.395, 0.0, 1.850, 1.304, 2.486, 0.773, 1.770, 17.140};
+std::vector<double> planetAscendingNodes = {48.331, 76.680, 0.0, 49.560, 100.474, 113.662, 74.017, 131.784, 110.304};
+std::vector<double> planetPerihelia = {77.458, 131.602, 102.938, 336.056, 14.728, 92.599, 170.954, 44.965, 224.069};
+
+// Planet masses relative to the Sun's (Earth with the Moon), for the N-body mode
+std::vector<double> planetMasses = {1.0 / 6023600.0, 1.0 / 408523.71, 1.0 / 328900.56, 1.0 / 3098708.0, 1.0 / 1047.3486, 1.0 / 3497.898, 1.0 / 22902.98, 1.0 / 19412.24, 1.0 / 1.35e8};
+
 // Planet sizes (scaled down for visualization)
 std::vector<float> planetSizes = {0.1f, 0.15f, 0.2f, 0.15f, 0.4f, 0.35f, 0.3f, 0.3f, 0.05f}; // Reduced sizes
 
@@ -64,9 +110,10 @@ std::vector<std::string> planetNames = {
 struct Moon {
     float distance; // Distance from the planet
     float size;     // Size of the moon
-    float orbit;    // Current orbit angle
-    float speed;    // Orbit speed
+    float orbit;    // Current orbit angle, set from the clock by update()
+    float speed;    // Orbit speed (degrees per animation step, see ANIMATION_STEPS_PER_DAY)
     std::string name; // Name of the moon
+    int lod;        // Current sphere level of detail (LOD_POINT or a sphereLods index)
 };
 
 std::vector<std::vector<Moon>> planetMoons = {
@@ -81,20 +128,447 @@ std::vector<std::vector<Moon>> planetMoons = {
     { {0.1f, 0.02f, 0.0f, 1.2f, "Charon"} } // Pluto has 1 moon (Charon)
 };
 
-// Shader program IDs
-GLuint sunShaderProgram;
-GLuint saturnShaderProgram;
-GLuint asteroidShaderProgram;
+// Uniforms used by the shader programs; locations are resolved once at link time
+enum ShaderUniform {
+    UNIFORM_MODEL,       // Model matrix
+    UNIFORM_FOG_DENSITY, // Fog density for the asteroid belt
+    UNIFORM_LABEL_ANCHORS, // Texture buffer of label anchors
+    UNIFORM_ORBIT_SEGMENTS, // Number of vertices per orbit path
+    UNIFORM_DAYS,        // Simulation time in days for the asteroid propagation
+    UNIFORM_ROCK_VARIANTS, // Texture buffer of the rock mesh variants
+    UNIFORM_ROCK_VERTEX_COUNT, // Vertices per rock mesh variant
+    UNIFORM_ASTEROID_BANDS, // Quantization ranges of the asteroid bands
+    UNIFORM_DENSITY_WEIGHT, // Asteroids each density splat stands for
+    UNIFORM_DENSITY_TEXTURE, // Accumulated asteroid density
+    UNIFORM_COUNT
+};
+
+const char* shaderUniformNames[UNIFORM_COUNT] = {
+    "model",
+    "fogDensity",
+    "labelAnchors",
+    "orbitSegments",
+    "days",
+    "rockVariants",
+    "rockVertexCount",
+    "asteroidBands",
+    "densityWeight",
+    "densityTexture"
+};
+
+// Shader program with its cached uniform locations
+struct ShaderProgram {
+    GLuint id;                     // Program ID
+    GLint uniforms[UNIFORM_COUNT]; // Uniform locations, -1 if the program does not use the uniform
+};
+
+// Camera uniform block shared by every shader program (std140 layout)
+#define CAMERA_UNIFORM_BLOCK \
+    "layout(std140) uniform CameraBlock {\n" \
+    "    mat4 view;\n" \
+    "    mat4 projection;\n" \
+    "    mat4 viewProjection;\n" \
+    "    float time;\n" /* Time in seconds */ \
+    "    float viewportHeight;\n" /* Viewport height in pixels */ \
+    "};\n"
+
+// Diffuse lighting from the Sun at the world origin, shared by the mesh and impostor body shaders
+#define SUN_LIGHTING_FUNCTION \
+    "vec3 sunLighting(vec3 color, vec3 normal, vec3 toSun) {\n" \
+    "    return color * (0.25 + 0.75 * max(dot(normal, toSun), 0.0));\n" \
+    "}\n"
+
+// Position on an orbit from its elements (semi-major axis, eccentricity, inclination, ascending node),
+// argument of periapsis and eccentric anomaly, shared by the orbit paths and the asteroid propagation
+#define ORBIT_POSITION_FUNCTION \
+    "vec3 orbitPosition(vec4 elements, float periapsis, float E) {\n" \
+    "    float a = elements.x;\n" \
+    "    float e = elements.y;\n" \
+    "    vec2 p = vec2(a * (cos(E) - e), a * sqrt(1.0 - e * e) * sin(E));\n" /* Position in the orbital plane */ \
+    "    float cO = cos(elements.w), sO = sin(elements.w);\n" \
+    "    float ci = cos(elements.z), si = sin(elements.z);\n" \
+    "    float cw = cos(periapsis), sw = sin(periapsis);\n" \
+    "    vec3 P = vec3(cO * cw - sO * sw * ci, sO * cw + cO * sw * ci, sw * si);\n" /* Towards periapsis */ \
+    "    vec3 Q = vec3(-cO * sw - sO * cw * ci, -sO * sw + cO * cw * ci, cw * si);\n" /* 90 degrees ahead in the orbit */ \
+    "    vec3 r = P * p.x + Q * p.y;\n" /* Ecliptic coordinates */ \
+    "    return vec3(r.x, r.z, -r.y);\n" /* The ecliptic is the scene's XZ plane */ \
+    "}\n"
+
+// Newton iteration for the eccentric anomaly E of Kepler's equation M = E - e sin(E), for elliptic orbits
+#define SOLVE_KEPLER_FUNCTION \
+    "float solveKepler(float M, float e) {\n" \
+    "    M = mod(M, 6.28318530718);\n" \
+    "    float E = e < 0.8 ? M : 3.14159265359;\n" /* Starting guess that converges for every eccentricity */ \
+    "    for (int k = 0; k < 10; k++) {\n" \
+    "        float dE = (E - e * sin(E) - M) / (1.0 - e * cos(E));\n" \
+    "        E -= dE;\n" \
+    "        if (abs(dE) < 1e-6) break;\n" \
+    "    }\n" \
+    "    return E;\n" \
+    "}\n"
+
+// Per-asteroid size, orientation and tint, derived from its stable id so they survive culling and sorting
+#define ASTEROID_SHAPE_FUNCTIONS \
+    "uint asteroidHash(uint x) {\n" \
+    "    x ^= x >> 16; x *= 0x7feb352du;\n" \
+    "    x ^= x >> 15; x *= 0x846ca68bu;\n" \
+    "    return x ^ (x >> 16);\n" \
+    "}\n" \
+    "float asteroidRandom(uint id, uint k) {\n" /* Uniform in [0, 1) */ \
+    "    return float(asteroidHash(id * 4u + k) >> 8) / 16777216.0;\n" \
+    "}\n" \
+    "float asteroidSize(uint id) {\n" /* Mostly small, a few large ones */ \
+    "    float u = asteroidRandom(id, 0u);\n" \
+    "    return 0.002 + 0.008 * u * u * u;\n" \
+    "}\n" \
+    "vec3 asteroidColor(uint id) {\n" \
+    "    return vec3(0.55, 0.5, 0.45) * (0.7 + 0.3 * asteroidRandom(id, 1u));\n" \
+    "}\n" \
+    "mat3 asteroidRotation(uint id, float time) {\n" /* Random axis, tumbling slowly */ \
+    "    float z = asteroidRandom(id, 2u) * 2.0 - 1.0;\n" \
+    "    float azimuth = asteroidRandom(id, 3u) * 6.28318530718;\n" \
+    "    vec3 k = vec3(sqrt(1.0 - z * z) * vec2(cos(azimuth), sin(azimuth)), z);\n" \
+    "    float angle = azimuth + time * (0.5 + z);\n" \
+    "    mat3 K = mat3(0.0, k.z, -k.y, -k.z, 0.0, k.x, k.y, -k.x, 0.0);\n" \
+    "    return mat3(1.0) + sin(angle) * K + (1.0 - cos(angle)) * K * K;\n" /* Rodrigues' formula */ \
+    "}\n"
+
+// Decoding of the 16-bit packed asteroid elements, matching unpackAsteroid() on the CPU; needs ASTEROID_SHAPE_FUNCTIONS
+#define UNPACK_ASTEROID_FUNCTION \
+    "uniform vec4 asteroidBands[32];\n" /* ASTEROID_SECTOR_BANDS: min axis, axis step, min mean motion, mean motion step */ \
+    "void unpackAsteroid(uvec4 words, out vec4 shape, out vec4 phase) {\n" \
+    "    const float angleStep = 6.28318530718 / 65536.0;\n" \
+    "    uvec4 low = words & 0xFFFFu;\n" \
+    "    uvec4 high = words >> 16;\n" \
+    "    vec4 band = asteroidBands[high.w & 31u];\n" \
+    "    shape = vec4(band.x + band.y * float(low.x), float(high.x) / 65536.0, float(low.y) * (0.5 * angleStep), float(high.y) * angleStep);\n" \
+    "    phase = vec4(float(low.z) * angleStep, float(high.z) * angleStep, band.z + band.w * float(low.w), float(high.w >> 5));\n" \
+    "}\n"
+
+// CPU mirror of the std140 camera uniform block
+struct CameraUniforms {
+    glm::mat4 view;
+    glm::mat4 projection;
+    glm::mat4 viewProjection;
+    float time;
+    float viewportHeight;
+    float padding[2]; // Round the block up to a vec4 boundary
+};
+
+const GLuint CAMERA_UNIFORM_BINDING = 0; // Binding point of the camera uniform block
+GLuint cameraUBO; // Uniform buffer holding the camera block, updated once per frame
+
+// Shader programs
+ShaderProgram sunShader;
+ShaderProgram saturnShader;
+ShaderProgram asteroidShader;
+ShaderProgram bodyShader;
+ShaderProgram impostorShader;
+ShaderProgram labelShader;
+ShaderProgram orbitShader;
+ShaderProgram asteroidPropagateShader; // Compute shader, or transform feedback vertex shader without GL 4.3
+ShaderProgram rockShader;
+ShaderProgram asteroidSpriteShader;
+ShaderProgram asteroidSplatShader;
+ShaderProgram asteroidResolveShader;
+
+// Asteroid belt data; the packed elements themselves are in asteroidBelt
+GLuint asteroidElementVBO; // Elements, read by the propagation shader
+GLuint asteroidUploadVBO; // Elements of the next sort, uploaded over several frames, then swapped with asteroidElementVBO
+GLuint asteroidVBO; // Positions (xyz) and ids (w) written by the propagation shader every frame
+GLuint asteroidVAO; // Draws the positions
+GLuint asteroidPropagateVAO; // Feeds the elements to the transform feedback fallback
+GLuint numAsteroids = 1000; // Number of asteroids, set with --asteroids on the command line
+bool asteroidComputeShaders = false; // GL 4.3 compute shaders available, otherwise transform feedback is used
+const GLuint ASTEROID_WORKGROUP_SIZE = 256; // Local size of the propagation compute shader
+const GLuint ASTEROID_ELEMENT_BINDING = 0; // Shader storage binding of the element buffer
+const GLuint ASTEROID_POSITION_BINDING = 1; // Shader storage binding of the position buffer
+const GLuint ASTEROID_RANGE_BINDING = 2; // Shader storage binding of the visible sector ranges
+const float DAYS_PER_SECOND = 365.25f / 20.0f; // Default time warp: the animation runs an Earth year in about 20 seconds
+const double ANIMATION_STEPS_PER_DAY = 60.0 / DAYS_PER_SECOND; // Planet spins and moon orbits turn by fixed angles per step, 60 steps a second at the default warp
+const float PLANET_ROTATION_SPEED = 1.0f; // Degrees per animation step
+
+// Simulation time; every position is evaluated from its day, set with --date and --warp on the command line
+SimulationClock g_Clock;
+double g_dStartDay = 0.0;
+double g_dStartWarp = DAYS_PER_SECOND * SimulationClock::SECONDS_PER_DAY;
+
+// The planets and moons are simulated in fixed steps of simulation time and drawn interpolated between two
+// steps, so the simulation does not depend on the frame rate and steps can be longer than frames
+struct SceneState {
+    double day;                  // Day of the step
+    double planetOrbits[9];      // Degrees, not wrapped to 360
+    double planetRotations[9];
+    glm::vec3 planetPositions[9]; // On the planets' Kepler orbits
+    std::vector<double> moonOrbits; // Moons planet by planet
+};
+
+// The steps run on a simulation thread, which publishes the states of the steps around the clock's current day
+// through a lock-free triple buffer; the render thread takes the newest window and never waits for a step
+struct SceneSnapshot {
+    long long firstStep; // Step of states[0]; the day of step k is k * SIMULATION_STEP
+    std::vector<SceneState> states; // Consecutive steps
+};
+
+const double SIMULATION_STEP = 0.25; // Days per simulation step
+const double SIMULATION_WINDOW = 0.1; // Real seconds of steps kept on either side of the current day
+const long long MAX_SIMULATION_BACKLOG = 1024; // Longer gaps, such as jumps to another date, restart the simulation
+TripleBuffer<SceneSnapshot> sceneSnapshots;
+std::thread simulationThread;
+std::atomic<bool> simulationStopping(false);
+KeplerBatch planetKeplerOrbits; // Set up by init() before the simulation thread starts, read only after
+
+// Procedural generation is keyed by a seed, with one counter-based random stream per purpose, so asteroid i
+// is a pure function of (seed, i) and the belt is identical on every machine and thread count
+uint32_t g_nSeed = 0x501A5u; // Set with --seed on the command line
+
+// Numbered minor planets from the MPC catalog, replacing the generated belt when --mpcorb is given
+std::string g_sCatalogPath;
+MinorPlanetCatalog g_MinorPlanets;
+
+// With --perturbed the belt is integrated on the CPU under Jupiter's pull (and Saturn's with --saturn), and
+// the GPU propagates the osculating orbits of the latest snapshot
+bool g_bPerturbed = false;
+bool g_bPerturbSaturn = false;
+BeltIntegrator g_BeltIntegrator;
+std::vector<MinorPlanetOrbit> beltSnapshot; // Osculating orbits (AU) of the latest snapshot, until handed to the belt worker
+
+// With --nbody the Sun, the planets and every asteroid attract each other, with forces from a Barnes-Hut octree,
+// or from the fast multipole method with --fmm <order>. The asteroids share --disc-mass (solar masses) equally.
+// Snapshots come as with --perturbed; the planets follow the osculating orbits of theirs, while the moons keep
+// circling their planets as before
+bool g_bNBody = false;
+double g_dDiscMass = 1.2e-9; // About the mass of the main belt
+float g_fOpeningAngle = BarnesHutSolver::DEFAULT_OPENING_ANGLE; // Set with --theta, and [ and ] while running
+const float MAX_OPENING_ANGLE = 1.5f; // Past this the solvers' far fields are too coarse to be of use
+int g_nMultipoleOrder = 0; // Expansion order of the fast multipole solver; 0 for Barnes-Hut
+NBodySimulation g_NBody;
+std::vector<MinorPlanetOrbit> nbodySnapshot; // Osculating orbits (AU) of the planets, then the asteroids
+KeplerBatch nbodyPlanetOrbits; // Scene orbits of the planets from the latest snapshot
+double nbodyPlanetPeriods[9];  // Their periods (days), to reduce the time by before propagating
+const double GAUSSIAN_GRAVITY = 0.01720209895; // k, so that GM of the Sun is k^2 in AU^3 / day^2
+
+// Every planet, moon and asteroid in a spatial index, rebuilt on a worker thread as the scene moves, for
+// queries such as the body under the mouse cursor
+const uint32_t SPATIAL_BODY = 0x80000000u; // Id flag of planets and moons, numbered planets first; asteroid ids are their indices
+const double SPATIAL_REBUILD_INTERVAL = 0.1; // Seconds between rebuilds of the index
+SpatialIndex g_SpatialIndex;
+int g_nMouseX = -1, g_nMouseY = -1; // Mouse cursor in the window, -1 when outside
+std::string g_sHoverName; // Name of the body under the cursor, shown in the window title
+
+// Shared low-poly rock meshes for nearby asteroids: variants of a subdivided icosahedron with the same topology
+const int NUM_ROCK_VARIANTS = 4;
+GLuint rockVAO, rockIBO; // Per-instance asteroid positions and the shared triangle list
+GLuint rockVariantTBO, rockVariantTexture; // Vertices of every variant, fetched by gl_VertexID
+GLsizei rockVertexCount = 0; // Vertices per variant
+GLsizei rockIndexCount = 0;
+
+// Unit sphere mesh stored on the GPU, scaled to each body by its model matrix
+struct SphereMesh {
+    GLuint vao, vbo, ibo; // Vertex Array Object, Vertex Buffer Object, Index Buffer Object
+    GLuint instanceVBO;   // Per-instance buffer for the instanced body renderer
+    GLenum mode;          // Primitive type (GL_TRIANGLES, or GL_POINTS for the point fallback)
+    GLsizei indexCount;   // Number of indices
+};
+
+// Sphere meshes keyed by (slices, stacks), built on first use
+std::map<std::pair<int, int>, SphereMesh> sphereMeshCache;
+
+// Sphere level of detail ladder, from coarsest to finest, picked by projected screen radius
+struct SphereLod {
+    int slices, stacks; // Tessellation of the cached mesh, 0 for the ray-cast impostor
+    float minPixels;    // Smallest screen radius (pixels) this level is used for
+};
+
+const SphereLod sphereLods[] = {
+    {  0,  0,  1.5f }, // Ray-cast impostor quad, pixel-perfect for small and distant bodies
+    { 32, 24, 32.0f },
+    { 64, 48, 80.0f }
+};
+
+const int NUM_SPHERE_LODS = sizeof(sphereLods) / sizeof(sphereLods[0]);
+const int LOD_POINT = -1;          // Below the coarsest level bodies are drawn as points
+const int LOD_IMPOSTOR = 0;        // Level drawn as camera-facing quads that ray-cast the sphere
+const float LOD_HYSTERESIS = 0.2f; // Relative margin around each threshold to avoid popping
+
+std::vector<int> planetLods(9, 0); // Current level of detail of each planet
+int sunLod = NUM_SPHERE_LODS - 1;  // Current level of detail of the Sun
+
+// Per-instance data for the instanced planet and moon renderer
+struct BodyInstance {
+    glm::mat4 model; // Model matrix, including the body's radius
+    glm::vec4 color; // Body color (RGBA)
+};
+
+std::vector<BodyInstance> bodyInstances[NUM_SPHERE_LODS + 1]; // Bodies queued for this frame, per level of detail (LOD_POINT first)
+
+// Bounding spheres in structure-of-arrays layout, tested against the view frustum in batches
+struct SphereBatch {
+    std::vector<float> x, y, z, radius;
+
+    void clear() { x.clear(); y.clear(); z.clear(); radius.clear(); }
+    void add(const glm::vec3& center, float r) { x.push_back(center.x); y.push_back(center.y); z.push_back(center.z); radius.push_back(r); }
+    size_t size() const { return radius.size(); }
+};
+
+// Body gathered while walking the planet/moon hierarchy, drawn only if it survives culling
+struct BodyCandidate {
+    glm::mat4 model;         // Model matrix, including the body's radius
+    glm::vec3 color;         // Body color
+    int* lod;                // Persistent level of detail of the body
+    const std::string* name; // Name shown in the body's label
+};
+
+std::vector<BodyCandidate> bodyCandidates; // Bodies gathered this frame
+SphereBatch bodySpheres; // Bounding spheres of bodyCandidates
+
+// Asteroids are stored in sectors by orbit size (band) and mean longitude (slice). Differential rotation
+// spreads a slice over time, so its longitude bounds widen until the asteroids are sorted again
+struct AsteroidSector {
+    GLint first;                      // First asteroid of the sector in the element buffer
+    GLsizei count;                    // Number of asteroids in the sector
+    float minRadius, maxRadius;       // Bounds of the distance from the Sun
+    float maxHeight;                  // Bound of the distance from the ecliptic
+    float minLongitude, maxLongitude; // Mean longitude bounds at the last sort (radians)
+    float minMeanMotion, maxMeanMotion; // Mean motion bounds (radians per day)
+    float maxEccentricity;            // Largest eccentricity in the sector
+    float maxInclination;             // Largest inclination in the sector
+    float area;                       // Ecliptic area of the band and slice; the sectors' areas tile the belt
+};
+
+const int ASTEROID_SECTOR_SLICES = 64; // Longitude slices per band
+const float ASTEROID_POINTS_PER_PIXEL = 4.0f; // Points drawn per pixel the belt covers; more add nothing visible
+std::vector<AsteroidSector> asteroidSectors; // Sectors in element buffer order, band by band
+
+// Packed belt with the ranges it was packed in. A belt is never changed once built: new orbits build a new one, so
+// the workers reading a belt keep theirs for as long as they hold it
+struct AsteroidBelt : AsteroidBands {
+    std::vector<PackedAsteroidElements> elements; // Packed orbital elements, by asteroid index
+    KeplerBatch keplerOrbits; // The same orbits as decoded by the shaders, for propagation on the CPU
+    float maxSpeed;  // Fastest any asteroid moves (scene units per day), at perihelion
+    float maxHeight; // Farthest any asteroid gets from the ecliptic
+};
+
+std::shared_ptr<const AsteroidBelt> asteroidBelt; // Belt drawn and picked from
+float asteroidSectorDays = 0.0f; // Time of the last sort (days)
+float asteroidDriftRate = 0.0f; // Fastest widening of a sector's longitude range (radians per day)
+
+// Belt's elements sorted into sectors at a time, in element buffer order
+struct AsteroidSectorSort {
+    std::shared_ptr<const AsteroidBelt> belt;
+    std::vector<PackedAsteroidElements> elements; // The belt's elements in sector order
+    std::vector<AsteroidSector> sectors;
+    float days;      // Time of the sort
+    float driftRate; // Fastest widening of a sector's longitude range (radians per day)
+};
+
+// Sorts, and the packing of the integrators' snapshots into new belts, run on the belt worker thread. The render
+// thread uploads a finished sort into asteroidUploadVBO a slice per frame and swaps it in once complete, keeping on
+// drawing the previous one until then
+std::thread asteroidWorker;
+std::mutex asteroidWorkerLock;
+std::condition_variable asteroidWorkerWake;
+bool asteroidWorkerStopping = false;
+bool asteroidWorkerBusy = false; // Sorting
+std::shared_ptr<const AsteroidBelt> asteroidSortBelt; // Belt of the requested sort, null when none is waiting
+bool asteroidSnapshotRequested = false; // Snapshot orbits waiting to be packed, then sorted
+std::vector<MinorPlanetOrbit> asteroidSnapshotOrbits; // Orbits (AU) of the requested snapshot
+size_t asteroidSnapshotFirst = 0; // First asteroid of the snapshot orbits
+float asteroidSortDays = 0.0f; // Time of the requested sort
+std::unique_ptr<AsteroidSectorSort> asteroidSortResult; // Finished sort, waiting to be uploaded
+std::unique_ptr<AsteroidSectorSort> asteroidUpload; // Sort being uploaded, owned by the render thread
+size_t asteroidUploaded = 0; // Elements of asteroidUpload uploaded so far
+const size_t ASTEROID_UPLOAD_ELEMENTS = 512 * 1024; // Elements uploaded per frame, 8 MB
+SphereBatch asteroidSectorSpheres; // Bounding spheres of asteroidSectors this frame
+std::vector<unsigned char> asteroidSectorVisibility; // Frustum test result of each sector
+std::vector<GLuint> asteroidRanges; // First, count, output offset and padding of each drawn sector
+std::vector<GLint> asteroidRangeFirsts; // First asteroid of each drawn sector, for the transform feedback path
+std::vector<GLsizei> asteroidRangeCounts; // Asteroids drawn from each sector
+GLsizei numVisibleAsteroids = 0; // Asteroids propagated and drawn this frame
+
+// Drawn asteroids are packed by tier: rock meshes first, then sprites, then points, then density splats. A sector's
+// tier comes from the distance between the camera and its bounding sphere; distant sectors with more asteroids
+// than pixels are accumulated into a low-resolution density texture instead of being drawn as points
+enum AsteroidTier { ASTEROID_ROCKS, ASTEROID_SPRITES, ASTEROID_POINTS, ASTEROID_DENSITY, NUM_ASTEROID_TIERS };
+const float ASTEROID_ROCK_DISTANCE = 2.0f;   // Sectors closer than this are drawn as rock meshes
+const float ASTEROID_SPRITE_DISTANCE = 8.0f; // Sectors closer than this are drawn as lit sprites
+const int ASTEROID_DENSITY_DOWNSAMPLE = 2;   // Screen pixels per density texel along each axis
+const float ASTEROID_DENSITY_SAMPLES_PER_TEXEL = 8.0f; // Splats per density texel of the screen, shared by all sectors
+GLuint asteroidDensityFBO, asteroidDensityTexture; // Density render target, sized with the window
+GLuint asteroidResolveVAO; // Empty VAO for the full-screen resolve triangle
+int asteroidDensityWidth = 0, asteroidDensityHeight = 0;
+float asteroidDensityWeight = 1.0f; // Asteroids each density splat stands for this frame
+std::vector<float> asteroidSectorPixels; // Screen area of each visible sector's share of the belt this frame
+GLsizei numTierAsteroids[NUM_ASTEROID_TIERS]; // Asteroids drawn in each tier this frame
+std::vector<int> asteroidSectorTiers; // Tier of each visible sector this frame, -1 when culled
+GLuint asteroidRangeBuffer; // Shader storage copy of asteroidRanges
+
+// Prebuilt label geometry: a range of the shared label VBO, keyed by body name
+struct Label {
+    int index;     // Index of the label's anchor
+    GLint first;   // First vertex in the label VBO
+    GLsizei count; // Number of vertices
+};
+
+std::unordered_map<std::string, Label> labels;
+std::vector<glm::vec4> labelAnchors; // Per-label anchor: xyz = world position, w = scale (0 hides the label)
+GLuint labelVAO, labelVBO; // Glyph geometry of every label
+GLuint labelAnchorTBO, labelAnchorTexture; // Texture buffer holding this frame's anchors
+GLsizei numLabelVertices = 0;
+
+// Orbit path described by its Keplerian elements; the path itself is generated in the vertex shader
+struct OrbitPath {
+    float semiMajorAxis;       // Semi-major axis (scene units)
+    float eccentricity;        // Eccentricity, 0 for a circle
+    float inclination;         // Inclination to the ecliptic (radians)
+    float ascendingNode;       // Longitude of the ascending node (radians)
+    float argumentOfPeriapsis; // Argument of periapsis (radians)
+};
+
+const GLsizei ORBIT_SEGMENTS = 128; // Vertices per orbit path
+std::vector<OrbitPath> orbitPaths; // One entry per orbit
+std::vector<unsigned char> orbitVisibility; // Frustum test result of each orbit, used to detect changes
+GLsizei numVisibleOrbits = 0; // Orbits currently uploaded to orbitVBO
+GLuint orbitVAO, orbitVBO; // Per-orbit elements of the visible orbits, no per-vertex storage
+
+const GLsizei RING_SEGMENTS = 100; // Vertices of Saturn's ring loop
+GLuint ringVAO, ringVBO; // Unit circle in the XZ plane, scaled to the ring radius when drawn
+
+// Camera owned by the CPU; matrices are computed once per frame and passed down to the draw functions
+struct Camera {
+    glm::vec3 eye;             // Camera position in world space
+    glm::mat4 view;            // View matrix, rebuilt in display()
+    glm::mat4 projection;      // Projection matrix, rebuilt in reshape()
+    glm::mat4 viewProjection;  // projection * view
+    glm::vec4 frustumPlanes[6]; // Normalized frustum planes (xyz = inward normal, w = distance)
+    int width, height;         // Viewport size in pixels
+};
+
+
+// glm-based replacement for glPushMatrix/glPopMatrix; angles are in degrees like glRotatef
+class TransformStack {
+public:
+    TransformStack() : m_stack(1, glm::mat4(1.0f)) {}
+
+    void push() { m_stack.push_back(m_stack.back()); }
+    void pop() { m_stack.pop_back(); }
+    const glm::mat4& top() const { return m_stack.back(); }
 
-// Asteroid belt data
-std::vector<glm::vec3> asteroidPositions; // Positions of asteroids
-GLuint asteroidVAO, asteroidVBO, asteroidIBO; // Vertex Array Object, Vertex Buffer Object, Index Buffer Object
-GLuint numAsteroids = 1000; // Number of asteroids
-float asteroidBeltRotation = 0.0f; // Rotation angle for the asteroid belt
+    void translate(const glm::vec3& offset) { m_stack.back() = glm::translate(m_stack.back(), offset); }
+    void rotate(float angle, const glm::vec3& axis) { m_stack.back() = glm::rotate(m_stack.back(), glm::radians(angle), axis); }
+    void scale(const glm::vec3& factors) { m_stack.back() = glm::scale(m_stack.back(), factors); }
+
+private:
+    std::vector<glm::mat4> m_stack;
+};
+
+Camera g_Camera = {};
+int g_nFollowPlanet = -1; // Planet followed by the camera, -1 for the overview
 
 SDL_Window* g_Window = NULL;
 SDL_GLContext g_glContext = NULL;
 bool g_bQuit = false;
+bool g_bCoreProfile = true; // Core profile context unless --compatibility is given
 
 glm::mat4 createViewMatrix(glm::vec3 eye, glm::vec3 center, glm::vec3 up) {
     return glm::lookAt(eye, center, up);
@@ -136,14 +610,8 @@ GLuint loadShader(const char* source, GLenum type) {
     return shader;
 }
 
-// Function to create a shader program
-GLuint createShaderProgram(const char* vertexSource, const char* fragmentSource) {
-    GLuint vertexShader = loadShader(vertexSource, GL_VERTEX_SHADER);
-    GLuint fragmentShader = loadShader(fragmentSource, GL_FRAGMENT_SHADER);
-
-    GLuint program = glCreateProgram();
-    glAttachShader(program, vertexShader);
-    glAttachShader(program, fragmentShader);
+// Function to link a shader program and report linking errors
+void linkShaderProgram(GLuint program) {
     glLinkProgram(program);
 
     // Check for linking errors
@@ -154,54 +622,852 @@ GLuint createShaderProgram(const char* vertexSource, const char* fragmentSource)
         glGetProgramInfoLog(program, 512, NULL, infoLog);
         printf("Shader program linking error: %s\n", infoLog);
     }
+}
+
+// Function to create a shader program
+GLuint createShaderProgram(const char* vertexSource, const char* fragmentSource) {
+    GLuint vertexShader = loadShader(vertexSource, GL_VERTEX_SHADER);
+    GLuint fragmentShader = loadShader(fragmentSource, GL_FRAGMENT_SHADER);
+
+    GLuint program = glCreateProgram();
+    glAttachShader(program, vertexShader);
+    glAttachShader(program, fragmentShader);
+    linkShaderProgram(program);
 
     glDeleteShader(vertexShader);
     glDeleteShader(fragmentShader);
 
     return program;
 }
-void renderText(const char* text, int bigger, float x, float y, float z) {
+
+// Function to resolve a linked program's uniforms and the camera block once
+ShaderProgram resolveShaderProgram(GLuint id) {
+    ShaderProgram program;
+    program.id = id;
+
+    for (int i = 0; i < UNIFORM_COUNT; i++) {
+        program.uniforms[i] = glGetUniformLocation(program.id, shaderUniformNames[i]);
+    }
+
+    // Attach the shared camera block, if the program uses it
+    GLuint cameraBlockIndex = glGetUniformBlockIndex(program.id, "CameraBlock");
+    if (cameraBlockIndex != GL_INVALID_INDEX) {
+        glUniformBlockBinding(program.id, cameraBlockIndex, CAMERA_UNIFORM_BINDING);
+    }
+
+    return program;
+}
+
+// Function to create a shader program and resolve its uniforms and the camera block once
+ShaderProgram loadShaderProgram(const char* vertexSource, const char* fragmentSource) {
+    return resolveShaderProgram(createShaderProgram(vertexSource, fragmentSource));
+}
+
+// Function to create a compute shader program (GL 4.3)
+ShaderProgram loadComputeProgram(const char* computeSource) {
+    GLuint computeShader = loadShader(computeSource, GL_COMPUTE_SHADER);
+
+    GLuint program = glCreateProgram();
+    glAttachShader(program, computeShader);
+    linkShaderProgram(program);
+
+    glDeleteShader(computeShader);
+
+    return resolveShaderProgram(program);
+}
+
+// Function to create a vertex-only program whose output is captured with transform feedback
+ShaderProgram loadTransformFeedbackProgram(const char* vertexSource, const char* varying) {
+    GLuint vertexShader = loadShader(vertexSource, GL_VERTEX_SHADER);
+
+    GLuint program = glCreateProgram();
+    glAttachShader(program, vertexShader);
+    glTransformFeedbackVaryings(program, 1, &varying, GL_INTERLEAVED_ATTRIBS); // Must precede linking
+    linkShaderProgram(program);
+
+    glDeleteShader(vertexShader);
+
+    return resolveShaderProgram(program);
+}
+
+// Function to upload the camera block; called once per frame before any drawing
+void updateCameraUniforms(const Camera& camera, float time) {
+    CameraUniforms uniforms = {};
+    uniforms.view = camera.view;
+    uniforms.projection = camera.projection;
+    uniforms.viewProjection = camera.viewProjection;
+    uniforms.time = time;
+    uniforms.viewportHeight = static_cast<float>(camera.height);
+
+    glBindBuffer(GL_UNIFORM_BUFFER, cameraUBO);
+    glBufferSubData(GL_UNIFORM_BUFFER, 0, sizeof(CameraUniforms), &uniforms);
+    glBindBuffer(GL_UNIFORM_BUFFER, 0);
+}
+// Function to append a label's glyph geometry to the shared label vertex data
+void buildLabel(const std::string& name, int bigger, float x, float y, std::vector<glm::vec3>& vertices) {
     static char buffer[60000]; // ~300 chars
 
     // Generate vertex data for the text
-    int num_quads = stb_easy_font_print(0, 0, (char*)text, nullptr, buffer, sizeof(buffer));
+    int num_quads = stb_easy_font_print(0, 0, (char*)name.c_str(), nullptr, buffer, sizeof(buffer));
 
     // Apply scaling based on the 'bigger' parameter
     float scale = 0.1f + (bigger * 0.1f); // Increase size by 10% for each 'bigger' step
 
-    // Transform vertices to apply scaling
-    for (int i = 0; i < num_quads * 4; i++) {
-        float* v = (float*)(buffer + i * 16); // Each vertex is 16 bytes (4 floats: x, y, z, padding)
-        v[0] = x + v[0] * scale; // Scale x
-        v[1] = y - v[1] * scale; // Scale y
-        v[2] = z;                // Set z (depth)
+    // The label is drawn as one range of the shared buffer, its anchor is looked up by index
+    Label label;
+    label.index = static_cast<int>(labels.size());
+    label.first = static_cast<GLint>(vertices.size());
+
+    // Split each quad into two triangles; z carries the label index for the anchor lookup
+    static const int quadTriangles[6] = { 0, 1, 2, 0, 2, 3 };
+    for (int i = 0; i < num_quads; i++) {
+        for (int j = 0; j < 6; j++) {
+            float* v = (float*)(buffer + (i * 4 + quadTriangles[j]) * 16); // Each vertex is 16 bytes (4 floats: x, y, z, color)
+            vertices.push_back(glm::vec3(x + v[0] * scale, y - v[1] * scale, static_cast<float>(label.index)));
+        }
+    }
+
+    label.count = static_cast<GLsizei>(vertices.size()) - label.first;
+    labels[name] = label;
+}
+
+// Function to build the geometry of every planet and moon name once into one shared VBO
+void buildLabels() {
+    std::vector<glm::vec3> vertices;
+    for (int i = 0; i < 9; i++) {
+        buildLabel(planetNames[i], 1, 0.0f, planetSizes[i] + 1.0f, vertices); // Display name above the planet
+        for (const Moon& moon : planetMoons[i]) {
+            buildLabel(moon.name, 0, 0.0f, - (moon.size + 0.5f), vertices); // Display name below the moon
+        }
+    }
+    numLabelVertices = static_cast<GLsizei>(vertices.size());
+    labelAnchors.assign(labels.size(), glm::vec4(0.0f));
+
+    glGenVertexArrays(1, &labelVAO);
+    glGenBuffers(1, &labelVBO);
+
+    glBindVertexArray(labelVAO);
+    glBindBuffer(GL_ARRAY_BUFFER, labelVBO);
+    glBufferData(GL_ARRAY_BUFFER, vertices.size() * sizeof(glm::vec3), vertices.data(), GL_STATIC_DRAW);
+    glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(glm::vec3), (void*)0);
+    glEnableVertexAttribArray(0);
+    glBindVertexArray(0);
+
+    // Label anchors live in a texture buffer so the vertex shader can look them up by label index
+    glGenBuffers(1, &labelAnchorTBO);
+    glBindBuffer(GL_TEXTURE_BUFFER, labelAnchorTBO);
+    glBufferData(GL_TEXTURE_BUFFER, labelAnchors.size() * sizeof(glm::vec4), NULL, GL_STREAM_DRAW);
+    glBindBuffer(GL_TEXTURE_BUFFER, 0);
+
+    glGenTextures(1, &labelAnchorTexture);
+    glBindTexture(GL_TEXTURE_BUFFER, labelAnchorTexture);
+    glTexBuffer(GL_TEXTURE_BUFFER, GL_RGBA32F, labelAnchorTBO);
+    glBindTexture(GL_TEXTURE_BUFFER, 0);
+}
+
+// Function to show a label this frame, anchored at the body's world position
+void placeLabel(const std::string& name, const glm::vec3& position) {
+    std::unordered_map<std::string, Label>::const_iterator it = labels.find(name);
+    if (it != labels.end()) {
+        labelAnchors[it->second.index] = glm::vec4(position, 1.0f);
+    }
+}
+
+// Function to draw all labels placed this frame with a single call
+void drawLabels() {
+    glUseProgram(labelShader.id);
+
+    // Upload this frame's anchors, orphaning the previous contents
+    glBindBuffer(GL_TEXTURE_BUFFER, labelAnchorTBO);
+    glBufferData(GL_TEXTURE_BUFFER, labelAnchors.size() * sizeof(glm::vec4), labelAnchors.data(), GL_STREAM_DRAW);
+    glBindBuffer(GL_TEXTURE_BUFFER, 0);
+
+    glActiveTexture(GL_TEXTURE0);
+    glBindTexture(GL_TEXTURE_BUFFER, labelAnchorTexture);
+
+    // Labels that were not placed keep a zero scale and collapse to nothing
+    glBindVertexArray(labelVAO);
+    glDrawArrays(GL_TRIANGLES, 0, numLabelVertices);
+    glBindVertexArray(0);
+
+    glBindTexture(GL_TEXTURE_BUFFER, 0);
+    glUseProgram(0); // Unbind the shader program
+
+    std::fill(labelAnchors.begin(), labelAnchors.end(), glm::vec4(0.0f));
+}
+
+// Function to extract the normalized frustum planes from the camera's view-projection matrix
+void updateFrustumPlanes(Camera& camera) {
+    const glm::mat4& m = camera.viewProjection;
+    glm::vec4 row0(m[0][0], m[1][0], m[2][0], m[3][0]);
+    glm::vec4 row1(m[0][1], m[1][1], m[2][1], m[3][1]);
+    glm::vec4 row2(m[0][2], m[1][2], m[2][2], m[3][2]);
+    glm::vec4 row3(m[0][3], m[1][3], m[2][3], m[3][3]);
+
+    camera.frustumPlanes[0] = row3 + row0; // Left
+    camera.frustumPlanes[1] = row3 - row0; // Right
+    camera.frustumPlanes[2] = row3 + row1; // Bottom
+    camera.frustumPlanes[3] = row3 - row1; // Top
+    camera.frustumPlanes[4] = row3 + row2; // Near
+    camera.frustumPlanes[5] = row3 - row2; // Far
+
+    for (int i = 0; i < 6; i++) {
+        camera.frustumPlanes[i] *= 1.0f / glm::length(glm::vec3(camera.frustumPlanes[i]));
+    }
+}
+
+// Function to test one bounding sphere against the view frustum
+bool isSphereVisible(const Camera& camera, const glm::vec3& center, float radius) {
+    for (int i = 0; i < 6; i++) {
+        const glm::vec4& plane = camera.frustumPlanes[i];
+        if (plane.x * center.x + plane.y * center.y + plane.z * center.z + plane.w < -radius) {
+            return false;
+        }
+    }
+    return true;
+}
+
+// Function to test a batch of bounding spheres against the view frustum, four at a time with SSE
+void cullSphereBatch(const Camera& camera, const SphereBatch& batch, std::vector<unsigned char>& visible) {
+    size_t count = batch.size();
+    visible.resize(count);
+
+    size_t i = 0;
+#ifdef SOLAR_SYSTEM_SSE
+    __m128 planeX[6], planeY[6], planeZ[6], planeW[6];
+    for (int p = 0; p < 6; p++) {
+        planeX[p] = _mm_set1_ps(camera.frustumPlanes[p].x);
+        planeY[p] = _mm_set1_ps(camera.frustumPlanes[p].y);
+        planeZ[p] = _mm_set1_ps(camera.frustumPlanes[p].z);
+        planeW[p] = _mm_set1_ps(camera.frustumPlanes[p].w);
+    }
+
+    for (; i + 4 <= count; i += 4) {
+        __m128 x = _mm_loadu_ps(&batch.x[i]);
+        __m128 y = _mm_loadu_ps(&batch.y[i]);
+        __m128 z = _mm_loadu_ps(&batch.z[i]);
+        __m128 negativeRadius = _mm_sub_ps(_mm_setzero_ps(), _mm_loadu_ps(&batch.radius[i]));
+
+        // A sphere is visible if it is not entirely behind any of the six planes
+        __m128 inside = _mm_castsi128_ps(_mm_set1_epi32(-1));
+        for (int p = 0; p < 6; p++) {
+            __m128 distance = _mm_add_ps(_mm_add_ps(_mm_mul_ps(planeX[p], x), _mm_mul_ps(planeY[p], y)),
+                                         _mm_add_ps(_mm_mul_ps(planeZ[p], z), planeW[p]));
+            inside = _mm_and_ps(inside, _mm_cmpge_ps(distance, negativeRadius));
+        }
+
+        int mask = _mm_movemask_ps(inside);
+        visible[i + 0] = (mask >> 0) & 1;
+        visible[i + 1] = (mask >> 1) & 1;
+        visible[i + 2] = (mask >> 2) & 1;
+        visible[i + 3] = (mask >> 3) & 1;
+    }
+#endif
+
+    // Remaining spheres (or all of them without SSE)
+    for (; i < count; i++) {
+        visible[i] = isSphereVisible(camera, glm::vec3(batch.x[i], batch.y[i], batch.z[i]), batch.radius[i]);
+    }
+}
+
+// Function to draw every visible orbit path with one instanced call; the vertices are generated in the shader
+void drawOrbits(const Camera& camera) {
+    // An orbit is bounded by a sphere around the Sun reaching its apoapsis
+    static SphereBatch orbitSpheres;
+    orbitSpheres.clear();
+    for (size_t i = 0; i < orbitPaths.size(); i++) {
+        orbitSpheres.add(glm::vec3(0.0f), orbitPaths[i].semiMajorAxis * (1.0f + orbitPaths[i].eccentricity));
+    }
+
+    std::vector<unsigned char> visibility;
+    cullSphereBatch(camera, orbitSpheres, visibility);
+
+    // Re-upload the visible orbits only when the visible set changes
+    if (visibility != orbitVisibility) {
+        orbitVisibility.swap(visibility);
+
+        std::vector<OrbitPath> visibleOrbits;
+        for (size_t i = 0; i < orbitPaths.size(); i++) {
+            if (orbitVisibility[i]) {
+                visibleOrbits.push_back(orbitPaths[i]);
+            }
+        }
+
+        numVisibleOrbits = static_cast<GLsizei>(visibleOrbits.size());
+        glBindBuffer(GL_ARRAY_BUFFER, orbitVBO);
+        glBufferData(GL_ARRAY_BUFFER, visibleOrbits.size() * sizeof(OrbitPath), visibleOrbits.data(), GL_DYNAMIC_DRAW);
+        glBindBuffer(GL_ARRAY_BUFFER, 0);
+    }
+
+    if (numVisibleOrbits == 0) {
+        return;
+    }
+
+    glUseProgram(orbitShader.id);
+    glBindVertexArray(orbitVAO);
+    glDrawArraysInstanced(GL_LINE_LOOP, 0, ORBIT_SEGMENTS, numVisibleOrbits);
+    glBindVertexArray(0);
+    glUseProgram(0); // Unbind the shader program
+}
+
+// Function to build a packed belt from a source of full-precision orbits, in three parallel passes: the range
+// of semi-major axes, the range of mean motions in every band, then the packed elements. Only the packed
+// elements are ever resident
+std::shared_ptr<const AsteroidBelt> buildAsteroids(size_t count, const std::function<void(size_t index, AsteroidElements& elements)>& source) {
+    std::shared_ptr<AsteroidBelt> belt = std::make_shared<AsteroidBelt>();
+    std::mutex merge;
+
+    float minAxis = FLT_MAX, maxAxis = 0.0f;
+    parallelFor(count, [&](size_t first, size_t last) {
+        float rangeMin = FLT_MAX, rangeMax = 0.0f;
+        AsteroidElements elements;
+        for (size_t i = first; i < last; i++) {
+            source(i, elements);
+            rangeMin = glm::min(rangeMin, elements.semiMajorAxis);
+            rangeMax = glm::max(rangeMax, elements.semiMajorAxis);
+        }
+        std::lock_guard<std::mutex> lock(merge);
+        minAxis = glm::min(minAxis, rangeMin);
+        maxAxis = glm::max(maxAxis, rangeMax);
+    });
+    belt->minAxis = count > 0 ? minAxis : 0.0f;
+    belt->bandWidth = glm::max(maxAxis - belt->minAxis, 1e-6f) / ASTEROID_SECTOR_BANDS;
+
+    std::vector<float> minMeanMotion(ASTEROID_SECTOR_BANDS, FLT_MAX), maxMeanMotion(ASTEROID_SECTOR_BANDS, 0.0f);
+    parallelFor(count, [&](size_t first, size_t last) {
+        std::vector<float> rangeMin(ASTEROID_SECTOR_BANDS, FLT_MAX), rangeMax(ASTEROID_SECTOR_BANDS, 0.0f);
+        AsteroidElements elements;
+        for (size_t i = first; i < last; i++) {
+            source(i, elements);
+            int band = asteroidBand(*belt, elements.semiMajorAxis);
+            rangeMin[band] = glm::min(rangeMin[band], elements.meanMotion);
+            rangeMax[band] = glm::max(rangeMax[band], elements.meanMotion);
+        }
+        std::lock_guard<std::mutex> lock(merge);
+        for (int band = 0; band < ASTEROID_SECTOR_BANDS; band++) {
+            minMeanMotion[band] = glm::min(minMeanMotion[band], rangeMin[band]);
+            maxMeanMotion[band] = glm::max(maxMeanMotion[band], rangeMax[band]);
+        }
+    });
+
+    for (int band = 0; band < ASTEROID_SECTOR_BANDS; band++) {
+        setAsteroidBand(*belt, band, minMeanMotion[band], maxMeanMotion[band]);
+    }
+
+    // The pass that packs the elements also bounds how fast and how far out of the ecliptic asteroids move
+    float maxSpeed = 0.0f, maxHeight = 0.0f;
+    belt->elements.resize(count);
+    belt->keplerOrbits.resize(count);
+    parallelFor(count, [&](size_t first, size_t last) {
+        float rangeSpeed = 0.0f, rangeHeight = 0.0f;
+        AsteroidElements elements;
+        for (size_t i = first; i < last; i++) {
+            source(i, elements);
+            belt->elements[i] = packAsteroid(*belt, elements, i);
+
+            AsteroidElements decoded = unpackAsteroid(*belt, belt->elements[i]);
+            KeplerOrbit orbit = { decoded.semiMajorAxis, decoded.eccentricity, decoded.inclination, decoded.ascendingNode,
+                                  decoded.argumentOfPeriapsis, decoded.meanAnomaly, decoded.meanMotion };
+            belt->keplerOrbits.setOrbit(i, orbit);
+
+            float e = glm::min(elements.eccentricity, 0.999f);
+            rangeSpeed = glm::max(rangeSpeed, elements.meanMotion * elements.semiMajorAxis * sqrt((1.0f + e) / (1.0f - e)));
+            rangeHeight = glm::max(rangeHeight, elements.semiMajorAxis * (1.0f + e) * sin(elements.inclination));
+        }
+        std::lock_guard<std::mutex> lock(merge);
+        maxSpeed = glm::max(maxSpeed, rangeSpeed);
+        maxHeight = glm::max(maxHeight, rangeHeight);
+    });
+    belt->maxSpeed = maxSpeed;
+    belt->maxHeight = maxHeight;
+    return belt;
+}
+
+// Function to generate every asteroid
+void generateAsteroids() {
+    asteroidBelt = buildAsteroids(numAsteroids, [](size_t index, AsteroidElements& elements) {
+        generateAsteroid(g_nSeed, index, planetDistances[2], elements);
+    });
+}
+
+// Function to map a distance from the Sun in AU to the scene, interpolating the planets' scaled distances
+// in log(AU) and extrapolating past the innermost and outermost planets
+float sceneDistance(float au) {
+    size_t segment = 0;
+    while (segment + 2 < planetAxes.size() && au > planetAxes[segment + 1]) {
+        segment++;
+    }
+    float t = log(au / planetAxes[segment]) / log(planetAxes[segment + 1] / planetAxes[segment]);
+    float distance = planetDistances[segment] + t * (planetDistances[segment + 1] - planetDistances[segment]);
+    return glm::max(distance, 0.5f); // Keep the few orbits inside Mercury's out of the Sun
+}
+
+// Function to map a scene distance back to AU, the inverse of sceneDistance()
+float auDistance(float distance) {
+    size_t segment = 0;
+    while (segment + 2 < planetDistances.size() && distance > planetDistances[segment + 1]) {
+        segment++;
+    }
+    float t = (distance - planetDistances[segment]) / (planetDistances[segment + 1] - planetDistances[segment]);
+    return planetAxes[segment] * pow(planetAxes[segment + 1] / planetAxes[segment], t);
+}
+
+// Function to convert a heliocentric orbit in AU to a scene orbit; the mean motion stays real, in radians per day
+void sceneOrbit(const MinorPlanetOrbit& orbit, AsteroidElements& elements) {
+    elements.semiMajorAxis = sceneDistance(orbit.semiMajorAxis);
+    elements.eccentricity = orbit.eccentricity;
+    elements.inclination = orbit.inclination;
+    elements.ascendingNode = orbit.ascendingNode;
+    elements.argumentOfPeriapsis = orbit.argumentOfPerihelion;
+    elements.meanAnomaly = orbit.meanAnomaly;
+    elements.meanMotion = orbit.meanMotion;
+}
+
+// Function to convert a catalog orbit to a scene orbit
+void convertCatalogOrbit(size_t index, AsteroidElements& elements) {
+    sceneOrbit(g_MinorPlanets.orbits()[index], elements);
+}
+
+// Function to use the minor planet catalog as the asteroid belt
+void loadCatalogAsteroids() {
+    numAsteroids = static_cast<GLuint>(g_MinorPlanets.size());
+    asteroidBelt = buildAsteroids(numAsteroids, convertCatalogOrbit);
+}
+
+// Function to get the current belt as heliocentric orbits in AU
+std::vector<MinorPlanetOrbit> beltOrbits() {
+    std::vector<MinorPlanetOrbit> orbits(numAsteroids);
+    if (g_MinorPlanets.size() == numAsteroids) {
+        orbits.assign(g_MinorPlanets.orbits(), g_MinorPlanets.orbits() + numAsteroids);
+    } else {
+        // The generated belt is placed in AU through the scene's distance mapping, so it keeps its look
+        parallelFor(numAsteroids, [&](size_t first, size_t last) {
+            AsteroidElements elements;
+            for (size_t i = first; i < last; i++) {
+                generateAsteroid(g_nSeed, i, planetDistances[2], elements);
+                MinorPlanetOrbit& orbit = orbits[i];
+                orbit.semiMajorAxis = auDistance(elements.semiMajorAxis);
+                orbit.eccentricity = elements.eccentricity;
+                orbit.inclination = elements.inclination;
+                orbit.ascendingNode = elements.ascendingNode;
+                orbit.argumentOfPerihelion = elements.argumentOfPeriapsis;
+                orbit.meanAnomaly = elements.meanAnomaly;
+                orbit.meanMotion = 0.0f; // Set from the semi-major axis by the integrators
+                orbit.absoluteMagnitude = 99.0f;
+            }
+        });
+    }
+    return orbits;
+}
+
+// Function to hand the current belt to the integrator
+void startBeltIntegrator() {
+    g_BeltIntegrator.start(beltOrbits(), g_dStartDay, g_bPerturbSaturn ? 2 : 1);
+}
+
+// Function to start the N-body simulation of the Sun, the planets from their J2000.0 elements at their real
+// distances, and the current belt
+void startNBody() {
+    std::vector<MinorPlanetOrbit> orbits;
+    for (int i = 0; i < 9; i++) {
+        MinorPlanetOrbit orbit;
+        orbit.semiMajorAxis = planetAxes[i];
+        orbit.eccentricity = float(planetEccentricities[i]);
+        orbit.inclination = float(glm::radians(planetInclinations[i]));
+        orbit.ascendingNode = float(glm::radians(planetAscendingNodes[i]));
+        orbit.argumentOfPerihelion = float(glm::radians(planetPerihelia[i] - planetAscendingNodes[i]));
+        orbit.meanAnomaly = float(glm::radians(planetLongitudes[i] - planetPerihelia[i]));
+        orbit.meanMotion = 0.0f;
+        orbit.absoluteMagnitude = 99.0f;
+        orbits.push_back(orbit);
+    }
+    std::vector<MinorPlanetOrbit> belt = beltOrbits();
+    orbits.insert(orbits.end(), belt.begin(), belt.end());
+
+    // The Sun first, at rest at the origin; the simulation moves everything to the barycentre
+    const double sunGM = GAUSSIAN_GRAVITY * GAUSSIAN_GRAVITY;
+    NBodyParticles particles;
+    particles.resize(orbits.size() + 1);
+    particles.x[0] = particles.y[0] = particles.z[0] = 0.0f;
+    particles.vx[0] = particles.vy[0] = particles.vz[0] = 0.0f;
+    particles.mass[0] = float(sunGM);
+    float asteroidGM = belt.empty() ? 0.0f : float(sunGM * g_dDiscMass / belt.size());
+    parallelFor(orbits.size(), [&](size_t first, size_t last) {
+        for (size_t i = first; i < last; i++) {
+            // Bodies orbit under the pull of the Sun and their own mass together, as the simulation publishes them
+            double gm = i < 9 ? sunGM * planetMasses[i] : asteroidGM;
+            double position[3], velocity[3];
+            orbitState(orbits[i], g_dStartDay, position, velocity, sunGM + gm);
+            particles.x[i + 1] = float(position[0]); particles.y[i + 1] = float(position[1]); particles.z[i + 1] = float(position[2]);
+            particles.vx[i + 1] = float(velocity[0]); particles.vy[i + 1] = float(velocity[1]); particles.vz[i + 1] = float(velocity[2]);
+            particles.mass[i + 1] = float(gm);
+        }
+    });
+    std::unique_ptr<GravitySolver> solver;
+    if (g_nMultipoleOrder > 0) {
+        solver.reset(new FastMultipoleSolver(g_nMultipoleOrder, g_fOpeningAngle));
+    } else {
+        solver.reset(new BarnesHutSolver(g_fOpeningAngle));
+    }
+    g_NBody.start(particles, g_dStartDay, std::move(solver));
+}
+
+// Function to upload the quantization ranges the propagation shader decodes the elements with
+void uploadAsteroidBands() {
+    glUseProgram(asteroidPropagateShader.id);
+    glUniform4fv(asteroidPropagateShader.uniforms[UNIFORM_ASTEROID_BANDS], ASTEROID_SECTOR_BANDS, &asteroidBelt->bands[0].minAxis);
+    glUseProgram(0); // Unbind the shader program
+}
+
+// Function to sort a belt's asteroids into sectors at a time. Every range of asteroids counts and bounds its asteroids
+// per sector in parallel; a prefix sum over the ranges' counts then gives every range its place within each sector,
+// and the ranges scatter their asteroids there
+std::unique_ptr<AsteroidSectorSort> sortAsteroidSectors(const std::shared_ptr<const AsteroidBelt>& belt, float days) {
+    const float sliceWidth = 2.0f * M_PI / ASTEROID_SECTOR_SLICES;
+    const int numSectors = ASTEROID_SECTOR_BANDS * ASTEROID_SECTOR_SLICES;
+    const std::vector<PackedAsteroidElements>& elements = belt->elements;
+    size_t count = elements.size();
+
+    std::unique_ptr<AsteroidSectorSort> sort(new AsteroidSectorSort());
+    sort->belt = belt;
+    sort->days = days;
+    sort->sectors.resize(numSectors);
+    for (int sector = 0; sector < numSectors; sector++) {
+        AsteroidSector& bounds = sort->sectors[sector];
+        bounds.first = 0;
+        bounds.count = 0;
+        bounds.minRadius = FLT_MAX;
+        bounds.maxRadius = 0.0f;
+        bounds.maxHeight = 0.0f;
+        bounds.minLongitude = (sector % ASTEROID_SECTOR_SLICES) * sliceWidth;
+        bounds.maxLongitude = bounds.minLongitude + sliceWidth;
+        bounds.minMeanMotion = FLT_MAX;
+        bounds.maxMeanMotion = 0.0f;
+        bounds.maxEccentricity = 0.0f;
+        bounds.maxInclination = 0.0f;
+        float innerAxis = belt->bands[sector / ASTEROID_SECTOR_SLICES].minAxis;
+        float outerAxis = innerAxis + belt->bandWidth;
+        bounds.area = 0.5f * (outerAxis * outerAxis - innerAxis * innerAxis) * sliceWidth;
+    }
+
+    // Sector of every asteroid from its band and mean longitude at the time, counted and bounded per range
+    size_t rangeSize = parallelRangeSize(count);
+    size_t numRanges = glm::max((count + rangeSize - 1) / rangeSize, size_t(1));
+    std::vector<uint16_t> sectorOf(count);
+    std::vector<std::vector<GLsizei> > rangeCounts(numRanges, std::vector<GLsizei>(numSectors, 0));
+    std::mutex merge;
+    parallelFor(count, [&](size_t first, size_t last) {
+        std::vector<GLsizei>& counts = rangeCounts[first / rangeSize];
+        std::vector<AsteroidSector> ranges(sort->sectors);
+        for (size_t i = first; i < last; i++) {
+            AsteroidElements orbit = unpackAsteroid(*belt, elements[i]);
+            int band = (elements[i].words[3] >> 16) & 31;
+            double longitude = orbit.ascendingNode + orbit.argumentOfPeriapsis + orbit.meanAnomaly + double(orbit.meanMotion) * days;
+            longitude -= 2.0 * M_PI * floor(longitude / (2.0 * M_PI));
+            int sector = band * ASTEROID_SECTOR_SLICES + glm::min(int(longitude / sliceWidth), ASTEROID_SECTOR_SLICES - 1);
+            sectorOf[i] = uint16_t(sector);
+            counts[sector]++;
+
+            AsteroidSector& bounds = ranges[sector];
+            float aphelion = orbit.semiMajorAxis * (1.0f + orbit.eccentricity);
+            bounds.minRadius = glm::min(bounds.minRadius, orbit.semiMajorAxis * (1.0f - orbit.eccentricity));
+            bounds.maxRadius = glm::max(bounds.maxRadius, aphelion);
+            bounds.maxHeight = glm::max(bounds.maxHeight, aphelion * sin(orbit.inclination));
+            bounds.minMeanMotion = glm::min(bounds.minMeanMotion, orbit.meanMotion);
+            bounds.maxMeanMotion = glm::max(bounds.maxMeanMotion, orbit.meanMotion);
+            bounds.maxEccentricity = glm::max(bounds.maxEccentricity, orbit.eccentricity);
+            bounds.maxInclination = glm::max(bounds.maxInclination, orbit.inclination);
+        }
+
+        std::lock_guard<std::mutex> lock(merge);
+        for (int sector = 0; sector < numSectors; sector++) {
+            AsteroidSector& bounds = sort->sectors[sector];
+            const AsteroidSector& range = ranges[sector];
+            bounds.minRadius = glm::min(bounds.minRadius, range.minRadius);
+            bounds.maxRadius = glm::max(bounds.maxRadius, range.maxRadius);
+            bounds.maxHeight = glm::max(bounds.maxHeight, range.maxHeight);
+            bounds.minMeanMotion = glm::min(bounds.minMeanMotion, range.minMeanMotion);
+            bounds.maxMeanMotion = glm::max(bounds.maxMeanMotion, range.maxMeanMotion);
+            bounds.maxEccentricity = glm::max(bounds.maxEccentricity, range.maxEccentricity);
+            bounds.maxInclination = glm::max(bounds.maxInclination, range.maxInclination);
+        }
+    });
+
+    // Sectors in band order, and within each sector the ranges in index order; the counts become the ranges' offsets
+    GLint first = 0;
+    for (int sector = 0; sector < numSectors; sector++) {
+        AsteroidSector& bounds = sort->sectors[sector];
+        bounds.first = first;
+        for (std::vector<GLsizei>& counts : rangeCounts) {
+            GLsizei rangeCount = counts[sector];
+            counts[sector] = first;
+            first += rangeCount;
+        }
+        bounds.count = first - bounds.first;
+    }
+
+    // Stable scatter: the generation order is random, so any prefix of a sector is a uniform sample of it
+    sort->elements.resize(count);
+    parallelFor(count, [&](size_t first, size_t last) {
+        std::vector<GLsizei>& offsets = rangeCounts[first / rangeSize];
+        for (size_t i = first; i < last; i++) {
+            sort->elements[offsets[sectorOf[i]]++] = elements[i];
+        }
+    });
+
+    sort->driftRate = 0.0f;
+    for (const AsteroidSector& bounds : sort->sectors) {
+        if (bounds.count > 0) {
+            sort->driftRate = glm::max(sort->driftRate, bounds.maxMeanMotion - bounds.minMeanMotion);
+        }
+    }
+    return sort;
+}
+
+// Function to run the belt worker thread: pack the requested snapshot into a new belt, or take the requested belt,
+// and sort it, leaving the newest result for the render thread to upload
+void runAsteroidWorker() {
+    std::vector<MinorPlanetOrbit> orbits;
+    std::unique_lock<std::mutex> guard(asteroidWorkerLock);
+    for (;;) {
+        asteroidWorkerWake.wait(guard, [] { return asteroidWorkerStopping || asteroidSnapshotRequested || asteroidSortBelt; });
+        if (asteroidWorkerStopping) {
+            return;
+        }
+        std::shared_ptr<const AsteroidBelt> belt;
+        belt.swap(asteroidSortBelt);
+        bool snapshot = asteroidSnapshotRequested;
+        size_t firstOrbit = asteroidSnapshotFirst;
+        if (snapshot) {
+            orbits.swap(asteroidSnapshotOrbits); // A snapshot replaces the belt any waiting sort was for
+            asteroidSnapshotRequested = false;
+        }
+        float days = asteroidSortDays;
+        asteroidWorkerBusy = true;
+        guard.unlock();
+
+        if (snapshot) {
+            belt = buildAsteroids(orbits.size() - firstOrbit, [&](size_t index, AsteroidElements& elements) {
+                sceneOrbit(orbits[firstOrbit + index], elements);
+            });
+        }
+        std::unique_ptr<AsteroidSectorSort> sort = sortAsteroidSectors(belt, days);
+
+        guard.lock();
+        asteroidSortResult = std::move(sort); // An older result not yet taken is dropped
+        asteroidWorkerBusy = false;
+    }
+}
+
+// Function to start the belt worker thread
+void startAsteroidWorker() {
+    asteroidWorkerStopping = false;
+    asteroidWorker = std::thread(runAsteroidWorker);
+}
+
+// Function to stop the belt worker thread, after the sort it is running
+void stopAsteroidWorker() {
+    if (asteroidWorker.joinable()) {
+        {
+            std::lock_guard<std::mutex> guard(asteroidWorkerLock);
+            asteroidWorkerStopping = true;
+        }
+        asteroidWorkerWake.notify_one();
+        asteroidWorker.join();
+    }
+}
+
+// Function to have the worker sort a belt at a time, replacing any sort it has not started yet
+void requestAsteroidSort(const std::shared_ptr<const AsteroidBelt>& belt, float days) {
+    {
+        std::lock_guard<std::mutex> guard(asteroidWorkerLock);
+        asteroidSortBelt = belt;
+        asteroidSortDays = days;
+    }
+    asteroidWorkerWake.notify_one();
+}
+
+// Function to have the worker pack a snapshot's orbits from the first asteroid on into a new belt and sort it at a
+// time, replacing any request it has not started yet. The orbits are taken over, leaving an older snapshot's behind
+void requestAsteroidSnapshot(std::vector<MinorPlanetOrbit>& orbits, size_t firstAsteroid, float days) {
+    {
+        std::lock_guard<std::mutex> guard(asteroidWorkerLock);
+        asteroidSnapshotOrbits.swap(orbits);
+        asteroidSnapshotFirst = firstAsteroid;
+        asteroidSnapshotRequested = true;
+        asteroidSortDays = days;
     }
+    asteroidWorkerWake.notify_one();
+}
+
+// Function to check whether no request is waiting, running, finished or being uploaded
+bool asteroidSortsIdle() {
+    std::lock_guard<std::mutex> guard(asteroidWorkerLock);
+    return !asteroidSnapshotRequested && !asteroidSortBelt && !asteroidWorkerBusy && !asteroidSortResult && !asteroidUpload;
+}
+
+// Function to point the transform feedback VAO at the element buffer drawn from
+void bindAsteroidElements() {
+    glBindVertexArray(asteroidPropagateVAO);
+    glBindBuffer(GL_ARRAY_BUFFER, asteroidElementVBO);
+    glVertexAttribIPointer(0, 4, GL_UNSIGNED_INT, sizeof(PackedAsteroidElements), (void*)0);
+    glEnableVertexAttribArray(0);
+    glBindVertexArray(0);
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+}
 
-    // Render the text
-    glEnableClientState(GL_VERTEX_ARRAY);
-    glVertexPointer(3, GL_FLOAT, 16, buffer); // Use 3D vertices (x, y, z)
-    glDrawArrays(GL_QUADS, 0, num_quads * 4);
-    glDisableClientState(GL_VERTEX_ARRAY);
+// Function to switch the belt, its sectors and its ranges to those of a sort whose elements are in asteroidElementVBO
+void installAsteroidSort(AsteroidSectorSort& sort) {
+    asteroidBelt = sort.belt;
+    asteroidSectors.swap(sort.sectors);
+    asteroidSectorDays = sort.days;
+    asteroidDriftRate = sort.driftRate;
+    uploadAsteroidBands();
 }
 
-// Function to draw a circle (for planet orbits)
-void drawCircle(float radius, int segments) {
-    glBegin(GL_LINE_LOOP);
-    for (int i = 0; i < segments; i++) {
-        float angle = 2.0f * M_PI * i / segments;
-        glVertex3f(radius * cos(angle), 0.0f, radius * sin(angle));
+// Function to upload the newest finished sort a slice per frame into the element buffer not drawn from, and to swap
+// the buffers once it is complete. The buffer's storage is orphaned first, so the upload never waits for draws still
+// reading the previous sort
+void updateAsteroidUpload() {
+    if (!asteroidUpload) {
+        {
+            std::lock_guard<std::mutex> guard(asteroidWorkerLock);
+            asteroidUpload = std::move(asteroidSortResult);
+        }
+        if (!asteroidUpload) {
+            return;
+        }
+        glBindBuffer(GL_ARRAY_BUFFER, asteroidUploadVBO);
+        glBufferData(GL_ARRAY_BUFFER, asteroidUpload->elements.size() * sizeof(PackedAsteroidElements), NULL, GL_DYNAMIC_DRAW);
+        asteroidUploaded = 0;
+    }
+
+    const std::vector<PackedAsteroidElements>& elements = asteroidUpload->elements;
+    size_t count = glm::min(elements.size() - asteroidUploaded, ASTEROID_UPLOAD_ELEMENTS);
+    glBindBuffer(GL_ARRAY_BUFFER, asteroidUploadVBO);
+    if (count > 0) {
+        glBufferSubData(GL_ARRAY_BUFFER, asteroidUploaded * sizeof(PackedAsteroidElements), count * sizeof(PackedAsteroidElements), &elements[asteroidUploaded]);
     }
-    glEnd();
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+    asteroidUploaded += count;
+    if (asteroidUploaded < elements.size()) {
+        return;
+    }
+
+    std::swap(asteroidElementVBO, asteroidUploadVBO);
+    bindAsteroidElements();
+    installAsteroidSort(*asteroidUpload);
+    asteroidUpload.reset();
+}
+
+// Function to build the rock mesh variants: an icosahedron subdivided once, with randomly displaced vertices
+void buildRockMeshes() {
+    const float t = (1.0f + sqrt(5.0f)) / 2.0f;
+    std::vector<glm::vec3> vertices = {
+        {-1, t, 0}, {1, t, 0}, {-1, -t, 0}, {1, -t, 0},
+        {0, -1, t}, {0, 1, t}, {0, -1, -t}, {0, 1, -t},
+        {t, 0, -1}, {t, 0, 1}, {-t, 0, -1}, {-t, 0, 1}
+    };
+    std::vector<GLuint> indices = {
+        0, 11, 5,  0, 5, 1,  0, 1, 7,  0, 7, 10,  0, 10, 11,
+        1, 5, 9,  5, 11, 4,  11, 10, 2,  10, 7, 6,  7, 1, 8,
+        3, 9, 4,  3, 4, 2,  3, 2, 6,  3, 6, 8,  3, 8, 9,
+        4, 9, 5,  2, 4, 11,  6, 2, 10,  8, 6, 7,  9, 8, 1
+    };
+
+    // Split every triangle in four, sharing the edge midpoints between neighbouring triangles
+    std::map<std::pair<GLuint, GLuint>, GLuint> midpoints;
+    std::vector<GLuint> subdivided;
+    for (size_t i = 0; i < indices.size(); i += 3) {
+        GLuint middle[3];
+        for (int edge = 0; edge < 3; edge++) {
+            GLuint a = indices[i + edge], b = indices[i + (edge + 1) % 3];
+            std::pair<GLuint, GLuint> key(glm::min(a, b), glm::max(a, b));
+            std::map<std::pair<GLuint, GLuint>, GLuint>::iterator it = midpoints.find(key);
+            if (it == midpoints.end()) {
+                vertices.push_back((vertices[a] + vertices[b]) * 0.5f);
+                it = midpoints.insert(std::make_pair(key, GLuint(vertices.size() - 1))).first;
+            }
+            middle[edge] = it->second;
+        }
+        GLuint triangles[] = {
+            indices[i], middle[0], middle[2],
+            indices[i + 1], middle[1], middle[0],
+            indices[i + 2], middle[2], middle[1],
+            middle[0], middle[1], middle[2]
+        };
+        subdivided.insert(subdivided.end(), triangles, triangles + 12);
+    }
+
+    // Every variant displaces the unit sphere's vertices differently
+    PhiloxStream random(g_nSeed, STREAM_ROCK_MESHES);
+    std::vector<glm::vec4> variants;
+    for (int variant = 0; variant < NUM_ROCK_VARIANTS; variant++) {
+        for (const glm::vec3& vertex : vertices) {
+            float radius = 0.7f + philoxUniform(random.block(variants.size()).v[0]) * 0.45f;
+            variants.push_back(glm::vec4(glm::normalize(vertex) * radius, 0.0f));
+        }
+    }
+    rockVertexCount = static_cast<GLsizei>(vertices.size());
+    rockIndexCount = static_cast<GLsizei>(subdivided.size());
+
+    glGenBuffers(1, &rockVariantTBO);
+    glBindBuffer(GL_TEXTURE_BUFFER, rockVariantTBO);
+    glBufferData(GL_TEXTURE_BUFFER, variants.size() * sizeof(glm::vec4), variants.data(), GL_STATIC_DRAW);
+    glBindBuffer(GL_TEXTURE_BUFFER, 0);
+
+    glGenTextures(1, &rockVariantTexture);
+    glBindTexture(GL_TEXTURE_BUFFER, rockVariantTexture);
+    glTexBuffer(GL_TEXTURE_BUFFER, GL_RGBA32F, rockVariantTBO);
+    glBindTexture(GL_TEXTURE_BUFFER, 0);
+
+    // The rock VAO only has the per-instance asteroid attribute; the rocks come first in the position buffer
+    glGenVertexArrays(1, &rockVAO);
+    glGenBuffers(1, &rockIBO);
+    glBindVertexArray(rockVAO);
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, rockIBO);
+    glBufferData(GL_ELEMENT_ARRAY_BUFFER, subdivided.size() * sizeof(GLuint), subdivided.data(), GL_STATIC_DRAW);
+    glBindBuffer(GL_ARRAY_BUFFER, asteroidVBO);
+    glVertexAttribPointer(0, 4, GL_FLOAT, GL_FALSE, sizeof(glm::vec4), (void*)0);
+    glEnableVertexAttribArray(0);
+    glVertexAttribDivisor(0, 1);
+    glBindVertexArray(0);
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
+
+    glUseProgram(rockShader.id);
+    glUniform1i(rockShader.uniforms[UNIFORM_ROCK_VARIANTS], 0); // Texture unit 0
+    glUniform1i(rockShader.uniforms[UNIFORM_ROCK_VERTEX_COUNT], rockVertexCount);
+    glUseProgram(0);
+}
+
+// Function to build the unit circle drawn for Saturn's rings
+void buildSaturnRings() {
+    std::vector<glm::vec3> vertices;
+    for (int i = 0; i < RING_SEGMENTS; i++) {
+        float angle = 2.0f * M_PI * i / RING_SEGMENTS;
+        vertices.push_back(glm::vec3(cos(angle), 0.0f, sin(angle)));
+    }
+
+    glGenVertexArrays(1, &ringVAO);
+    glGenBuffers(1, &ringVBO);
+    glBindVertexArray(ringVAO);
+    glBindBuffer(GL_ARRAY_BUFFER, ringVBO);
+    glBufferData(GL_ARRAY_BUFFER, vertices.size() * sizeof(glm::vec3), vertices.data(), GL_STATIC_DRAW);
+    glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(glm::vec3), (void*)0);
+    glEnableVertexAttribArray(0);
+    glBindVertexArray(0);
 }
 
 // Function to initialize OpenGL settings and shaders
 void init() {
     // Initialize GLEW
-    glewExperimental = GL_FALSE;
+    glewExperimental = GL_TRUE; // Needed to load entry points on core profile contexts
     if (glewInit() != GLEW_OK) {
         printf("Failed to initialize GLEW\n");
         exit(1);
     }
+    glGetError(); // glewInit queries GL_EXTENSIONS, which raises GL_INVALID_ENUM on core profiles
     
     glClearColor(0.0f, 0.0f, 0.0f, 1.0f); // Set background color to black
     glEnable(GL_DEPTH_TEST);          // Enable depth testing for 3D rendering
@@ -209,30 +1475,32 @@ void init() {
     // Vertex and fragment shaders for the Sun (burning effect)
     const char* sunVertexShaderSource =
         "#version 330 core\n"
+        CAMERA_UNIFORM_BLOCK
         "layout(location = 0) in vec3 aPos;\n"
-        "uniform mat4 MVP;\n" // Model-View-Projection matrix
+        "uniform mat4 model;\n" // Model matrix
         "void main() {\n"
-        "    gl_Position = MVP * vec4(aPos, 1.0);\n" // Transform vertex position
+        "    gl_Position = viewProjection * model * vec4(aPos, 1.0);\n" // Transform vertex position
         "}\n";
 
     const char* sunFragmentShaderSource =
         "#version 330 core\n"
+        CAMERA_UNIFORM_BLOCK
         "out vec4 FragColor;\n"
-        "uniform float time;\n"
         "void main() {\n"
         "    float intensity = 0.8 + 0.2 * sin(time * 5.0);\n" // Pulsating effect
         "    FragColor = vec4(1.0, 0.5 * intensity, 0.0, 1.0);\n" // Yellow-orange color
         "}\n";
 
-    sunShaderProgram = createShaderProgram(sunVertexShaderSource, sunFragmentShaderSource);
+    sunShader = loadShaderProgram(sunVertexShaderSource, sunFragmentShaderSource);
 
     // Vertex and fragment shaders for Saturn's rings
     const char* saturnVertexShaderSource =
         "#version 330 core\n"
+        CAMERA_UNIFORM_BLOCK
         "layout(location = 0) in vec3 aPos;\n"
-        "uniform mat4 MVP;\n" // Model-View-Projection matrix
+        "uniform mat4 model;\n" // Model matrix
         "void main() {\n"
-        "    gl_Position = MVP * vec4(aPos, 1.0);\n" // Transform vertex position
+        "    gl_Position = viewProjection * model * vec4(aPos, 1.0);\n" // Transform vertex position
         "}\n";
 
     const char* saturnFragmentShaderSource =
@@ -242,371 +1510,1472 @@ void init() {
         "    FragColor = vec4(0.9, 0.8, 0.5, 1.0);\n" // Beige color for Saturn's rings
         "}\n";
 
-    saturnShaderProgram = createShaderProgram(saturnVertexShaderSource, saturnFragmentShaderSource);
+    saturnShader = loadShaderProgram(saturnVertexShaderSource, saturnFragmentShaderSource);
+    buildSaturnRings();
+
+    // Vertex and fragment shaders for asteroids
+    const char* asteroidVertexShaderSource =
+        "#version 330 core\n"
+        CAMERA_UNIFORM_BLOCK
+        "layout(location = 0) in vec4 aPos;\n" // Position and id written by the propagation shader
+        "void main() {\n"
+        "    gl_Position = viewProjection * vec4(aPos.xyz, 1.0);\n" // Transform vertex position
+        "}\n";
+
+    const char* asteroidFragmentShaderSource =
+        "#version 330 core\n"
+        "out vec4 FragColor;\n"
+        "uniform float fogDensity;\n" // Fog density
+        "void main() {\n"
+        "    float fogFactor = exp(-fogDensity * gl_FragCoord.z / gl_FragCoord.w);\n" // Fog calculation
+        "    fogFactor = clamp(fogFactor, 0.0, 1.0);\n"
+        "    vec3 fogColor = vec3(0.5, 0.5, 0.5);\n" // Gray fog color
+        "    vec3 objectColor = vec3(0.7, 0.7, 0.7);\n" // Gray asteroid color
+        "    FragColor = vec4(mix(fogColor, objectColor, fogFactor), 1.0);\n" // Apply fog
+        "}\n";
+
+    asteroidShader = loadShaderProgram(asteroidVertexShaderSource, asteroidFragmentShaderSource);
+
+    // The fog density never changes, so set it once
+    glUseProgram(asteroidShader.id);
+    glUniform1f(asteroidShader.uniforms[UNIFORM_FOG_DENSITY], 0.05f); // Adjust fog density as needed
+    glUseProgram(0);
+
+    // Vertex and fragment shaders for nearby asteroids: instanced rock meshes with flat-shaded facets
+    const char* rockVertexShaderSource =
+        "#version 330 core\n"
+        CAMERA_UNIFORM_BLOCK
+        ASTEROID_SHAPE_FUNCTIONS
+        "layout(location = 0) in vec4 aAsteroid;\n" // Per-instance position and id
+        "uniform samplerBuffer rockVariants;\n"
+        "uniform int rockVertexCount;\n"
+        "out vec3 vPosition;\n" // View-space position
+        "flat out vec3 vColor;\n"
+        "void main() {\n"
+        "    uint id = uint(aAsteroid.w);\n"
+        "    int variant = int(id % 4u);\n" // NUM_ROCK_VARIANTS
+        "    vec3 vertex = texelFetch(rockVariants, variant * rockVertexCount + gl_VertexID).xyz;\n"
+        "    vec3 world = aAsteroid.xyz + asteroidRotation(id, time) * vertex * asteroidSize(id);\n"
+        "    vPosition = (view * vec4(world, 1.0)).xyz;\n"
+        "    vColor = asteroidColor(id);\n"
+        "    gl_Position = projection * vec4(vPosition, 1.0);\n"
+        "}\n";
+
+    const char* rockFragmentShaderSource =
+        "#version 330 core\n"
+        CAMERA_UNIFORM_BLOCK
+        SUN_LIGHTING_FUNCTION
+        "in vec3 vPosition;\n"
+        "flat in vec3 vColor;\n"
+        "out vec4 FragColor;\n"
+        "void main() {\n"
+        "    vec3 normal = normalize(cross(dFdx(vPosition), dFdy(vPosition)));\n" // Facet normal, facing the eye
+        "    vec3 sun = (view * vec4(0.0, 0.0, 0.0, 1.0)).xyz;\n"
+        "    FragColor = vec4(sunLighting(vColor, normal, normalize(sun - vPosition)), 1.0);\n"
+        "}\n";
+
+    rockShader = loadShaderProgram(rockVertexShaderSource, rockFragmentShaderSource);
+
+    // Vertex and fragment shaders for mid-range asteroids: point sprites shaded as spheres
+    const char* asteroidSpriteVertexShaderSource =
+        "#version 330 core\n"
+        CAMERA_UNIFORM_BLOCK
+        ASTEROID_SHAPE_FUNCTIONS
+        "layout(location = 0) in vec4 aPos;\n" // Position and id
+        "flat out vec3 vCenter;\n" // View-space center
+        "flat out vec3 vColor;\n"
+        "void main() {\n"
+        "    uint id = uint(aPos.w);\n"
+        "    vCenter = (view * vec4(aPos.xyz, 1.0)).xyz;\n"
+        "    vColor = asteroidColor(id);\n"
+        "    float pixels = asteroidSize(id) / max(-vCenter.z, 1e-3) * projection[1][1] * viewportHeight;\n" // Diameter
+        "    gl_PointSize = max(pixels, 1.0);\n"
+        "    gl_Position = projection * vec4(vCenter, 1.0);\n"
+        "}\n";
+
+    const char* asteroidSpriteFragmentShaderSource =
+        "#version 330 core\n"
+        CAMERA_UNIFORM_BLOCK
+        SUN_LIGHTING_FUNCTION
+        "flat in vec3 vCenter;\n"
+        "flat in vec3 vColor;\n"
+        "out vec4 FragColor;\n"
+        "void main() {\n"
+        "    vec2 coord = gl_PointCoord * 2.0 - 1.0;\n"
+        "    float r2 = dot(coord, coord);\n"
+        "    if (r2 > 1.0) discard;\n"
+        "    vec3 normal = vec3(coord.x, -coord.y, sqrt(1.0 - r2));\n" // Sphere normal facing the eye
+        "    vec3 sun = (view * vec4(0.0, 0.0, 0.0, 1.0)).xyz;\n"
+        "    FragColor = vec4(sunLighting(vColor, normal, normalize(sun - vCenter)), 1.0);\n"
+        "}\n";
+
+    asteroidSpriteShader = loadShaderProgram(asteroidSpriteVertexShaderSource, asteroidSpriteFragmentShaderSource);
+
+    // Vertex and fragment shaders accumulating distant asteroids into the density texture
+    const char* asteroidSplatVertexShaderSource =
+        "#version 330 core\n"
+        CAMERA_UNIFORM_BLOCK
+        "layout(location = 0) in vec4 aPos;\n" // Position and id written by the propagation shader
+        "void main() {\n"
+        "    gl_Position = viewProjection * vec4(aPos.xyz, 1.0);\n"
+        "}\n";
+
+    const char* asteroidSplatFragmentShaderSource =
+        "#version 330 core\n"
+        "uniform float densityWeight;\n"
+        "uniform float fogDensity;\n"
+        "out vec4 FragColor;\n"
+        "void main() {\n"
+        "    float fogFactor = clamp(exp(-fogDensity * gl_FragCoord.z / gl_FragCoord.w), 0.0, 1.0);\n" // Same fog as the points
+        "    FragColor = vec4(densityWeight, densityWeight * fogFactor, 0.0, 0.0);\n" // Added up by the blending
+        "}\n";
+
+    asteroidSplatShader = loadShaderProgram(asteroidSplatVertexShaderSource, asteroidSplatFragmentShaderSource);
+    glUseProgram(asteroidSplatShader.id);
+    glUniform1f(asteroidSplatShader.uniforms[UNIFORM_FOG_DENSITY], 0.05f); // As the points
+    glUseProgram(0); // Unbind the shader program
+
+    // Vertex and fragment shaders turning the density into belt coverage over the whole screen
+    const char* asteroidResolveVertexShaderSource =
+        "#version 330 core\n"
+        "out vec2 vTexCoord;\n"
+        "void main() {\n"
+        "    vec2 corner = vec2((gl_VertexID << 1) & 2, gl_VertexID & 2);\n" // One triangle covering the screen
+        "    vTexCoord = corner;\n"
+        "    gl_Position = vec4(corner * 2.0 - 1.0, 0.0, 1.0);\n"
+        "}\n";
+
+    const char* asteroidResolveFragmentShaderSource =
+        "#version 330 core\n"
+        "uniform sampler2D densityTexture;\n"
+        "in vec2 vTexCoord;\n"
+        "out vec4 FragColor;\n"
+        "void main() {\n"
+        "    vec2 density = texture(densityTexture, vTexCoord).rg;\n" // Asteroids, and fog-weighted asteroids, per texel
+        "    float perPixel = density.r * 0.25;\n" // Asteroids per screen pixel (ASTEROID_DENSITY_DOWNSAMPLE^2 pixels per texel)
+        "    float coverage = 1.0 - exp(-perPixel);\n" // Chance that a pixel shows at least one asteroid
+        "    float fogFactor = density.g / max(density.r, 1e-6);\n" // Average fog of the asteroids in the texel
+        "    FragColor = vec4(mix(vec3(0.5), vec3(0.7), fogFactor), coverage);\n" // Gray fog and asteroid colors, as the points
+        "}\n";
+
+    asteroidResolveShader = loadShaderProgram(asteroidResolveVertexShaderSource, asteroidResolveFragmentShaderSource);
+    glUseProgram(asteroidResolveShader.id);
+    glUniform1i(asteroidResolveShader.uniforms[UNIFORM_DENSITY_TEXTURE], 0); // Texture unit 0
+    glUseProgram(0); // Unbind the shader program
+
+    // Propagate every asteroid along its own orbit on the GPU: a compute shader where GL 4.3 is available,
+    // otherwise a vertex shader whose output is captured with transform feedback
+    asteroidComputeShaders = GLEW_VERSION_4_3 != 0;
+    if (asteroidComputeShaders) {
+        const char* asteroidComputeShaderSource =
+            "#version 430 core\n"
+            "layout(local_size_x = 256) in;\n" // ASTEROID_WORKGROUP_SIZE, one work group per drawn sector
+            "layout(std430, binding = 0) readonly buffer ElementBuffer { uvec4 elements[]; };\n" // Packed elements
+            "layout(std430, binding = 1) writeonly buffer PositionBuffer { vec4 positions[]; };\n"
+            "layout(std430, binding = 2) readonly buffer RangeBuffer { uvec4 ranges[]; };\n" // First, count, output offset
+            "uniform float days;\n"
+            ORBIT_POSITION_FUNCTION
+            SOLVE_KEPLER_FUNCTION
+            ASTEROID_SHAPE_FUNCTIONS
+            UNPACK_ASTEROID_FUNCTION
+            "void main() {\n"
+            "    uvec4 range = ranges[gl_WorkGroupID.x];\n"
+            "    for (uint k = gl_LocalInvocationID.x; k < range.y; k += gl_WorkGroupSize.x) {\n"
+            "        vec4 shape, phase;\n" // Semi-major axis, eccentricity, inclination, ascending node; argument of periapsis, mean anomaly at day 0, mean motion, id
+            "        unpackAsteroid(elements[range.x + k], shape, phase);\n"
+            "        float E = solveKepler(phase.y + phase.z * days, shape.y);\n"
+            "        positions[range.z + k] = vec4(orbitPosition(shape, phase.x, E), phase.w);\n" // Packed in draw order
+            "    }\n"
+            "}\n";
+
+        asteroidPropagateShader = loadComputeProgram(asteroidComputeShaderSource);
+    } else {
+        const char* asteroidFeedbackShaderSource =
+            "#version 330 core\n"
+            "layout(location = 0) in uvec4 aElements;\n" // Packed elements
+            "uniform float days;\n"
+            "out vec4 vPosition;\n" // Captured into the position buffer
+            ORBIT_POSITION_FUNCTION
+            SOLVE_KEPLER_FUNCTION
+            ASTEROID_SHAPE_FUNCTIONS
+            UNPACK_ASTEROID_FUNCTION
+            "void main() {\n"
+            "    vec4 shape, phase;\n" // Semi-major axis, eccentricity, inclination, ascending node; argument of periapsis, mean anomaly at day 0, mean motion, id
+            "    unpackAsteroid(aElements, shape, phase);\n"
+            "    float E = solveKepler(phase.y + phase.z * days, shape.y);\n"
+            "    vPosition = vec4(orbitPosition(shape, phase.x, E), phase.w);\n"
+            "}\n";
+
+        asteroidPropagateShader = loadTransformFeedbackProgram(asteroidFeedbackShaderSource, "vPosition");
+    }
+
+    // Vertex and fragment shaders for instanced planets and moons
+    const char* bodyVertexShaderSource =
+        "#version 330 core\n"
+        CAMERA_UNIFORM_BLOCK
+        "layout(location = 0) in vec3 aPos;\n"
+        "layout(location = 1) in mat4 aModel;\n" // Per-instance model matrix (locations 1-4)
+        "layout(location = 5) in vec4 aColor;\n" // Per-instance color
+        "out vec4 vColor;\n"
+        "out vec3 vNormal;\n" // World-space normal; zero for the point fallback
+        "out vec3 vPosition;\n" // World-space position
+        "void main() {\n"
+        "    vColor = aColor;\n"
+        "    vNormal = mat3(aModel) * aPos;\n" // On a unit sphere the position is the normal
+        "    vec4 position = aModel * vec4(aPos, 1.0);\n"
+        "    vPosition = position.xyz;\n"
+        "    gl_Position = viewProjection * position;\n" // Transform vertex position
+        "}\n";
+
+    const char* bodyFragmentShaderSource =
+        "#version 330 core\n"
+        SUN_LIGHTING_FUNCTION
+        "in vec4 vColor;\n"
+        "in vec3 vNormal;\n"
+        "in vec3 vPosition;\n"
+        "out vec4 FragColor;\n"
+        "void main() {\n"
+        "    float normalLength = length(vNormal);\n"
+        "    if (normalLength == 0.0) {\n"
+        "        FragColor = vColor;\n" // Points are too small to shade
+        "        return;\n"
+        "    }\n"
+        "    FragColor = vec4(sunLighting(vColor.rgb, vNormal / normalLength, normalize(-vPosition)), vColor.a);\n"
+        "}\n";
+
+    bodyShader = loadShaderProgram(bodyVertexShaderSource, bodyFragmentShaderSource);
+
+    // Vertex and fragment shaders for ray-cast sphere impostors, used for small and distant bodies
+    const char* impostorVertexShaderSource =
+        "#version 330 core\n"
+        CAMERA_UNIFORM_BLOCK
+        "layout(location = 0) in vec3 aCorner;\n" // Quad corner in [-1, 1]
+        "layout(location = 1) in mat4 aModel;\n" // Per-instance model matrix (locations 1-4)
+        "layout(location = 5) in vec4 aColor;\n" // Per-instance color
+        "out vec3 vRay;\n" // View-space point on the quad, the ray from the eye passes through it
+        "flat out vec3 vCenter;\n" // View-space sphere center
+        "flat out float vRadius;\n"
+        "flat out vec4 vColor;\n"
+        "void main() {\n"
+        "    vColor = aColor;\n"
+        "    vCenter = (view * vec4(aModel[3].xyz, 1.0)).xyz;\n"
+        "    vRadius = length(aModel[0].xyz);\n" // The model matrix scales the unit sphere uniformly
+        "    float d = length(vCenter);\n"
+        // Quad facing the eye through the center, just large enough to cover the sphere's silhouette
+        "    float extent = vRadius * d / sqrt(max(d * d - vRadius * vRadius, 1e-6));\n"
+        "    vec3 toCenter = vCenter / d;\n"
+        "    vec3 right = normalize(cross(toCenter, vec3(0.0, 1.0, 0.0)) + vec3(1e-6, 0.0, 0.0));\n"
+        "    vec3 up = cross(right, toCenter);\n"
+        "    vRay = vCenter + (right * aCorner.x + up * aCorner.y) * extent;\n"
+        "    gl_Position = projection * vec4(vRay, 1.0);\n"
+        "}\n";
+
+    const char* impostorFragmentShaderSource =
+        "#version 330 core\n"
+        CAMERA_UNIFORM_BLOCK
+        SUN_LIGHTING_FUNCTION
+        "in vec3 vRay;\n"
+        "flat in vec3 vCenter;\n"
+        "flat in float vRadius;\n"
+        "flat in vec4 vColor;\n"
+        "out vec4 FragColor;\n"
+        "void main() {\n"
+        // Intersect the eye ray with the sphere; pixels outside the silhouette are discarded
+        "    vec3 dir = normalize(vRay);\n"
+        "    float b = dot(dir, vCenter);\n"
+        "    float h = b * b - dot(vCenter, vCenter) + vRadius * vRadius;\n"
+        "    if (h < 0.0) discard;\n"
+        "    vec3 hit = dir * (b - sqrt(h));\n"
+        "    vec3 normal = (hit - vCenter) / vRadius;\n"
+        // Write the depth of the sphere's surface, not of the quad
+        "    vec4 clip = projection * vec4(hit, 1.0);\n"
+        "    gl_FragDepth = (gl_DepthRange.diff * clip.z / clip.w + gl_DepthRange.near + gl_DepthRange.far) * 0.5;\n"
+        "    vec3 sun = (view * vec4(0.0, 0.0, 0.0, 1.0)).xyz;\n"
+        "    FragColor = vec4(sunLighting(vColor.rgb, normal, normalize(sun - hit)), vColor.a);\n"
+        "}\n";
+
+    impostorShader = loadShaderProgram(impostorVertexShaderSource, impostorFragmentShaderSource);
+
+    // Vertex and fragment shaders for labels, billboarded towards the camera
+    const char* labelVertexShaderSource =
+        "#version 330 core\n"
+        CAMERA_UNIFORM_BLOCK
+        "layout(location = 0) in vec3 aGlyph;\n" // xy = offset from the anchor, z = label index
+        "uniform samplerBuffer labelAnchors;\n" // xyz = world position, w = scale
+        "void main() {\n"
+        "    vec4 anchor = texelFetch(labelAnchors, int(aGlyph.z));\n"
+        "    vec4 viewPos = view * vec4(anchor.xyz, 1.0);\n"
+        "    viewPos.xy += aGlyph.xy * anchor.w;\n" // Offset in view space so the text faces the camera
+        "    gl_Position = projection * viewPos;\n"
+        "}\n";
+
+    const char* labelFragmentShaderSource =
+        "#version 330 core\n"
+        "out vec4 FragColor;\n"
+        "void main() {\n"
+        "    FragColor = vec4(1.0, 1.0, 1.0, 1.0);\n" // White color for text
+        "}\n";
+
+    labelShader = loadShaderProgram(labelVertexShaderSource, labelFragmentShaderSource);
+
+    glUseProgram(labelShader.id);
+    glUniform1i(labelShader.uniforms[UNIFORM_LABEL_ANCHORS], 0); // Texture unit 0
+    glUseProgram(0);
+
+    // Build the geometry of every label once
+    buildLabels();
 
-    // Vertex and fragment shaders for asteroids
-    const char* asteroidVertexShaderSource =
+    // Vertex and fragment shaders for orbit paths, generated from gl_VertexID and the orbital elements
+    const char* orbitVertexShaderSource =
         "#version 330 core\n"
-        "layout(location = 0) in vec3 aPos;\n"
-        "uniform mat4 MVP;\n" // Model-View-Projection matrix
-        "uniform float time;\n" // Time for rotation
+        CAMERA_UNIFORM_BLOCK
+        "layout(location = 0) in vec4 aElements;\n" // Semi-major axis, eccentricity, inclination, ascending node
+        "layout(location = 1) in float aPeriapsis;\n" // Argument of periapsis
+        "uniform int orbitSegments;\n"
+        ORBIT_POSITION_FUNCTION
         "void main() {\n"
-        "    float angle = time * 0.1;\n" // Rotate over time
-        "    vec3 rotatedPos = vec3(\n"
-        "        aPos.x * cos(angle) - aPos.z * sin(angle),\n"
-        "        aPos.y,\n"
-        "        aPos.x * sin(angle) + aPos.z * cos(angle)\n"
-        "    );\n"
-        "    gl_Position = MVP * vec4(rotatedPos, 1.0);\n" // Transform vertex position
+        "    float E = 6.28318530718 * float(gl_VertexID) / float(orbitSegments);\n" // Eccentric anomaly
+        "    gl_Position = viewProjection * vec4(orbitPosition(aElements, aPeriapsis, E), 1.0);\n"
         "}\n";
 
-    const char* asteroidFragmentShaderSource =
+    const char* orbitFragmentShaderSource =
         "#version 330 core\n"
         "out vec4 FragColor;\n"
-        "uniform float fogDensity;\n" // Fog density
         "void main() {\n"
-        "    float fogFactor = exp(-fogDensity * gl_FragCoord.z / gl_FragCoord.w);\n" // Fog calculation
-        "    fogFactor = clamp(fogFactor, 0.0, 1.0);\n"
-        "    vec3 fogColor = vec3(0.5, 0.5, 0.5);\n" // Gray fog color
-        "    vec3 objectColor = vec3(0.7, 0.7, 0.7);\n" // Gray asteroid color
-        "    FragColor = vec4(mix(fogColor, objectColor, fogFactor), 1.0);\n" // Apply fog
+        "    FragColor = vec4(0.5, 0.5, 0.5, 1.0);\n" // Gray color for orbits
         "}\n";
 
-    asteroidShaderProgram = createShaderProgram(asteroidVertexShaderSource, asteroidFragmentShaderSource);
+    orbitShader = loadShaderProgram(orbitVertexShaderSource, orbitFragmentShaderSource);
 
-    // Generate asteroid positions
-    asteroidPositions.resize(numAsteroids);
-    for (int i = 0; i < numAsteroids; i++) {
-        float angle = static_cast<float>(rand()) / RAND_MAX * 2.0f * M_PI;
-        float distance = 7.0f + static_cast<float>(rand()) / RAND_MAX * 1.0f; // Between 7.0 and 8.0
-        float height = (static_cast<float>(rand()) / RAND_MAX - 0.5f) * 0.5f; // Random height
-        asteroidPositions[i] = glm::vec3(distance * cos(angle), height, distance * sin(angle));
+    glUseProgram(orbitShader.id);
+    glUniform1i(orbitShader.uniforms[UNIFORM_ORBIT_SEGMENTS], ORBIT_SEGMENTS);
+    glUseProgram(0);
+
+    // Planet orbits have their real shapes and tilts at the scaled distances, and are propagated by the simulation
+    planetKeplerOrbits.resize(9);
+    for (int i = 0; i < 9; i++) {
+        float ascendingNode = glm::radians(float(planetAscendingNodes[i]));
+        float argumentOfPeriapsis = glm::radians(float(planetPerihelia[i] - planetAscendingNodes[i]));
+        OrbitPath orbit = { planetDistances[i], float(planetEccentricities[i]), glm::radians(float(planetInclinations[i])), ascendingNode, argumentOfPeriapsis };
+        orbitPaths.push_back(orbit);
+
+        KeplerOrbit kepler;
+        kepler.semiMajorAxis = orbit.semiMajorAxis;
+        kepler.eccentricity = orbit.eccentricity;
+        kepler.inclination = orbit.inclination;
+        kepler.ascendingNode = orbit.ascendingNode;
+        kepler.argumentOfPeriapsis = orbit.argumentOfPeriapsis;
+        kepler.meanAnomaly = glm::radians(float(planetLongitudes[i] - planetPerihelia[i]));
+        kepler.meanMotion = float(2.0 * M_PI / planetPeriods[i]);
+        planetKeplerOrbits.setOrbit(i, kepler);
     }
 
-    // Create VAO, VBO, and IBO for asteroids
-    glGenVertexArrays(1, &asteroidVAO);
+    // The orbit VAO only has per-instance attributes; the visible orbits are uploaded by drawOrbits()
+    glGenVertexArrays(1, &orbitVAO);
+    glGenBuffers(1, &orbitVBO);
+
+    glBindVertexArray(orbitVAO);
+    glBindBuffer(GL_ARRAY_BUFFER, orbitVBO);
+    glVertexAttribPointer(0, 4, GL_FLOAT, GL_FALSE, sizeof(OrbitPath), (void*)offsetof(OrbitPath, semiMajorAxis));
+    glEnableVertexAttribArray(0);
+    glVertexAttribDivisor(0, 1);
+    glVertexAttribPointer(1, 1, GL_FLOAT, GL_FALSE, sizeof(OrbitPath), (void*)offsetof(OrbitPath, argumentOfPeriapsis));
+    glEnableVertexAttribArray(1);
+    glVertexAttribDivisor(1, 1);
+    glBindVertexArray(0);
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+
+    // Create the camera uniform buffer and attach it to its binding point
+    glGenBuffers(1, &cameraUBO);
+    glBindBuffer(GL_UNIFORM_BUFFER, cameraUBO);
+    glBufferData(GL_UNIFORM_BUFFER, sizeof(CameraUniforms), NULL, GL_DYNAMIC_DRAW);
+    glBindBuffer(GL_UNIFORM_BUFFER, 0);
+    glBindBufferBase(GL_UNIFORM_BUFFER, CAMERA_UNIFORM_BINDING, cameraUBO);
+
+    // Real minor planets when a catalog is given and loads, a generated belt otherwise
+    if (!g_sCatalogPath.empty() && g_MinorPlanets.load(g_sCatalogPath)) {
+        loadCatalogAsteroids();
+    } else {
+        generateAsteroids();
+    }
+
+    // The elements are uploaded in sector order, the first sort here and later ones by updateAsteroidUpload(); the
+    // positions are written on the GPU every frame
+    std::unique_ptr<AsteroidSectorSort> sort = sortAsteroidSectors(asteroidBelt, float(g_dStartDay));
+    glGenBuffers(1, &asteroidElementVBO);
+    glBindBuffer(GL_ARRAY_BUFFER, asteroidElementVBO);
+    glBufferData(GL_ARRAY_BUFFER, sort->elements.size() * sizeof(PackedAsteroidElements), sort->elements.data(), GL_DYNAMIC_DRAW);
+    glGenBuffers(1, &asteroidUploadVBO);
+
     glGenBuffers(1, &asteroidVBO);
-    glGenBuffers(1, &asteroidIBO);
+    glBindBuffer(GL_ARRAY_BUFFER, asteroidVBO);
+    glBufferData(GL_ARRAY_BUFFER, numAsteroids * sizeof(glm::vec4), NULL, GL_DYNAMIC_COPY);
 
+    // Draw VAO: one point per propagated position
+    glGenVertexArrays(1, &asteroidVAO);
     glBindVertexArray(asteroidVAO);
-
-    //// Upload vertex data
     glBindBuffer(GL_ARRAY_BUFFER, asteroidVBO);
-    glBufferData(GL_ARRAY_BUFFER, asteroidPositions.size() * sizeof(glm::vec3), asteroidPositions.data(), GL_STATIC_DRAW);
+    glVertexAttribPointer(0, 4, GL_FLOAT, GL_FALSE, sizeof(glm::vec4), (void*)0);
+    glEnableVertexAttribArray(0);
+
+    glBindVertexArray(0); // Unbind VAO
+    glBindBuffer(GL_ARRAY_BUFFER, 0); // Unbind buffers
+
+    // Transform feedback VAO: the packed elements as one integer uvec4 attribute
+    glGenVertexArrays(1, &asteroidPropagateVAO);
+    bindAsteroidElements();
+
+    if (asteroidComputeShaders) {
+        glGenBuffers(1, &asteroidRangeBuffer);
+    }
+
+    installAsteroidSort(*sort);
+    startAsteroidWorker();
+    buildRockMeshes();
+
+    // Density render target; the texture is sized by drawAsteroidDensity() once the window size is known
+    glGenTextures(1, &asteroidDensityTexture);
+    glBindTexture(GL_TEXTURE_2D, asteroidDensityTexture);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_RG32F, 1, 1, 0, GL_RG, GL_FLOAT, NULL); // Storage for the completeness check
+    asteroidDensityWidth = asteroidDensityHeight = 1;
+    glBindTexture(GL_TEXTURE_2D, 0);
+
+    glGenFramebuffers(1, &asteroidDensityFBO);
+    glBindFramebuffer(GL_FRAMEBUFFER, asteroidDensityFBO);
+    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, asteroidDensityTexture, 0);
+    if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE) {
+        std::cerr << "Asteroid density framebuffer is incomplete" << std::endl;
+    }
+    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+
+    glGenVertexArrays(1, &asteroidResolveVAO);
 
-    //// Set up vertex attribute pointers
+    if (g_bNBody) {
+        startNBody();
+    } else if (g_bPerturbed) {
+        startBeltIntegrator();
+    }
+}
+
+// Function to upload body mesh geometry and attach the per-instance attributes
+void uploadBodyMesh(SphereMesh& mesh, const std::vector<glm::vec3>& vertices, const std::vector<GLuint>& indices) {
+    glGenVertexArrays(1, &mesh.vao);
+    glGenBuffers(1, &mesh.vbo);
+    glGenBuffers(1, &mesh.ibo);
+    glGenBuffers(1, &mesh.instanceVBO);
+
+    glBindVertexArray(mesh.vao);
+
+    glBindBuffer(GL_ARRAY_BUFFER, mesh.vbo);
+    glBufferData(GL_ARRAY_BUFFER, vertices.size() * sizeof(glm::vec3), vertices.data(), GL_STATIC_DRAW);
+
+    // Attribute 0 is the vertex position (aPos)
     glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(glm::vec3), (void*)0);
     glEnableVertexAttribArray(0);
 
-    //// Generate indices for asteroids (each asteroid is a point)
-    std::vector<GLuint> indices(numAsteroids);
-    for (int i = 0; i < numAsteroids; i++) {
-        indices[i] = i;
+    // Attributes 1-4 (model matrix columns) and 5 (color) advance once per instance
+    glBindBuffer(GL_ARRAY_BUFFER, mesh.instanceVBO);
+    for (int column = 0; column < 4; column++) {
+        glVertexAttribPointer(1 + column, 4, GL_FLOAT, GL_FALSE, sizeof(BodyInstance), (void*)(offsetof(BodyInstance, model) + column * sizeof(glm::vec4)));
+        glEnableVertexAttribArray(1 + column);
+        glVertexAttribDivisor(1 + column, 1);
     }
+    glVertexAttribPointer(5, 4, GL_FLOAT, GL_FALSE, sizeof(BodyInstance), (void*)offsetof(BodyInstance, color));
+    glEnableVertexAttribArray(5);
+    glVertexAttribDivisor(5, 1);
 
-    // Upload index data
-    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, asteroidIBO);
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, mesh.ibo);
     glBufferData(GL_ELEMENT_ARRAY_BUFFER, indices.size() * sizeof(GLuint), indices.data(), GL_STATIC_DRAW);
-        
+
     glBindVertexArray(0); // Unbind VAO
     glBindBuffer(GL_ARRAY_BUFFER, 0); // Unbind buffers
     glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
-    
 }
 
-void drawSolidSphere(float radius, int slices, int stacks) {
-    std::vector<float> vertices;
-    std::vector<float> normals;
-    std::vector<float> texCoords;
+// Function to get the cached unit sphere mesh for the given tessellation, building it on first use
+const SphereMesh& getSphereMesh(int slices, int stacks) {
+    std::map<std::pair<int, int>, SphereMesh>::iterator it = sphereMeshCache.find(std::make_pair(slices, stacks));
+    if (it != sphereMeshCache.end()) {
+        return it->second;
+    }
 
+    // Unit sphere vertices; the position doubles as the normal
+    std::vector<glm::vec3> vertices;
+    vertices.reserve((stacks + 1) * (slices + 1));
     for (int i = 0; i <= stacks; ++i) {
         float phi = static_cast<float>(i) / static_cast<float>(stacks) * M_PI;
         for (int j = 0; j <= slices; ++j) {
             float theta = static_cast<float>(j) / static_cast<float>(slices) * 2.0f * M_PI;
+            vertices.push_back(glm::vec3(cos(theta) * sin(phi), cos(phi), sin(theta) * sin(phi)));
+        }
+    }
 
-            float x = cos(theta) * sin(phi);
-            float y = cos(phi);
-            float z = sin(theta) * sin(phi);
+    // Two triangles per quad between neighbouring stacks
+    std::vector<GLuint> indices;
+    indices.reserve(stacks * slices * 6);
+    for (int i = 0; i < stacks; ++i) {
+        for (int j = 0; j < slices; ++j) {
+            GLuint index = i * (slices + 1) + j;
+            GLuint below = index + slices + 1;
+            indices.push_back(index);
+            indices.push_back(below);
+            indices.push_back(index + 1);
+            indices.push_back(index + 1);
+            indices.push_back(below);
+            indices.push_back(below + 1);
+        }
+    }
 
-            float u = static_cast<float>(j) / static_cast<float>(slices);
-            float v = static_cast<float>(i) / static_cast<float>(stacks);
+    SphereMesh mesh;
+    mesh.indexCount = static_cast<GLsizei>(indices.size());
+    uploadBodyMesh(mesh, vertices, indices);
+    mesh.mode = GL_TRIANGLES;
 
-            vertices.push_back(radius * x);
-            vertices.push_back(radius * y);
-            vertices.push_back(radius * z);
+    return sphereMeshCache[std::make_pair(slices, stacks)] = mesh;
+}
 
-            normals.push_back(x);
-            normals.push_back(y);
-            normals.push_back(z);
+// Function to get the single-vertex mesh used for bodies below the coarsest level of detail
+const SphereMesh& getPointMesh() {
+    static SphereMesh mesh = {};
+    if (mesh.vao == 0) {
+        std::vector<glm::vec3> vertices(1, glm::vec3(0.0f)); // The body's center
+        std::vector<GLuint> indices(1, 0);
+        mesh.indexCount = 1;
+        uploadBodyMesh(mesh, vertices, indices);
+        mesh.mode = GL_POINTS;
+    }
+    return mesh;
+}
 
-            texCoords.push_back(u);
-            texCoords.push_back(v);
+// Function to get the quad used by the ray-cast sphere impostors
+const SphereMesh& getImpostorMesh() {
+    static SphereMesh mesh = {};
+    if (mesh.vao == 0) {
+        // Quad corners; the vertex shader turns them into a camera-facing square around the sphere
+        std::vector<glm::vec3> vertices;
+        vertices.push_back(glm::vec3(-1.0f, -1.0f, 0.0f));
+        vertices.push_back(glm::vec3( 1.0f, -1.0f, 0.0f));
+        vertices.push_back(glm::vec3(-1.0f,  1.0f, 0.0f));
+        vertices.push_back(glm::vec3( 1.0f,  1.0f, 0.0f));
+        std::vector<GLuint> indices;
+        for (GLuint i = 0; i < 4; i++) {
+            indices.push_back(i);
         }
+        mesh.indexCount = 4;
+        uploadBodyMesh(mesh, vertices, indices);
+        mesh.mode = GL_TRIANGLE_STRIP;
     }
+    return mesh;
+}
 
-    glEnableClientState(GL_VERTEX_ARRAY);
-    glEnableClientState(GL_NORMAL_ARRAY);
-    glEnableClientState(GL_TEXTURE_COORD_ARRAY);
+// Function to get the mesh for a level of detail
+const SphereMesh& getLodMesh(int lod) {
+    if (lod == LOD_POINT) {
+        return getPointMesh();
+    }
+    if (lod == LOD_IMPOSTOR) {
+        return getImpostorMesh();
+    }
+    return getSphereMesh(sphereLods[lod].slices, sphereLods[lod].stacks);
+}
 
-    glVertexPointer(3, GL_FLOAT, 0, vertices.data());
-    glNormalPointer(GL_FLOAT, 0, normals.data());
-    glTexCoordPointer(2, GL_FLOAT, 0, texCoords.data());
+// Function to get the radius in pixels of a sphere projected on the screen
+float projectedPixelRadius(const Camera& camera, const glm::vec3& center, float radius) {
+    // Clamp the distance so a camera inside the sphere gets a large radius rather than a negative one
+    float distance = glm::max(glm::length(center - camera.eye), radius * 1.01f);
+    return radius / distance * camera.projection[1][1] * 0.5f * camera.height;
+}
 
-    for (int i = 0; i < stacks; ++i) {
-        glBegin(GL_TRIANGLE_STRIP);
-        for (int j = 0; j <= slices; ++j) {
-            int index = i * (slices + 1) + j;
-            glArrayElement(index);
-            glArrayElement(index + slices + 1);
-        }
-        glEnd();
-    }
+// Function to pick a level of detail from the body's projected screen radius, with hysteresis
+int selectSphereLod(const Camera& camera, const glm::vec3& center, float radius, int currentLod) {
+    float pixels = projectedPixelRadius(camera, center, radius);
 
-    glDisableClientState(GL_VERTEX_ARRAY);
-    glDisableClientState(GL_NORMAL_ARRAY);
-    glDisableClientState(GL_TEXTURE_COORD_ARRAY);
+    // Only change level once the threshold has been crossed by the hysteresis margin
+    int lod = currentLod;
+    while (lod + 1 < NUM_SPHERE_LODS && pixels >= sphereLods[lod + 1].minPixels * (1.0f + LOD_HYSTERESIS)) {
+        lod++;
+    }
+    while (lod > LOD_POINT && pixels < sphereLods[lod].minPixels * (1.0f - LOD_HYSTERESIS)) {
+        lod--;
+    }
+    return lod;
 }
 
-// Function to draw the Sun with a burning effect
-void drawSun() {
-    glUseProgram(sunShaderProgram);
+// Function to draw a cached sphere mesh; the radius comes from the current model matrix
+void drawSphereMesh(const SphereMesh& mesh) {
+    glBindVertexArray(mesh.vao);
+    glDrawElements(mesh.mode, mesh.indexCount, GL_UNSIGNED_INT, 0);
+    glBindVertexArray(0);
+}
 
-    // Pass time uniform to the shader
-    float time = SDL_GetTicks() / 1000.0f; // Get time in seconds
-    GLint timeLocation = glGetUniformLocation(sunShaderProgram, "time");
-    glUniform1f(timeLocation, time);
+// Function to gather a planet or moon for culling; the model matrix includes the radius
+void gatherBody(const glm::mat4& model, float radius, const glm::vec3& color, int& lod, const std::string& name) {
+    BodyCandidate candidate;
+    candidate.model = model;
+    candidate.color = color;
+    candidate.lod = &lod;
+    candidate.name = &name;
+    bodyCandidates.push_back(candidate);
+    bodySpheres.add(glm::vec3(model[3]), radius);
+}
 
-    // Calculate MVP matrix for the Sun using GLM
-    glm::mat4 model = glm::mat4(1.0f); // Identity matrix
-    // Get the View matrix
-    glm::mat4 view;
-    glGetFloatv(GL_MODELVIEW_MATRIX, &view[0][0]);
+// Function to queue a planet or moon for the instanced body renderer at the given level of detail
+void queueBody(const glm::mat4& model, const glm::vec3& color, int lod) {
+    BodyInstance instance;
+    instance.model = model;
+    instance.color = glm::vec4(color, 1.0f);
+    bodyInstances[lod - LOD_POINT].push_back(instance);
+}
 
-    // Get the Projection matrix
-    glm::mat4 projection;
-    glGetFloatv(GL_PROJECTION_MATRIX, &projection[0][0]);
+// Function to cull the gathered bodies in one batch and queue the visible ones and their labels
+void cullBodies(const Camera& camera) {
+    std::vector<unsigned char> visibility;
+    cullSphereBatch(camera, bodySpheres, visibility);
 
-    glm::mat4 MVP = projection * view * model;
+    for (size_t i = 0; i < bodyCandidates.size(); i++) {
+        if (!visibility[i]) {
+            continue;
+        }
 
-    // Pass MVP matrix to the shader
-    GLint mvpLocation = glGetUniformLocation(sunShaderProgram, "MVP");
-    glUniformMatrix4fv(mvpLocation, 1, GL_FALSE, glm::value_ptr(MVP));
+        const BodyCandidate& body = bodyCandidates[i];
+        glm::vec3 center(bodySpheres.x[i], bodySpheres.y[i], bodySpheres.z[i]);
+        *body.lod = selectSphereLod(camera, center, bodySpheres.radius[i], *body.lod);
+        queueBody(body.model, body.color, *body.lod);
 
-    drawSolidSphere(0.5, 50, 50); // Draw the Sun with a smaller radius (0.5)
+        // Show the body's name, billboarded at the body's position
+        placeLabel(*body.name, center);
+    }
 
-    glUseProgram(0); // Switch back to fixed-function pipeline
+    bodyCandidates.clear();
+    bodySpheres.clear();
 }
 
-// Function to draw Saturn's rings
-void drawSaturnRings(float radius) {
-    glUseProgram(saturnShaderProgram);
+// Function to draw all queued planets and moons with one instanced call per level of detail
+void drawBodies(const Camera& camera) {
+    // Instances carry their model matrix, the view-projection comes from the camera block
+    glPointSize(2.0f); // Point fallback for bodies smaller than the coarsest mesh
+
+    for (int lod = LOD_POINT; lod < NUM_SPHERE_LODS; lod++) {
+        std::vector<BodyInstance>& instances = bodyInstances[lod - LOD_POINT];
+        if (instances.empty()) {
+            continue;
+        }
 
-    // Calculate MVP matrix for Saturn's rings using GLM
-    glm::mat4 model = glm::mat4(1.0f); // Identity matrix
+        // Impostors ray-cast the sphere in their own shader, points and meshes share the body shader
+        glUseProgram(lod == LOD_IMPOSTOR ? impostorShader.id : bodyShader.id);
 
-    // Get the View matrix
-    glm::mat4 view;
-    glGetFloatv(GL_MODELVIEW_MATRIX, &view[0][0]);
+        // Upload this level's instances, orphaning the previous contents
+        const SphereMesh& mesh = getLodMesh(lod);
+        glBindBuffer(GL_ARRAY_BUFFER, mesh.instanceVBO);
+        glBufferData(GL_ARRAY_BUFFER, instances.size() * sizeof(BodyInstance), instances.data(), GL_STREAM_DRAW);
+        glBindBuffer(GL_ARRAY_BUFFER, 0);
 
-    // Get the Projection matrix
-    glm::mat4 projection;
-    glGetFloatv(GL_PROJECTION_MATRIX, &projection[0][0]);
+        glBindVertexArray(mesh.vao);
+        glDrawElementsInstanced(mesh.mode, mesh.indexCount, GL_UNSIGNED_INT, 0, static_cast<GLsizei>(instances.size()));
+        glBindVertexArray(0);
 
-    // Calculate the Model-View-Projection matrix
-    glm::mat4 MVP = projection * view * model;
+        instances.clear();
+    }
 
-    // Pass MVP matrix to the shader
-    GLint mvpLocation = glGetUniformLocation(saturnShaderProgram, "MVP");
-    glUniformMatrix4fv(mvpLocation, 1, GL_FALSE, glm::value_ptr(MVP));
+    glPointSize(1.0f);
+    glUseProgram(0); // Unbind the shader program
+}
 
-    glBegin(GL_LINE_LOOP);
-    for (int i = 0; i < 100; i++) {
-        float angle = 2.0f * M_PI * i / 100;
-        glVertex3f(radius * cos(angle), 0.0f, radius * sin(angle));
+// Function to draw the Sun with a burning effect
+void drawSun(const Camera& camera) {
+    if (!isSphereVisible(camera, glm::vec3(0.0f), 0.5f)) {
+        return;
     }
-    glEnd();
 
-    glUseProgram(0); // Switch back to fixed-function pipeline
+    glUseProgram(sunShader.id);
+
+    // Pass the model matrix to the shader; time and view-projection come from the camera block
+    glm::mat4 model = glm::scale(glm::mat4(1.0f), glm::vec3(0.5f)); // Scale the unit sphere to the Sun's radius (0.5)
+    glUniformMatrix4fv(sunShader.uniforms[UNIFORM_MODEL], 1, GL_FALSE, glm::value_ptr(model));
+
+    // The Sun's shader only handles real geometry, so it never drops below the coarsest mesh
+    sunLod = glm::max(selectSphereLod(camera, glm::vec3(0.0f), 0.5f, sunLod), LOD_IMPOSTOR + 1);
+    drawSphereMesh(getLodMesh(sunLod)); // Draw the Sun
+
+    glUseProgram(0); // Unbind the shader program
 }
 
-// Function to draw a moon
-void drawMoon(float distance, float size, float orbitAngle, float planetAngle, float speed, const std::string& name) {
-    glPushMatrix();
-    
-    glm::mat4 mvorig, mvorbit, mvplanet, mvtext;
-    glGetFloatv(GL_MODELVIEW_MATRIX, &mvorig[0][0]);
+// Function to draw Saturn's rings
+void drawSaturnRings(const Camera& camera, const glm::mat4& model, float radius) {
+    glUseProgram(saturnShader.id);
 
-    mvorbit = mvorig;
-    // Calculate the Model-View-Projection matrix
-    
-    // Move to the moon's orbit
-    mvorbit = glm::rotate(mvorbit, glm::radians(orbitAngle), glm::vec3(0.0f, 1.0f, 0.0f));
-    
-    // Rotate the moon on its axis
-    mvorbit = glm::translate(mvorbit, glm::vec3(distance, 0.0f, 0.0f));
+    // Pass the model matrix to the shader, scaling the unit ring out to the ring radius
+    glm::mat4 ringModel = glm::scale(model, glm::vec3(radius));
+    glUniformMatrix4fv(saturnShader.uniforms[UNIFORM_MODEL], 1, GL_FALSE, glm::value_ptr(ringModel));
 
-    mvtext = glm::rotate(mvorbit, glm::radians(360.0f - planetAngle - orbitAngle), glm::vec3(0.0f, 1.0f, 0.0f));
+    glBindVertexArray(ringVAO);
+    glDrawArrays(GL_LINE_LOOP, 0, RING_SEGMENTS);
+    glBindVertexArray(0);
 
-    glLoadMatrixf(glm::value_ptr(mvorbit));
+    glUseProgram(0); // Unbind the shader program
+}
 
-    //glRotatef(orbitAngle, 0.0, 1.0, 0.0); // Rotate around the planet
-    //glTranslatef(distance, 0.0, 0.0);     // Move to the moon's orbit
-    glColor3f(0.8f, 0.8f, 0.8f); // Gray color for moons
-    drawSolidSphere(size, 20, 20); // Draw the moon
+// Function to draw a moon
+void drawMoon(TransformStack& transforms, float distance, float size, float orbitAngle, float planetAngle, float speed, const std::string& name, int& lod) {
+    transforms.push();
 
-    glLoadMatrixf(glm::value_ptr(mvtext));
+    // Rotate around the planet
+    transforms.rotate(orbitAngle, glm::vec3(0.0f, 1.0f, 0.0f));
+    // Move to the moon's orbit
+    transforms.translate(glm::vec3(distance, 0.0f, 0.0f));
 
-    // Render the moon's name
-    glColor3f(1.0f, 1.0f, 1.0f); // White color for text
-    renderText(name.c_str(), 0, 0.0f, - (size + 0.5f), 0.0f); // Display name above the moon
+    // Gather the moon in gray, scaled to its size
+    transforms.push();
+    transforms.scale(glm::vec3(size));
+    gatherBody(transforms.top(), size, glm::vec3(0.8f, 0.8f, 0.8f), lod, name);
+    transforms.pop();
 
-    glPopMatrix();
+    transforms.pop();
 }
 
 // Function to draw a planet and its moons
-void drawPlanet(float radius, float distance, const std::vector<float>& color, float orbitAngle, float rotationAngle, const std::string& name, const std::vector<Moon>& moons) {
-    glPushMatrix();
-    // Get the View matrix
-    glm::mat4 mvorig, mvorbit, mvplanet, mvtext;
-    glGetFloatv(GL_MODELVIEW_MATRIX, &mvorig[0][0]);
-
-    mvorbit = mvorig;
-    // Calculate the Model-View-Projection matrix
-    // Rotate around the Sun
-    mvorbit = glm::rotate(mvorbit, glm::radians(orbitAngle), glm::vec3(0.0f, 1.0f, 0.0f));
-    // Move to the planet's orbit
-    mvorbit = glm::translate(mvorbit, glm::vec3(distance, 0.0f, 0.0f));
+void drawPlanet(const Camera& camera, TransformStack& transforms, float radius, const glm::vec3& position, const std::vector<float>& color, float orbitAngle, float rotationAngle, const std::string& name, std::vector<Moon>& moons, int& lod) {
+    transforms.push();
+
+    // Move to the planet's place on its orbit, turned with its mean longitude so its moons keep their frame
+    transforms.translate(position);
+    transforms.rotate(orbitAngle, glm::vec3(0.0f, 1.0f, 0.0f));
+
     // Rotate the planet on its axis
-    mvplanet = glm::rotate(mvorbit, glm::radians(rotationAngle), glm::vec3(0.0f, 1.0f, 0.0f));
-    // Rotate the text
-    mvtext = glm::rotate(mvorbit, glm::radians(360.0f - orbitAngle), glm::vec3(0.0f, 1.0f, 0.0f));
+    transforms.push();
+    transforms.rotate(rotationAngle, glm::vec3(0.0f, 1.0f, 0.0f));
+
+    // Gather the planet, scaled to its radius
+    transforms.push();
+    transforms.scale(glm::vec3(radius));
+    gatherBody(transforms.top(), radius, glm::vec3(color[0], color[1], color[2]), lod, name);
+    transforms.pop();
+
+    // Draw Saturn's rings if it's Saturn and they are in view
+    if (name == "Saturn" && isSphereVisible(camera, glm::vec3(transforms.top()[3]), radius * 1.5f)) {
+        drawSaturnRings(camera, transforms.top(), radius * 1.5); // Draw rings around Saturn
+    }
+
+    // Draw moons
+    for (Moon& moon : moons) {
+        drawMoon(transforms, moon.distance, moon.size, moon.orbit, rotationAngle + orbitAngle, moon.speed, moon.name, moon.lod);
+    }
 
-    //load modelview matrix
-    glLoadMatrixf(glm::value_ptr(mvplanet));
+    transforms.pop();
 
-    glColor3fv(color.data()); // Set planet color
-    drawSolidSphere(radius, 20, 20); // Draw the planet
+    transforms.pop();
+}
 
-    // Draw Saturn's rings if it's Saturn
-    if (name == "Saturn") {
-        drawSaturnRings(radius * 1.5); // Draw rings around Saturn
+// Function to keep the belt integrator up with the animation and hand its newest orbits to the belt worker, which
+// packs and sorts them off the render thread
+void updateBeltSnapshot(float days) {
+    double snapshotDay;
+    if (g_NBody.running()) {
+        g_NBody.setTargetDay(days);
+        if (g_NBody.takeSnapshot(nbodySnapshot, snapshotDay)) {
+            // The planets' orbits drive their positions and replace their drawn orbits
+            nbodyPlanetOrbits.resize(9);
+            for (int i = 0; i < 9; i++) {
+                AsteroidElements elements;
+                sceneOrbit(nbodySnapshot[i], elements);
+                KeplerOrbit orbit = { elements.semiMajorAxis, elements.eccentricity, elements.inclination, elements.ascendingNode,
+                                      elements.argumentOfPeriapsis, elements.meanAnomaly, elements.meanMotion };
+                nbodyPlanetOrbits.setOrbit(i, orbit);
+                nbodyPlanetPeriods[i] = 2.0 * M_PI / double(elements.meanMotion);
+                OrbitPath path = { elements.semiMajorAxis, elements.eccentricity, elements.inclination, elements.ascendingNode, elements.argumentOfPeriapsis };
+                orbitPaths[i] = path;
+            }
+            orbitVisibility.clear(); // Upload the new orbits
+            requestAsteroidSnapshot(nbodySnapshot, 9, days);
+        }
+    } else {
+        g_BeltIntegrator.setTargetDay(days);
+        if (g_BeltIntegrator.takeSnapshot(beltSnapshot, snapshotDay)) {
+            requestAsteroidSnapshot(beltSnapshot, 0, days);
+        }
     }
+}
 
-    // Draw moons
-    for (const Moon& moon : moons) {
-        drawMoon(moon.distance, moon.size, moon.orbit, rotationAngle + orbitAngle, moon.speed, moon.name);
+// Function to cull the asteroid sectors and pick how many asteroids of each visible sector to draw
+void cullAsteroidSectors(const Camera& camera, float days) {
+    // Sort again once the fastest-spreading sector has widened by a whole slice. The sectors stay valid until the
+    // worker's sort is swapped in, their bounds only widen further
+    const float sliceWidth = 2.0f * M_PI / ASTEROID_SECTOR_SLICES;
+    if (fabs(days - asteroidSectorDays) * asteroidDriftRate > sliceWidth && asteroidSortsIdle()) {
+        requestAsteroidSort(asteroidBelt, days);
+    }
+
+    // Bounding sphere of each sector's annular wedge at the current time
+    float elapsed = days - asteroidSectorDays;
+    asteroidSectorSpheres.clear();
+    for (const AsteroidSector& sector : asteroidSectors) {
+        // The true longitude stays within about 2e of the mean longitude, inclined orbits add about i^2/2
+        float margin = 2.0f * sector.maxEccentricity + 0.5f * sector.maxInclination * sector.maxInclination;
+        float minLongitude = sector.minLongitude + glm::min(sector.minMeanMotion * elapsed, sector.maxMeanMotion * elapsed) - margin;
+        float maxLongitude = sector.maxLongitude + glm::max(sector.minMeanMotion * elapsed, sector.maxMeanMotion * elapsed) + margin;
+        float halfWidth = 0.5f * (maxLongitude - minLongitude);
+
+        if (sector.count == 0 || halfWidth >= 0.5f * M_PI) {
+            // Empty, or wide enough that the whole ring is the tighter bound
+            asteroidSectorSpheres.add(glm::vec3(0.0f), sqrt(sector.maxRadius * sector.maxRadius + sector.maxHeight * sector.maxHeight));
+            continue;
+        }
+
+        // Center on the middle line of the wedge; the farthest points of the wedge are then its corners
+        float middle = minLongitude + halfWidth;
+        glm::vec3 direction(cos(middle), 0.0f, -sin(middle));
+        glm::vec3 center = direction * (0.5f * (sector.minRadius * cos(halfWidth) + sector.maxRadius));
+        glm::vec3 edge(cos(minLongitude), 0.0f, -sin(minLongitude));
+        float corner = glm::max(glm::length(edge * sector.minRadius - center), glm::length(edge * sector.maxRadius - center));
+        asteroidSectorSpheres.add(center, sqrt(corner * corner + sector.maxHeight * sector.maxHeight));
+    }
+
+    cullSphereBatch(camera, asteroidSectorSpheres, asteroidSectorVisibility);
+
+    // Pick the tier of every visible sector from the distance to its bounding sphere, and switch distant sectors to
+    // density splats once they have more asteroids than the points would draw
+    asteroidSectorTiers.assign(asteroidSectors.size(), -1);
+    asteroidSectorPixels.assign(asteroidSectors.size(), 0.0f);
+    GLsizei densityAsteroids = 0;
+    for (size_t i = 0; i < asteroidSectors.size(); i++) {
+        if (!asteroidSectorVisibility[i] || asteroidSectors[i].count == 0) {
+            continue;
+        }
+        glm::vec3 center(asteroidSectorSpheres.x[i], asteroidSectorSpheres.y[i], asteroidSectorSpheres.z[i]);
+        float radius = asteroidSectorSpheres.radius[i];
+        float distance = glm::length(center - camera.eye) - radius;
+        asteroidSectorTiers[i] = distance < ASTEROID_ROCK_DISTANCE ? ASTEROID_ROCKS :
+                                 distance < ASTEROID_SPRITE_DISTANCE ? ASTEROID_SPRITES : ASTEROID_POINTS;
+
+        // Pixels per scene unit at the sector's distance gives the screen area of the sector's share of the belt
+        float scale = projectedPixelRadius(camera, center, radius) / radius;
+        asteroidSectorPixels[i] = asteroidSectors[i].area * scale * scale;
+        if (asteroidSectorTiers[i] == ASTEROID_POINTS && asteroidSectors[i].count > asteroidSectorPixels[i] * ASTEROID_POINTS_PER_PIXEL) {
+            asteroidSectorTiers[i] = ASTEROID_DENSITY;
+            densityAsteroids += asteroidSectors[i].count;
+        }
     }
 
-    glLoadMatrixf(glm::value_ptr(mvtext));
-   
-    // Render the planet's name
-    glColor3f(1.0, 1.0, 1.0); // White color for text
-    renderText(name.c_str(), 1, 0.0f, radius + 1.0f, 0.0f); // Display name above the planet
+    // Every density sector draws the same fraction of its asteroids, so one weight per splat keeps the density right.
+    // The splats are bounded by the density texture's size, however many asteroids the sectors hold
+    float densityTexels = float(camera.width / ASTEROID_DENSITY_DOWNSAMPLE) * float(camera.height / ASTEROID_DENSITY_DOWNSAMPLE);
+    float densityBudget = glm::max(densityTexels, 1.0f) * ASTEROID_DENSITY_SAMPLES_PER_TEXEL;
+    float densityFraction = densityAsteroids > 0 ? glm::min(densityBudget / densityAsteroids, 1.0f) : 1.0f;
+
+    // Pack the drawn ranges tier by tier. Distant sectors only draw a prefix, which is a random sample of the sector
+    asteroidRanges.clear();
+    asteroidRangeFirsts.clear();
+    asteroidRangeCounts.clear();
+    numVisibleAsteroids = 0;
+    for (int tier = 0; tier < NUM_ASTEROID_TIERS; tier++) {
+        numTierAsteroids[tier] = 0;
+        for (size_t i = 0; i < asteroidSectors.size(); i++) {
+            if (asteroidSectorTiers[i] != tier) {
+                continue;
+            }
 
-    glPopMatrix();
+            const AsteroidSector& sector = asteroidSectors[i];
+            float budget = tier == ASTEROID_DENSITY ? ceil(sector.count * densityFraction) : asteroidSectorPixels[i] * ASTEROID_POINTS_PER_PIXEL;
+            GLsizei count = budget < sector.count ? glm::max(GLsizei(budget), 1) : sector.count;
+
+            asteroidRanges.push_back(sector.first);
+            asteroidRanges.push_back(count);
+            asteroidRanges.push_back(numVisibleAsteroids);
+            asteroidRanges.push_back(0);
+            asteroidRangeFirsts.push_back(sector.first);
+            asteroidRangeCounts.push_back(count);
+            numVisibleAsteroids += count;
+            numTierAsteroids[tier] += count;
+        }
+    }
+    asteroidDensityWeight = numTierAsteroids[ASTEROID_DENSITY] > 0 ? float(densityAsteroids) / numTierAsteroids[ASTEROID_DENSITY] : 1.0f;
 }
 
-// Function to draw the asteroid belt
-void drawAsteroidBelt() {
-    glUseProgram(asteroidShaderProgram);
+// Function to move the drawn asteroids along their orbits to the given time, entirely on the GPU.
+// Positions are packed in sector order, so the draw call reads them as one range
+void propagateAsteroids(float days) {
+    if (numVisibleAsteroids == 0) {
+        return;
+    }
 
-    // Calculate MVP matrix for the asteroid belt using GLM
-    glm::mat4 model = glm::mat4(1.0f); // Identity matrix
-    // Get the View matrix
-    glm::mat4 view;
-    glGetFloatv(GL_MODELVIEW_MATRIX, &view[0][0]);
+    glUseProgram(asteroidPropagateShader.id);
+    glUniform1f(asteroidPropagateShader.uniforms[UNIFORM_DAYS], days);
+
+    if (asteroidComputeShaders) {
+        glBindBuffer(GL_SHADER_STORAGE_BUFFER, asteroidRangeBuffer);
+        glBufferData(GL_SHADER_STORAGE_BUFFER, asteroidRanges.size() * sizeof(GLuint), asteroidRanges.data(), GL_STREAM_DRAW);
+        glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+
+        glBindBufferBase(GL_SHADER_STORAGE_BUFFER, ASTEROID_ELEMENT_BINDING, asteroidElementVBO);
+        glBindBufferBase(GL_SHADER_STORAGE_BUFFER, ASTEROID_POSITION_BINDING, asteroidVBO);
+        glBindBufferBase(GL_SHADER_STORAGE_BUFFER, ASTEROID_RANGE_BINDING, asteroidRangeBuffer);
+        glDispatchCompute(GLuint(asteroidRangeCounts.size()), 1, 1);
+
+        // The positions are read as vertex attributes by the draw call
+        glMemoryBarrier(GL_VERTEX_ATTRIB_ARRAY_BARRIER_BIT);
+    } else {
+        // Capture one position per drawn asteroid, nothing is rasterized
+        glEnable(GL_RASTERIZER_DISCARD);
+        glBindBufferBase(GL_TRANSFORM_FEEDBACK_BUFFER, 0, asteroidVBO);
+        glBindVertexArray(asteroidPropagateVAO);
+        glBeginTransformFeedback(GL_POINTS);
+        glMultiDrawArrays(GL_POINTS, asteroidRangeFirsts.data(), asteroidRangeCounts.data(), GLsizei(asteroidRangeCounts.size()));
+        glEndTransformFeedback();
+        glBindVertexArray(0);
+        glBindBufferBase(GL_TRANSFORM_FEEDBACK_BUFFER, 0, 0);
+        glDisable(GL_RASTERIZER_DISCARD);
+    }
 
-    // Get the Projection matrix
-    glm::mat4 projection;
-    glGetFloatv(GL_PROJECTION_MATRIX, &projection[0][0]);
+    glUseProgram(0); // Unbind the shader program
+}
 
-    glm::mat4 MVP = projection * view * model;
+// Function to draw the density-tier asteroids: splat them additively into the low-resolution density texture, then
+// resolve it over the screen as belt coverage. It runs before the opaque bodies, which then hide the belt behind them
+void drawAsteroidDensity(const Camera& camera) {
+    // (Re)size the density texture with the window
+    int width = glm::max(camera.width / ASTEROID_DENSITY_DOWNSAMPLE, 1);
+    int height = glm::max(camera.height / ASTEROID_DENSITY_DOWNSAMPLE, 1);
+    if (width != asteroidDensityWidth || height != asteroidDensityHeight) {
+        asteroidDensityWidth = width;
+        asteroidDensityHeight = height;
+        glBindTexture(GL_TEXTURE_2D, asteroidDensityTexture);
+        glTexImage2D(GL_TEXTURE_2D, 0, GL_RG32F, width, height, 0, GL_RG, GL_FLOAT, NULL);
+        glBindTexture(GL_TEXTURE_2D, 0);
+    }
+
+    if (numTierAsteroids[ASTEROID_DENSITY] == 0) {
+        return;
+    }
+
+    GLint first = numTierAsteroids[ASTEROID_ROCKS] + numTierAsteroids[ASTEROID_SPRITES] + numTierAsteroids[ASTEROID_POINTS];
 
-    // Pass MVP matrix to the shader
-    GLint mvpLocation = glGetUniformLocation(asteroidShaderProgram, "MVP");
-    glUniformMatrix4fv(mvpLocation, 1, GL_FALSE, glm::value_ptr(MVP));
+    // Accumulate the splats; every asteroid adds its weight to the texel it lands in
+    glBindFramebuffer(GL_FRAMEBUFFER, asteroidDensityFBO);
+    glViewport(0, 0, width, height);
+    const GLfloat zero[4] = { 0.0f, 0.0f, 0.0f, 0.0f };
+    glClearBufferfv(GL_COLOR, 0, zero);
+    glDisable(GL_DEPTH_TEST);
+    glEnable(GL_BLEND);
+    glBlendFunc(GL_ONE, GL_ONE);
 
-    // Pass time uniform to the shader for rotation
-    float time = SDL_GetTicks() / 1000.0f; // Get time in seconds
-    GLint timeLocation = glGetUniformLocation(asteroidShaderProgram, "time");
-    glUniform1f(timeLocation, time);
+    glUseProgram(asteroidSplatShader.id);
+    glUniform1f(asteroidSplatShader.uniforms[UNIFORM_DENSITY_WEIGHT], asteroidDensityWeight);
+    glBindVertexArray(asteroidVAO);
+    glDrawArrays(GL_POINTS, first, numTierAsteroids[ASTEROID_DENSITY]);
+
+    // Resolve over the background
+    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+    glViewport(0, 0, camera.width, camera.height);
+    glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+    glUseProgram(asteroidResolveShader.id);
+    glBindTexture(GL_TEXTURE_2D, asteroidDensityTexture);
+    glBindVertexArray(asteroidResolveVAO);
+    glDrawArrays(GL_TRIANGLES, 0, 3);
+
+    glBindVertexArray(0);
+    glBindTexture(GL_TEXTURE_2D, 0);
+    glDisable(GL_BLEND);
+    glEnable(GL_DEPTH_TEST);
+    glUseProgram(0); // Unbind the shader program
+}
 
-    // Pass fog density to the shader
-    GLint fogDensityLocation = glGetUniformLocation(asteroidShaderProgram, "fogDensity");
-    glUniform1f(fogDensityLocation, 0.05f); // Adjust fog density as needed
+// Function to draw the asteroid belt; the positions are already in world space, packed by tier
+void drawAsteroidBelt(const Camera& camera) {
+    GLint first = 0;
+
+    // Nearby asteroids: one rock mesh instance per asteroid
+    if (numTierAsteroids[ASTEROID_ROCKS] > 0) {
+        glUseProgram(rockShader.id);
+        glBindTexture(GL_TEXTURE_BUFFER, rockVariantTexture);
+        glBindVertexArray(rockVAO);
+        glDrawElementsInstanced(GL_TRIANGLES, rockIndexCount, GL_UNSIGNED_INT, 0, numTierAsteroids[ASTEROID_ROCKS]);
+        glBindVertexArray(0);
+        glBindTexture(GL_TEXTURE_BUFFER, 0);
+    }
+    first += numTierAsteroids[ASTEROID_ROCKS];
 
-    // Draw asteroids
+    // Mid-range asteroids: sprites sized by the shader
     glBindVertexArray(asteroidVAO);
-    glDrawElements(GL_POINTS, numAsteroids, GL_UNSIGNED_INT, 0);
+    if (numTierAsteroids[ASTEROID_SPRITES] > 0) {
+        glUseProgram(asteroidSpriteShader.id);
+        glEnable(GL_PROGRAM_POINT_SIZE);
+        glDrawArrays(GL_POINTS, first, numTierAsteroids[ASTEROID_SPRITES]);
+        glDisable(GL_PROGRAM_POINT_SIZE);
+    }
+    first += numTierAsteroids[ASTEROID_SPRITES];
+
+    // Distant asteroids: fogged points
+    glUseProgram(asteroidShader.id);
+    glDrawArrays(GL_POINTS, first, numTierAsteroids[ASTEROID_POINTS]);
     glBindVertexArray(0);
 
-    glUseProgram(0); // Switch back to fixed-function pipeline
+    glUseProgram(0); // Unbind the shader program
+}
+
+// Function to get a planet's current position on its orbit
+glm::vec3 planetPosition(int planet) {
+    return planetPositions[planet];
+}
+
+// Function to get the radius of the sphere enclosing a planet and all of its moons
+float planetSystemRadius(int planet) {
+    float radius = planetSizes[planet];
+    for (const Moon& moon : planetMoons[planet]) {
+        radius = glm::max(radius, moon.distance + moon.size);
+    }
+    return radius;
+}
+
+// Function to get a moon's position from its planet's and its own current angles
+glm::vec3 moonPosition(int planet, const Moon& moon) {
+    float angle = glm::radians(planetOrbits[planet] + planetRotations[planet] + moon.orbit);
+    return planetPosition(planet) + glm::vec3(moon.distance * cos(angle), 0.0f, -moon.distance * sin(angle));
+}
+
+// Function to find a planet or moon by its number in the spatial index, planets first, then the moons planet by
+// planet; moon is -1 for a planet. Returns false past the last moon
+bool findIndexedBody(uint32_t body, int& planet, int& moon) {
+    if (body < 9) {
+        planet = int(body);
+        moon = -1;
+        return true;
+    }
+    body -= 9;
+    for (planet = 0; planet < 9; planet++) {
+        if (body < planetMoons[planet].size()) {
+            moon = int(body);
+            return true;
+        }
+        body -= static_cast<uint32_t>(planetMoons[planet].size());
+    }
+    return false;
+}
+
+// Function to get an asteroid's position at a time, from the same decoded elements as the propagation shaders
+glm::vec3 asteroidPosition(size_t index, float days) {
+    float x, y, z;
+    KeplerStates position = { &x, &y, &z, NULL, NULL, NULL };
+    asteroidBelt->keplerOrbits.propagate(days, index, index + 1, position);
+    return glm::vec3(x, z, -y); // The ecliptic is the scene's XZ plane
+}
+
+// Function to get the fastest any planet or moon moves (scene units per day)
+float bodyMaxSpeed() {
+    float maxSpeed = 0.0f;
+    for (int i = 0; i < 9; i++) {
+        float orbitRate = float(360.0 / planetPeriods[i]); // Degrees per day
+        float e = float(planetEccentricities[i]);
+        float planetSpeed = glm::radians(orbitRate) * planetDistances[i] * sqrt((1.0f + e) / (1.0f - e)); // At perihelion
+        maxSpeed = glm::max(maxSpeed, planetSpeed);
+        for (const Moon& moon : planetMoons[i]) {
+            float moonRate = orbitRate + float((PLANET_ROTATION_SPEED + moon.speed) * ANIMATION_STEPS_PER_DAY);
+            maxSpeed = glm::max(maxSpeed, planetSpeed + glm::radians(moonRate) * moon.distance);
+        }
+    }
+    return maxSpeed;
+}
+
+// Function to start rebuilding the spatial index over the scene at a time, unless a build is still running or
+// the last one is recent. Bodies are captured here; the worker propagates the asteroids itself
+void updateSpatialIndex(float days) {
+    static Uint32 lastRebuild = 0;
+    Uint32 now = SDL_GetTicks();
+    if (g_SpatialIndex.busy() || (lastRebuild != 0 && now - lastRebuild < SPATIAL_REBUILD_INTERVAL * 1000.0)) {
+        return;
+    }
+
+    std::vector<SpatialPoint> bodies;
+    for (int i = 0; i < 9; i++) {
+        glm::vec3 position = planetPosition(i);
+        SpatialPoint point = { position.x, position.y, position.z, SPATIAL_BODY | uint32_t(i) };
+        bodies.push_back(point);
+    }
+    for (int i = 0; i < 9; i++) {
+        for (const Moon& moon : planetMoons[i]) {
+            glm::vec3 position = moonPosition(i, moon);
+            SpatialPoint point = { position.x, position.y, position.z, SPATIAL_BODY | uint32_t(bodies.size()) };
+            bodies.push_back(point);
+        }
+    }
+
+    // The worker holds on to the current belt, which new snapshots replace rather than change
+    std::shared_ptr<const AsteroidBelt> belt = asteroidBelt;
+    g_SpatialIndex.rebuild(days, [bodies, belt, days](std::vector<SpatialPoint>& points) {
+        const KeplerBatch& orbits = belt->keplerOrbits;
+        points.resize(bodies.size() + orbits.size());
+        std::copy(bodies.begin(), bodies.end(), points.begin());
+        SpatialPoint* asteroids = &points[bodies.size()];
+        parallelFor(orbits.size(), [&](size_t first, size_t last) {
+            // Propagate in blocks that stay in cache, then scatter into the points
+            const size_t BLOCK = 1024;
+            float x[BLOCK], y[BLOCK], z[BLOCK];
+            KeplerStates positions = { x, y, z, NULL, NULL, NULL };
+            for (size_t block = first; block < last; block += BLOCK) {
+                size_t blockEnd = glm::min(block + BLOCK, last);
+                orbits.propagate(days, block, blockEnd, positions);
+                for (size_t i = block; i < blockEnd; i++) {
+                    SpatialPoint point = { x[i - block], z[i - block], -y[i - block], uint32_t(i) };
+                    asteroids[i] = point;
+                }
+            }
+        });
+    });
+    lastRebuild = now;
+}
+
+// Function to find the planet, moon or asteroid under a window position at a time. Candidates come from the
+// index around where the view ray meets the ecliptic, widened by how far anything can have moved since the index
+// was built, and are then tested at their current positions
+bool pickBody(const Camera& camera, int x, int y, float days, std::string& name) {
+    std::shared_ptr<const SpatialGrid> grid = g_SpatialIndex.current();
+    if (!grid || camera.width <= 0 || camera.height <= 0) {
+        return false;
+    }
+
+    // View ray through the pixel center
+    glm::mat4 inverse = glm::inverse(camera.viewProjection);
+    glm::vec2 ndc(2.0f * (x + 0.5f) / camera.width - 1.0f, 1.0f - 2.0f * (y + 0.5f) / camera.height);
+    glm::vec4 nearPoint = inverse * glm::vec4(ndc.x, ndc.y, -1.0f, 1.0f);
+    glm::vec4 farPoint = inverse * glm::vec4(ndc.x, ndc.y, 1.0f, 1.0f);
+    glm::vec3 origin = glm::vec3(nearPoint) / nearPoint.w;
+    glm::vec3 direction = glm::normalize(glm::vec3(farPoint) / farPoint.w - origin);
+    if (direction.y * origin.y >= 0.0f) {
+        return false; // Looking away from the ecliptic
+    }
+    float hitDistance = -origin.y / direction.y;
+    glm::vec3 hit = origin + direction * hitDistance;
+
+    // A few pixels of tolerance, as a world distance per unit of depth
+    const float pickPixels = 6.0f;
+    float tolerancePerDepth = pickPixels * 2.0f * tan(glm::radians(15.0f)) / camera.height;
+
+    float maxBodyRadius = 0.0f, maxBodyHeight = 0.0f;
+    for (int i = 0; i < 9; i++) {
+        maxBodyRadius = glm::max(maxBodyRadius, planetSizes[i]);
+        float aphelion = planetDistances[i] * float(1.0 + planetEccentricities[i]);
+        maxBodyHeight = glm::max(maxBodyHeight, aphelion * sin(glm::radians(float(planetInclinations[i]))) + planetSystemRadius(i));
+    }
+    float drift = glm::max(asteroidBelt->maxSpeed, bodyMaxSpeed()) * fabs(days - float(grid->time()));
+    float slant = glm::max(fabs(direction.y), 0.05f); // Bodies above or below the plane meet the ray off the hit point
+    float searchRadius = (glm::max(asteroidBelt->maxHeight, maxBodyHeight) + tolerancePerDepth * hitDistance) / slant + drift;
+
+    std::vector<SpatialPoint> candidates;
+    grid->withinRadius(hit.x, hit.y, hit.z, searchRadius, candidates);
+
+    size_t numBeltAsteroids = asteroidBelt->elements.size();
+    bool catalog = g_MinorPlanets.size() == numBeltAsteroids;
+    float bestScore = FLT_MAX;
+    for (const SpatialPoint& candidate : candidates) {
+        // Rule out most candidates at their indexed positions before propagating them
+        glm::vec3 indexed(candidate.x, candidate.y, candidate.z);
+        float depth = glm::dot(indexed - origin, direction);
+        float reach = tolerancePerDepth * glm::max(depth, 0.0f) + maxBodyRadius + drift;
+        glm::vec3 offset = indexed - origin - direction * depth;
+        if (depth <= 0.0f || glm::dot(offset, offset) > reach * reach) {
+            continue;
+        }
+
+        glm::vec3 position;
+        float radius = 0.0f;
+        std::string candidateName;
+        if (candidate.id & SPATIAL_BODY) {
+            int planet, moon;
+            if (!findIndexedBody(candidate.id & ~SPATIAL_BODY, planet, moon)) {
+                continue;
+            }
+            position = moon < 0 ? planetPosition(planet) : moonPosition(planet, planetMoons[planet][moon]);
+            radius = moon < 0 ? planetSizes[planet] : planetMoons[planet][moon].size;
+            candidateName = moon < 0 ? planetNames[planet] : planetMoons[planet][moon].name;
+        } else if (candidate.id < numBeltAsteroids) {
+            position = asteroidPosition(candidate.id, days);
+            candidateName = catalog ? g_MinorPlanets.name(candidate.id) : "Asteroid #" + std::to_string(candidate.id);
+        } else {
+            continue;
+        }
+
+        // Distance from the ray past the body's surface, in units of the pixel tolerance at its depth
+        depth = glm::dot(position - origin, direction);
+        if (depth <= 0.0f) {
+            continue;
+        }
+        float score = (glm::length(position - origin - direction * depth) - radius) / (tolerancePerDepth * depth);
+        if (score <= 1.0f && score < bestScore) {
+            bestScore = score;
+            name = candidateName;
+        }
+    }
+    return bestScore <= 1.0f;
+}
+
+// Function to find the name of the body under the mouse cursor
+void updateHover(const Camera& camera, float days) {
+    g_sHoverName.clear();
+    if (g_nMouseX >= 0 && g_nMouseY >= 0) {
+        pickBody(camera, g_nMouseX, g_nMouseY, days, g_sHoverName);
+    }
+}
+
+// Function to show the date, the time warp and the body under the mouse cursor in the window title
+void updateWindowTitle() {
+    static std::string lastTitle;
+    char warp[32];
+    if (g_Clock.paused()) {
+        snprintf(warp, sizeof(warp), "paused");
+    } else {
+        snprintf(warp, sizeof(warp), "%.3gx", g_Clock.warp());
+    }
+    std::string title = "Solar System Simulation - " + formatDate(g_Clock.day()) + " (" + warp + ")";
+    if (g_NBody.running()) {
+        char solver[64];
+        if (g_nMultipoleOrder > 0) {
+            snprintf(solver, sizeof(solver), " - %s order %d theta %.2f", g_NBody.gravitySolver()->name(), g_nMultipoleOrder, g_fOpeningAngle);
+        } else {
+            snprintf(solver, sizeof(solver), " - %s theta %.2f", g_NBody.gravitySolver()->name(), g_fOpeningAngle);
+        }
+        title += solver;
+    }
+    if (!g_sHoverName.empty()) {
+        title += " - " + g_sHoverName;
+    }
+    if (title != lastTitle) {
+        lastTitle = title;
+        SDL_SetWindowTitle(g_Window, title.c_str());
+    }
 }
 
 // Function to display the solar system
 void display() {
 
     glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT); // Clear color and depth buffers
-    
-    glLoadIdentity(); // Reset the model-view matrix
 
-    // Create the view matrix using glm::lookAt
-    glm::mat4 viewMatrix = glm::lookAt(
-        glm::vec3(0.0f, 30.0f, 50.0f), 
-        glm::vec3(0.0f, 0.0f, 0.0f), 
+    // Create the view matrix using glm::lookAt; the projection is kept up to date by reshape()
+    glm::vec3 target(0.0f, 0.0f, 0.0f);
+    g_Camera.eye = glm::vec3(0.0f, 30.0f, 50.0f);
+    if (g_nFollowPlanet >= 0) {
+        // Follow the planet from a distance that frames its whole moon system
+        target = planetPosition(g_nFollowPlanet);
+        g_Camera.eye = target + glm::vec3(0.0f, 0.5f, 1.0f) * (planetSystemRadius(g_nFollowPlanet) * 4.0f + 1.0f);
+    }
+    g_Camera.view = glm::lookAt(
+        g_Camera.eye,
+        target,
         glm::vec3(0.0f, 1.0f, 0.0f));
+    g_Camera.viewProjection = g_Camera.projection * g_Camera.view;
+    updateFrustumPlanes(g_Camera);
+
+    // Upload the camera block shared by all shader programs
+    float time = SDL_GetTicks() / 1000.0f; // Time in seconds
+    updateCameraUniforms(g_Camera, time);
+
+    // Move the asteroid belt to the current time; the dense distant parts are drawn first, under everything else
+    float days = float(g_Clock.day());
+    if (g_BeltIntegrator.running() || g_NBody.running()) {
+        updateBeltSnapshot(days);
+    }
+    updateAsteroidUpload();
+    cullAsteroidSectors(g_Camera, days);
+    propagateAsteroids(days);
+    drawAsteroidDensity(g_Camera);
 
-    glLoadMatrixf(glm::value_ptr(viewMatrix));
-   
     // Draw the Sun at the center
-    drawSun();
+    drawSun(g_Camera);
     
     // Draw planet orbits
-    glColor3f(0.5f, 0.5f, 0.5f); // Gray color for orbits
+    drawOrbits(g_Camera);
+
+    // Test each planet system's enclosing sphere first, so whole moon systems are rejected at once
+    static SphereBatch systemSpheres;
+    systemSpheres.clear();
     for (int i = 0; i < 9; i++) {
-        drawCircle(planetDistances[i], 100); // Draw orbit for each planet
+        systemSpheres.add(planetPosition(i), planetSystemRadius(i));
     }
 
-    // Draw all 9 planets with their names and moons
+    std::vector<unsigned char> systemVisibility;
+    cullSphereBatch(g_Camera, systemSpheres, systemVisibility);
+
+    // Gather the 9 planets and their moons in view
+    TransformStack transforms;
     for (int i = 0; i < 9; i++) {
-        drawPlanet(planetSizes[i], planetDistances[i], planetColors[i], planetOrbits[i], planetRotations[i], planetNames[i], planetMoons[i]);
+        if (systemVisibility[i]) {
+            drawPlanet(g_Camera, transforms, planetSizes[i], planetPositions[i], planetColors[i], planetOrbits[i], planetRotations[i], planetNames[i], planetMoons[i], planetLods[i]);
+        }
     }
 
-    // Draw the asteroid belt
-    drawAsteroidBelt();
+    // Cull the gathered planets and moons individually, then draw the visible ones at once
+    cullBodies(g_Camera);
+    drawBodies(g_Camera);
+
+    // Draw all planet and moon names at once
+    drawLabels();
+
+    // Draw the nearer parts of the asteroid belt
+    drawAsteroidBelt(g_Camera);
+
+    // Index the scene as it is now for the next frames' queries, and name whatever is under the cursor
+    updateSpatialIndex(days);
+    updateHover(g_Camera, days);
+    updateWindowTitle();
 
     
 }
 
-// Function to update the rotation and orbit angles
-void update() {
-    // Update planet rotations and orbits
+// Function to simulate the planets and moons at a step's day. The angles are evaluated from the day in double
+// precision and left unwrapped, so consecutive steps interpolate linearly
+void simulateScene(double day, SceneState& state) {
+    double steps = day * ANIMATION_STEPS_PER_DAY;
+    state.day = day;
+
+    // Planet rotations and orbits
     for (int i = 0; i < 9; i++) {
-        planetRotations[i] += 1.0f; // Rotate each planet on its axis
-        planetOrbits[i] += 0.1f * (i + 1); // Orbit each planet around the Sun
-        if (planetRotations[i] > 360) planetRotations[i] -= 360;
-        if (planetOrbits[i] > 360) planetOrbits[i] -= 360;
+        state.planetRotations[i] = PLANET_ROTATION_SPEED * steps; // Rotate each planet on its axis
+        state.planetOrbits[i] = planetLongitudes[i] + 360.0 * day / planetPeriods[i]; // Orbit each planet around the Sun
     }
 
-    // Update moon orbits
+    // Planet positions on their Kepler orbits; each planet's time is reduced to within one period in double
+    // precision first, as the solver's single precision mean anomaly would lose the position far from J2000
+    float times[9], x[9], y[9], z[9];
     for (int i = 0; i < 9; i++) {
-        for (Moon& moon : planetMoons[i]) {
-            moon.orbit += moon.speed; // Rotate moon around its planet
-            if (moon.orbit > 360) moon.orbit -= 360;
+        times[i] = float(day - planetPeriods[i] * floor(day / planetPeriods[i]));
+    }
+    KeplerStates positions = { x, y, z, NULL, NULL, NULL };
+    planetKeplerOrbits.propagate(times, 0, 9, positions);
+    for (int i = 0; i < 9; i++) {
+        state.planetPositions[i] = glm::vec3(x[i], z[i], -y[i]); // The ecliptic is the scene's XZ plane
+    }
+
+    // Moon orbits, planet by planet
+    state.moonOrbits.clear();
+    for (int i = 0; i < 9; i++) {
+        for (const Moon& moon : planetMoons[i]) {
+            state.moonOrbits.push_back(moon.speed * steps); // Rotate moon around its planet
         }
     }
+}
+
+// Function to run the simulation thread: keep the steps from SIMULATION_WINDOW before the clock's current day to
+// SIMULATION_WINDOW after it, publishing the window whenever it moves. Steps run as the clock reaches them, so
+// their results do not depend on the frame rate; a jump restarts the window at the new day
+void runSimulation() {
+    std::deque<SceneState> window;
+    long long firstStep = 0;
+    while (!simulationStopping.load()) {
+        double day = g_Clock.now();
+        double margin = g_Clock.warp() * SIMULATION_WINDOW / SimulationClock::SECONDS_PER_DAY;
+        long long wantedFirst = (long long)floor((day - margin) / SIMULATION_STEP);
+        long long wantedLast = (long long)ceil((day + margin) / SIMULATION_STEP);
+        long long lastStep = firstStep + (long long)window.size() - 1;
+
+        // Restart when the day is before the window, or too far past it to catch up step by step
+        bool changed = false;
+        if ((long long)floor(day / SIMULATION_STEP) < firstStep || wantedLast - lastStep > MAX_SIMULATION_BACKLOG) {
+            window.clear();
+        }
+        while (!window.empty() && firstStep < wantedFirst) {
+            window.pop_front();
+            firstStep++;
+            changed = true;
+        }
+        if (window.empty()) {
+            firstStep = wantedFirst;
+            lastStep = wantedFirst - 1;
+        }
+        while (lastStep < wantedLast) {
+            lastStep++;
+            window.push_back(SceneState());
+            simulateScene(lastStep * SIMULATION_STEP, window.back());
+            changed = true;
+        }
+
+        if (changed) {
+            SceneSnapshot& snapshot = sceneSnapshots.write();
+            snapshot.firstStep = firstStep;
+            snapshot.states.assign(window.begin(), window.end());
+            sceneSnapshots.publish();
+        }
+
+        // Sleep until the clock reaches the next step, but wake up often enough to follow jumps and warp changes
+        double wait = 0.005;
+        if (!g_Clock.paused()) {
+            double untilNext = ((wantedLast + 1) * SIMULATION_STEP - margin - day) * SimulationClock::SECONDS_PER_DAY / g_Clock.warp();
+            wait = glm::clamp(untilNext, 0.0, wait);
+        }
+        std::this_thread::sleep_for(std::chrono::duration<double>(wait));
+    }
+}
+
+// Function to start the simulation thread
+void startSimulation() {
+    simulationStopping.store(false);
+    simulationThread = std::thread(runSimulation);
+}
+
+// Function to stop the simulation thread
+void stopSimulation() {
+    if (simulationThread.joinable()) {
+        simulationStopping.store(true);
+        simulationThread.join();
+    }
+}
+
+// Function to set the rotation and orbit angles and planet positions for a day, interpolated between the two steps around it in the
+// newest window the simulation thread has published. Before the first window, or when the day is outside the
+// window (right after a jump), the nearest step is shown
+void update(double day) {
+    sceneSnapshots.update();
+    const SceneSnapshot& snapshot = sceneSnapshots.read();
+    if (snapshot.states.empty()) {
+        return;
+    }
+
+    long long last = (long long)snapshot.states.size() - 1;
+    long long index = glm::clamp((long long)floor(day / SIMULATION_STEP) - snapshot.firstStep, 0LL, last);
+    const SceneState& previous = snapshot.states[index];
+    const SceneState& current = snapshot.states[glm::min(index + 1, last)];
+    double alpha = glm::clamp((day - previous.day) / SIMULATION_STEP, 0.0, 1.0);
 
-    //glutPostRedisplay(); // Redraw the scene
-    //glutTimerFunc(16, update, 0); // Call update function every 16ms (~60 FPS)
+    // Interpolate the rendered angles between the two steps
+    for (int i = 0; i < 9; i++) {
+        planetRotations[i] = float(fmod(glm::mix(previous.planetRotations[i], current.planetRotations[i], alpha), 360.0));
+        planetOrbits[i] = float(fmod(glm::mix(previous.planetOrbits[i], current.planetOrbits[i], alpha), 360.0));
+        planetPositions[i] = glm::mix(previous.planetPositions[i], current.planetPositions[i], float(alpha));
+    }
+
+    // In the N-body mode the planets follow their latest osculating orbits instead, with the time reduced to within
+    // one period in double precision as in simulateScene()
+    if (nbodyPlanetOrbits.size() == 9) {
+        float times[9], x[9], y[9], z[9];
+        for (int i = 0; i < 9; i++) {
+            times[i] = float(day - nbodyPlanetPeriods[i] * floor(day / nbodyPlanetPeriods[i]));
+        }
+        KeplerStates positions = { x, y, z, NULL, NULL, NULL };
+        nbodyPlanetOrbits.propagate(times, 0, 9, positions);
+        for (int i = 0; i < 9; i++) {
+            planetPositions[i] = glm::vec3(x[i], z[i], -y[i]); // The ecliptic is the scene's XZ plane
+        }
+    }
+    size_t moonIndex = 0;
+    for (int i = 0; i < 9; i++) {
+        for (Moon& moon : planetMoons[i]) {
+            moon.orbit = float(fmod(glm::mix(previous.moonOrbits[moonIndex], current.moonOrbits[moonIndex], alpha), 360.0));
+            moonIndex++;
+        }
+    }
 }
 
 // Function to handle window resizing
 void reshape(int w, int h) {
     glViewport(0, 0, w, h); // Set the viewport to cover the new window
-    glMatrixMode(GL_PROJECTION); // Switch to the projection matrix
-    glLoadIdentity(); // Reset the projection matrix
-    gluPerspective(30.0, (double)w / (double)h, 1.0, 200.0); // Adjust FOV to 30 degrees
-    glMatrixMode(GL_MODELVIEW); // Switch back to the model-view matrix
+    if (h == 0) h = 1; // Avoid division by zero when minimized
+
+    // Build the projection on the CPU, adjust FOV to 30 degrees
+    g_Camera.width = w;
+    g_Camera.height = h;
+    g_Camera.projection = glm::perspective(glm::radians(30.0f), (float)w / (float)h, 1.0f, 200.0f);
+
 }
 
 
@@ -629,10 +2998,43 @@ void mainloop()
             return;
             break;
         }
+        case SDL_KEYDOWN:
+        {
+            // 1-9 follow a planet, 0 returns to the overview; comma and period halve and double the time warp,
+            // space pauses and T jumps to today; [ and ] narrow and widen the N-body opening angle
+            SDL_Keycode key = e.key.keysym.sym;
+            if (key >= SDLK_1 && key <= SDLK_9) {
+                g_nFollowPlanet = key - SDLK_1;
+            } else if (key == SDLK_0) {
+                g_nFollowPlanet = -1;
+            } else if (key == SDLK_COMMA) {
+                g_Clock.setWarp(g_Clock.warp() * 0.5);
+            } else if (key == SDLK_PERIOD) {
+                g_Clock.setWarp(g_Clock.warp() * 2.0);
+            } else if (key == SDLK_SPACE) {
+                g_Clock.setPaused(!g_Clock.paused());
+            } else if (key == SDLK_t) {
+                g_Clock.setDay(todayDay());
+            } else if ((key == SDLK_LEFTBRACKET || key == SDLK_RIGHTBRACKET) && g_NBody.running()) {
+                g_fOpeningAngle = glm::clamp(g_fOpeningAngle + (key == SDLK_LEFTBRACKET ? -0.1f : 0.1f), 0.0f, MAX_OPENING_ANGLE);
+                g_NBody.gravitySolver()->setOpeningAngle(g_fOpeningAngle);
+            }
+            break;
+        }
+        case SDL_MOUSEMOTION:
+        {
+            // Hovering a body names it in the window title
+            g_nMouseX = e.motion.x;
+            g_nMouseY = e.motion.y;
+            break;
+        }
         case SDL_WINDOWEVENT:
         {
             switch (e.window.event)
             {
+            case SDL_WINDOWEVENT_LEAVE:
+                g_nMouseX = g_nMouseY = -1;
+                break;
             case SDL_WINDOWEVENT_EXPOSED:
             case SDL_WINDOWEVENT_RESIZED:
             case SDL_WINDOWEVENT_SIZE_CHANGED:
@@ -654,7 +3056,8 @@ void mainloop()
         }
     }
 
-    update();
+    g_Clock.tick();
+    update(g_Clock.day());
     display();
     SDL_GL_SwapWindow(g_Window);
 
@@ -672,21 +3075,83 @@ int main(int argc, char** argv)
 {
     SDL_SetMainReady();
 
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--compatibility") == 0) {
+            g_bCoreProfile = false;
+        } else if (strcmp(argv[i], "--asteroids") == 0 && i + 1 < argc) {
+            numAsteroids = strtoul(argv[++i], NULL, 10); // Millions of asteroids for the main-belt views
+        } else if (strcmp(argv[i], "--seed") == 0 && i + 1 < argc) {
+            g_nSeed = strtoul(argv[++i], NULL, 0); // Same seed, same belt on every machine
+        } else if (strcmp(argv[i], "--mpcorb") == 0 && i + 1 < argc) {
+            g_sCatalogPath = argv[++i]; // Path to MPCORB.DAT
+        } else if (strcmp(argv[i], "--perturbed") == 0) {
+            g_bPerturbed = true; // Integrate the belt under Jupiter's pull
+        } else if (strcmp(argv[i], "--saturn") == 0) {
+            g_bPerturbed = g_bPerturbSaturn = true; // And Saturn's
+        } else if (strcmp(argv[i], "--nbody") == 0) {
+            g_bNBody = true; // Everything attracts everything
+        } else if (strcmp(argv[i], "--disc-mass") == 0 && i + 1 < argc) {
+            g_dDiscMass = strtod(argv[++i], NULL); // Total mass of the asteroids in the N-body mode (solar masses)
+        } else if (strcmp(argv[i], "--theta") == 0 && i + 1 < argc) {
+            float angle = float(strtod(argv[++i], NULL)); // Opening angle of the N-body solver, 0 for direct summation
+            if (angle >= 0.0f && angle <= MAX_OPENING_ANGLE) {
+                g_fOpeningAngle = angle;
+            } else {
+                std::cerr << "Invalid opening angle " << argv[i] << ", expected 0 to " << MAX_OPENING_ANGLE << std::endl;
+            }
+        } else if (strcmp(argv[i], "--fmm") == 0 && i + 1 < argc) {
+            g_nMultipoleOrder = glm::clamp(int(strtol(argv[++i], NULL, 10)), FastMultipoleSolver::MIN_ORDER, FastMultipoleSolver::MAX_ORDER); // Fast multipole expansion order
+        } else if (strcmp(argv[i], "--date") == 0 && i + 1 < argc) {
+            if (!parseDate(argv[++i], g_dStartDay)) { // Start date, YYYY-MM-DD
+                std::cerr << "Invalid date " << argv[i] << ", expected YYYY-MM-DD" << std::endl;
+            }
+        } else if (strcmp(argv[i], "--warp") == 0 && i + 1 < argc) {
+            g_dStartWarp = strtod(argv[++i], NULL); // Simulation seconds per real second, 1 to 1e7
+        }
+    }
+
     if (SDL_Init(SDL_INIT_VIDEO) == 0)
     {
+        // Every draw goes through VAOs and shaders, so a 3.3 core profile is all the renderer needs
+        SDL_GL_SetAttribute(SDL_GL_CONTEXT_MAJOR_VERSION, 3);
+        SDL_GL_SetAttribute(SDL_GL_CONTEXT_MINOR_VERSION, 3);
+        if (g_bCoreProfile) {
+            SDL_GL_SetAttribute(SDL_GL_CONTEXT_PROFILE_MASK, SDL_GL_CONTEXT_PROFILE_CORE);
+            SDL_GL_SetAttribute(SDL_GL_CONTEXT_FLAGS, SDL_GL_CONTEXT_FORWARD_COMPATIBLE_FLAG);
+        } else {
+            SDL_GL_SetAttribute(SDL_GL_CONTEXT_PROFILE_MASK, SDL_GL_CONTEXT_PROFILE_COMPATIBILITY);
+        }
+
         //Create window
         g_Window = SDL_CreateWindow("Solar System Simulation", SDL_WINDOWPOS_UNDEFINED, SDL_WINDOWPOS_UNDEFINED, 800, 600, SDL_WINDOW_OPENGL | SDL_WINDOW_RESIZABLE | SDL_WINDOW_SHOWN);
         if (g_Window != NULL)
         {
             g_glContext = SDL_GL_CreateContext(g_Window);
+            if (g_glContext == NULL && g_bCoreProfile)
+            {
+                // Fall back to a compatibility profile on drivers without core profile support
+                std::cerr << "Core profile context unavailable (" << SDL_GetError() << "), using compatibility profile" << std::endl;
+                g_bCoreProfile = false;
+                SDL_GL_SetAttribute(SDL_GL_CONTEXT_PROFILE_MASK, SDL_GL_CONTEXT_PROFILE_COMPATIBILITY);
+                SDL_GL_SetAttribute(SDL_GL_CONTEXT_FLAGS, 0);
+                g_glContext = SDL_GL_CreateContext(g_Window);
+            }
             if (g_glContext != NULL)
             {
                 init();
+                g_Clock.setDay(g_dStartDay);
+                g_Clock.setWarp(g_dStartWarp);
+                startSimulation();
 
                 while (!g_bQuit)
                 {
                     mainloop();
                 }
+                stopSimulation();
+                stopAsteroidWorker();
+                g_BeltIntegrator.stop();
+                g_NBody.stop();
+                g_SpatialIndex.wait();
                
                 SDL_GL_DeleteContext(g_glContext);
             }
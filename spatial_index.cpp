@@ -0,0 +1,265 @@
+// spatial_index.cpp - Uniform grid over points for nearest, radius and box queries
+
+#include "spatial_index.h"
+
+#include <algorithm>
+#include <cfloat>
+#include <cmath>
+#include <queue>
+#include <utility>
+
+namespace {
+
+const float POINTS_PER_CELL = 4.0f; // Average occupancy the cell size is chosen for
+const int MAX_CELLS_PER_AXIS = 4096;
+
+// Function to get the squared distance between a point and a position
+float distanceSquared(const SpatialPoint& point, float x, float y, float z) {
+    float dx = point.x - x, dy = point.y - y, dz = point.z - z;
+    return dx * dx + dy * dy + dz * dz;
+}
+
+} // namespace
+
+SpatialGrid::SpatialGrid() : buildTime(0.0) {
+    for (int axis = 0; axis < 3; axis++) {
+        origin[axis] = 0.0f;
+        cellSize[axis] = 1.0f;
+        dims[axis] = 1;
+    }
+    cellStarts.assign(2, 0);
+}
+
+void SpatialGrid::build(std::vector<SpatialPoint>& input) {
+    size_t count = input.size();
+    float minCorner[3] = { FLT_MAX, FLT_MAX, FLT_MAX };
+    float maxCorner[3] = { -FLT_MAX, -FLT_MAX, -FLT_MAX };
+    for (const SpatialPoint& point : input) {
+        const float position[3] = { point.x, point.y, point.z };
+        for (int axis = 0; axis < 3; axis++) {
+            minCorner[axis] = std::min(minCorner[axis], position[axis]);
+            maxCorner[axis] = std::max(maxCorner[axis], position[axis]);
+        }
+    }
+
+    // Cube cells sized for POINTS_PER_CELL on average over the bounding box. Axes thinner than a cell get a single
+    // layer, and the size is solved again over the remaining axes, so flat and thin clouds are not left with empty cells
+    float extents[3];
+    bool flat[3];
+    for (int axis = 0; axis < 3; axis++) {
+        origin[axis] = count > 0 ? minCorner[axis] : 0.0f;
+        extents[axis] = count > 0 ? std::max(maxCorner[axis] - minCorner[axis], 1e-6f) : 1.0f;
+        flat[axis] = false;
+    }
+    double targetCells = std::max(double(count) / POINTS_PER_CELL, 1.0);
+    double size = 0.0;
+    for (int pass = 0; pass < 3; pass++) {
+        double volume = 1.0;
+        int numAxes = 0;
+        for (int axis = 0; axis < 3; axis++) {
+            if (!flat[axis]) {
+                volume *= extents[axis];
+                numAxes++;
+            }
+        }
+        if (numAxes == 0) {
+            break;
+        }
+        size = std::pow(volume / targetCells, 1.0 / numAxes);
+
+        bool changed = false;
+        for (int axis = 0; axis < 3; axis++) {
+            if (!flat[axis] && extents[axis] < size) {
+                flat[axis] = changed = true;
+            }
+        }
+        if (!changed) {
+            break;
+        }
+    }
+    for (int axis = 0; axis < 3; axis++) {
+        dims[axis] = flat[axis] || size <= 0.0 ? 1 : int(std::min(std::ceil(extents[axis] / size), double(MAX_CELLS_PER_AXIS)));
+        cellSize[axis] = extents[axis] / dims[axis];
+    }
+
+    // Counting sort of the points by cell
+    size_t numCells = size_t(dims[0]) * dims[1] * dims[2];
+    std::vector<uint32_t> cellOf(count);
+    cellStarts.assign(numCells + 1, 0);
+    for (size_t i = 0; i < count; i++) {
+        const SpatialPoint& point = input[i];
+        uint32_t cell = uint32_t((cellCoordinate(point.z, 2) * dims[1] + cellCoordinate(point.y, 1)) * dims[0] + cellCoordinate(point.x, 0));
+        cellOf[i] = cell;
+        cellStarts[cell + 1]++;
+    }
+    for (size_t cell = 0; cell < numCells; cell++) {
+        cellStarts[cell + 1] += cellStarts[cell];
+    }
+
+    points.resize(count);
+    std::vector<uint32_t> next(cellStarts.begin(), cellStarts.end() - 1);
+    for (size_t i = 0; i < count; i++) {
+        points[next[cellOf[i]]++] = input[i];
+    }
+    std::vector<SpatialPoint>().swap(input);
+}
+
+int SpatialGrid::cellCoordinate(float value, int axis) const {
+    int coordinate = int(std::floor((value - origin[axis]) / cellSize[axis]));
+    return std::min(std::max(coordinate, 0), dims[axis] - 1);
+}
+
+void SpatialGrid::nearest(float x, float y, float z, size_t k, std::vector<SpatialPoint>& result) const {
+    result.clear();
+    if (k == 0 || points.empty()) {
+        return;
+    }
+
+    const int center[3] = { cellCoordinate(x, 0), cellCoordinate(y, 1), cellCoordinate(z, 2) };
+    int maxRing = 0;
+    float minCellSize = FLT_MAX; // Smallest step between rings, along the axes that have more than one cell
+    for (int axis = 0; axis < 3; axis++) {
+        maxRing = std::max(maxRing, std::max(center[axis], dims[axis] - 1 - center[axis]));
+        if (dims[axis] > 1) {
+            minCellSize = std::min(minCellSize, cellSize[axis]);
+        }
+    }
+
+    // Visit the cells in rings of growing Chebyshev distance around the query's cell, keeping the k best in a max-heap.
+    // Cells beyond ring r are at least r cells away along some axis, so the search ends once the k-th best is nearer
+    std::priority_queue<std::pair<float, uint32_t> > best;
+    for (int ring = 0; ring <= maxRing; ring++) {
+        int low[3], high[3];
+        for (int axis = 0; axis < 3; axis++) {
+            low[axis] = std::max(center[axis] - ring, 0);
+            high[axis] = std::min(center[axis] + ring, dims[axis] - 1);
+        }
+        for (int cz = low[2]; cz <= high[2]; cz++) {
+            for (int cy = low[1]; cy <= high[1]; cy++) {
+                bool onShell = std::abs(cz - center[2]) == ring || std::abs(cy - center[1]) == ring;
+                for (int cx = low[0]; cx <= high[0]; cx++) {
+                    if (!onShell && std::abs(cx - center[0]) != ring) {
+                        // Interior of the ring, visited already; jump to its far side
+                        cx = std::max(cx, center[0] + ring - 1);
+                        continue;
+                    }
+                    size_t cell = (size_t(cz) * dims[1] + cy) * dims[0] + cx;
+                    for (uint32_t i = cellStarts[cell]; i < cellStarts[cell + 1]; i++) {
+                        float distance2 = distanceSquared(points[i], x, y, z);
+                        if (best.size() < k) {
+                            best.push(std::make_pair(distance2, i));
+                        } else if (distance2 < best.top().first) {
+                            best.pop();
+                            best.push(std::make_pair(distance2, i));
+                        }
+                    }
+                }
+            }
+        }
+
+        float bound = ring * minCellSize;
+        if (best.size() == k && best.top().first <= bound * bound) {
+            break;
+        }
+    }
+
+    result.resize(best.size());
+    for (size_t i = best.size(); i > 0; i--) {
+        result[i - 1] = points[best.top().second];
+        best.pop();
+    }
+}
+
+void SpatialGrid::withinRadius(float x, float y, float z, float radius, std::vector<SpatialPoint>& result) const {
+    result.clear();
+    if (points.empty()) {
+        return;
+    }
+
+    const float position[3] = { x, y, z };
+    int low[3], high[3];
+    for (int axis = 0; axis < 3; axis++) {
+        low[axis] = cellCoordinate(position[axis] - radius, axis);
+        high[axis] = cellCoordinate(position[axis] + radius, axis);
+    }
+
+    float radius2 = radius * radius;
+    for (int cz = low[2]; cz <= high[2]; cz++) {
+        for (int cy = low[1]; cy <= high[1]; cy++) {
+            size_t row = (size_t(cz) * dims[1] + cy) * dims[0];
+            for (uint32_t i = cellStarts[row + low[0]]; i < cellStarts[row + high[0] + 1]; i++) {
+                if (distanceSquared(points[i], x, y, z) <= radius2) {
+                    result.push_back(points[i]);
+                }
+            }
+        }
+    }
+}
+
+void SpatialGrid::withinBox(const float minCorner[3], const float maxCorner[3], std::vector<SpatialPoint>& result) const {
+    result.clear();
+    if (points.empty()) {
+        return;
+    }
+
+    int low[3], high[3];
+    for (int axis = 0; axis < 3; axis++) {
+        low[axis] = cellCoordinate(minCorner[axis], axis);
+        high[axis] = cellCoordinate(maxCorner[axis], axis);
+    }
+
+    for (int cz = low[2]; cz <= high[2]; cz++) {
+        for (int cy = low[1]; cy <= high[1]; cy++) {
+            // The cells of a row are consecutive, so the row is one range of points
+            size_t row = (size_t(cz) * dims[1] + cy) * dims[0];
+            for (uint32_t i = cellStarts[row + low[0]]; i < cellStarts[row + high[0] + 1]; i++) {
+                const SpatialPoint& point = points[i];
+                if (point.x >= minCorner[0] && point.x <= maxCorner[0] &&
+                    point.y >= minCorner[1] && point.y <= maxCorner[1] &&
+                    point.z >= minCorner[2] && point.z <= maxCorner[2]) {
+                    result.push_back(point);
+                }
+            }
+        }
+    }
+}
+
+SpatialIndex::SpatialIndex() : building(false) {
+}
+
+SpatialIndex::~SpatialIndex() {
+    wait();
+}
+
+bool SpatialIndex::rebuild(double time, std::function<void(std::vector<SpatialPoint>& points)> gather) {
+    if (building.load()) {
+        return false;
+    }
+    wait(); // Reap the finished worker
+
+    building.store(true);
+    worker = std::thread([this, time, gather]() {
+        std::vector<SpatialPoint> points;
+        gather(points);
+        std::shared_ptr<SpatialGrid> grid = std::make_shared<SpatialGrid>();
+        grid->build(points);
+        grid->buildTime = time;
+        {
+            std::lock_guard<std::mutex> guard(lock);
+            latest = grid;
+        }
+        building.store(false);
+    });
+    return true;
+}
+
+void SpatialIndex::wait() {
+    if (worker.joinable()) {
+        worker.join();
+    }
+}
+
+std::shared_ptr<const SpatialGrid> SpatialIndex::current() const {
+    std::lock_guard<std::mutex> guard(lock);
+    return latest;
+}
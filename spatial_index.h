@@ -0,0 +1,90 @@
+// spatial_index.h - Uniform grid over points for nearest, radius and box queries
+//
+// SpatialGrid sorts points into the cells of a uniform grid fitted to their bounding box,
+// with cell sizes chosen for a few points per cell whatever the shape of the cloud (a thin
+// belt gets one layer of cells). Queries visit only the cells they overlap, so their cost
+// follows the answer instead of the number of points.
+//
+// SpatialIndex rebuilds grids on a worker thread. The caller hands over a function that
+// gathers the points, e.g. every body at a simulation time; queries go to the newest finished
+// grid, which stays valid for as long as the caller holds it.
+
+#ifndef SPATIAL_INDEX_H
+#define SPATIAL_INDEX_H
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Point of the index: a position and the caller's id for it
+struct SpatialPoint {
+    float x, y, z;
+    uint32_t id;
+};
+
+class SpatialGrid {
+public:
+    SpatialGrid();
+
+    // Function to build the grid over the points, taking them over
+    void build(std::vector<SpatialPoint>& points);
+
+    // Function to find the k points nearest to a position, nearest first
+    void nearest(float x, float y, float z, size_t k, std::vector<SpatialPoint>& result) const;
+
+    // Function to find the points within a distance of a position, in no particular order
+    void withinRadius(float x, float y, float z, float radius, std::vector<SpatialPoint>& result) const;
+
+    // Function to find the points inside an axis-aligned box, in no particular order
+    void withinBox(const float minCorner[3], const float maxCorner[3], std::vector<SpatialPoint>& result) const;
+
+    size_t size() const { return points.size(); }
+    double time() const { return buildTime; }
+
+private:
+    friend class SpatialIndex;
+
+    // Function to get the cell coordinate of a position along an axis, clamped to the grid
+    int cellCoordinate(float value, int axis) const;
+
+    float origin[3];  // Minimum corner of the grid
+    float cellSize[3];
+    int dims[3];      // Cells along each axis
+    std::vector<uint32_t> cellStarts; // First point of every cell, plus the end
+    std::vector<SpatialPoint> points; // Sorted by cell
+    double buildTime; // Caller's time stamp of the points
+};
+
+class SpatialIndex {
+public:
+    SpatialIndex();
+    ~SpatialIndex();
+
+    // Function to start building a grid over the points that gather() produces on the worker thread,
+    // stamped with a time; does nothing and returns false while a build is still running
+    bool rebuild(double time, std::function<void(std::vector<SpatialPoint>& points)> gather);
+
+    // Function to wait until the running build, if any, has finished
+    void wait();
+
+    bool busy() const { return building.load(); }
+
+    // Function to get the newest finished grid, null before the first build finishes
+    std::shared_ptr<const SpatialGrid> current() const;
+
+private:
+    SpatialIndex(const SpatialIndex&) = delete;
+    SpatialIndex& operator=(const SpatialIndex&) = delete;
+
+    std::thread worker;
+    std::atomic<bool> building;
+    mutable std::mutex lock;
+    std::shared_ptr<const SpatialGrid> latest;
+};
+
+#endif // SPATIAL_INDEX_H
@@ -0,0 +1,209 @@
+// asteroid_elements_test.cpp - 16-bit packing of asteroid elements against its error bounds
+//
+// Random elements across a belt of bands go through packAsteroid() and unpackAsteroid(), and every element
+// must decode to within half a step of its value: the semi-major axis and mean motion in the steps of
+// their band, the eccentricity, inclination and angles in their fixed steps, angles measured around the
+// circle. Beyond the random belt: angles at and past 2 pi and below 0, bands whose mean motions are all
+// equal or that hold no asteroids (step 0, decoding to the minimum), values outside a band's range, and
+// the band and shape id bits.
+
+#include "asteroid_elements.h"
+#include "philox.h"
+#include "check.h"
+
+#include <algorithm>
+#include <cfloat>
+#include <cmath>
+#include <cstdio>
+#include <vector>
+
+namespace {
+
+const double PI = 3.14159265358979323846;
+const size_t NUM_ASTEROIDS = 100000;
+const float MIN_AXIS = 2.0f, MAX_AXIS = 40.0f; // Wide enough that the axis steps are far coarser than a float
+
+// Function to get the mean motion of an orbit, an axis of 3 going round in a year
+float meanMotion(float semiMajorAxis) {
+    float ratio = 3.0f / semiMajorAxis;
+    return float(2.0 * PI / 365.25) * ratio * std::sqrt(ratio);
+}
+
+// Function to get the bound of a decoded value: half a step, plus the rounding of the decoded float
+float bound(float step, float value) {
+    return 0.5f * step + 2.0f * FLT_EPSILON * std::fabs(value);
+}
+
+// Function to get the difference of two angles around the circle
+double angleError(float decoded, float angle) {
+    return std::fabs(std::remainder(double(decoded) - double(angle), 2.0 * PI));
+}
+
+// Function to set up a belt's bands from a set of elements as buildAsteroids() does
+void setBands(AsteroidBands& belt, const std::vector<AsteroidElements>& elements) {
+    float minAxis = FLT_MAX, maxAxis = 0.0f;
+    for (size_t i = 0; i < elements.size(); i++) {
+        minAxis = std::min(minAxis, elements[i].semiMajorAxis);
+        maxAxis = std::max(maxAxis, elements[i].semiMajorAxis);
+    }
+    belt.minAxis = minAxis;
+    belt.bandWidth = std::max(maxAxis - minAxis, 1e-6f) / ASTEROID_SECTOR_BANDS;
+
+    std::vector<float> minMeanMotion(ASTEROID_SECTOR_BANDS, FLT_MAX), maxMeanMotion(ASTEROID_SECTOR_BANDS, 0.0f);
+    for (size_t i = 0; i < elements.size(); i++) {
+        int band = asteroidBand(belt, elements[i].semiMajorAxis);
+        minMeanMotion[band] = std::min(minMeanMotion[band], elements[i].meanMotion);
+        maxMeanMotion[band] = std::max(maxMeanMotion[band], elements[i].meanMotion);
+    }
+    for (int band = 0; band < ASTEROID_SECTOR_BANDS; band++) {
+        setAsteroidBand(belt, band, minMeanMotion[band], maxMeanMotion[band]);
+    }
+}
+
+// Function to check that random elements across a belt decode to within half a step, and that the band and id survive
+void testRandomBelt() {
+    PhiloxStream random(7, 0);
+    std::vector<AsteroidElements> elements(NUM_ASTEROIDS);
+    for (size_t i = 0; i < NUM_ASTEROIDS; i++) {
+        PhiloxCounter shape = random.block(i, 0), phase = random.block(i, 1);
+        AsteroidElements& asteroid = elements[i];
+        asteroid.semiMajorAxis = MIN_AXIS + philoxUniform(shape.v[0]) * (MAX_AXIS - MIN_AXIS);
+        asteroid.eccentricity = philoxUniform(shape.v[1]) * 0.999f;
+        asteroid.inclination = philoxUniform(shape.v[2]) * float(0.999 * PI); // The last code is half a step short of pi
+        asteroid.ascendingNode = philoxUniform(shape.v[3]) * float(2.0 * PI);
+        asteroid.argumentOfPeriapsis = philoxUniform(phase.v[0]) * float(2.0 * PI);
+        asteroid.meanAnomaly = philoxUniform(phase.v[1]) * float(2.0 * PI);
+        asteroid.meanMotion = meanMotion(asteroid.semiMajorAxis);
+    }
+    AsteroidBands belt;
+    setBands(belt, elements);
+
+    const float angleStep = float(2.0 * PI / 65536.0);
+    double worst[7] = {};
+    for (size_t i = 0; i < NUM_ASTEROIDS; i++) {
+        const AsteroidElements& asteroid = elements[i];
+        PackedAsteroidElements packed = packAsteroid(belt, asteroid, i);
+        AsteroidElements decoded = unpackAsteroid(belt, packed);
+        int band = asteroidBand(belt, asteroid.semiMajorAxis);
+        const AsteroidBand& range = belt.bands[band];
+
+        double errors[7] = {
+            std::fabs(decoded.semiMajorAxis - asteroid.semiMajorAxis) / bound(range.axisStep, asteroid.semiMajorAxis),
+            std::fabs(decoded.eccentricity - asteroid.eccentricity) / bound(1.0f / 65536.0f, asteroid.eccentricity),
+            std::fabs(decoded.inclination - asteroid.inclination) / bound(0.5f * angleStep, asteroid.inclination),
+            angleError(decoded.ascendingNode, asteroid.ascendingNode) / bound(angleStep, float(2.0 * PI)),
+            angleError(decoded.argumentOfPeriapsis, asteroid.argumentOfPeriapsis) / bound(angleStep, float(2.0 * PI)),
+            angleError(decoded.meanAnomaly, asteroid.meanAnomaly) / bound(angleStep, float(2.0 * PI)),
+            std::fabs(decoded.meanMotion - asteroid.meanMotion) / bound(range.meanMotionStep, asteroid.meanMotion),
+        };
+        for (int k = 0; k < 7; k++) {
+            worst[k] = std::max(worst[k], errors[k]);
+        }
+        CHECK(int((packed.words[3] >> 16) & 31) == band);
+        CHECK((packed.words[3] >> 21) == (i & 0x7FF));
+    }
+    std::printf("random belt: worst error / bound  a %.3f  e %.3f  i %.3f  node %.3f  peri %.3f  M %.3f  n %.3f\n",
+                worst[0], worst[1], worst[2], worst[3], worst[4], worst[5], worst[6]);
+    for (int k = 0; k < 7; k++) {
+        CHECK(worst[k] <= 1.0);
+    }
+
+    // Every band of a uniform belt holds asteroids, with a range of mean motions
+    for (int band = 0; band < ASTEROID_SECTOR_BANDS; band++) {
+        CHECK(belt.bands[band].meanMotionStep > 0.0f);
+    }
+}
+
+// Function to check that angles wrap around the circle, from below 0 and at and past 2 pi
+void testAngleWrap() {
+    const float twoPi = float(2.0 * PI);
+    const float angleStep = float(2.0 * PI / 65536.0);
+    CHECK(quantizeAngle(0.0f) == 0);
+    CHECK(quantizeAngle(twoPi) == 0);
+    CHECK(quantizeAngle(std::nextafter(twoPi, 0.0f)) == 0); // Rounds up to 65536, which is 0 again
+    CHECK(quantizeAngle(-1e-6f) == 0);
+    CHECK(quantizeAngle(-0.5f * angleStep + 1e-7f) == 0);
+    CHECK(quantizeAngle(-angleStep) == 65535);
+    CHECK(quantizeAngle(twoPi + angleStep) == 1);
+    CHECK(quantizeAngle(float(PI)) == 32768);
+
+    double worst = 0.0;
+    for (int k = -2000; k <= 2000; k++) {
+        float angles[3] = { k * 1e-4f, twoPi + k * 1e-4f, 3.0f * twoPi + k * 1e-3f }; // Around 0, 2 pi and 6 pi
+        for (int j = 0; j < 3; j++) {
+            float decoded = float(quantizeAngle(angles[j])) * angleStep;
+            CHECK(decoded >= 0.0f && decoded < twoPi);
+            worst = std::max(worst, angleError(decoded, angles[j]) / bound(angleStep, twoPi * 3.0f));
+        }
+    }
+    std::printf("angle wrap: worst error / bound %.3f\n", worst);
+    CHECK(worst <= 1.0);
+}
+
+// Function to check bands whose mean motions are all equal or that hold no asteroids, and values outside a band
+void testDegenerateBands() {
+    AsteroidBands belt;
+    belt.minAxis = MIN_AXIS;
+    belt.bandWidth = (MAX_AXIS - MIN_AXIS) / ASTEROID_SECTOR_BANDS;
+    for (int band = 0; band < ASTEROID_SECTOR_BANDS; band++) {
+        setAsteroidBand(belt, band, FLT_MAX, 0.0f); // No asteroids
+    }
+    float n = meanMotion(MIN_AXIS);
+    setAsteroidBand(belt, 1, n, n); // All alike
+    setAsteroidBand(belt, 2, n, n * 1.001f);
+
+    CHECK(belt.bands[0].minMeanMotion == 0.0f && belt.bands[0].meanMotionStep == 0.0f);
+    CHECK(belt.bands[1].minMeanMotion == n && belt.bands[1].meanMotionStep == 0.0f);
+    CHECK(belt.bands[2].meanMotionStep > 0.0f);
+    for (int band = 0; band < ASTEROID_SECTOR_BANDS; band++) {
+        CHECK(belt.bands[band].minAxis == belt.minAxis + band * belt.bandWidth);
+        CHECK(belt.bands[band].axisStep == belt.bandWidth / 65535.0f);
+    }
+
+    // A step of zero packs every value to code 0, which decodes to the band's minimum exactly
+    CHECK(quantize16(1.0f, 0.0f) == 0);
+    CHECK(quantize16(-1.0f, 0.0f) == 0);
+    AsteroidElements asteroid = { MIN_AXIS + 1.5f * belt.bandWidth, 0.05f, 0.01f, 1.0f, 2.0f, 3.0f, n * 1.5f };
+    PackedAsteroidElements packed = packAsteroid(belt, asteroid, 5);
+    AsteroidElements decoded = unpackAsteroid(belt, packed);
+    CHECK(((packed.words[3] >> 16) & 31) == 1);
+    CHECK((packed.words[3] & 0xFFFFu) == 0);
+    CHECK(decoded.meanMotion == n);
+
+    asteroid.semiMajorAxis = MIN_AXIS + 0.5f * belt.bandWidth; // In the empty band, which decodes zero
+    decoded = unpackAsteroid(belt, packAsteroid(belt, asteroid, 5));
+    CHECK(decoded.meanMotion == 0.0f);
+
+    // Values outside a band clamp to its first and last codes, and axes outside the belt to its first and last bands
+    asteroid.semiMajorAxis = MIN_AXIS + 2.5f * belt.bandWidth;
+    asteroid.meanMotion = n * 0.5f;
+    packed = packAsteroid(belt, asteroid, 5);
+    CHECK((packed.words[3] & 0xFFFFu) == 0);
+    asteroid.meanMotion = n * 2.0f;
+    packed = packAsteroid(belt, asteroid, 5);
+    CHECK((packed.words[3] & 0xFFFFu) == 0xFFFFu);
+    CHECK(asteroidBand(belt, MIN_AXIS - 1.0f) == 0);
+    CHECK(asteroidBand(belt, MAX_AXIS + 1.0f) == ASTEROID_SECTOR_BANDS - 1);
+    CHECK(quantize16(-1.0f, 1.0f) == 0);
+    CHECK(quantize16(1e9f, 1.0f) == 0xFFFFu);
+
+    // Eccentricities and inclinations at the last codes of their ranges
+    asteroid.eccentricity = 65535.0f / 65536.0f;
+    asteroid.inclination = float(PI * 65535.0 / 65536.0);
+    decoded = unpackAsteroid(belt, packAsteroid(belt, asteroid, 5));
+    CHECK(decoded.eccentricity == 65535.0f / 65536.0f);
+    CHECK(std::fabs(decoded.inclination - asteroid.inclination) <= bound(0.0f, float(PI)));
+
+    // The shape id keeps the low 11 bits of the index
+    packed = packAsteroid(belt, asteroid, 0x12345);
+    CHECK((packed.words[3] >> 21) == (0x12345u & 0x7FF));
+}
+
+} // namespace
+
+int main() {
+    testRandomBelt();
+    testAngleWrap();
+    testDegenerateBands();
+    return checkFailures();
+}
@@ -0,0 +1,185 @@
+// belt_integrator_test.cpp - Orbit conversions and the restricted three-body integration of the belt
+//
+// Random belt orbits are turned into states and back, at days either side of J2000; states that are
+// unbound or too wide must come back clamped to drawable ellipses. The integrator then has to keep
+// orbits on their Kepler ellipses with no perturbers, and, with Jupiter and Saturn pulling, has to
+// bring them back to where they started when the clock is run forward and back again.
+
+#include "belt_integrator.h"
+#include "philox.h"
+#include "check.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <thread>
+#include <vector>
+
+namespace {
+
+const double PI = 3.14159265358979323846;
+const size_t NUM_ORBITS = 1001; // Not a whole number of SIMD registers
+
+// Function to make random main-belt orbits, inclined and eccentric enough for every angle to be well defined
+std::vector<MinorPlanetOrbit> randomOrbits(uint64_t seed) {
+    PhiloxStream random(seed, 0);
+    std::vector<MinorPlanetOrbit> orbits(NUM_ORBITS);
+    for (size_t i = 0; i < NUM_ORBITS; i++) {
+        PhiloxCounter bits = random.block(i);
+        PhiloxCounter more = random.block(i, 1);
+        MinorPlanetOrbit& orbit = orbits[i];
+        orbit.semiMajorAxis = 2.1f + 1.2f * philoxUniform(bits.v[0]);
+        orbit.eccentricity = 0.02f + 0.3f * philoxUniform(bits.v[1]);
+        orbit.inclination = 0.02f + 0.5f * philoxUniform(bits.v[2]);
+        orbit.ascendingNode = float(2.0 * PI) * philoxUniform(bits.v[3]);
+        orbit.argumentOfPerihelion = float(2.0 * PI) * philoxUniform(more.v[0]);
+        orbit.meanAnomaly = float(2.0 * PI) * philoxUniform(more.v[1]);
+        orbit.meanMotion = float(std::sqrt(SUN_GM / std::pow(double(orbit.semiMajorAxis), 3.0)));
+        orbit.absoluteMagnitude = 10.0f + 8.0f * philoxUniform(more.v[2]);
+    }
+    return orbits;
+}
+
+// Function to get the difference of two angles, wrapped to [-pi, pi]
+double angleDifference(double a, double b) {
+    return std::remainder(a - b, 2.0 * PI);
+}
+
+// Largest differences between two sets of orbits: relative for the semi-major axis and mean motion, absolute for
+// the eccentricity, radians for the angles, and relative to the distance from the Sun for the positions at a day.
+// Nearly circular orbits have ill-defined periapses, whose errors the mean anomaly makes up for, so the positions
+// are the better measure of integrated orbits
+struct Differences {
+    double axis, eccentricity, angles, meanAnomaly, position;
+};
+
+Differences differences(const std::vector<MinorPlanetOrbit>& orbits, const std::vector<MinorPlanetOrbit>& expected, double day) {
+    Differences result = { 0.0, 0.0, 0.0, 0.0, 0.0 };
+    for (size_t i = 0; i < orbits.size(); i++) {
+        const MinorPlanetOrbit& orbit = orbits[i];
+        const MinorPlanetOrbit& reference = expected[i];
+        double position[3], expectedPosition[3], velocity[3];
+        orbitState(orbit, day, position, velocity);
+        orbitState(reference, day, expectedPosition, velocity);
+        double dx = position[0] - expectedPosition[0], dy = position[1] - expectedPosition[1], dz = position[2] - expectedPosition[2];
+        double distance = std::sqrt(expectedPosition[0] * expectedPosition[0] + expectedPosition[1] * expectedPosition[1] +
+                                    expectedPosition[2] * expectedPosition[2]);
+        result.position = std::max(result.position, std::sqrt(dx * dx + dy * dy + dz * dz) / distance);
+        result.axis = std::max(result.axis, std::fabs(orbit.semiMajorAxis / reference.semiMajorAxis - 1.0));
+        result.axis = std::max(result.axis, std::fabs(orbit.meanMotion / reference.meanMotion - 1.0));
+        result.eccentricity = std::max(result.eccentricity, double(std::fabs(orbit.eccentricity - reference.eccentricity)));
+        result.angles = std::max(result.angles, std::fabs(angleDifference(orbit.inclination, reference.inclination)));
+        result.angles = std::max(result.angles, std::fabs(angleDifference(orbit.ascendingNode, reference.ascendingNode)));
+        result.angles = std::max(result.angles, std::fabs(angleDifference(orbit.argumentOfPerihelion, reference.argumentOfPerihelion)));
+        result.meanAnomaly = std::max(result.meanAnomaly, std::fabs(angleDifference(orbit.meanAnomaly, reference.meanAnomaly)));
+    }
+    return result;
+}
+
+// Function to print the differences between two sets of orbits
+Differences printDifferences(const char* name, const std::vector<MinorPlanetOrbit>& orbits, const std::vector<MinorPlanetOrbit>& expected,
+                             double day) {
+    Differences result = differences(orbits, expected, day);
+    std::printf("%-36s a %.1e e %.1e angles %.1e M %.1e position %.1e\n", name, result.axis, result.eccentricity, result.angles,
+                result.meanAnomaly, result.position);
+    return result;
+}
+
+// Function to convert orbits to states at a day and back
+void checkRoundTrip(const std::vector<MinorPlanetOrbit>& orbits, double day) {
+    std::vector<MinorPlanetOrbit> converted(orbits.size());
+    for (size_t i = 0; i < orbits.size(); i++) {
+        double position[3], velocity[3];
+        orbitState(orbits[i], day, position, velocity);
+        converted[i] = osculatingOrbit(position, velocity, day);
+        converted[i].absoluteMagnitude = orbits[i].absoluteMagnitude;
+    }
+    char name[64];
+    std::snprintf(name, sizeof(name), "Round trip at day %g", day);
+    Differences result = printDifferences(name, converted, orbits, day);
+    CHECK(result.axis < 1e-6);
+    CHECK(result.eccentricity < 1e-6);
+    CHECK(result.angles < 1e-5);
+    CHECK(result.meanAnomaly < 1e-4); // Comes back from the mean motion times the day
+    CHECK(result.position < 1e-5);
+}
+
+// Function to convert a state to an orbit and check that it is a drawable ellipse
+MinorPlanetOrbit clampedOrbit(double x, double vy, double vz) {
+    double position[3] = { x, 0.0, 0.0 }, velocity[3] = { 0.0, vy, vz };
+    MinorPlanetOrbit orbit = osculatingOrbit(position, velocity, 0.0);
+    const float* values = &orbit.semiMajorAxis;
+    for (size_t i = 0; i < sizeof(MinorPlanetOrbit) / sizeof(float); i++) {
+        CHECK(std::isfinite(values[i]));
+    }
+    CHECK(orbit.semiMajorAxis > 0.0f && orbit.semiMajorAxis <= 100.0f);
+    CHECK(orbit.eccentricity >= 0.0f && orbit.eccentricity <= 0.99f);
+    return orbit;
+}
+
+// Function to integrate to a day and wait for the snapshot of it
+bool integrateTo(BeltIntegrator& integrator, double day, std::vector<MinorPlanetOrbit>& orbits) {
+    integrator.setTargetDay(day);
+    std::chrono::steady_clock::time_point giveUp = std::chrono::steady_clock::now() + std::chrono::seconds(60);
+    while (std::chrono::steady_clock::now() < giveUp) {
+        double snapshotDay;
+        if (integrator.takeSnapshot(orbits, snapshotDay) && snapshotDay == day) {
+            return true;
+        }
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    }
+    std::fprintf(stderr, "No snapshot of day %g\n", day);
+    return false;
+}
+
+} // namespace
+
+int main() {
+    std::vector<MinorPlanetOrbit> orbits = randomOrbits(1);
+    checkRoundTrip(orbits, 0.0);
+    checkRoundTrip(orbits, 1234.5);
+    checkRoundTrip(orbits, -5000.0);
+
+    // Escaping at 1 AU, on a hyperbola and a parabola, and a bound orbit wider than the clamp
+    double escape = std::sqrt(2.0 * SUN_GM);
+    clampedOrbit(1.0, 2.0 * escape, 0.0);
+    clampedOrbit(1.0, escape, 0.1 * escape);
+    CHECK(clampedOrbit(1.0, 0.999 * escape, 0.0).semiMajorAxis == 100.0f);
+    CHECK(clampedOrbit(1.0, 0.0, 0.01 * escape).eccentricity == 0.99f);
+
+    // Without perturbers the leapfrog keeps the Kepler orbits over ten years. The osculating elements wobble by about
+    // (n h)^2, n h being 1/90 for the fastest orbits here, and single-precision states let the phase drift by a few
+    // parts in 10^4 of the distance; a wrong force would move the asteroids by far more
+    {
+        BeltIntegrator integrator;
+        integrator.start(orbits, 0.0, 0);
+        std::vector<MinorPlanetOrbit> integrated;
+        if (integrateTo(integrator, 3650.0, integrated)) {
+            for (size_t i = 0; i < integrated.size(); i++) {
+                CHECK(integrated[i].absoluteMagnitude == orbits[i].absoluteMagnitude);
+            }
+            Differences result = printDifferences("Ten years without perturbers", integrated, orbits, 3650.0);
+            CHECK(result.axis < 1e-4);
+            CHECK(result.eccentricity < 1e-4);
+            CHECK(result.position < 5e-3);
+        }
+    }
+
+    // With the planets the orbits change, and the time-reversible leapfrog undoes that on the way back, up to the
+    // rounding of the single-precision states
+    {
+        BeltIntegrator integrator;
+        integrator.start(orbits, 0.0, BeltIntegrator::MAX_PERTURBERS);
+        std::vector<MinorPlanetOrbit> forward, back;
+        if (integrateTo(integrator, 4000.0, forward) && integrateTo(integrator, 0.0, back)) {
+            Differences perturbed = printDifferences("Perturbed after 4000 days", forward, orbits, 4000.0);
+            CHECK(perturbed.axis > 1e-3);
+            Differences result = printDifferences("4000 days forward and back", back, orbits, 0.0);
+            CHECK(result.axis < 1e-4);
+            CHECK(result.eccentricity < 1e-4);
+            CHECK(result.position < 1e-3);
+        }
+    }
+    return checkFailures();
+}
@@ -0,0 +1,25 @@
+// check.h - Minimal checks for the tests of the modules that need no GL context
+//
+// CHECK reports a failed condition with its location and carries on, so one run shows every
+// failure; a test's main() returns checkFailures() as its exit code for CTest.
+
+#ifndef CHECK_H
+#define CHECK_H
+
+#include <cstdio>
+
+// Function to count failed checks across the test
+inline int& checkFailures() {
+    static int failures = 0;
+    return failures;
+}
+
+#define CHECK(condition)                                                                 \
+    do {                                                                                 \
+        if (!(condition)) {                                                              \
+            std::fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__, #condition); \
+            checkFailures()++;                                                           \
+        }                                                                                \
+    } while (0)
+
+#endif // CHECK_H
@@ -0,0 +1,173 @@
+// kepler_test.cpp - Batch propagation of Kepler orbits against a double-precision reference
+//
+// Random orbits of a range of eccentricities go through KeplerBatch, and the positions and velocities
+// are compared with Kepler's equation solved by Newton's method in double precision from the same
+// elements: elliptic and hyperbolic orbits, eccentricities close to 1 on either side, and times of a
+// century, where the single-precision mean anomaly sets the error.
+
+#include "kepler.h"
+#include "philox.h"
+#include "check.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <vector>
+
+namespace {
+
+const double PI = 3.14159265358979323846;
+const size_t NUM_ORBITS = 1001; // Not a whole number of SIMD registers
+
+struct State {
+    double x, y, z, vx, vy, vz;
+};
+
+// Function to solve Kepler's equation in double precision, returning the state of an orbit at a time
+State referenceState(const KeplerOrbit& orbit, double time) {
+    double e = orbit.eccentricity, a = orbit.semiMajorAxis;
+    double M = double(orbit.meanAnomaly) + double(orbit.meanMotion) * time;
+    double sine, cosine, rate;
+    if (e < 1.0) {
+        // Newton from E = pi for the reduced anomaly, which converges monotonically for any eccentricity
+        M = std::remainder(M, 2.0 * PI);
+        double E = M < 0.0 ? -PI : PI;
+        for (int k = 0; k < 100; k++) {
+            double dE = (E - e * std::sin(E) - M) / (1.0 - e * std::cos(E));
+            E -= dE;
+            if (std::fabs(dE) < 1e-15) {
+                break;
+            }
+        }
+        sine = std::sin(E);
+        cosine = std::cos(E);
+        rate = orbit.meanMotion / (1.0 - e * cosine);
+    } else {
+        double H = std::asinh(M / e);
+        for (int k = 0; k < 100; k++) {
+            double dH = (e * std::sinh(H) - H - M) / (e * std::cosh(H) - 1.0);
+            H -= dH;
+            if (std::fabs(dH) < 1e-15 * (1.0 + std::fabs(H))) {
+                break;
+            }
+        }
+        sine = std::sinh(H);
+        cosine = std::cosh(H);
+        rate = orbit.meanMotion / (e * cosine - 1.0);
+    }
+
+    double b = std::fabs(a) * std::sqrt(std::fabs(1.0 - e * e));
+    double planeX = a * (cosine - e), planeY = b * sine;
+    double planeVX = (e < 1.0 ? -a * sine : a * sine) * rate, planeVY = b * cosine * rate;
+
+    double cosNode = std::cos(orbit.ascendingNode), sinNode = std::sin(orbit.ascendingNode);
+    double cosInc = std::cos(orbit.inclination), sinInc = std::sin(orbit.inclination);
+    double cosPeri = std::cos(orbit.argumentOfPeriapsis), sinPeri = std::sin(orbit.argumentOfPeriapsis);
+    double px = cosNode * cosPeri - sinNode * sinPeri * cosInc, qx = -cosNode * sinPeri - sinNode * cosPeri * cosInc;
+    double py = sinNode * cosPeri + cosNode * sinPeri * cosInc, qy = -sinNode * sinPeri + cosNode * cosPeri * cosInc;
+    double pz = sinPeri * sinInc, qz = cosPeri * sinInc;
+    State state = { px * planeX + qx * planeY, py * planeX + qy * planeY, pz * planeX + qz * planeY,
+                    px * planeVX + qx * planeVY, py * planeVX + qy * planeVY, pz * planeVX + qz * planeVY };
+    return state;
+}
+
+// Function to make random orbits of one eccentricity, with the mean motion of the semi-major axis around a Sun of GM 1
+std::vector<KeplerOrbit> randomOrbits(uint64_t seed, float eccentricity, float semiMajorAxis) {
+    PhiloxStream random(seed, 0);
+    std::vector<KeplerOrbit> orbits(NUM_ORBITS);
+    for (size_t i = 0; i < NUM_ORBITS; i++) {
+        PhiloxCounter bits = random.block(i);
+        PhiloxCounter more = random.block(i, 1);
+        KeplerOrbit& orbit = orbits[i];
+        orbit.semiMajorAxis = semiMajorAxis * (0.5f + philoxUniform(more.v[0]));
+        orbit.eccentricity = eccentricity;
+        orbit.inclination = float(PI) * philoxUniform(bits.v[0]);
+        orbit.ascendingNode = float(2.0 * PI) * philoxUniform(bits.v[1]);
+        orbit.argumentOfPeriapsis = float(2.0 * PI) * philoxUniform(bits.v[2]);
+        orbit.meanAnomaly = float(2.0 * PI) * (philoxUniform(bits.v[3]) - 0.5f);
+        orbit.meanMotion = float(1.0 / std::pow(std::fabs(double(orbit.semiMajorAxis)), 1.5));
+    }
+    return orbits;
+}
+
+// Largest errors of positions relative to the distance and of velocities relative to the speed
+struct Errors {
+    double position, velocity;
+};
+
+// Function to compare propagated states with the reference at the given times
+Errors compare(const std::vector<KeplerOrbit>& orbits, const std::vector<float>& times, const std::vector<float>& x,
+               const std::vector<float>& y, const std::vector<float>& z, const std::vector<float>& vx,
+               const std::vector<float>& vy, const std::vector<float>& vz, size_t first) {
+    Errors errors = { 0.0, 0.0 };
+    for (size_t i = 0; i < x.size(); i++) {
+        State reference = referenceState(orbits[first + i], times[i]);
+        double distance = std::sqrt(reference.x * reference.x + reference.y * reference.y + reference.z * reference.z);
+        double speed = std::sqrt(reference.vx * reference.vx + reference.vy * reference.vy + reference.vz * reference.vz);
+        double dx = x[i] - reference.x, dy = y[i] - reference.y, dz = z[i] - reference.z;
+        double dvx = vx[i] - reference.vx, dvy = vy[i] - reference.vy, dvz = vz[i] - reference.vz;
+        errors.position = std::max(errors.position, std::sqrt(dx * dx + dy * dy + dz * dz) / distance);
+        errors.velocity = std::max(errors.velocity, std::sqrt(dvx * dvx + dvy * dvy + dvz * dvz) / speed);
+    }
+    return errors;
+}
+
+// Function to propagate the orbits [first, last) to one time and to a time of their own each, and check both
+void checkOrbits(const char* name, const std::vector<KeplerOrbit>& orbits, double time, double timeSpread, double bound) {
+    KeplerBatch batch;
+    batch.resize(orbits.size());
+    for (size_t i = 0; i < orbits.size(); i++) {
+        batch.setOrbit(i, orbits[i]);
+    }
+
+    // An odd range, so that neither end falls on a SIMD register boundary
+    size_t first = 3, last = orbits.size() - 2, count = last - first;
+    std::vector<float> x(count), y(count), z(count), vx(count), vy(count), vz(count);
+    KeplerStates states = { x.data(), y.data(), z.data(), vx.data(), vy.data(), vz.data() };
+
+    batch.propagate(time, first, last, states);
+    std::vector<float> times(count, float(time));
+    Errors shared = compare(orbits, times, x, y, z, vx, vy, vz, first);
+
+    PhiloxStream random(7, 0);
+    for (size_t i = 0; i < count; i++) {
+        times[i] = float(time + timeSpread * (philoxUniform(random.block(i).v[0]) - 0.5));
+    }
+    batch.propagate(times.data(), first, last, states);
+    Errors own = compare(orbits, times, x, y, z, vx, vy, vz, first);
+
+    std::printf("%-34s position %.2e %.2e velocity %.2e %.2e\n", name, shared.position, own.position, shared.velocity, own.velocity);
+    CHECK(shared.position < bound);
+    CHECK(shared.velocity < bound);
+    CHECK(own.position < bound);
+    CHECK(own.velocity < bound);
+}
+
+} // namespace
+
+int main() {
+    // Within a few revolutions of the epoch the solvers' tolerance of 1e-6 in the anomaly sets the error
+    const double BOUND = 1e-4;
+    checkOrbits("Circular", randomOrbits(1, 0.0f, 2.7f), 10.0, 40.0, BOUND);
+    checkOrbits("Elliptic e 0.1", randomOrbits(2, 0.1f, 2.7f), 10.0, 40.0, BOUND);
+    checkOrbits("Elliptic e 0.5", randomOrbits(3, 0.5f, 2.7f), 10.0, 40.0, BOUND);
+    checkOrbits("Elliptic e 0.9", randomOrbits(4, 0.9f, 2.7f), 10.0, 40.0, BOUND);
+    checkOrbits("Hyperbolic e 1.5", randomOrbits(5, 1.5f, -2.7f), 10.0, 40.0, BOUND);
+    checkOrbits("Hyperbolic e 5", randomOrbits(6, 5.0f, -2.7f), 10.0, 40.0, BOUND);
+
+    // Near periapsis of a nearly parabolic orbit the rounding of the single-precision mean anomaly is amplified by
+    // 1 / (1 - e cos E), up to a hundred times for e 0.99, and measured against a periapsis distance of a (1 - e)
+    const double NEAR_PARABOLIC_BOUND = 2e-3;
+    checkOrbits("Near-parabolic elliptic e 0.99", randomOrbits(7, 0.99f, 2.7f), 10.0, 40.0, NEAR_PARABOLIC_BOUND);
+    checkOrbits("Near-parabolic elliptic e 0.999", randomOrbits(8, 0.999f, 2.7f), 10.0, 40.0, NEAR_PARABOLIC_BOUND);
+    checkOrbits("Near-parabolic hyperbolic e 1.001", randomOrbits(9, 1.001f, -2.7f), 10.0, 40.0, NEAR_PARABOLIC_BOUND);
+    checkOrbits("Near-parabolic hyperbolic e 1.01", randomOrbits(10, 1.01f, -2.7f), 10.0, 40.0, NEAR_PARABOLIC_BOUND);
+
+    // A century of days at the Earth's mean motion of 0.0172 radians a day: the mean anomaly of about 630 radians
+    // keeps about 6e-5 of them in single precision, and far along a hyperbola the anomaly grows only logarithmically
+    const double CENTURY = 36525.0;
+    checkOrbits("Elliptic e 0.5, a century", randomOrbits(11, 0.5f, 148.0f), CENTURY, 400.0, 1e-4);
+    checkOrbits("Elliptic e 0.99, a century", randomOrbits(12, 0.99f, 148.0f), CENTURY, 400.0, NEAR_PARABOLIC_BOUND);
+    checkOrbits("Hyperbolic e 1.5, a century", randomOrbits(13, 1.5f, -148.0f), CENTURY, 400.0, BOUND);
+    return checkFailures();
+}
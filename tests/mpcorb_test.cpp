@@ -0,0 +1,167 @@
+// mpcorb_test.cpp - Parsing of MPCORB.DAT lines and the round trip through the binary cache
+//
+// A small catalog with a header, Ceres, Pallas and Vesta in the MPC's fixed-width format, a line
+// without a name and lines to skip is parsed and checked field by field, including the packed
+// epochs and the mean anomalies moved back to J2000. The cache it writes is then loaded back, and
+// truncated and corrupted copies of it must be rejected in favour of parsing the catalog again.
+
+#include "mpcorb.h"
+#include "check.h"
+
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iterator>
+#include <string>
+#include <vector>
+
+namespace {
+
+const double DEGREES = 3.14159265358979323846 / 180.0;
+const double J2000 = 2451545.0;
+const double EPOCH_K2555 = 2460800.5; // 2025-05-05.0
+const double EPOCH_K24AU = 2460613.5; // 2024-10-30.0
+
+const char* const CATALOG_PATH = "mpcorb_test.dat";
+const char* const CACHE_PATH = "mpcorb_test.dat.cache";
+
+const char* const CATALOG =
+    "MINOR PLANET CENTER ORBIT DATABASE (MPCORB)\n"
+    "\n"
+    "Des'n     H     G   Epoch     M        Peri.      Node       Incl.       e            n           a        Reference #Obs #Opp    Arc    rms  Perts   Computer\n"
+    "----------------------------------------------------------------------------------------------------------------------------------------------------------------\n"
+    "00001    3.34  0.15 K2555 188.70269   73.27343   80.25221   10.58780  0.0794013  0.21424651   2.7660512  0 E2024-V47  7330 125 1801-2024 0.80 M-v 30k MPCORB     0000 (1) Ceres                   20241101\n"
+    "00002    4.11  0.15 K2555 168.80092  310.93239  172.88701   34.92832  0.2306429  0.21375954   2.7701736  0 E2024-S50  8884 122 1804-2024 0.58 M-c 28k MPCORB     0000 (2) Pallas                  20240920\r\n"
+    "\n"
+    "00004    3.25  0.15 K24AU  26.80587  151.53712  103.70232    7.14406  0.0901693  0.27154465   2.3613676  0 E2024-X01  7660 110 1821-2024 0.60 M-p 18k MPCORB     0000 (4) Vesta                   20241201\n"
+    "K24A02C  9.00  0.15 K2555  10.00000   20.00000   30.00000    1.50000  1.0123000  0.10000000   4.0000000\n" // Hyperbolic, skipped
+    "K24A01B             K2555  10.00000   20.00000   30.00000    1.50000  0.9000000  0.10000000   4.0000000\n" // No magnitude or name
+    "not an orbit\n";
+
+// Function to get the elements a catalog line should parse to, with the mean anomaly moved back to J2000
+MinorPlanetOrbit expectedOrbit(double H, double epoch, double M, double perihelion, double node, double inclination, double e,
+                               double n, double a) {
+    double meanAnomaly = std::fmod(M - n * (epoch - J2000), 360.0);
+    MinorPlanetOrbit orbit;
+    orbit.semiMajorAxis = float(a);
+    orbit.eccentricity = float(e);
+    orbit.inclination = float(inclination * DEGREES);
+    orbit.ascendingNode = float(node * DEGREES);
+    orbit.argumentOfPerihelion = float(perihelion * DEGREES);
+    orbit.meanAnomaly = float((meanAnomaly < 0.0 ? meanAnomaly + 360.0 : meanAnomaly) * DEGREES);
+    orbit.meanMotion = float(n * DEGREES);
+    orbit.absoluteMagnitude = float(H);
+    return orbit;
+}
+
+// Function to check a parsed orbit against the expected one, to a few float ulps
+void checkOrbit(const MinorPlanetOrbit& orbit, const MinorPlanetOrbit& expected) {
+    const float* values = &orbit.semiMajorAxis;
+    const float* expectedValues = &expected.semiMajorAxis;
+    for (size_t i = 0; i < sizeof(MinorPlanetOrbit) / sizeof(float); i++) {
+        CHECK(std::fabs(values[i] - expectedValues[i]) <= 1e-6f * std::fabs(expectedValues[i]) + 1e-6f);
+    }
+}
+
+// Function to check that a catalog holds the test catalog's orbits and names
+void checkCatalog(const MinorPlanetCatalog& catalog) {
+    CHECK(catalog.size() == 4);
+    if (catalog.size() != 4) {
+        return;
+    }
+    checkOrbit(catalog.orbits()[0], expectedOrbit(3.34, EPOCH_K2555, 188.70269, 73.27343, 80.25221, 10.58780, 0.0794013, 0.21424651, 2.7660512));
+    checkOrbit(catalog.orbits()[1], expectedOrbit(4.11, EPOCH_K2555, 168.80092, 310.93239, 172.88701, 34.92832, 0.2306429, 0.21375954, 2.7701736));
+    checkOrbit(catalog.orbits()[2], expectedOrbit(3.25, EPOCH_K24AU, 26.80587, 151.53712, 103.70232, 7.14406, 0.0901693, 0.27154465, 2.3613676));
+    checkOrbit(catalog.orbits()[3], expectedOrbit(99.0, EPOCH_K2555, 10.0, 20.0, 30.0, 1.5, 0.9, 0.1, 4.0));
+    CHECK(catalog.name(0) == "(1) Ceres");
+    CHECK(catalog.name(1) == "(2) Pallas");
+    CHECK(catalog.name(2) == "(4) Vesta");
+    CHECK(catalog.name(3) == "K24A01B");
+}
+
+// Function to read a whole file
+std::vector<char> readFile(const char* path) {
+    std::ifstream file(path, std::ios::binary);
+    return std::vector<char>(std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>());
+}
+
+// Function to replace a file's contents
+void writeFile(const char* path, const std::vector<char>& data) {
+    std::ofstream file(path, std::ios::binary | std::ios::trunc);
+    file.write(data.data(), data.size());
+}
+
+// Function to load the catalog from a changed cache, which must be rejected: the catalog is parsed again and
+// the cache written anew
+void checkRejected(const char* name, const std::vector<char>& cache, const std::vector<char>& changed) {
+    std::printf("Rejecting a cache with %s\n", name);
+    writeFile(CACHE_PATH, changed);
+    MinorPlanetCatalog catalog;
+    CHECK(catalog.load(CATALOG_PATH));
+    checkCatalog(catalog);
+    CHECK(readFile(CACHE_PATH) == cache);
+}
+
+} // namespace
+
+int main() {
+    std::remove(CACHE_PATH);
+    {
+        std::ofstream file(CATALOG_PATH, std::ios::binary | std::ios::trunc);
+        file << CATALOG;
+    }
+
+    // Parsed from the text, writing the cache
+    {
+        MinorPlanetCatalog catalog;
+        CHECK(catalog.load(CATALOG_PATH));
+        checkCatalog(catalog);
+    }
+    std::vector<char> cache = readFile(CACHE_PATH);
+    CHECK(!cache.empty());
+
+    // Mapped from the cache: an orbit changed in it shows that it was used rather than the text
+    {
+        MinorPlanetCatalog catalog;
+        CHECK(catalog.load(CATALOG_PATH));
+        checkCatalog(catalog);
+    }
+    const size_t HEADER_SIZE = cache.size() - 4 * sizeof(MinorPlanetOrbit) - 5 * sizeof(uint32_t) - std::strlen("(1) Ceres(2) Pallas(4) VestaK24A01B");
+    std::vector<char> changed = cache;
+    float axis = 5.0f;
+    std::memcpy(&changed[HEADER_SIZE], &axis, sizeof(axis));
+    writeFile(CACHE_PATH, changed);
+    {
+        MinorPlanetCatalog catalog;
+        CHECK(catalog.load(CATALOG_PATH));
+        CHECK(catalog.size() == 4 && catalog.orbits()[0].semiMajorAxis == 5.0f);
+    }
+
+    // Caches that do not hold what their header describes
+    checkRejected("a missing byte", cache, std::vector<char>(cache.begin(), cache.end() - 1));
+    checkRejected("an extra byte", cache, [&]() { std::vector<char> longer = cache; longer.push_back(0); return longer; }());
+
+    const size_t OFFSETS = HEADER_SIZE + 4 * sizeof(MinorPlanetOrbit);
+    uint32_t offsets[5];
+    std::memcpy(offsets, &cache[OFFSETS], sizeof(offsets));
+    struct Corruption {
+        const char* name;
+        size_t index;
+        uint32_t value;
+    } corruptions[] = {
+        { "names that do not start at 0", 0, 1 },
+        { "decreasing name offsets", 2, offsets[1] - 1 },
+        { "a name far past the end", 2, 0x7fffffffu },
+        { "names ending before the name characters do", 4, offsets[4] - 1 },
+    };
+    for (const Corruption& corruption : corruptions) {
+        changed = cache;
+        std::memcpy(&changed[OFFSETS + corruption.index * sizeof(uint32_t)], &corruption.value, sizeof(uint32_t));
+        checkRejected(corruption.name, cache, changed);
+    }
+
+    std::remove(CACHE_PATH);
+    std::remove(CATALOG_PATH);
+    return checkFailures();
+}
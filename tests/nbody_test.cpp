@@ -0,0 +1,181 @@
+// nbody_test.cpp - Forces of the Barnes-Hut and fast multipole solvers against direct summation
+//
+// The same particles go through each solver and through direct summation (Barnes-Hut with an
+// opening angle of 0), and the mean and largest relative errors of the accelerations are checked,
+// for a uniform cube and for a disc around a central body, as in the N-body mode. A simulation of two
+// bodies must publish the orbit they started on.
+
+#include "nbody.h"
+#include "belt_integrator.h"
+#include "philox.h"
+#include "check.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <thread>
+#include <vector>
+
+namespace {
+
+const size_t NUM_PARTICLES = 8000; // Enough for the disc to have cells far from the central body's
+
+// Function to fill a cube with particles of random mass
+NBodyParticles uniformCube(size_t count) {
+    PhiloxStream random(1, 0);
+    NBodyParticles particles;
+    particles.resize(count);
+    for (size_t i = 0; i < count; i++) {
+        PhiloxCounter bits = random.block(i);
+        particles.x[i] = philoxUniform(bits.v[0]);
+        particles.y[i] = philoxUniform(bits.v[1]);
+        particles.z[i] = philoxUniform(bits.v[2]);
+        particles.mass[i] = (0.5f + philoxUniform(bits.v[3])) / count;
+    }
+    return particles;
+}
+
+// Function to place a heavy central body and a thin disc of light particles from 2 to 4 AU around it
+NBodyParticles centralDisc(size_t count) {
+    PhiloxStream random(1, 1);
+    NBodyParticles particles;
+    particles.resize(count);
+    particles.mass[0] = 2.959e-4f; // The Sun's GM in AU^3 / day^2
+    for (size_t i = 1; i < count; i++) {
+        PhiloxCounter bits = random.block(i);
+        float radius = 2.0f + 2.0f * philoxUniform(bits.v[0]);
+        float angle = 6.2831853f * philoxUniform(bits.v[1]);
+        particles.x[i] = radius * std::cos(angle);
+        particles.y[i] = radius * std::sin(angle);
+        particles.z[i] = 0.1f * (philoxUniform(bits.v[2]) - 0.5f);
+        particles.mass[i] = 2.959e-4f * 1e-9f * (0.5f + philoxUniform(bits.v[3]));
+    }
+    return particles;
+}
+
+struct Accelerations {
+    std::vector<float> x, y, z;
+};
+
+// Function to get the accelerations of the particles from a solver
+Accelerations accelerations(GravitySolver& solver, const NBodyParticles& particles) {
+    Accelerations result;
+    result.x.resize(particles.size());
+    result.y.resize(particles.size());
+    result.z.resize(particles.size());
+    solver.accelerations(particles, result.x.data(), result.y.data(), result.z.data());
+    return result;
+}
+
+// Relative errors of accelerations against the reference ones
+struct Errors {
+    double mean, max;
+};
+
+Errors relativeErrors(const Accelerations& values, const Accelerations& reference) {
+    Errors errors = { 0.0, 0.0 };
+    size_t count = reference.x.size();
+    for (size_t i = 0; i < count; i++) {
+        double dx = double(values.x[i]) - reference.x[i];
+        double dy = double(values.y[i]) - reference.y[i];
+        double dz = double(values.z[i]) - reference.z[i];
+        double magnitude = std::sqrt(double(reference.x[i]) * reference.x[i] + double(reference.y[i]) * reference.y[i] +
+                                     double(reference.z[i]) * reference.z[i]);
+        double error = std::sqrt(dx * dx + dy * dy + dz * dz) / magnitude;
+        errors.mean += error / count;
+        errors.max = std::max(errors.max, error);
+    }
+    return errors;
+}
+
+// Function to measure a solver against the reference, printing the errors
+Errors measure(GravitySolver& solver, const char* label, const NBodyParticles& particles, const Accelerations& reference) {
+    Errors errors = relativeErrors(accelerations(solver, particles), reference);
+    std::printf("%-28s mean %.2e max %.2e\n", label, errors.mean, errors.max);
+    return errors;
+}
+
+// Function to check both solvers on a set of particles; the bounds are a few times the errors measured when the
+// kernels were written, so they catch broken expansions rather than rounding changes
+void checkSolvers(const char* name, const NBodyParticles& particles, double fmmBound) {
+    std::printf("%s, %zu particles\n", name, particles.size());
+    BarnesHutSolver direct(0.0f);
+    Accelerations reference = accelerations(direct, particles);
+
+    BarnesHutSolver barnesHut(0.5f);
+    Errors barnesHutErrors = measure(barnesHut, "Barnes-Hut theta 0.5", particles, reference);
+    CHECK(barnesHutErrors.mean < 1e-2);
+
+    // Direct summation through the fast multipole tree: every pair is near
+    FastMultipoleSolver fmmDirect(FastMultipoleSolver::DEFAULT_ORDER, 0.0f);
+    Errors directErrors = measure(fmmDirect, "FMM theta 0", particles, reference);
+    CHECK(directErrors.mean < 1e-5);
+
+    FastMultipoleSolver order2(2, 0.5f);
+    FastMultipoleSolver order6(6, 0.5f);
+    FastMultipoleSolver order10(10, 0.5f);
+    Errors order2Errors = measure(order2, "FMM order 2 theta 0.5", particles, reference);
+    Errors order6Errors = measure(order6, "FMM order 6 theta 0.5", particles, reference);
+    Errors order10Errors = measure(order10, "FMM order 10 theta 0.5", particles, reference);
+    CHECK(order2Errors.mean < 0.5);
+    CHECK(order6Errors.mean < fmmBound);
+    CHECK(order10Errors.mean < fmmBound / 10.0);
+
+    // Higher orders converge
+    CHECK(order6Errors.mean < order2Errors.mean / 10.0);
+    CHECK(order10Errors.mean < order6Errors.mean);
+
+    // A smaller opening angle is more accurate too
+    FastMultipoleSolver narrow(6, 0.3f);
+    Errors narrowErrors = measure(narrow, "FMM order 6 theta 0.3", particles, reference);
+    CHECK(narrowErrors.mean < order6Errors.mean);
+}
+
+// Function to simulate the Sun and a planet of Jupiter's mass for a while and check that the published orbit is the
+// one the planet started on: the relative orbit of two bodies is a Kepler ellipse under both their masses, and
+// taking it under the Sun's alone would shift its semi-major axis by the mass ratio of 1e-3
+void checkTwoBodySnapshot() {
+    const double MASS_RATIO = 1.0 / 1047.3486;
+    const double GM = SUN_GM * (1.0 + MASS_RATIO);
+    MinorPlanetOrbit orbit = { 5.2f, 0.05f, 0.02f, 1.75f, 4.78f, 0.35f, float(std::sqrt(GM / (5.2 * 5.2 * 5.2))), 99.0f };
+    double position[3], velocity[3];
+    orbitState(orbit, 0.0, position, velocity, GM);
+
+    NBodyParticles particles;
+    particles.resize(2);
+    particles.x[0] = particles.y[0] = particles.z[0] = particles.vx[0] = particles.vy[0] = particles.vz[0] = 0.0f;
+    particles.mass[0] = float(SUN_GM);
+    particles.x[1] = float(position[0]); particles.y[1] = float(position[1]); particles.z[1] = float(position[2]);
+    particles.vx[1] = float(velocity[0]); particles.vy[1] = float(velocity[1]); particles.vz[1] = float(velocity[2]);
+    particles.mass[1] = float(SUN_GM * MASS_RATIO);
+
+    NBodySimulation simulation;
+    simulation.start(particles, 0.0, std::unique_ptr<GravitySolver>(new BarnesHutSolver(0.0f)));
+    simulation.setTargetDay(1000.0);
+    std::vector<MinorPlanetOrbit> orbits;
+    double day = 0.0;
+    std::chrono::steady_clock::time_point giveUp = std::chrono::steady_clock::now() + std::chrono::seconds(60);
+    while (!(simulation.takeSnapshot(orbits, day) && day == 1000.0) && std::chrono::steady_clock::now() < giveUp) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    }
+    CHECK(day == 1000.0 && orbits.size() == 1);
+    if (orbits.size() == 1) {
+        double axisError = std::fabs(orbits[0].semiMajorAxis / orbit.semiMajorAxis - 1.0);
+        double meanMotionError = std::fabs(orbits[0].meanMotion / orbit.meanMotion - 1.0);
+        double meanAnomalyError = std::fabs(std::remainder(double(orbits[0].meanAnomaly) - orbit.meanAnomaly, 2.0 * 3.14159265358979));
+        std::printf("Two bodies after 1000 days: a %.1e n %.1e M %.1e\n", axisError, meanMotionError, meanAnomalyError);
+        CHECK(axisError < 1e-5);
+        CHECK(meanMotionError < 1e-5);
+        CHECK(meanAnomalyError < 1e-4);
+    }
+}
+
+} // namespace
+
+int main() {
+    checkTwoBodySnapshot();
+    checkSolvers("Uniform cube", uniformCube(NUM_PARTICLES), 1e-4);
+    checkSolvers("Disc around a central body", centralDisc(NUM_PARTICLES), 1e-3);
+    return checkFailures();
+}
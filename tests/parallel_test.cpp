@@ -0,0 +1,98 @@
+// parallel_test.cpp - Loops on the shared thread pool
+//
+// Every index of a loop must be visited exactly once, in ranges of the advertised length and
+// alignment, whether loops are started one at a time, from several threads at once, or from
+// inside one another.
+
+#include "parallel.h"
+#include "check.h"
+
+#include <atomic>
+#include <cstdio>
+#include <thread>
+#include <vector>
+
+namespace {
+
+// Function to run a loop and check that it covers [0, count) once, in numbered ranges of whole alignments
+bool checkLoop(size_t count, size_t alignment) {
+    std::vector<std::atomic<int> > visits(count);
+    for (std::atomic<int>& visit : visits) {
+        visit = 0;
+    }
+    size_t rangeSize = parallelRangeSize(count, alignment);
+    std::atomic<int> badRanges(0);
+    parallelFor(count, [&](size_t first, size_t last) {
+        if (first % rangeSize != 0 || (last != count && last != first + rangeSize) || first >= last) {
+            badRanges++;
+        }
+        for (size_t i = first; i < last; i++) {
+            visits[i]++;
+        }
+    }, alignment);
+
+    bool valid = rangeSize % alignment == 0 && badRanges == 0;
+    for (size_t i = 0; i < count; i++) {
+        valid = valid && visits[i] == 1;
+    }
+    return valid;
+}
+
+// Function to run uneven tasks and check that each runs once
+bool checkTasks(size_t count, size_t numThreads) {
+    std::vector<std::atomic<int> > runs(count);
+    for (std::atomic<int>& run : runs) {
+        run = 0;
+    }
+    parallelTasks(count, numThreads, [&](size_t task) {
+        volatile double sink = 0.0;
+        for (size_t i = 0; i < task * 100; i++) {
+            sink = sink + double(i);
+        }
+        runs[task]++;
+    });
+    bool valid = true;
+    for (size_t i = 0; i < count; i++) {
+        valid = valid && runs[i] == 1;
+    }
+    return valid;
+}
+
+} // namespace
+
+int main() {
+    std::printf("%zu threads for a million items\n", parallelThreadCount(1000000));
+    CHECK(parallelThreadCount(0) == 1);
+    CHECK(parallelThreadCount(PARALLEL_MIN_ITEMS) == 1);
+
+    const size_t counts[] = { 0, 1, 7, 4095, 4096, 100000, 1000003 };
+    for (size_t count : counts) {
+        CHECK(checkLoop(count, 1));
+        CHECK(checkLoop(count, 16));
+        CHECK(checkTasks(count / 1000, 8));
+    }
+
+    // Loops from several threads at once, some with loops inside their ranges
+    std::atomic<int> failures(0);
+    std::vector<std::thread> callers;
+    for (int c = 0; c < 4; c++) {
+        callers.push_back(std::thread([&failures, c]() {
+            for (int repeat = 0; repeat < 50; repeat++) {
+                if (!checkLoop(100000 + c, c + 1)) {
+                    failures++;
+                }
+                parallelFor(4 * PARALLEL_MIN_ITEMS * 4, [&](size_t first, size_t last) {
+                    if (first == 0 && !checkLoop(50000, 4)) {
+                        failures++;
+                    }
+                    (void)last;
+                });
+            }
+        }));
+    }
+    for (std::thread& caller : callers) {
+        caller.join();
+    }
+    CHECK(failures == 0);
+    return checkFailures();
+}
@@ -0,0 +1,123 @@
+// philox_test.cpp - Philox4x32-10 known answers and a belt that does not depend on the thread count
+//
+// The generator must reproduce the known-answer vectors of the Random123 reference implementation,
+// which pins the round multipliers, the key schedule and the word order. The generated belt is then
+// built one asteroid at a time, backwards, from several threads in interleaved ranges and on the
+// thread pool, and every build must match the first bit for bit.
+
+#include "philox.h"
+#include "asteroid_elements.h"
+#include "parallel.h"
+#include "check.h"
+
+#include <cstdio>
+#include <cstring>
+#include <thread>
+#include <vector>
+
+namespace {
+
+const size_t NUM_ASTEROIDS = 100003; // Not a whole number of any thread's ranges
+const uint32_t SEED = 0x501A5u;
+const float EARTH_DISTANCE = 3.0f;
+
+// One known answer: a counter and key, and the block they give
+struct KnownAnswer {
+    PhiloxCounter counter;
+    PhiloxKey key;
+    PhiloxCounter expected;
+};
+
+// Function to check the generator against the Random123 known-answer vectors
+void testKnownAnswers() {
+    const KnownAnswer answers[] = {
+        { { { 0x00000000u, 0x00000000u, 0x00000000u, 0x00000000u } }, { { 0x00000000u, 0x00000000u } },
+          { { 0x6627e8d5u, 0xe169c58du, 0xbc57ac4cu, 0x9b00dbd8u } } },
+        { { { 0xffffffffu, 0xffffffffu, 0xffffffffu, 0xffffffffu } }, { { 0xffffffffu, 0xffffffffu } },
+          { { 0x408f276du, 0x41c83b0eu, 0xa20bc7c6u, 0x6d5451fdu } } },
+        { { { 0x243f6a88u, 0x85a308d3u, 0x13198a2eu, 0x03707344u } }, { { 0xa4093822u, 0x299f31d0u } },
+          { { 0xd16cfe09u, 0x94fdccebu, 0x5001e420u, 0x24126ea1u } } },
+    };
+    for (const KnownAnswer& answer : answers) {
+        PhiloxCounter block = philox4x32(answer.counter, answer.key);
+        for (int k = 0; k < 4; k++) {
+            CHECK(block.v[k] == answer.expected.v[k]);
+        }
+    }
+
+    // A stream puts the index in the low counter words, low word first, and the block number above them
+    PhiloxStream stream(0xa4093822u, 0x299f31d0u);
+    PhiloxCounter block = stream.block(0x85a308d3243f6a88ull, 0x13198a2eu);
+    PhiloxCounter counter = { { 0x243f6a88u, 0x85a308d3u, 0x13198a2eu, 0 } };
+    PhiloxKey key = { { 0xa4093822u, 0x299f31d0u } };
+    PhiloxCounter direct = philox4x32(counter, key);
+    CHECK(std::memcmp(&block, &direct, sizeof(block)) == 0);
+
+    CHECK(philoxUniform(0) == 0.0f);
+    CHECK(philoxUniform(0xffffffffu) < 1.0f);
+}
+
+// Function to compare two belts bit for bit
+bool sameBelt(const std::vector<AsteroidElements>& a, const std::vector<AsteroidElements>& b) {
+    return a.size() == b.size() && std::memcmp(a.data(), b.data(), a.size() * sizeof(AsteroidElements)) == 0;
+}
+
+// Function to check that asteroid i is the same whichever order and thread it is generated in
+void testThreadCounts() {
+    std::vector<AsteroidElements> reference(NUM_ASTEROIDS);
+    for (size_t i = 0; i < NUM_ASTEROIDS; i++) {
+        generateAsteroid(SEED, i, EARTH_DISTANCE, reference[i]);
+    }
+
+    std::vector<AsteroidElements> belt(NUM_ASTEROIDS);
+    for (size_t i = NUM_ASTEROIDS; i-- > 0;) {
+        generateAsteroid(SEED, i, EARTH_DISTANCE, belt[i]);
+    }
+    CHECK(sameBelt(belt, reference));
+
+    const int threadCounts[] = { 2, 3, 8 };
+    for (int numThreads : threadCounts) {
+        std::vector<AsteroidElements> threaded(NUM_ASTEROIDS);
+        std::vector<std::thread> threads;
+        for (int t = 0; t < numThreads; t++) {
+            threads.push_back(std::thread([&, t]() {
+                for (size_t i = t; i < NUM_ASTEROIDS; i += numThreads) {
+                    generateAsteroid(SEED, i, EARTH_DISTANCE, threaded[i]);
+                }
+            }));
+        }
+        for (std::thread& thread : threads) {
+            thread.join();
+        }
+        CHECK(sameBelt(threaded, reference));
+    }
+
+    std::vector<AsteroidElements> pooled(NUM_ASTEROIDS);
+    parallelFor(NUM_ASTEROIDS, [&](size_t first, size_t last) {
+        for (size_t i = first; i < last; i++) {
+            generateAsteroid(SEED, i, EARTH_DISTANCE, pooled[i]);
+        }
+    });
+    CHECK(sameBelt(pooled, reference));
+
+    // Another seed gives another belt, and every asteroid of this one lies in the generated ranges
+    generateAsteroid(SEED + 1, 0, EARTH_DISTANCE, belt[0]);
+    CHECK(std::memcmp(&belt[0], &reference[0], sizeof(AsteroidElements)) != 0);
+    size_t outside = 0;
+    for (const AsteroidElements& asteroid : reference) {
+        if (!(asteroid.semiMajorAxis >= 7.0f && asteroid.semiMajorAxis < 8.0f && asteroid.eccentricity < 0.1f &&
+              asteroid.inclination < 0.035f && asteroid.meanMotion > 0.0f)) {
+            outside++;
+        }
+    }
+    std::printf("belt of %zu asteroids: %zu outside the generated ranges\n", reference.size(), outside);
+    CHECK(outside == 0);
+}
+
+} // namespace
+
+int main() {
+    testKnownAnswers();
+    testThreadCounts();
+    return checkFailures();
+}
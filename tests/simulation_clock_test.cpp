@@ -0,0 +1,87 @@
+// simulation_clock_test.cpp - Calendar dates of the simulation clock
+//
+// Days since J2000.0 go to "YYYY-MM-DD" and back for every day of three centuries, across the leap
+// years and the century years that are not, and dates the month does not have must be rejected
+// rather than rolled over into the next month.
+
+#include "simulation_clock.h"
+#include "check.h"
+
+#include <cstdio>
+#include <string>
+
+namespace {
+
+// Function to parse a date that must be accepted, returning its day
+double parsed(const char* text) {
+    double day = 1e9;
+    CHECK(parseDate(text, day));
+    return day;
+}
+
+// Function to check that a date is rejected
+void checkRejected(const char* text) {
+    double day = 0.0;
+    if (parseDate(text, day)) {
+        std::fprintf(stderr, "Accepted invalid date %s as day %g\n", text, day);
+        checkFailures()++;
+    }
+}
+
+} // namespace
+
+int main() {
+    // J2000.0 is noon of 2000-01-01, 10957.5 days after the Unix epoch
+    CHECK(daysFromCivil(1970, 1, 1) == 0);
+    CHECK(daysFromCivil(2000, 1, 1) == 10957);
+    CHECK(daysFromCivil(1969, 12, 31) == -1);
+    CHECK(formatDate(0.0) == "2000-01-01");
+    CHECK(formatDate(-0.5) == "2000-01-01");
+    CHECK(formatDate(-0.51) == "1999-12-31");
+    CHECK(parsed("2000-01-01") == -0.5);
+    CHECK(parsed("2000-03-01") == 59.5); // 2000 is a leap year
+    CHECK(parsed("2100-03-01") - parsed("2100-02-28") == 1.0); // 2100 is not
+
+    // Every day from 1900 to 2200 round trips, and consecutive dates of the calendar are consecutive days
+    const unsigned DAYS_IN_MONTH[12] = { 31, 28, 31, 30, 31, 30, 31, 31, 30, 31, 30, 31 };
+    long days = daysFromCivil(1900, 1, 1);
+    int failures = 0;
+    for (long year = 1900; year < 2200; year++) {
+        bool leap = year % 4 == 0 && (year % 100 != 0 || year % 400 == 0);
+        for (unsigned month = 1; month <= 12; month++) {
+            unsigned monthDays = month == 2 && leap ? 29 : DAYS_IN_MONTH[month - 1];
+            for (unsigned dayOfMonth = 1; dayOfMonth <= monthDays; dayOfMonth++, days++) {
+                char text[16];
+                std::snprintf(text, sizeof(text), "%04ld-%02u-%02u", year, month, dayOfMonth);
+                double day = 0.0;
+                if (daysFromCivil(year, month, dayOfMonth) != days || !parseDate(text, day) || day != days - 10957.5 ||
+                    formatDate(day) != text || formatDate(day + 0.99) != text) {
+                    if (failures++ < 10) {
+                        std::fprintf(stderr, "Date %s does not round trip\n", text);
+                    }
+                }
+            }
+        }
+    }
+    CHECK(failures == 0);
+
+    CHECK(parsed("2024-02-29") == parsed("2024-03-01") - 1.0);
+    CHECK(parsed("2000-02-29") == parsed("2000-03-01") - 1.0);
+    CHECK(parsed("2023-04-30") == parsed("2023-05-01") - 1.0);
+    checkRejected("2024-02-30");
+    checkRejected("2023-02-29");
+    checkRejected("1900-02-29");
+    checkRejected("2100-02-29");
+    checkRejected("2023-04-31");
+    checkRejected("2023-06-31");
+    checkRejected("2023-09-31");
+    checkRejected("2023-11-31");
+    checkRejected("2023-01-32");
+    checkRejected("2023-01-00");
+    checkRejected("2023-00-10");
+    checkRejected("2023-13-01");
+    checkRejected("2023-01-01x");
+    checkRejected("2023-01");
+    checkRejected("today");
+    return checkFailures();
+}
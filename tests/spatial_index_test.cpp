@@ -0,0 +1,220 @@
+// spatial_index_test.cpp - Grid queries against brute force
+//
+// Random points go into a SpatialGrid, and nearest(), withinRadius() and withinBox() must return what
+// a scan of every point returns: the same distances for the k nearest, nearest first, and the same
+// points for the radius and box queries. The clouds are a cube, a flat belt (an axis thinner than a
+// cell, which gets a single layer), a belt of some thickness, and a few degenerate ones. Queries fall
+// inside and outside the cloud and in the empty middle of the belt, and ask for more neighbours than
+// the nearby cells hold, so the ring search has to go out until its stop bound is met.
+
+#include "spatial_index.h"
+#include "philox.h"
+#include "check.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <vector>
+
+namespace {
+
+const double PI = 3.14159265358979323846;
+const size_t NUM_POINTS = 20000;
+const int NUM_QUERIES = 300;
+
+// Function to get the squared distance between a point and a position, as the grid computes it
+float distanceSquared(const SpatialPoint& point, float x, float y, float z) {
+    float dx = point.x - x, dy = point.y - y, dz = point.z - z;
+    return dx * dx + dy * dy + dz * dz;
+}
+
+// Function to get the sorted ids of a set of points
+std::vector<uint32_t> sortedIds(const std::vector<SpatialPoint>& points) {
+    std::vector<uint32_t> ids;
+    for (const SpatialPoint& point : points) {
+        ids.push_back(point.id);
+    }
+    std::sort(ids.begin(), ids.end());
+    return ids;
+}
+
+// Function to check the k nearest points against a scan; ties may come in either order, so distances are compared
+bool checkNearest(const SpatialGrid& grid, const std::vector<SpatialPoint>& points, float x, float y, float z, size_t k) {
+    std::vector<float> expected;
+    for (const SpatialPoint& point : points) {
+        expected.push_back(distanceSquared(point, x, y, z));
+    }
+    size_t count = std::min(k, expected.size());
+    std::partial_sort(expected.begin(), expected.begin() + count, expected.end());
+    expected.resize(count);
+
+    std::vector<SpatialPoint> result;
+    grid.nearest(x, y, z, k, result);
+    if (result.size() != expected.size()) {
+        return false;
+    }
+    for (size_t i = 0; i < result.size(); i++) {
+        if (distanceSquared(result[i], x, y, z) != expected[i]) {
+            return false;
+        }
+    }
+    return true;
+}
+
+// Function to check the points within a radius against a scan
+bool checkRadius(const SpatialGrid& grid, const std::vector<SpatialPoint>& points, float x, float y, float z, float radius) {
+    std::vector<SpatialPoint> expected;
+    for (const SpatialPoint& point : points) {
+        if (distanceSquared(point, x, y, z) <= radius * radius) {
+            expected.push_back(point);
+        }
+    }
+    std::vector<SpatialPoint> result;
+    grid.withinRadius(x, y, z, radius, result);
+    return sortedIds(result) == sortedIds(expected);
+}
+
+// Function to check the points inside a box against a scan
+bool checkBox(const SpatialGrid& grid, const std::vector<SpatialPoint>& points, const float minCorner[3], const float maxCorner[3]) {
+    std::vector<SpatialPoint> expected;
+    for (const SpatialPoint& point : points) {
+        if (point.x >= minCorner[0] && point.x <= maxCorner[0] && point.y >= minCorner[1] && point.y <= maxCorner[1] &&
+            point.z >= minCorner[2] && point.z <= maxCorner[2]) {
+            expected.push_back(point);
+        }
+    }
+    std::vector<SpatialPoint> result;
+    grid.withinBox(minCorner, maxCorner, result);
+    return sortedIds(result) == sortedIds(expected);
+}
+
+// Function to make a cloud: a cube of side 10, or a belt between 7 and 8 from the origin of a given thickness
+std::vector<SpatialPoint> makeCloud(uint32_t seed, size_t count, bool belt, float thickness) {
+    PhiloxStream random(seed, 0);
+    std::vector<SpatialPoint> points(count);
+    for (size_t i = 0; i < count; i++) {
+        PhiloxCounter bits = random.block(i);
+        SpatialPoint& point = points[i];
+        if (belt) {
+            float radius = 7.0f + philoxUniform(bits.v[0]);
+            float angle = philoxUniform(bits.v[1]) * float(2.0 * PI);
+            point.x = radius * std::cos(angle);
+            point.y = radius * std::sin(angle);
+            point.z = (philoxUniform(bits.v[2]) - 0.5f) * thickness;
+        } else {
+            point.x = philoxUniform(bits.v[0]) * 10.0f;
+            point.y = philoxUniform(bits.v[1]) * 10.0f;
+            point.z = philoxUniform(bits.v[2]) * 10.0f;
+        }
+        point.id = uint32_t(i);
+    }
+    return points;
+}
+
+// Function to check every query over a cloud at random positions around it, and at the positions given
+void testCloud(const char* name, const std::vector<SpatialPoint>& points, float extent, const std::vector<float>& fixedQueries) {
+    std::vector<SpatialPoint> input = points;
+    SpatialGrid grid;
+    grid.build(input);
+    CHECK(grid.size() == points.size());
+    CHECK(input.empty());
+
+    // Random queries over a box around the origin three times the size of the cloud, so many fall outside the grid
+    PhiloxStream random(99, 1);
+    std::vector<float> queries = fixedQueries;
+    for (int q = 0; q < NUM_QUERIES; q++) {
+        PhiloxCounter bits = random.block(q);
+        for (int axis = 0; axis < 3; axis++) {
+            queries.push_back((philoxUniform(bits.v[axis]) - 0.5f) * 3.0f * extent);
+        }
+    }
+
+    const size_t counts[] = { 1, 8, 100 };
+    int failures[3] = {};
+    for (size_t q = 0; q + 2 < queries.size(); q += 3) {
+        float x = queries[q], y = queries[q + 1], z = queries[q + 2];
+        PhiloxCounter bits = random.block(q, 1);
+        for (size_t k : counts) {
+            failures[0] += !checkNearest(grid, points, x, y, z, k);
+        }
+        float radius = philoxUniform(bits.v[0]) * 0.2f * extent;
+        failures[1] += !checkRadius(grid, points, x, y, z, radius);
+        float size[3] = { philoxUniform(bits.v[1]) * extent, philoxUniform(bits.v[2]) * extent, philoxUniform(bits.v[3]) * 0.1f * extent };
+        float minCorner[3] = { x - size[0], y - size[1], z - size[2] };
+        float maxCorner[3] = { x + size[0], y + size[1], z + size[2] };
+        failures[2] += !checkBox(grid, points, minCorner, maxCorner);
+    }
+    std::printf("%-14s %zu points, %zu queries: %d nearest, %d radius, %d box mismatches\n", name, points.size(),
+                queries.size() / 3, failures[0], failures[1], failures[2]);
+    for (int k = 0; k < 3; k++) {
+        CHECK(failures[k] == 0);
+    }
+}
+
+// Function to check grids of no points, one point, and points all in one place
+void testDegenerateClouds() {
+    SpatialGrid empty;
+    std::vector<SpatialPoint> none, result;
+    empty.build(none);
+    empty.nearest(0.0f, 0.0f, 0.0f, 5, result);
+    CHECK(result.empty());
+    empty.withinRadius(0.0f, 0.0f, 0.0f, 1.0f, result);
+    CHECK(result.empty());
+
+    std::vector<SpatialPoint> single(1);
+    single[0].x = 1.0f;
+    single[0].y = 2.0f;
+    single[0].z = 3.0f;
+    single[0].id = 42;
+    SpatialGrid one;
+    std::vector<SpatialPoint> input = single;
+    one.build(input);
+    one.nearest(-100.0f, 0.0f, 0.0f, 3, result);
+    CHECK(result.size() == 1 && result[0].id == 42);
+    one.nearest(1.0f, 2.0f, 3.0f, 0, result);
+    CHECK(result.empty());
+
+    std::vector<SpatialPoint> stacked(500, single[0]);
+    for (size_t i = 0; i < stacked.size(); i++) {
+        stacked[i].id = uint32_t(i);
+    }
+    SpatialGrid pile;
+    input = stacked;
+    pile.build(input);
+    CHECK(checkNearest(pile, stacked, 5.0f, 5.0f, 5.0f, 10));
+    CHECK(checkRadius(pile, stacked, 1.0f, 2.0f, 3.0f, 0.0f));
+    const float minCorner[3] = { 1.0f, 2.0f, 3.0f }, maxCorner[3] = { 1.0f, 2.0f, 3.0f };
+    CHECK(checkBox(pile, stacked, minCorner, maxCorner));
+}
+
+// Function to check that the worker's grid holds the gathered points at the build's time
+void testIndex() {
+    std::vector<SpatialPoint> points = makeCloud(5, 1000, false, 0.0f);
+    SpatialIndex index;
+    CHECK(!index.current());
+    CHECK(index.rebuild(2.5, [&](std::vector<SpatialPoint>& gathered) { gathered = points; }));
+    index.wait();
+    std::shared_ptr<const SpatialGrid> grid = index.current();
+    CHECK(grid && grid->size() == points.size() && grid->time() == 2.5);
+    if (grid) {
+        CHECK(checkNearest(*grid, points, 5.0f, 5.0f, 5.0f, 20));
+    }
+}
+
+} // namespace
+
+int main() {
+    // The middle of the belt has no points for 7 units around, so its neighbours are many rings out; the
+    // other fixed queries sit on the belt, just off its plane, and far above it
+    std::vector<float> beltQueries = { 0.0f, 0.0f, 0.0f, 7.5f, 0.0f, 0.0f, 7.5f, 0.0f, 0.3f, 0.0f, -7.2f, 5.0f, 20.0f, 20.0f, 0.0f };
+    std::vector<float> cubeQueries = { 5.0f, 5.0f, 5.0f, 0.0f, 0.0f, 0.0f, -30.0f, 5.0f, 40.0f };
+
+    testCloud("cube", makeCloud(1, NUM_POINTS, false, 0.0f), 10.0f, cubeQueries);
+    testCloud("flat belt", makeCloud(2, NUM_POINTS, true, 0.0f), 16.0f, beltQueries);
+    testCloud("thin belt", makeCloud(3, NUM_POINTS, true, 0.05f), 16.0f, beltQueries);
+    testCloud("thick belt", makeCloud(4, NUM_POINTS, true, 1.0f), 16.0f, beltQueries);
+    testCloud("small cube", makeCloud(6, 50, false, 0.0f), 10.0f, cubeQueries);
+    testDegenerateClouds();
+    testIndex();
+    return checkFailures();
+}
@@ -0,0 +1,84 @@
+// triple_buffer_test.cpp - Stress test of the triple buffer between a writer and a reader thread
+//
+// The writer publishes snapshots whose every field holds an increasing counter, as fast as it can;
+// the reader checks that each value it switches to is newer than the last, complete (no field from
+// another snapshot) and left alone by the writer while it holds it, and that the last one published
+// is the one it ends with. Run it under -fsanitize=thread to check the memory ordering as well.
+
+#include "triple_buffer.h"
+#include "check.h"
+
+#include <atomic>
+#include <cstdint>
+#include <cstdio>
+#include <thread>
+
+namespace {
+
+const uint64_t NUM_PUBLISHES = 2000000;
+const size_t SNAPSHOT_FIELDS = 61; // Spans several cache lines, so a torn copy would show
+
+struct Snapshot {
+    Snapshot() : fields() {} // The empty snapshot 0
+    uint64_t fields[SNAPSHOT_FIELDS];
+};
+
+// Function to check that every field of a snapshot holds its counter, returning the counter
+uint64_t checkComplete(const Snapshot& snapshot) {
+    uint64_t counter = snapshot.fields[0];
+    for (size_t i = 1; i < SNAPSHOT_FIELDS; i++) {
+        if (snapshot.fields[i] != counter) {
+            std::fprintf(stderr, "Torn snapshot: field %zu holds %llu, field 0 %llu\n", i, (unsigned long long)snapshot.fields[i],
+                         (unsigned long long)counter);
+            checkFailures()++;
+            break;
+        }
+    }
+    return counter;
+}
+
+} // namespace
+
+int main() {
+    TripleBuffer<Snapshot> buffer;
+    std::atomic<bool> done(false);
+    std::thread writer([&]() {
+        for (uint64_t counter = 1; counter <= NUM_PUBLISHES; counter++) {
+            Snapshot& snapshot = buffer.write();
+            for (size_t i = 0; i < SNAPSHOT_FIELDS; i++) {
+                snapshot.fields[i] = counter;
+            }
+            buffer.publish();
+            if (counter % 1024 == 0) {
+                std::this_thread::yield(); // Lets the reader in on a single core too
+            }
+        }
+        done.store(true, std::memory_order_release);
+    });
+
+    uint64_t last = checkComplete(buffer.read());
+    uint64_t updates = 0, monotonicFailures = 0;
+    bool finished = false;
+    while (!finished) {
+        finished = done.load(std::memory_order_acquire); // Once set, one more update must get the last value
+        if (buffer.update()) {
+            updates++;
+            uint64_t counter = checkComplete(buffer.read());
+            if (counter <= last) {
+                monotonicFailures++;
+            }
+            last = counter;
+        }
+
+        // The held value must not change under the reader, whether or not it was just switched to
+        CHECK(checkComplete(buffer.read()) == last);
+    }
+    writer.join();
+
+    std::printf("%llu publishes, %llu seen by the reader, last %llu\n", (unsigned long long)NUM_PUBLISHES, (unsigned long long)updates,
+                (unsigned long long)last);
+    CHECK(monotonicFailures == 0);
+    CHECK(last == NUM_PUBLISHES);
+    CHECK(!buffer.update());
+    return checkFailures();
+}
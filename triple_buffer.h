@@ -0,0 +1,50 @@
+// triple_buffer.h - Lock-free triple buffer handing values from one thread to another
+//
+// The writer fills a buffer of its own and publishes it by swapping it with the middle buffer; the
+// reader swaps its own buffer for the middle one whenever a newer value was published. Neither side
+// ever waits for the other, the reader always gets the newest complete value, and a value stays
+// untouched for as long as the reader holds it.
+
+#ifndef TRIPLE_BUFFER_H
+#define TRIPLE_BUFFER_H
+
+#include <atomic>
+
+template <typename T>
+class TripleBuffer {
+public:
+    TripleBuffer() : middle(1), writeIndex(0), readIndex(2) {}
+
+    // Function to get the buffer the writer fills next; it may hold an older value
+    T& write() { return buffers[writeIndex]; }
+
+    // Function to publish the write buffer, getting the previous middle buffer back to fill next
+    void publish() {
+        writeIndex = middle.exchange(writeIndex | FRESH, std::memory_order_acq_rel) & INDEX_MASK;
+    }
+
+    // Function to switch the reader to the newest published value; returns false if nothing newer was published
+    bool update() {
+        if (!(middle.load(std::memory_order_relaxed) & FRESH)) {
+            return false;
+        }
+        readIndex = middle.exchange(readIndex, std::memory_order_acq_rel) & INDEX_MASK;
+        return true;
+    }
+
+    // Function to get the reader's current value
+    const T& read() const { return buffers[readIndex]; }
+
+private:
+    TripleBuffer(const TripleBuffer&) = delete;
+    TripleBuffer& operator=(const TripleBuffer&) = delete;
+
+    enum { INDEX_MASK = 3, FRESH = 4 };
+
+    T buffers[3];
+    std::atomic<unsigned> middle; // Index of the middle buffer, with FRESH set when published and not yet read
+    unsigned writeIndex;          // Owned by the writer
+    unsigned readIndex;           // Owned by the reader
+};
+
+#endif // TRIPLE_BUFFER_H